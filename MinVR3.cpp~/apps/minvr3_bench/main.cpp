@@ -0,0 +1,1498 @@
+/** MinVR3 Networking Benchmarks
+ Measures the cost of the different ways the MinVR3 library can move VREvents between processes.  Each benchmark
+ runs on the loopback interface, so the numbers reflect CPU and system call overhead rather than the network.
+
+ Usage: minvr3_bench <benchmark> [benchmark args]
+   send [num-clients] [num-events] [events-per-pass]
+       Fans each event out to every client, like the relay server does, using MinNet::SendString() and each
+       NetBatchIO backend.  Reports throughput and the number of system calls made by the sender.
+   latency [num-round-trips]
+       Bounces an event back and forth between two threads over loopback TCP, with the default and the
+       low-latency SocketTuning and, on a machine with a core for each thread, with spin_wait as well, and over a
+       pair of shared-memory rings (ShmRingWriter/ShmRingReader), and reports the round trip times.
+   relay [num-clients] [num-events]
+       Runs an EventRelay in this process with one client sending and every client receiving, over in-memory
+       connections (MemoryConnection) and over loopback TCP with blocking sends, NetBatchIO, and non-blocking
+       per-client send queues.  The memory numbers are
+       the cost of the relay's own parsing and fan-out (plus the clients' reads), with the kernel factored out.
+   sharded [num-clients] [num-events] [max-threads]
+       Runs a ShardedEventRelay with 1, 2, 4, ... up to max-threads threads (defaults to the number of cores), one
+       client sending as fast as it can and every other client receiving on a thread of its own, and reports the
+       relay's throughput for each thread count.
+   subscribe [num-clients] [num-topics] [num-events]
+       Runs an EventRelay over loopback TCP with non-blocking send queues, one client sending events spread
+       evenly over num-topics event names, first broadcast to every client and then with each client subscribed to
+       one of the names, and reports the time per event and the events sent by the relay for each.
+   receive [num-events]
+       Receives events over loopback TCP with MinNet::ReceiveString() and with TcpConnection, into new and into
+       reused buffers, and reports the heap allocations and time per event spent receiving (parsing excluded).
+   dictionary [num-clients] [num-events]
+       Compares events sent as json with events sent with an EventDictionary: the bytes per event and the time
+       to encode and to decode each one, then an EventRelay over loopback TCP with one client sending and every
+       client receiving VREvents, as json and with each version of the dictionary protocol, reporting the time per
+       event.
+   binary [num-events]
+       For an event of each built-in type, compares json with both versions of the dictionary protocol, the data
+       as json text (version 1) and in the binary layout (version 2): the time to encode and to decode each event,
+       and its bytes.  test_events checks that every event decodes to exactly the event that was encoded.
+   msgpack [num-clients] [num-events]
+       Compares json with MessagePack: the time to encode and to decode an event of each type and its bytes, and
+       an EventRelay over loopback TCP with every client sending and receiving in one format.  test_events checks
+       that every type comes back from MsgPackCodec exactly as it was sent.
+   mixed [num-events] [bulk-bytes] [socket-profile]
+       Sends tracker events at 1 kHz and, on the same connection, a large event (4 MB by default) every 50 ms,
+       through an EventRelay over loopback TCP to a receiver, and reports the tracker events' latency: first with
+       every frame sent whole (protocol version 2), so tracker events wait behind each large event on both
+       hops, then with large frames sent in fragments (version 3).  The sockets are set up with the given
+       SocketTuning profile (default, low-latency or throughput).  Since the sender, the relay and the receiver
+       share one thread, the slowest percent of tracker events also wait while the relay and the receiver
+       handle a large event.
+   cluster [max-relays] [num-clients] [num-events]
+       Runs 1, 2, 4, ... up to max-relays relays as a RelayCluster, each relay on a thread of its own, with every
+       client connected to all of them, one client sending events over 64 names and the others receiving, and
+       reports the events per second and how many events each relay carried.  Then stops one of three relays and
+       checks that every event still reaches every client.
+   federation [num-sites] [clients-per-site] [num-events]
+       Sends events from a client at one site to the clients at every site, first with every client connected to
+       the hub's relay, then with a relay at each site linked to the hub's (see RelayFederation), and reports the
+       events per second and how many times each event crossed the links between sites.  Then subscribes the last
+       site's clients to half of the events and reports how many crossed its link.  Finally checks that a link
+       that would close a loop is refused, and that events in a loop made anyway end where they started.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <minvr3.h>
+
+#include "sample_events.h"
+
+#ifndef WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#else
+#define poll WSAPoll
+#endif
+
+
+// Every heap allocation made by the program, for the receive benchmark.
+static std::atomic<uint64_t> num_allocations(0);
+
+void* operator new(size_t size) {
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    void *p = malloc((size > 0) ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+
+// Creates num_pairs connected TCP socket pairs over loopback.
+static bool CreateSocketPairs(int num_pairs, std::vector<SOCKET> *server_side, std::vector<SOCKET> *client_side) {
+    SOCKET listener_fd;
+    if (!MinNet::CreateListener(0, &listener_fd, num_pairs)) {
+        return false;
+    }
+    std::string addr = MinNet::GetAddressAndPort(listener_fd);
+    int port = std::stoi(addr.substr(addr.rfind(':') + 1));
+    for (int i=0; i<num_pairs; i++) {
+        SOCKET c, s;
+        if ((!MinNet::ConnectTo("127.0.0.1", port, &c)) || (!MinNet::TryAcceptConnection(listener_fd, &s))) {
+            MinNet::CloseSocket(&listener_fd);
+            return false;
+        }
+        client_side->push_back(c);
+        server_side->push_back(s);
+    }
+    MinNet::CloseSocket(&listener_fd);
+    return true;
+}
+
+
+// Reads and discards bytes from all fds until total_bytes have been read.
+static void DrainThread(std::vector<SOCKET> fds, uint64_t total_bytes, std::atomic<bool> *done) {
+    std::vector<struct pollfd> pfds(fds.size());
+    for (int i=0; i<fds.size(); i++) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+    }
+    std::vector<char> buf(65536);
+    uint64_t n_read = 0;
+    while (n_read < total_bytes) {
+        if (poll(pfds.data(), (unsigned long)pfds.size(), 1000) <= 0) {
+            break;
+        }
+        for (int i=0; i<pfds.size(); i++) {
+            if (pfds[i].revents & POLLIN) {
+                int n = (int)recv(pfds[i].fd, buf.data(), (int)buf.size(), 0);
+                if (n > 0) {
+                    n_read += n;
+                }
+            }
+        }
+    }
+    *done = true;
+}
+
+
+static void PrintResult(const std::string &name, double seconds, int num_events, int num_clients, uint64_t syscalls) {
+    double sends = (double)num_events * num_clients;
+    std::cout << "  " << name << ": " << seconds * 1000.0 << " ms, "
+        << (int)(sends / seconds) << " event-sends/s, "
+        << syscalls << " syscalls (" << (double)syscalls / sends << " per event-send)" << std::endl;
+}
+
+
+static int BenchSend(int num_clients, int num_events, int events_per_pass) {
+    std::vector<SOCKET> server_fds, client_fds;
+    if (!CreateSocketPairs(num_clients, &server_fds, &client_fds)) {
+        std::cerr << "Could not create socket pairs." << std::endl;
+        return 1;
+    }
+    std::string json = VREventVector3("Tracker/Head/Position", 1.0f, 2.0f, 3.0f).ToJson();
+    uint64_t total_bytes = (uint64_t)num_events * num_clients * (4 + json.size());
+
+    std::cout << "send: " << num_clients << " clients, " << num_events << " events of " << json.size()
+        << " bytes, " << events_per_pass << " events per pass" << std::endl;
+
+    // 1. one MinNet::SendString() per event per client
+    {
+        std::atomic<bool> done(false);
+        std::thread drain(DrainThread, client_fds, total_bytes, &done);
+        auto start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            for (int c=0; c<num_clients; c++) {
+                MinNet::SendString(&server_fds[c], json);
+            }
+        }
+        drain.join();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // SendString makes one gathered write for the length and body together
+        PrintResult("MinNet::SendString", secs, num_events, num_clients, (uint64_t)num_events * num_clients);
+    }
+
+    // 2. NetBatchIO with each backend, submitting once per pass
+    std::vector<NetBatchIO::Backend> backends;
+    backends.push_back(NetBatchIO::BACKEND_SYSCALL);
+    if (NetBatchIO::IsIoUringSupported()) {
+        backends.push_back(NetBatchIO::BACKEND_IO_URING);
+    }
+    else {
+        std::cout << "  (io_uring is not supported on this system)" << std::endl;
+    }
+    for (int b=0; b<backends.size(); b++) {
+        NetBatchIO batch(backends[b]);
+        std::atomic<bool> done(false);
+        std::thread drain(DrainThread, client_fds, total_bytes, &done);
+        auto start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            batch.QueueString(server_fds, json);
+            if (((e + 1) % events_per_pass == 0) || (e == num_events - 1)) {
+                batch.Submit();
+            }
+        }
+        drain.join();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        PrintResult("NetBatchIO " + NetBatchIO::BackendToString(batch.get_backend()), secs, num_events,
+                    num_clients, batch.get_num_syscalls());
+    }
+
+    for (int i=0; i<num_clients; i++) {
+        MinNet::CloseSocket(&server_fds[i]);
+        MinNet::CloseSocket(&client_fds[i]);
+    }
+    return 0;
+}
+
+
+static void PrintLatency(const std::string &name, std::vector<double> *round_trip_us) {
+    std::sort(round_trip_us->begin(), round_trip_us->end());
+    double sum = 0.0;
+    for (int i=0; i<round_trip_us->size(); i++) {
+        sum += (*round_trip_us)[i];
+    }
+    size_t n = round_trip_us->size();
+    std::cout << "  " << name << ": round trip mean " << sum / n << " us, median " << (*round_trip_us)[n / 2]
+        << " us, 99th percentile " << (*round_trip_us)[(n * 99) / 100] << " us" << std::endl;
+}
+
+
+static int BenchLatency(int num_round_trips) {
+    std::string json = VREventVector3("Tracker/Head/Position", 1.0f, 2.0f, 3.0f).ToJson();
+    std::cout << "latency: " << num_round_trips << " round trips of a " << json.size() << " byte event" << std::endl;
+    std::vector<double> round_trip_us(num_round_trips);
+
+    // 1. loopback TCP, MinNet::SendString() and ReceiveString(), with each socket tuning; spinning needs a core for
+    // each of the two threads, or they take turns at the scheduler's pace
+    std::vector<std::string> tunings = {"default", "low-latency"};
+    if (std::thread::hardware_concurrency() >= 2) {
+        tunings.push_back("low-latency + spin-wait");
+    }
+    for (int t=0; t<tunings.size(); t++) {
+        SocketTuning tuning;
+        SocketTuning::FromProfile((t == 0) ? "default" : "low-latency", &tuning);
+        tuning.spin_wait = (t == 2);
+        MinNet::set_socket_tuning(tuning);
+        std::vector<SOCKET> server_fds, client_fds;
+        if (!CreateSocketPairs(1, &server_fds, &client_fds)) {
+            std::cerr << "Could not create socket pairs." << std::endl;
+            return 1;
+        }
+        std::thread echo([&]() {
+            std::string s;
+            for (int i=0; i<num_round_trips; i++) {
+                MinNet::ReceiveString(&client_fds[0], &s);
+                MinNet::SendString(&client_fds[0], s);
+            }
+        });
+        std::string reply;
+        for (int i=0; i<num_round_trips; i++) {
+            auto start = std::chrono::steady_clock::now();
+            MinNet::SendString(&server_fds[0], json);
+            MinNet::ReceiveString(&server_fds[0], &reply);
+            round_trip_us[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        echo.join();
+        PrintLatency("loopback TCP, " + tunings[t], &round_trip_us);
+        MinNet::CloseSocket(&server_fds[0]);
+        MinNet::CloseSocket(&client_fds[0]);
+    }
+    MinNet::set_socket_tuning(SocketTuning());
+
+    // 2. a shared-memory ring in each direction
+    {
+        std::string ping_name = "bench_ping_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+        std::string pong_name = ping_name + "_pong";
+        ShmRingWriter ping_writer, pong_writer;
+        ShmRingReader ping_reader, pong_reader;
+        if ((!ping_writer.Create(ping_name)) || (!pong_writer.Create(pong_name)) ||
+            (!ping_reader.Open(ping_name)) || (!pong_reader.Open(pong_name))) {
+            std::cerr << "Shared-memory rings are not available." << std::endl;
+            return 1;
+        }
+        std::thread echo([&]() {
+            std::string s;
+            for (int i=0; i<num_round_trips; i++) {
+                ping_reader.ReceiveString(&s);
+                pong_writer.SendString(s);
+            }
+        });
+        std::string reply;
+        for (int i=0; i<num_round_trips; i++) {
+            auto start = std::chrono::steady_clock::now();
+            ping_writer.SendString(json);
+            pong_reader.ReceiveString(&reply);
+            round_trip_us[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        }
+        echo.join();
+        PrintLatency("shared-memory ring", &round_trip_us);
+    }
+    return 0;
+}
+
+
+// Sends num_events events from the first client through the relay, one per pass, with every client reading
+// everything relayed to it after each pass.  Returns the seconds taken, or a negative number on failure.
+static double RunRelay(EventRelay *relay, const std::vector<Connection*> &clients, int num_events,
+                       const std::string &json)
+{
+    std::vector<std::string> frames;
+    uint64_t num_received = 0;
+    uint64_t expected = (uint64_t)num_events * clients.size();
+    auto start = std::chrono::steady_clock::now();
+    for (int e=0; e<num_events; e++) {
+        clients[0]->SendString(json);
+        // a loopback TCP send is normally readable straight away, but not always
+        while (relay->Poll() == 0) {
+        }
+        for (int c=0; c<clients.size(); c++) {
+            frames.clear();
+            clients[c]->ReceiveAvailableStrings(&frames);
+            num_received += frames.size();
+        }
+    }
+    // collect any stragglers
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while ((num_received < expected) && (std::chrono::steady_clock::now() < give_up)) {
+        for (int c=0; c<clients.size(); c++) {
+            frames.clear();
+            clients[c]->ReceiveAvailableStrings(&frames);
+            num_received += frames.size();
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (num_received == expected) ? secs : -1.0;
+}
+
+
+static int BenchRelay(int num_clients, int num_events) {
+    std::string json = VREventVector3("Tracker/Head/Position", 1.0f, 2.0f, 3.0f).ToJson();
+    std::cout << "relay: " << num_clients << " clients, " << num_events << " events of " << json.size()
+        << " bytes, each relayed to every client" << std::endl;
+
+    std::vector<std::string> names;
+    names.push_back("MemoryConnection");
+    names.push_back("TcpConnection");
+    names.push_back("TcpConnection + NetBatchIO");
+    names.push_back("TcpConnection + non-blocking send queues");
+    for (int t=0; t<names.size(); t++) {
+        EventRelay relay;
+        NetBatchIO batch;
+        Listener *listener;
+        std::string address;
+        int port = 0;
+        if (t == 0) {
+            listener = Listener::Create("mem:bench_relay");
+            address = "mem:bench_relay";
+        }
+        else {
+            listener = Listener::Create("0");
+            std::string desc = listener->get_description();
+            port = std::stoi(desc.substr(desc.rfind(':') + 1));
+            address = "127.0.0.1";
+            if (t == 2) {
+                relay.set_batch_io(&batch);
+            }
+            else if (t == 3) {
+                relay.set_send_limit(4194304, SendQueue::OVERFLOW_DROP_OLDEST);
+            }
+        }
+        if (listener == NULL) {
+            std::cerr << "Could not create a listener." << std::endl;
+            return 1;
+        }
+        relay.AddListener(listener);
+        std::vector<Connection*> clients;
+        for (int c=0; c<num_clients; c++) {
+            Connection *client = Connection::Connect(address, port);
+            if (client == NULL) {
+                std::cerr << "Could not connect to the relay." << std::endl;
+                return 1;
+            }
+            clients.push_back(client);
+            // accept as we go, so the listener's backlog never fills up
+            while (relay.get_connections().size() < clients.size()) {
+                relay.Poll();
+            }
+        }
+
+        double secs = RunRelay(&relay, clients, num_events, json);
+        if (secs < 0.0) {
+            std::cerr << "  " << names[t] << ": not every event arrived" << std::endl;
+        }
+        else {
+            double sends = (double)num_events * num_clients;
+            std::cout << "  " << names[t] << ": " << secs * 1000.0 << " ms, " << (int)(num_events / secs)
+                << " events/s, " << (int)(sends / secs) << " event-sends/s, " << secs * 1.0e9 / sends
+                << " ns per event-send" << std::endl;
+        }
+        for (int c=0; c<clients.size(); c++) {
+            delete clients[c];
+        }
+    }
+    return 0;
+}
+
+
+// Sends num_events events from one client through a ShardedEventRelay with num_threads shards to num_clients
+// receivers.  Returns the seconds taken until every receiver has everything, or a negative number on failure.
+static double RunSharded(int num_threads, int num_clients, int num_events, const std::string &json) {
+    ShardedEventRelay relay(num_threads, false);
+    // nothing may be dropped, or the receivers would wait forever
+    relay.set_send_limit(0, SendQueue::OVERFLOW_DROP_OLDEST);
+    Listener *listener = Listener::Create("0");
+    if (listener == NULL) {
+        return -1.0;
+    }
+    std::string desc = listener->get_description();
+    int port = std::stoi(desc.substr(desc.rfind(':') + 1));
+    relay.AddListener(listener);
+    if (!relay.Start()) {
+        return -1.0;
+    }
+
+    SOCKET sender_fd;
+    std::vector<SOCKET> receiver_fds;
+    bool ok = MinNet::ConnectTo("127.0.0.1", port, &sender_fd);
+    for (int c=0; (ok) && (c<num_clients); c++) {
+        SOCKET fd;
+        ok = MinNet::ConnectTo("127.0.0.1", port, &fd);
+        if (ok) {
+            receiver_fds.push_back(fd);
+        }
+        // accept as we go, so the listener's backlog never fills up
+        while ((ok) && (relay.get_num_connections() < c + 2)) {
+            relay.RunOnce(10);
+        }
+    }
+    if (!ok) {
+        return -1.0;
+    }
+
+    // each receiver thread drains a slice of the clients
+    int num_drain_threads = std::min(num_clients, std::max(1, (int)std::thread::hardware_concurrency()));
+    std::vector<std::thread> drains;
+    std::vector<std::atomic<bool>*> done;
+    uint64_t frame_size = 4 + json.size();
+    for (int t=0; t<num_drain_threads; t++) {
+        std::vector<SOCKET> fds;
+        for (int c=t; c<num_clients; c+=num_drain_threads) {
+            fds.push_back(receiver_fds[c]);
+        }
+        done.push_back(new std::atomic<bool>(false));
+        drains.push_back(std::thread(DrainThread, fds, frame_size * num_events * fds.size(), done.back()));
+    }
+
+    // the sender writes many events per system call, so it is the relay that sets the pace
+    const int events_per_send = 64;
+    std::string block;
+    for (int e=0; e<events_per_send; e++) {
+        uint32_t len = (uint32_t)json.size();
+        uint8_t header[4] = { (uint8_t)(len & 0xff), (uint8_t)((len >> 8) & 0xff), (uint8_t)((len >> 16) & 0xff), (uint8_t)(len >> 24) };
+        block.append((const char*)header, 4);
+        block.append(json);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int e=0; (ok) && (e<num_events); e+=events_per_send) {
+        int n = std::min(events_per_send, num_events - e);
+        const char *data = block.data();
+        int remaining = (int)(n * frame_size);
+        while ((ok) && (remaining > 0)) {
+            int sent = (int)send(sender_fd, data, remaining, 0);
+            ok = (sent > 0);
+            data += sent;
+            remaining -= sent;
+        }
+    }
+    for (int t=0; t<drains.size(); t++) {
+        drains[t].join();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    relay.Stop();
+    MinNet::CloseSocket(&sender_fd);
+    for (int c=0; c<receiver_fds.size(); c++) {
+        MinNet::CloseSocket(&receiver_fds[c]);
+    }
+    for (int t=0; t<done.size(); t++) {
+        delete done[t];
+    }
+    return ((ok) && (relay.get_num_events_relayed() == (uint64_t)num_events)) ? secs : -1.0;
+}
+
+
+static int BenchSharded(int num_clients, int num_events, int max_threads) {
+    std::string json = VREventVector3("Tracker/Head/Position", 1.0f, 2.0f, 3.0f).ToJson();
+    if (max_threads <= 0) {
+        max_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    std::cout << "sharded: " << num_clients << " receiving clients, " << num_events << " events of " << json.size()
+        << " bytes, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+    for (int t=1; t<=max_threads; t*=2) {
+        double secs = RunSharded(t, num_clients, num_events, json);
+        if (secs < 0.0) {
+            std::cerr << "  " << t << " threads: not every event arrived" << std::endl;
+            continue;
+        }
+        double sends = (double)num_events * num_clients;
+        std::cout << "  " << t << " threads: " << secs * 1000.0 << " ms, " << (int)(num_events / secs)
+            << " events/s, " << (int)(sends / secs) << " event-sends/s, " << secs * 1.0e9 / sends
+            << " ns per event-send" << std::endl;
+    }
+    return 0;
+}
+
+
+// Sends num_events events to receive() in batches, and reports the allocations and time spent in receive() per
+// event.  The first batch warms the buffers up and is not counted.  receive(n) must receive n events.
+template <typename ReceiveFn>
+static void RunReceive(const std::string &name, SOCKET sender_fd, int num_events, const std::string &json,
+                       ReceiveFn receive)
+{
+    const int batch = 64;
+    uint64_t allocations = 0;
+    std::chrono::steady_clock::duration elapsed(0);
+    for (int sent=-batch; sent<num_events; sent+=batch) {
+        for (int i=0; i<batch; i++) {
+            MinNet::SendString(&sender_fd, json);
+        }
+        uint64_t before = num_allocations;
+        auto start = std::chrono::steady_clock::now();
+        receive(batch);
+        if (sent >= 0) {
+            elapsed += std::chrono::steady_clock::now() - start;
+            allocations += num_allocations - before;
+        }
+    }
+    int n = (num_events / batch) * batch;
+    std::cout << "  " << name << ": " << (double)allocations / n << " allocations per event, "
+        << std::chrono::duration<double, std::nano>(elapsed).count() / n << " ns per event" << std::endl;
+}
+
+
+static int BenchSubscribe(int num_clients, int num_topics, int num_events) {
+    std::cout << "subscribe: " << num_clients << " clients, " << num_events << " events over " << num_topics
+        << " event names" << std::endl;
+    std::vector<std::string> jsons;
+    for (int t=0; t<num_topics; t++) {
+        jsons.push_back(VREventVector3("Topic" + std::to_string(t) + "/Position", 1.0f, 2.0f, 3.0f).ToJson());
+    }
+
+    for (int subscribed=0; subscribed<2; subscribed++) {
+        EventRelay relay;
+        relay.set_send_limit(4194304, SendQueue::OVERFLOW_DROP_OLDEST);
+        Listener *listener = Listener::Create("0");
+        if (listener == NULL) {
+            return 1;
+        }
+        std::string desc = listener->get_description();
+        int port = std::stoi(desc.substr(desc.rfind(':') + 1));
+        relay.AddListener(listener);
+        std::vector<Connection*> clients;
+        for (int c=0; c<num_clients; c++) {
+            Connection *client = Connection::Connect("127.0.0.1", port);
+            if (client == NULL) {
+                return 1;
+            }
+            clients.push_back(client);
+            while (relay.get_connections().size() < clients.size()) {
+                relay.Poll();
+            }
+            if (subscribed) {
+                // the sender (client 0) only sends
+                relay.Subscribe(relay.get_connections().back(), (c == 0) ? "Nothing" :
+                                "Topic" + std::to_string(c % num_topics) + "/*");
+            }
+        }
+
+        // every client reads everything relayed to it after each event, as in RunRelay()
+        FrameBatch frames;
+        uint64_t num_received = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            clients[0]->SendString(jsons[e % num_topics]);
+            while (relay.Poll() == 0) {
+            }
+            for (int c=0; c<clients.size(); c++) {
+                frames.Clear();
+                clients[c]->ReceiveAvailableFrames(&frames);
+                num_received += frames.get_num_frames();
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  " << (subscribed ? "subscribed" : "broadcast") << ": " << secs * 1.0e9 / num_events
+            << " ns per event, " << (double)num_received / num_events << " event-sends per event" << std::endl;
+        for (int c=0; c<clients.size(); c++) {
+            delete clients[c];
+        }
+    }
+    return 0;
+}
+
+
+static int BenchReceive(int num_events) {
+    std::string json = VREventVector3("Tracker/Head/Position", 1.0f, 2.0f, 3.0f).ToJson();
+    std::vector<SOCKET> server_fds, client_fds;
+    if (!CreateSocketPairs(3, &server_fds, &client_fds)) {
+        return 1;
+    }
+    std::cout << "receive bench: " << num_events << " events of " << json.size() << " bytes over loopback TCP"
+        << std::endl;
+
+    RunReceive("MinNet::ReceiveString(), new string", server_fds[0], num_events, json, [&](int n) {
+        for (int i=0; i<n; i++) {
+            std::string s;
+            MinNet::ReceiveString(&client_fds[0], &s);
+        }
+    });
+    std::string reused;
+    RunReceive("MinNet::ReceiveString(), reused string", server_fds[0], num_events, json, [&](int n) {
+        for (int i=0; i<n; i++) {
+            MinNet::ReceiveString(&client_fds[0], &reused);
+        }
+    });
+
+    TcpConnection strings_connection(client_fds[1]);
+    std::vector<std::string> strings;
+    RunReceive("TcpConnection::ReceiveAvailableStrings()", server_fds[1], num_events, json, [&](int n) {
+        strings.clear();
+        while (strings.size() < n) {
+            strings_connection.ReceiveAvailableStrings(&strings);
+        }
+    });
+
+    TcpConnection frames_connection(client_fds[2]);
+    FrameBatch frames;
+    RunReceive("TcpConnection::ReceiveAvailableFrames()", server_fds[2], num_events, json, [&](int n) {
+        frames.Clear();
+        while (frames.get_num_frames() < n) {
+            frames_connection.ReceiveAvailableFrames(&frames);
+        }
+    });
+
+    for (int i=0; i<server_fds.size(); i++) {
+        MinNet::CloseSocket(&server_fds[i]);
+    }
+    MinNet::CloseSocket(&client_fds[0]);
+    return 0;
+}
+
+
+static int BenchDictionary(int num_clients, int num_events) {
+    VREventVector3 event("Tracker/RightHand/Position", 1.25f, 1.5f, -0.75f);
+    std::string json = event.ToJson();
+    EventDictionary sender, receiver;
+    std::string definition, compact, data;
+    sender.Encode(json, &definition, &compact);
+    receiver.Read(definition, &data);
+    std::cout << "dictionary: " << event.get_name() << " (" << event.get_data_type_name() << "), " << num_events
+        << " events" << std::endl;
+    std::cout << "  bytes per event: json " << json.size() << ", dictionary " << compact.size() << " (plus "
+        << definition.size() << " once)" << std::endl;
+
+    // 1. encoding and decoding on their own
+    int num_created = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int e=0; e<num_events; e++) {
+        json = event.ToJson();
+    }
+    double encode_json = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int e=0; e<num_events; e++) {
+        sender.Encode(event.ToJson(), &definition, &compact);
+    }
+    double encode_dictionary = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int e=0; e<num_events; e++) {
+        VREvent *v = VREvent::CreateFromJson(json);
+        num_created += (v != NULL);
+        delete v;
+    }
+    double decode_json = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    start = std::chrono::steady_clock::now();
+    for (int e=0; e<num_events; e++) {
+        const EventDictionary::Entry *entry = receiver.Read(compact, &data);
+        VREvent *v = VREvent::CreateFromData(entry->name, entry->data_type_name, data);
+        num_created += (v != NULL);
+        delete v;
+    }
+    double decode_dictionary = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (num_created != 2 * num_events) {
+        std::cerr << "  not every event could be decoded" << std::endl;
+        return 1;
+    }
+    std::cout << "  encode: json " << encode_json * 1.0e9 / num_events << " ns, dictionary "
+        << encode_dictionary * 1.0e9 / num_events << " ns per event" << std::endl;
+    std::cout << "  decode: json " << decode_json * 1.0e9 / num_events << " ns, dictionary "
+        << decode_dictionary * 1.0e9 / num_events << " ns per event" << std::endl;
+
+    // 2. through a relay, with every client receiving and parsing every event, as json, then with each version of
+    // the dictionary protocol
+    for (int version=0; version<=EventDictionary::PROTOCOL_VERSION; version++) {
+        EventRelay relay;
+        relay.set_send_limit(4194304, SendQueue::OVERFLOW_DROP_OLDEST);
+        Listener *listener = Listener::Create("0");
+        if (listener == NULL) {
+            return 1;
+        }
+        std::string desc = listener->get_description();
+        int port = std::stoi(desc.substr(desc.rfind(':') + 1));
+        relay.AddListener(listener);
+        std::vector<Connection*> clients;
+        std::vector<VREvent*> events;
+        for (int c=0; c<num_clients; c++) {
+            Connection *client = Connection::Connect("127.0.0.1", port);
+            if (client == NULL) {
+                return 1;
+            }
+            clients.push_back(client);
+            while (relay.get_connections().size() < clients.size()) {
+                relay.Poll();
+            }
+            if (version > 0) {
+                client->OfferEventDictionary(0, version);
+                while (!client->is_event_dictionary_accepted()) {
+                    relay.Poll();
+                    client->ReceiveAvailableVREvents(&events);
+                }
+            }
+        }
+
+        uint64_t num_received = 0;
+        start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            clients[0]->SendVREvent(event);
+            while (relay.Poll() == 0) {
+            }
+            for (int c=0; c<clients.size(); c++) {
+                events.clear();
+                clients[c]->ReceiveAvailableVREvents(&events);
+                num_received += events.size();
+                for (int i=0; i<events.size(); i++) {
+                    delete events[i];
+                }
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  relay, " << ((version > 0) ? "dictionary version " + std::to_string(version) : std::string("json"))
+            << ": " << secs * 1.0e9 / num_events
+            << " ns per event, " << (double)num_received / num_events << " events received per event" << std::endl;
+        for (int c=0; c<clients.size(); c++) {
+            delete clients[c];
+        }
+    }
+    return 0;
+}
+
+
+static int BenchBinary(int num_events) {
+    std::vector<VREvent*> samples = MakeSampleEvents();
+    std::cout << "binary: " << num_events << " events of each type, encode ns / decode ns / bytes per event" << std::endl;
+
+    int result = 0;
+    for (int s=0; s<samples.size(); s++) {
+        const VREvent &event = *samples[s];
+        std::string json;
+
+        int num_created = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            json = event.ToJson();
+        }
+        double encode = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            VREvent *v = VREvent::CreateFromJson(json);
+            num_created += (v != NULL);
+            delete v;
+        }
+        double decode = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::string type = event.get_data_type_name().empty() ? "no data" : event.get_data_type_name();
+        std::cout << "  " << type << ": json " << encode * 1.0e9 / num_events << " / "
+            << decode * 1.0e9 / num_events << " / " << json.size();
+
+        for (int version=1; version<=EventDictionary::PROTOCOL_VERSION; version++) {
+            EventDictionary sender, receiver;
+            std::string definition, compact;
+            sender.Encode(event, version, &definition, &compact);
+            delete receiver.ReadVREvent(definition);
+            start = std::chrono::steady_clock::now();
+            for (int e=0; e<num_events; e++) {
+                sender.Encode(event, version, &definition, &compact);
+            }
+            encode = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            start = std::chrono::steady_clock::now();
+            for (int e=0; e<num_events; e++) {
+                VREvent *v = receiver.ReadVREvent(compact);
+                num_created += (v != NULL);
+                delete v;
+            }
+            decode = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << ", version " << version << " " << encode * 1.0e9 / num_events << " / " << decode * 1.0e9 / num_events << " / "
+                << compact.size();
+        }
+        std::cout << std::endl;
+        if (num_created != (1 + EventDictionary::PROTOCOL_VERSION) * num_events) {
+            result = 1;
+        }
+    }
+    if (result != 0) {
+        std::cerr << "  not every event could be decoded" << std::endl;
+    }
+    for (int s=0; s<samples.size(); s++) {
+        delete samples[s];
+    }
+    return result;
+}
+
+
+static int BenchMsgPack(int num_clients, int num_events) {
+    // 1. encoding and decoding on their own
+    std::vector<VREvent*> samples = MakeSampleEvents();
+    int num_failed = 0;
+    std::cout << "msgpack: " << num_events << " events of each type, encode ns / decode ns / bytes per event"
+        << std::endl;
+    for (int s=0; s<samples.size(); s++) {
+        const VREvent &event = *samples[s];
+        std::string json, frame;
+        int num_created = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            json = event.ToJson();
+        }
+        double encode_json = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            VREvent *v = VREvent::CreateFromJson(json);
+            num_created += (v != NULL);
+            delete v;
+        }
+        double decode_json = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            MsgPackCodec::Encode(event, &frame);
+        }
+        double encode_msgpack = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            VREvent *v = MsgPackCodec::Decode(frame);
+            num_created += (v != NULL);
+            delete v;
+        }
+        double decode_msgpack = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (num_created != 2 * num_events) {
+            std::cerr << "  not every event could be decoded" << std::endl;
+            num_failed++;
+        }
+        std::string type = event.get_data_type_name().empty() ? "no data" : event.get_data_type_name();
+        std::cout << "  " << type << ": json " << encode_json * 1.0e9 / num_events << " / "
+            << decode_json * 1.0e9 / num_events << " / " << json.size() << ", msgpack "
+            << encode_msgpack * 1.0e9 / num_events << " / " << decode_msgpack * 1.0e9 / num_events << " / "
+            << frame.size() << std::endl;
+    }
+    for (int s=0; s<samples.size(); s++) {
+        delete samples[s];
+    }
+
+    // 2. through a relay, with one client sending and every client receiving and parsing every event, all in one
+    // format
+    VREventVector3 event("Tracker/RightHand/Position", 1.25f, 1.5f, -0.75f);
+    for (int f=0; f<2; f++) {
+        Connection::EventFormat format = (f == 0) ? Connection::JSON_FORMAT : Connection::MSGPACK_FORMAT;
+        EventRelay relay;
+        relay.set_send_limit(4194304, SendQueue::OVERFLOW_DROP_OLDEST);
+        Listener *listener = Listener::Create("0");
+        if (listener == NULL) {
+            return 1;
+        }
+        std::string desc = listener->get_description();
+        int port = std::stoi(desc.substr(desc.rfind(':') + 1));
+        relay.AddListener(listener);
+        std::vector<Connection*> clients;
+        std::vector<VREvent*> events;
+        for (int c=0; c<num_clients; c++) {
+            Connection *client = Connection::Connect("127.0.0.1", port);
+            if (client == NULL) {
+                return 1;
+            }
+            clients.push_back(client);
+            client->set_event_format(format);
+            client->RequestEventFormat(format);
+            while ((relay.get_connections().size() < clients.size()) ||
+                   (relay.get_connections().back()->get_event_format() != format))
+            {
+                relay.Poll();
+            }
+        }
+
+        uint64_t num_received = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int e=0; e<num_events; e++) {
+            clients[0]->SendVREvent(event);
+            while (relay.Poll() == 0) {
+            }
+            for (int c=0; c<clients.size(); c++) {
+                events.clear();
+                clients[c]->ReceiveAvailableVREvents(&events);
+                num_received += events.size();
+                for (int i=0; i<events.size(); i++) {
+                    delete events[i];
+                }
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "  relay, " << Connection::EventFormatToString(format) << ": " << secs * 1.0e9 / num_events
+            << " ns per event, " << (double)num_received / num_events << " events received per event" << std::endl;
+        for (int c=0; c<clients.size(); c++) {
+            delete clients[c];
+        }
+    }
+    return (num_failed == 0) ? 0 : 1;
+}
+
+
+static int BenchMixed(int num_events, int bulk_bytes, const std::string &socket_profile) {
+    SocketTuning tuning;
+    if (!SocketTuning::FromProfile(socket_profile, &tuning)) {
+        std::cerr << "Unknown socket profile " << socket_profile << std::endl;
+        return 1;
+    }
+    MinNet::set_socket_tuning(tuning);
+    // a tracker event every millisecond, and a large event every 50 ms, e.g., a mesh
+    const std::chrono::microseconds tracker_period(1000);
+    const std::chrono::microseconds bulk_period(50000);
+    VREventString bulk("Scene/Mesh", std::string(bulk_bytes, 'm'));
+    std::cout << "mixed: " << num_events << " tracker events at 1 kHz, with a " << bulk_bytes
+        << " byte event every 50 ms on the same connection, through an EventRelay over loopback TCP, sockets "
+        << tuning.ToString() << std::endl;
+
+    // version 2 sends every frame whole, version 3 sends large frames in fragments, with small ones in between
+    for (int version=2; version<=EventDictionary::FRAGMENTS_VERSION; version++) {
+        EventRelay relay(false);
+        relay.set_send_limit(268435456, SendQueue::OVERFLOW_DROP_OLDEST);
+        Listener *listener = Listener::Create("0");
+        if (listener == NULL) {
+            return 1;
+        }
+        std::string desc = listener->get_description();
+        int port = std::stoi(desc.substr(desc.rfind(':') + 1));
+        relay.AddListener(listener);
+        std::vector<Connection*> clients;
+        std::vector<VREvent*> events;
+        for (int c=0; c<2; c++) {
+            Connection *client = Connection::Connect("127.0.0.1", port);
+            if (client == NULL) {
+                return 1;
+            }
+            clients.push_back(client);
+            client->OfferEventDictionary(0, version);
+            while (!client->is_event_dictionary_accepted()) {
+                relay.Poll();
+                client->ReceiveAvailableVREvents(&events);
+            }
+        }
+        Connection *sender = clients[0];
+        Connection *receiver = clients[1];
+        // the sender does not need its own events back
+        sender->Subscribe("Nothing");
+        while (relay.get_num_subscribers() == 0) {
+            relay.Poll();
+        }
+
+        std::vector<std::chrono::steady_clock::time_point> sent_at(num_events);
+        std::vector<double> latencies;
+        int num_sent = 0;
+        int num_bulk_received = 0;
+        auto start = std::chrono::steady_clock::now();
+        auto next_tracker = start;
+        auto next_bulk = start;
+        auto deadline = start + tracker_period * num_events + std::chrono::seconds(10);
+        while ((latencies.size() < num_events) && (std::chrono::steady_clock::now() < deadline)) {
+            auto now = std::chrono::steady_clock::now();
+            if ((num_sent < num_events) && (now >= next_bulk)) {
+                sender->QueueVREvent(bulk);
+                next_bulk += bulk_period;
+            }
+            if ((num_sent < num_events) && (now >= next_tracker)) {
+                sent_at[num_sent] = now;
+                sender->QueueVREvent(VREventVector3("Tracker/Head/Position", (float)num_sent, 1.5f, 0.0f));
+                num_sent++;
+                next_tracker += tracker_period;
+            }
+            sender->TryFlush();
+            relay.Poll();
+            events.clear();
+            receiver->ReceiveAvailableVREvents(&events);
+            now = std::chrono::steady_clock::now();
+            for (int i=0; i<events.size(); i++) {
+                VREventVector3 *tracker = dynamic_cast<VREventVector3*>(events[i]);
+                if (tracker != NULL) {
+                    latencies.push_back(std::chrono::duration<double, std::milli>(now - sent_at[(int)tracker->x()]).count());
+                }
+                else {
+                    num_bulk_received++;
+                }
+                delete events[i];
+            }
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << "  " << ((version < EventDictionary::FRAGMENTS_VERSION) ? "whole frames" : "fragments") << ": ";
+        if (latencies.size() < num_events) {
+            std::cout << "only " << latencies.size() << " tracker events arrived" << std::endl;
+            return 1;
+        }
+        std::cout << "tracker latency median " << latencies[latencies.size() / 2] << " ms, 90th percentile "
+            << latencies[latencies.size() * 9 / 10] << " ms, 99th " << latencies[latencies.size() * 99 / 100]
+            << " ms, max " << latencies.back() << " ms; " << num_bulk_received << " large events received" << std::endl;
+        for (int c=0; c<clients.size(); c++) {
+            delete clients[c];
+        }
+    }
+    return 0;
+}
+
+
+// Starts num_relays relays, each a ShardedEventRelay with one thread as a stand-in for a relay process, and connects
+// each of the clients to all of them.  Returns false on failure.
+static bool StartCluster(int num_relays, std::vector<RelayCluster*> *clients, std::vector<ShardedEventRelay*> *relays) {
+    std::vector<std::string> addresses;
+    for (int r=0; r<num_relays; r++) {
+        ShardedEventRelay *relay = new ShardedEventRelay(1, false);
+        // nothing may be dropped, or the receivers would wait forever
+        relay->set_send_limit(0, SendQueue::OVERFLOW_DROP_OLDEST);
+        relays->push_back(relay);
+        Listener *listener = Listener::Create("0");
+        if (listener == NULL) {
+            return false;
+        }
+        std::string desc = listener->get_description();
+        addresses.push_back("127.0.0.1:" + desc.substr(desc.rfind(':') + 1));
+        relay->AddListener(listener);
+        if (!relay->Start()) {
+            return false;
+        }
+    }
+    for (int c=0; c<clients->size(); c++) {
+        if (!(*clients)[c]->Connect(addresses)) {
+            return false;
+        }
+        for (int r=0; r<num_relays; r++) {
+            while ((*relays)[r]->get_num_connections() < c + 1) {
+                (*relays)[r]->RunOnce(10);
+            }
+        }
+    }
+    return true;
+}
+
+
+// Sends num_events events, spread over num_topics names, from the first client, and waits until every other client
+// has received them all.  Returns the seconds taken, or a negative number if some never arrived.
+static double RunCluster(const std::vector<RelayCluster*> &clients, int num_events, int num_topics) {
+    std::vector<std::thread> receivers;
+    std::atomic<int> num_incomplete(0);
+    for (int c=1; c<clients.size(); c++) {
+        receivers.push_back(std::thread([&clients, &num_incomplete, c, num_events]() {
+            int n = 0;
+            VREvent *e;
+            while ((n < num_events) && ((e = clients[c]->ReceiveVREvent(5000)) != NULL)) {
+                delete e;
+                n++;
+            }
+            if (n < num_events) {
+                num_incomplete++;
+            }
+        }));
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (int e=0; e<num_events; e++) {
+        clients[0]->QueueVREvent(VREventVector3("Topic" + std::to_string(e % num_topics) + "/Position", 1.0f, 2.0f, 3.0f));
+        if ((e % 64) == 63) {
+            clients[0]->Flush();
+        }
+    }
+    clients[0]->Flush();
+    for (int r=0; r<receivers.size(); r++) {
+        receivers[r].join();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (num_incomplete == 0) ? secs : -1.0;
+}
+
+
+static int BenchCluster(int max_relays, int num_clients, int num_events) {
+    const int num_topics = 64;
+    std::cout << "cluster: " << num_clients << " receiving clients, " << num_events << " events over " << num_topics
+        << " event names, " << std::thread::hardware_concurrency() << " cores" << std::endl;
+    for (int n=1; n<=max_relays; n*=2) {
+        std::vector<RelayCluster*> clients;
+        for (int c=0; c<=num_clients; c++) {
+            clients.push_back(new RelayCluster());
+        }
+        std::vector<ShardedEventRelay*> relays;
+        double secs = StartCluster(n, &clients, &relays) ? RunCluster(clients, num_events, num_topics) : -1.0;
+        if (secs < 0.0) {
+            std::cerr << "  " << n << " relays: not every event arrived" << std::endl;
+        }
+        else {
+            std::cout << "  " << n << " relays: " << (int)(num_events / secs) << " events/s, each relay's share";
+            for (int r=0; r<relays.size(); r++) {
+                std::cout << " " << relays[r]->get_num_events_relayed();
+            }
+            std::cout << std::endl;
+        }
+        for (int c=0; c<clients.size(); c++) {
+            delete clients[c];
+        }
+        for (int r=0; r<relays.size(); r++) {
+            delete relays[r];
+        }
+    }
+
+    // with one of three relays gone, its share of the names goes to the next one, and still reaches everybody
+    std::vector<RelayCluster*> clients;
+    for (int c=0; c<=num_clients; c++) {
+        clients.push_back(new RelayCluster());
+    }
+    std::vector<ShardedEventRelay*> relays;
+    bool ok = StartCluster(3, &clients, &relays);
+    if (ok) {
+        delete relays[1];
+        relays[1] = NULL;
+        // the clients notice the relay has gone the next time they read from it
+        std::vector<VREvent*> events;
+        for (int c=0; c<clients.size(); c++) {
+            while (clients[c]->get_num_open() == 3) {
+                clients[c]->ReceiveAvailableVREvents(&events);
+            }
+        }
+        ok = (events.empty()) && (RunCluster(clients, num_events, num_topics) >= 0.0);
+    }
+    std::cout << "  failover: " << (ok ? "every event arrived" : "FAILED, not every event arrived")
+        << " with one of 3 relays gone" << std::endl;
+    for (int c=0; c<clients.size(); c++) {
+        delete clients[c];
+    }
+    for (int r=0; r<relays.size(); r++) {
+        delete relays[r];
+    }
+    return ok ? 0 : 1;
+}
+
+
+// Starts a relay for one site of the federation benchmark, on loopback TCP, with non-blocking sends, so relays polled
+// from one thread never wait for each other.  Its clients and the relays below it connect to the same listener.
+// Returns NULL on failure.
+static EventRelay* StartSiteRelay(int *port) {
+    Listener *listener = Listener::Create("0");
+    if (listener == NULL) {
+        return NULL;
+    }
+    std::string desc = listener->get_description();
+    *port = std::stoi(desc.substr(desc.rfind(':') + 1));
+    EventRelay *relay = new EventRelay(false);
+    relay->set_send_limit(0, SendQueue::OVERFLOW_DROP_OLDEST);
+    relay->AddLinkListener(listener);
+    return relay;
+}
+
+
+static void PollRelays(const std::vector<EventRelay*> &relays, int num_passes) {
+    for (int p=0; p<num_passes; p++) {
+        for (int r=0; r<relays.size(); r++) {
+            relays[r]->Poll();
+        }
+    }
+}
+
+
+// Connects a client to the relay listening on port, and waits for the relay to accept it.
+static Connection* ConnectSiteClient(EventRelay *relay, int port) {
+    Connection *client = Connection::Connect("127.0.0.1", port);
+    size_t n = relay->get_connections().size();
+    while ((client != NULL) && (relay->get_connections().size() == n)) {
+        relay->Poll();
+    }
+    return client;
+}
+
+
+// Links downstream to the relay upstream listening on port, and polls every relay until upstream has taken the link
+// and the links' subscriptions have settled.  Returns false if upstream never took it.
+static bool LinkRelays(EventRelay *downstream, EventRelay *upstream, int port, const std::vector<EventRelay*> &relays) {
+    Connection *link = Connection::Connect("127.0.0.1", port);
+    if (link == NULL) {
+        return false;
+    }
+    downstream->AddLink(link);
+    int n = upstream->get_num_links();
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds(500);
+    while ((upstream->get_num_links() == n) && (std::chrono::steady_clock::now() < give_up)) {
+        PollRelays(relays, 1);
+    }
+    PollRelays(relays, 20);
+    return upstream->get_num_links() > n;
+}
+
+
+// Sends num_events events from sender, alternately named "Head/Position" and "Wand/Position", polling the relays as
+// it goes, until each receiver has received exactly as many as expected.  Returns the seconds taken, or a negative
+// number if some never arrived or some arrived more than once.
+static double RunFederation(const std::vector<EventRelay*> &relays, Connection *sender,
+                            const std::vector<Connection*> &receivers, const std::vector<int> &expected, int num_events)
+{
+    std::vector<int> received(receivers.size(), 0);
+    std::vector<std::string> frames;
+    auto receive = [&]() {
+        bool done = true;
+        for (int c=0; c<receivers.size(); c++) {
+            frames.clear();
+            receivers[c]->ReceiveAvailableStrings(&frames);
+            received[c] += (int)frames.size();
+            done = done && (received[c] >= expected[c]);
+        }
+        return done;
+    };
+    auto start = std::chrono::steady_clock::now();
+    for (int e=0; e<num_events; e++) {
+        sender->QueueVREvent(VREventVector3(((e % 2) == 0) ? "Head/Position" : "Wand/Position", 1.0f, 2.0f, 3.0f));
+        if ((e % 64) == 63) {
+            sender->Flush();
+            PollRelays(relays, 1);
+            receive();
+        }
+    }
+    sender->Flush();
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    bool done = false;
+    while ((!done) && (std::chrono::steady_clock::now() < give_up)) {
+        PollRelays(relays, 1);
+        done = receive();
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // and nothing more turns up
+    PollRelays(relays, 20);
+    receive();
+    return (received == expected) ? secs : -1.0;
+}
+
+
+static int BenchFederation(int num_sites, int clients_per_site, int num_events) {
+    std::cout << "federation: " << num_sites << " sites with " << clients_per_site << " clients each, " << num_events
+        << " events from a client at site 1 (site 0 is the hub)" << std::endl;
+    bool ok = true;
+    for (int t=0; t<2; t++) {
+        bool tree = (t == 1);
+        std::vector<EventRelay*> relays;
+        std::vector<int> ports;
+        for (int s=0; s<(tree ? num_sites : 1); s++) {
+            int port;
+            EventRelay *relay = StartSiteRelay(&port);
+            if (relay == NULL) {
+                std::cerr << "Could not create a listener." << std::endl;
+                return 1;
+            }
+            relays.push_back(relay);
+            ports.push_back(port);
+            if ((s > 0) && (!LinkRelays(relay, relays[0], ports[0], relays))) {
+                std::cerr << "Could not link site " << s << " to the hub." << std::endl;
+                return 1;
+            }
+        }
+        // every client but the sender receives every event
+        Connection *sender = NULL;
+        std::vector<Connection*> receivers;
+        std::vector<int> receiver_sites;
+        for (int s=0; s<num_sites; s++) {
+            int r = tree ? s : 0;
+            for (int c=0; c<clients_per_site; c++) {
+                Connection *client = ConnectSiteClient(relays[r], ports[r]);
+                if (client == NULL) {
+                    std::cerr << "Could not connect to the relay." << std::endl;
+                    return 1;
+                }
+                if ((s == 1) && (c == 0)) {
+                    sender = client;
+                }
+                else {
+                    receivers.push_back(client);
+                    receiver_sites.push_back(s);
+                }
+            }
+        }
+        PollRelays(relays, 20);
+        std::vector<int> expected(receivers.size(), num_events);
+        double secs = RunFederation(relays, sender, receivers, expected, num_events);
+        if (secs < 0.0) {
+            std::cerr << "  " << (tree ? "tree" : "star") << ": not every event arrived exactly once" << std::endl;
+            ok = false;
+        }
+        else if (!tree) {
+            // the sender's own upload, and one for each client away from the hub
+            int64_t crossings = num_events;
+            for (int c=0; c<receivers.size(); c++) {
+                crossings += (receiver_sites[c] != 0) ? num_events : 0;
+            }
+            std::cout << "  star, every client on the hub's relay: " << (int)(num_events / secs) << " events/s, "
+                << (double)crossings / num_events << " crossings of the links between sites per event" << std::endl;
+        }
+        else {
+            // every relay but the sender's received each event over one link, and relayed it once
+            int64_t crossings = 0;
+            bool once = true;
+            for (int r=0; r<relays.size(); r++) {
+                crossings += (r != 1) ? relays[r]->get_num_events_relayed() : 0;
+                once = once && (relays[r]->get_num_events_relayed() == num_events) && (relays[r]->get_num_looped() == 0);
+            }
+            std::cout << "  tree, a relay at each site linked to the hub's: " << (int)(num_events / secs)
+                << " events/s, " << (double)crossings / num_events << " crossings per event, "
+                << (once ? "every relay relayed each event once" : "FAILED, some relay did not relay each event once")
+                << std::endl;
+            ok = ok && once;
+
+            // once the last site's clients only want the head, the wand events stop at the hub
+            for (int c=0; c<receivers.size(); c++) {
+                if (receiver_sites[c] == num_sites - 1) {
+                    receivers[c]->Subscribe("Head/*");
+                    expected[c] = (num_events + 1) / 2;
+                }
+            }
+            PollRelays(relays, 50);
+            uint64_t before = relays[num_sites - 1]->get_num_events_relayed();
+            secs = RunFederation(relays, sender, receivers, expected, num_events);
+            uint64_t crossed = relays[num_sites - 1]->get_num_events_relayed() - before;
+            std::cout << "  with site " << num_sites - 1 << "'s clients subscribed to Head/*: " << crossed << " of "
+                << num_events << " events crossed its link" << std::endl;
+            ok = ok && (secs >= 0.0) && (crossed == expected.back());
+        }
+        delete sender;
+        for (int c=0; c<receivers.size(); c++) {
+            delete receivers[c];
+        }
+        for (int r=0; r<relays.size(); r++) {
+            delete relays[r];
+        }
+    }
+
+    // a chain of three sites, where linking the top to the bottom would close a loop
+    std::vector<EventRelay*> relays;
+    std::vector<int> ports(3);
+    for (int r=0; r<3; r++) {
+        relays.push_back(StartSiteRelay(&ports[r]));
+        if (relays[r] == NULL) {
+            return 1;
+        }
+        relays[r]->set_relay_id(std::string(1, (char)('a' + r)));
+    }
+    bool refused = (LinkRelays(relays[1], relays[0], ports[0], relays)) && (LinkRelays(relays[2], relays[1], ports[1], relays)) &&
+        (!LinkRelays(relays[0], relays[2], ports[2], relays)) && (relays[0]->get_num_links() == 1);
+    std::cout << "  a link that would close a loop: " << (refused ? "refused" : "FAILED, not refused") << std::endl;
+    ok = ok && refused;
+    for (int r=0; r<relays.size(); r++) {
+        delete relays[r];
+    }
+
+    // the same loop made anyway, each link checked against the others before they were all made: each event goes
+    // round in both directions, and every copy is dropped when it comes back to the relay where it started
+    relays.clear();
+    for (int r=0; r<3; r++) {
+        relays.push_back(StartSiteRelay(&ports[r]));
+        if (relays[r] == NULL) {
+            return 1;
+        }
+        relays[r]->set_relay_id(std::string(1, (char)('a' + r)));
+    }
+    bool made = (LinkRelays(relays[1], relays[0], ports[0], relays)) && (LinkRelays(relays[0], relays[2], ports[2], relays)) &&
+        (LinkRelays(relays[2], relays[1], ports[1], relays));
+    Connection *sender = ConnectSiteClient(relays[0], ports[0]);
+    std::vector<Connection*> receivers;
+    receivers.push_back(ConnectSiteClient(relays[1], ports[1]));
+    receivers.push_back(ConnectSiteClient(relays[2], ports[2]));
+    PollRelays(relays, 20);
+    const int num_loop_events = 100;
+    std::vector<int> expected(2, 2 * num_loop_events);
+    bool ended = made && (RunFederation(relays, sender, receivers, expected, num_loop_events) >= 0.0) &&
+        (relays[0]->get_num_looped() == 2 * num_loop_events);
+    std::cout << "  a loop made anyway: " << (ended ? "each event arrived twice, once each way round, and went no further" :
+        "FAILED, events did not stop where they started") << std::endl;
+    ok = ok && ended;
+    delete sender;
+    for (int c=0; c<receivers.size(); c++) {
+        delete receivers[c];
+    }
+    for (int r=0; r<relays.size(); r++) {
+        delete relays[r];
+    }
+    return ok ? 0 : 1;
+}
+
+
+int main(int argc, char** argv) {
+    std::string benchmark = (argc > 1) ? argv[1] : "help";
+
+    MinNet::Init();
+#ifndef WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    int result = 0;
+    if (benchmark == "send") {
+        int num_clients = (argc > 2) ? std::stoi(argv[2]) : 30;
+        int num_events = (argc > 3) ? std::stoi(argv[3]) : 20000;
+        int events_per_pass = (argc > 4) ? std::stoi(argv[4]) : 1;
+        result = BenchSend(num_clients, num_events, events_per_pass);
+    }
+    else if (benchmark == "latency") {
+        int num_round_trips = (argc > 2) ? std::stoi(argv[2]) : 100000;
+        result = BenchLatency(num_round_trips);
+    }
+    else if (benchmark == "relay") {
+        int num_clients = (argc > 2) ? std::stoi(argv[2]) : 30;
+        int num_events = (argc > 3) ? std::stoi(argv[3]) : 20000;
+        result = BenchRelay(num_clients, num_events);
+    }
+    else if (benchmark == "sharded") {
+        int num_clients = (argc > 2) ? std::stoi(argv[2]) : 200;
+        int num_events = (argc > 3) ? std::stoi(argv[3]) : 20000;
+        int max_threads = (argc > 4) ? std::stoi(argv[4]) : 0;
+        result = BenchSharded(num_clients, num_events, max_threads);
+    }
+    else if (benchmark == "subscribe") {
+        int num_clients = (argc > 2) ? std::stoi(argv[2]) : 30;
+        int num_topics = (argc > 3) ? std::stoi(argv[3]) : 10;
+        int num_events = (argc > 4) ? std::stoi(argv[4]) : 20000;
+        result = BenchSubscribe(num_clients, num_topics, num_events);
+    }
+    else if (benchmark == "receive") {
+        int num_events = (argc > 2) ? std::stoi(argv[2]) : 100000;
+        result = BenchReceive(num_events);
+    }
+    else if (benchmark == "dictionary") {
+        int num_clients = (argc > 2) ? std::stoi(argv[2]) : 30;
+        int num_events = (argc > 3) ? std::stoi(argv[3]) : 20000;
+        result = BenchDictionary(num_clients, num_events);
+    }
+    else if (benchmark == "binary") {
+        int num_events = (argc > 2) ? std::stoi(argv[2]) : 100000;
+        result = BenchBinary(num_events);
+    }
+    else if (benchmark == "msgpack") {
+        int num_clients = (argc > 2) ? std::stoi(argv[2]) : 30;
+        int num_events = (argc > 3) ? std::stoi(argv[3]) : 20000;
+        result = BenchMsgPack(num_clients, num_events);
+    }
+    else if (benchmark == "mixed") {
+        int num_events = (argc > 2) ? std::stoi(argv[2]) : 2000;
+        int bulk_bytes = (argc > 3) ? std::stoi(argv[3]) : 4194304;
+        std::string socket_profile = (argc > 4) ? argv[4] : "default";
+        result = BenchMixed(num_events, bulk_bytes, socket_profile);
+    }
+    else if (benchmark == "cluster") {
+        int max_relays = (argc > 2) ? std::stoi(argv[2]) : 4;
+        int num_clients = (argc > 3) ? std::stoi(argv[3]) : 4;
+        int num_events = (argc > 4) ? std::stoi(argv[4]) : 20000;
+        result = BenchCluster(max_relays, num_clients, num_events);
+    }
+    else if (benchmark == "federation") {
+        int num_sites = (argc > 2) ? std::stoi(argv[2]) : 3;
+        int clients_per_site = (argc > 3) ? std::stoi(argv[3]) : 4;
+        int num_events = (argc > 4) ? std::stoi(argv[4]) : 20000;
+        result = BenchFederation(num_sites, clients_per_site, num_events);
+    }
+    else {
+        std::cout << "Usage: minvr3_bench <benchmark> [benchmark args]" << std::endl;
+        std::cout << "  send [num-clients] [num-events] [events-per-pass]" << std::endl;
+        std::cout << "  latency [num-round-trips]" << std::endl;
+        std::cout << "  relay [num-clients] [num-events]" << std::endl;
+        std::cout << "  sharded [num-clients] [num-events] [max-threads]" << std::endl;
+        std::cout << "  subscribe [num-clients] [num-topics] [num-events]" << std::endl;
+        std::cout << "  receive [num-events]" << std::endl;
+        std::cout << "  dictionary [num-clients] [num-events]" << std::endl;
+        std::cout << "  binary [num-events]" << std::endl;
+        std::cout << "  msgpack [num-clients] [num-events]" << std::endl;
+        std::cout << "  mixed [num-events] [bulk-bytes] [socket-profile]" << std::endl;
+        std::cout << "  cluster [max-relays] [num-clients] [num-events]" << std::endl;
+        std::cout << "  federation [num-sites] [clients-per-site] [num-events]" << std::endl;
+    }
+
+    MinNet::Shutdown();
+    return result;
+}
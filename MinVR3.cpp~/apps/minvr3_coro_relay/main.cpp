@@ -0,0 +1,300 @@
+/** MinVR3 Coroutine Relay Server
+ A sample of the C++20 coroutine API (MinVR3Coro): the same job as minvr3_relay_server, relaying every VREvent
+ received from any client to all clients, written as one straight-line coroutine per client instead of
+ callbacks.  All clients are served by one thread.
+
+ A client that cannot keep up slows down the clients whose events it is sent, once its send buffer is full,
+ rather than having its events dropped; minvr3_relay_server's overflow policies are the better fit for clients
+ on poor links.
+
+ With "bench", it instead measures the cost per relayed event-send of this relay against EventRelay driven by a
+ NetReactor (the loop minvr3_relay_server uses), with both relays and all clients in this process on loopback
+ TCP, one event at a time.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifndef WIN32
+#include <signal.h>
+#endif
+
+#include <minvr3.h>
+#include <coro_connection.h>
+
+
+struct CoroRelay {
+    CoroReactor *reactor;
+    bool relay_to_source;
+    std::vector<std::shared_ptr<CoroConnection>> clients;
+    uint64_t num_relayed;
+    bool shutdown;
+    bool quiet;
+};
+
+
+CoroTask<void> ServeClient(CoroRelay *relay, std::shared_ptr<CoroConnection> client) {
+    std::string s, name;
+    std::vector<std::shared_ptr<CoroConnection>> dests;
+    while (co_await client->ReceiveString(&s)) {
+        // forwarded as received, only the name is needed (see EventRelay)
+        if (!VREvent::PeekName(s, &name)) {
+            VREvent *e = VREvent::CreateFromJson(s);
+            if (e == NULL) {
+                continue;
+            }
+            name = e->get_name();
+            s = e->ToJson();
+            delete e;
+        }
+        OutboundFramePtr frame = std::make_shared<const OutboundFrame>(std::move(s), name);
+
+        // a copy of the list, since clients may come and go while this waits for a slow one
+        dests = relay->clients;
+        for (int i=0; i<dests.size(); i++) {
+            if ((dests[i] != client) || (relay->relay_to_source)) {
+                co_await dests[i]->SendFrame(frame);
+            }
+        }
+        relay->num_relayed++;
+
+        if ((name == "Shutdown") || (name == "SHUTDOWN")) {
+            relay->shutdown = true;
+            relay->reactor->Stop();
+        }
+    }
+
+    if (!relay->quiet) {
+        std::cout << "Dropped connection from " << client->get_description() << std::endl;
+    }
+    relay->clients.erase(std::remove(relay->clients.begin(), relay->clients.end(), client), relay->clients.end());
+    client->Close();
+}
+
+
+CoroTask<void> AcceptClients(CoroRelay *relay, CoroListener *listener) {
+    while (std::shared_ptr<CoroConnection> client = co_await listener->Accept()) {
+        relay->clients.push_back(client);
+        relay->reactor->Spawn(ServeClient(relay, client));
+    }
+}
+
+
+// --- bench ---
+
+// Sends num_events events from the first client, one at a time, calling pass() until the relay has relayed it,
+// with every client reading everything relayed to it after each event.  Returns seconds, or < 0 on failure.
+template <typename PassFn, typename CountFn>
+static double RunBench(const std::vector<Connection*> &clients, int num_events, const std::string &json,
+                       PassFn pass, CountFn num_relayed)
+{
+    std::vector<std::string> frames;
+    uint64_t num_received = 0;
+    uint64_t expected = (uint64_t)num_events * clients.size();
+    auto start = std::chrono::steady_clock::now();
+    for (int e=0; e<num_events; e++) {
+        uint64_t before = num_relayed();
+        clients[0]->SendString(json);
+        while (num_relayed() == before) {
+            pass();
+        }
+        // the relayed event goes out at the end of the pass
+        pass();
+        for (int c=0; c<clients.size(); c++) {
+            frames.clear();
+            clients[c]->ReceiveAvailableStrings(&frames);
+            num_received += frames.size();
+        }
+    }
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while ((num_received < expected) && (std::chrono::steady_clock::now() < give_up)) {
+        pass();
+        for (int c=0; c<clients.size(); c++) {
+            frames.clear();
+            clients[c]->ReceiveAvailableStrings(&frames);
+            num_received += frames.size();
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (num_received == expected) ? secs : -1.0;
+}
+
+
+template <typename PassFn>
+static bool ConnectClients(int port, int num_clients, std::vector<Connection*> *clients, PassFn pass,
+                           std::function<int()> num_accepted)
+{
+    for (int c=0; c<num_clients; c++) {
+        Connection *client = Connection::Connect("127.0.0.1", port);
+        if (client == NULL) {
+            return false;
+        }
+        clients->push_back(client);
+        // accept as we go, so the listener's backlog never fills up
+        while (num_accepted() < clients->size()) {
+            pass();
+        }
+    }
+    return true;
+}
+
+
+static void PrintBench(const std::string &name, double secs, int num_events, int num_clients) {
+    if (secs < 0.0) {
+        std::cerr << "  " << name << ": not every event arrived" << std::endl;
+        return;
+    }
+    double sends = (double)num_events * num_clients;
+    std::cout << "  " << name << ": " << secs * 1000.0 << " ms, " << (int)(num_events / secs) << " events/s, "
+        << (int)(sends / secs) << " event-sends/s, " << secs * 1.0e9 / sends << " ns per event-send" << std::endl;
+}
+
+
+static int Bench(int num_clients, int num_events) {
+    std::string json = VREventVector3("Tracker/Head/Position", 1.0f, 2.0f, 3.0f).ToJson();
+    std::cout << "coro relay bench: " << num_clients << " clients, " << num_events << " events of " << json.size()
+        << " bytes, each relayed to every client" << std::endl;
+
+    // 1. EventRelay + NetReactor, as minvr3_relay_server runs it
+    {
+        NetReactor reactor;
+        EventRelay relay;
+        relay.set_send_limit(4194304, SendQueue::OVERFLOW_DROP_OLDEST);
+        relay.set_connect_callback([&](Connection *c) {
+            reactor.Add(c->get_socket(), NetReactor::READABLE, [&relay, c](SOCKET, int events) {
+                if (events & NetReactor::WRITABLE) {
+                    relay.WriteTo(c);
+                }
+                if (events & (NetReactor::READABLE | NetReactor::CLOSED)) {
+                    relay.ReadFrom(c);
+                }
+            });
+        });
+        relay.set_writable_callback([&](Connection *c, bool waiting) {
+            reactor.Modify(c->get_socket(), waiting ? (NetReactor::READABLE | NetReactor::WRITABLE) : NetReactor::READABLE);
+        });
+        relay.set_disconnect_callback([&](Connection *c) {
+            reactor.Remove(c->get_socket());
+        });
+        Listener *listener = Listener::Create("0");
+        if (listener == NULL) {
+            return 1;
+        }
+        std::string desc = listener->get_description();
+        int port = std::stoi(desc.substr(desc.rfind(':') + 1));
+        relay.AddListener(listener);
+        reactor.Add(listener->get_socket(), NetReactor::READABLE, [&relay, listener](SOCKET, int) {
+            relay.AcceptFrom(listener);
+        });
+        auto pass = [&]() {
+            reactor.RunOnce(0);
+            relay.Flush();
+            relay.RemoveDisconnected();
+        };
+
+        std::vector<Connection*> clients;
+        if (!ConnectClients(port, num_clients, &clients, pass, [&]() { return (int)relay.get_connections().size(); })) {
+            return 1;
+        }
+        double secs = RunBench(clients, num_events, json, pass, [&]() { return relay.get_num_events_relayed(); });
+        PrintBench("EventRelay + NetReactor", secs, num_events, num_clients);
+        for (int c=0; c<clients.size(); c++) {
+            delete clients[c];
+        }
+    }
+
+    // 2. the coroutine relay
+    {
+        CoroReactor reactor;
+        CoroRelay relay = { &reactor, true, {}, 0, false, true };
+        SOCKET listener_fd;
+        if (!MinNet::CreateListener(0, &listener_fd, num_clients)) {
+            return 1;
+        }
+        std::string desc = MinNet::GetAddressAndPort(listener_fd);
+        int port = std::stoi(desc.substr(desc.rfind(':') + 1));
+        CoroListener listener(&reactor, listener_fd);
+        reactor.Spawn(AcceptClients(&relay, &listener));
+        auto pass = [&]() {
+            reactor.RunOnce(0);
+        };
+
+        std::vector<Connection*> clients;
+        if (!ConnectClients(port, num_clients, &clients, pass, [&]() { return (int)relay.clients.size(); })) {
+            return 1;
+        }
+        double secs = RunBench(clients, num_events, json, pass, [&]() { return relay.num_relayed; });
+        PrintBench("coroutines + CoroReactor", secs, num_events, num_clients);
+        for (int c=0; c<clients.size(); c++) {
+            delete clients[c];
+        }
+        // let the client coroutines see their connections close and end
+        listener.Close();
+        for (int i=0; (i<100) && (reactor.get_num_tasks() > 0); i++) {
+            reactor.RunOnce(10);
+        }
+    }
+    return 0;
+}
+
+
+int main(int argc, char** argv) {
+    int port = 9034;
+    bool relay_to_source_client = true;
+
+    std::string arg = (argc > 1) ? argv[1] : "";
+    if ((arg == "help") || (arg == "-h") || (arg == "-help") || (arg == "--help")) {
+        std::cout << "Usage: minvr3_coro_relay [port] [relay-to-source-client: true/false]" << std::endl;
+        std::cout << "       minvr3_coro_relay bench [num-clients] [num-events]" << std::endl;
+        std::cout << "  * Relays all VREvents received to all connected clients, one coroutine per client." << std::endl;
+        std::cout << "  * port defaults to " << port << std::endl;
+        std::cout << "  * relay-to-source-client defaults to " << relay_to_source_client << std::endl;
+        std::cout << "  * Quits if an event named 'Shutdown' is received, or press Ctrl-C" << std::endl;
+        std::cout << "  * bench compares this relay with minvr3_relay_server's loop" << std::endl;
+        exit(0);
+    }
+
+    MinVR3Net::Init();
+#ifndef WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    if (arg == "bench") {
+        int num_clients = (argc > 2) ? std::stoi(argv[2]) : 30;
+        int num_events = (argc > 3) ? std::stoi(argv[3]) : 20000;
+        int result = Bench(num_clients, num_events);
+        MinVR3Net::Shutdown();
+        return result;
+    }
+
+    if (argc > 1) {
+        port = std::stoi(argv[1]);
+    }
+    if (argc > 2) {
+        std::string a = argv[2];
+        relay_to_source_client = ((a == "1") || (a == "true") || (a == "True") || (a == "TRUE"));
+    }
+
+    std::cout << "MinVR3 Coroutine Relay Server" << std::endl;
+    SOCKET listener_fd;
+    if (!MinNet::CreateListener(port, &listener_fd)) {
+        exit(1);
+    }
+    CoroReactor reactor;
+    CoroRelay relay = { &reactor, relay_to_source_client, {}, 0, false, false };
+    CoroListener listener(&reactor, listener_fd);
+    reactor.Spawn(AcceptClients(&relay, &listener));
+    reactor.Run();
+
+    // the shutdown event has been sent, now let everything else go
+    listener.Close();
+    for (int i=0; i<relay.clients.size(); i++) {
+        relay.clients[i]->Close();
+    }
+    MinVR3Net::Shutdown();
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string>
 #include <thread>
+#include <vector>
 
 
 #include <minvr3.h>
@@ -33,21 +34,27 @@ int main(int argc, char** argv) {
     
     MinVR3Net::Init();
     
-    SOCKET server_fd;
-    if (MinNet::ConnectTo(ip, port, &server_fd)) {
+    // The connection is handled on a background thread, so this loop, like a program's frame loop, only ever
+    // takes events that have already arrived and never waits on the network.
+    AsyncClient client;
+    if (client.Connect(ip, port)) {
         bool done = false;
+        std::vector<VREvent*> events;
         while (!done) {
-            if (MinVR3Net::IsReadyToRead(&server_fd)) {
-                VREvent* e = MinVR3Net::ReceiveVREvent(&server_fd);
-                std::cout << *e << std::endl;
-                if (e->get_name() == "Shutdown") {
+            events.clear();
+            if (!client.ReceiveAvailableVREvents(&events)) {
+                done = true;
+            }
+            for (int i=0; i<events.size(); i++) {
+                std::cout << *events[i] << std::endl;
+                if (events[i]->get_name() == "Shutdown") {
                     done = true;
                 }
-                delete e;
+                delete events[i];
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
-        MinNet::CloseSocket(&server_fd);
+        client.Close();
     }
         
     MinVR3Net::Shutdown();
@@ -0,0 +1,172 @@
+/** MinVR3 Multicast Node
+ Publishes or subscribes to a multicast VREvent stream, for trying out multicast delivery and its repairs, e.g., with
+ several processes on one machine over the loopback interface:
+
+   minvr3_multicast_node subscribe --interface 127.0.0.1 --loss 0.1     (in as many terminals as you like)
+   minvr3_multicast_node publish 100000 --interface 127.0.0.1
+
+ The publisher sends a numbered Vector3 event named "Test/Counter" for each count, then "Shutdown".  Each subscriber
+ checks that every count arrives exactly once and in order, even with simulated loss, and prints its counters when
+ the stream ends.  A subscriber can also follow a minvr3_relay_server started with --multicast, in which case it
+ prints the events it receives.
+*/
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <minvr3.h>
+
+
+int main(int argc, char** argv) {
+    // defaults
+    std::string mode = "help";
+    std::string group = "239.255.77.34";
+    int port = 9035;
+    std::string publisher_ip = "127.0.0.1";
+    std::string interface_ip;
+    double loss = 0.0;
+    int num_events = 10000;
+    int rate_hz = 0;
+    int events_per_datagram = 1;
+
+    std::vector<std::string> args;
+    for (int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--group") && (i+1 < argc)) {
+            std::string group_and_port = argv[++i];
+            size_t colon = group_and_port.rfind(':');
+            group = group_and_port.substr(0, colon);
+            if (colon != std::string::npos) {
+                port = std::stoi(group_and_port.substr(colon + 1));
+            }
+        }
+        else if ((arg == "--publisher") && (i+1 < argc)) {
+            publisher_ip = argv[++i];
+        }
+        else if ((arg == "--interface") && (i+1 < argc)) {
+            interface_ip = argv[++i];
+        }
+        else if ((arg == "--loss") && (i+1 < argc)) {
+            loss = std::stod(argv[++i]);
+        }
+        else if ((arg == "--rate") && (i+1 < argc)) {
+            rate_hz = std::stoi(argv[++i]);
+        }
+        else if ((arg == "--batch") && (i+1 < argc)) {
+            events_per_datagram = std::stoi(argv[++i]);
+        }
+        else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() > 0) {
+        mode = args[0];
+    }
+    if (args.size() > 1) {
+        num_events = std::stoi(args[1]);
+    }
+
+    if ((mode != "publish") && (mode != "subscribe")) {
+        std::cout << "Usage: minvr3_multicast_node publish [num-events] [options]" << std::endl;
+        std::cout << "       minvr3_multicast_node subscribe [options]" << std::endl;
+        std::cout << "Options:" << std::endl;
+        std::cout << "  --group group:port   Multicast group, defaults to " << group << ":" << port << std::endl;
+        std::cout << "                       (repair requests go to port + 1)" << std::endl;
+        std::cout << "  --interface ip       Interface to use, e.g. 127.0.0.1, defaults to the OS choice" << std::endl;
+        std::cout << "  --publisher ip       Where subscribers send repair requests, defaults to " << publisher_ip << std::endl;
+        std::cout << "  --loss fraction      Subscribers drop this fraction of datagrams on arrival to test repairs" << std::endl;
+        std::cout << "  --rate hz            Publish at this many events per second, defaults to as fast as possible" << std::endl;
+        std::cout << "  --batch n            Publish n events per datagram, defaults to " << events_per_datagram << std::endl;
+        exit(0);
+    }
+
+    MinVR3Net::Init();
+    int result = 0;
+
+    if (mode == "publish") {
+        MulticastPublisher pub;
+        if (!pub.Open(group, port, port + 1, interface_ip)) {
+            exit(1);
+        }
+        // give subscribers a moment to hear the first heartbeat
+        pub.Poll();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i=0; i<num_events; i++) {
+            pub.QueueVREvent(VREventVector3("Test/Counter", (float)i, 0.0f, 0.0f));
+            if ((i + 1) % events_per_datagram == 0) {
+                pub.Flush();
+            }
+            pub.Poll();
+            if (rate_hz > 0) {
+                std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t)(i + 1) * 1000000 / rate_hz));
+            }
+        }
+        pub.QueueVREvent(VREvent("Shutdown"));
+        pub.Flush();
+
+        // stay around to answer late repair requests
+        auto linger_end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (std::chrono::steady_clock::now() < linger_end) {
+            pub.Poll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::cout << "Published " << pub.get_num_datagrams_sent() << " datagrams, answered "
+            << pub.get_num_repair_requests() << " repair requests with " << pub.get_num_repairs_sent()
+            << " repairs (" << pub.get_num_unrepairable() << " unrepairable)" << std::endl;
+    }
+    else {
+        MulticastSubscriber sub;
+        if (!sub.Open(group, port, publisher_ip, port + 1, interface_ip)) {
+            exit(1);
+        }
+        sub.set_simulated_loss(loss);
+
+        NetReactor reactor;
+        reactor.Add(sub.get_socket(), NetReactor::READABLE, [](SOCKET, int) {});
+        reactor.Add(sub.get_repair_socket(), NetReactor::READABLE, [](SOCKET, int) {});
+
+        int num_counted = 0;
+        int num_out_of_order = 0;
+        int next_count = -1;
+        bool done = false;
+        while (!done) {
+            // wake up for new datagrams, and often enough to resend repair requests
+            reactor.RunOnce(5);
+            std::vector<VREvent*> events;
+            sub.ReceiveVREvents(&events);
+            for (int i=0; i<events.size(); i++) {
+                VREventVector3 *counter = dynamic_cast<VREventVector3*>(events[i]);
+                if ((counter != NULL) && (events[i]->get_name() == "Test/Counter")) {
+                    int count = (int)counter->get_data()[0];
+                    if ((next_count >= 0) && (count != next_count)) {
+                        num_out_of_order++;
+                    }
+                    next_count = count + 1;
+                    num_counted++;
+                }
+                else {
+                    std::cout << *events[i] << std::endl;
+                }
+                if (events[i]->get_name() == "Shutdown") {
+                    done = true;
+                }
+                delete events[i];
+            }
+        }
+
+        std::cout << "Received " << num_counted << " counter events, " << num_out_of_order << " out of order or missing"
+            << std::endl;
+        std::cout << "Datagrams: " << sub.get_num_datagrams_received() << " received, "
+            << sub.get_num_datagrams_repaired() << " repaired, " << sub.get_num_datagrams_lost() << " lost, "
+            << sub.get_num_duplicates() << " duplicates, " << sub.get_num_nacks_sent() << " repair requests sent"
+            << std::endl;
+        result = (num_out_of_order == 0) ? 0 : 1;
+    }
+
+    MinVR3Net::Shutdown();
+    return result;
+}
@@ -2,134 +2,609 @@
  This simple app acts as a MinVR3 Connection server.  It will accept connections from an unlimited number of clients.
  Whenever a VREvent is received from a client, the event is relayed out to all attached clients.  By default, this includes
  relaying the event "back to" the source client who sent the event.  However, this behavior can be turned off with the
- relay-to-source-client command line option.  The port number and inner-loop sleep milliseconds can also be set on
- the command line.
+ relay-to-source-client command line option.  The port number and read/write timeout can also be set on the command
+ line.
+
+ The relaying itself is done by an EventRelay, which works with any Connection transport; this app drives it over TCP and
+ unix domain sockets.  The server is driven by a NetReactor, so it sleeps inside the kernel until a client connects or sends data and it
+ does not do any work proportional to the number of connected clients unless they are actually sending events.
+
+ A client that cannot keep up (e.g., a laptop on a poor wireless link) does not hold up the others: each client has
+ its own send queue, and the relay only sends a client more when its socket has room.  If a client falls more than
+ --send-queue bytes behind, --overflow decides whether its oldest events are dropped, it is disconnected, or its
+ queued events are coalesced to the latest value of each event name.  --overflow block restores the older behavior
+ of waiting for each client in turn.
+
+ --coalesce with a pattern (may be repeated), e.g., "Tracker/" followed by *, relays the matching events as latest
+ values: a client that is behind only ever has the newest of each waiting for it, so it catches up to the present as
+ soon as it can take more, rather than replaying stale poses, while every other event (button presses, etc.) is still
+ delivered in order.  Events that were already handed to the kernel (up to a socket send buffer's worth) are still
+ delivered.
+
+ Clients that only need some of the events can subscribe to them by name or pattern (see Connection::Subscribe() and
+ EventRelay), and are then sent nothing else.  Clients that offer an event dictionary (see
+ Connection::OfferEventDictionary()) are sent each event name once and a small id from then on, with the data in
+ binary for those that read protocol version 2, and clients that ask for it (see Connection::RequestEventFormat())
+ are sent MessagePack, while every other client still gets plain json.
+
+ With --multicast, every relayed event is also published once to a multicast group (see MulticastPublisher), so any
+ number of cluster render nodes can receive the stream with a MulticastSubscriber rather than a TCP connection each.
+ The relay answers the subscribers' repair requests on the group's port + 1.
+
+ The relay can listen on several addresses at once with --listen, e.g., a TCP port for remote clients and a unix
+ domain socket for clients on the same machine.  With --handover, it also listens for a newer relay that starts with
+ --take-over; the running relay then passes all of its listeners and client connections to the new one and quits,
+ so the relay can be upgraded without any client noticing (not available on windows).  Each client is passed on with
+ what the relay knew about it (see EventRelay::GetConnectionState()), e.g., its subscriptions, and the relays linked
+ to it with --uplink stay linked, to a relay with the same id.
+
+ With --threads N, the clients are split between N threads (see ShardedEventRelay), so a relay with hundreds of clients
+ can use every core.  Each relayed event is still serialized only once and shared by all of the clients' send queues.
+
+ Several relays, on one machine or several, can also share the events as a cluster: each is started as usual, e.g.,
+ on ports 9034, 9035 and 9036, and clients connect to all of them with a RelayCluster, which sends each event only to
+ the relay that owns its name, so each relay carries a share of the events and one going down only moves its share
+ to the next.
+
+ For a session shared between sites, run a relay at each site, with the clients at each site connected to their own
+ relay, and link each relay to the hub's (see RelayFederation): the hub also listens for the other relays with
+ --link-listen, e.g., on port 9044, which only they should be able to reach, and each of them links to it with
+ --uplink hub:9044.  Each event then crosses the link between two sites once, rather than once for every client at
+ the far end, and only if somebody there has subscribed to it.  The relays can form a tree of any depth; a link that would close a loop is refused.  A lost
+ uplink is made again every second, on a thread of its own so the local clients are not held up.
+
+ --socket-profile low-latency sets TCP_QUICKACK, SO_BUSY_POLL and DSCP Expedited Forwarding on every client connection
+ (see SocketTuning), e.g., for a relay on a head tracking path, and --spin-wait makes the relay wait for events on a
+ busy core rather than sleeping in the kernel, for a machine with a core to spare for it.
 */
 
 
+#include <algorithm>
 #include <chrono>
+#include <future>
 #include <iostream>
-#include <thread>
+#include <mutex>
+#include <signal.h>
+#include <sstream>
 
 #include <minvr3.h>
 
 
+// The --threads version of the main loop.  The shards do all of the relaying on their own threads; this thread only
+// accepts new clients and keeps the multicast publisher going.
+int RunSharded(int num_threads, bool relay_to_source_client, const std::string &overflow, int64_t send_queue_bytes,
+               const std::vector<std::string> &coalesce_patterns, std::vector<std::string> listen_addresses, int port,
+               const std::string &multicast_group, int multicast_port, const std::string &multicast_interface,
+               const std::string &handover_address, const std::string &take_over_address)
+{
+    SendQueue::OverflowPolicy overflow_policy;
+    if (!SendQueue::StringToPolicy(overflow, &overflow_policy)) {
+        std::cerr << "--overflow " << overflow << " is not available with --threads" << std::endl;
+        return 1;
+    }
+    if ((!handover_address.empty()) || (!take_over_address.empty())) {
+        std::cerr << "--handover and --take-over are not available with --threads" << std::endl;
+        return 1;
+    }
+
+    ShardedEventRelay relay(num_threads, relay_to_source_client);
+    relay.set_send_limit(send_queue_bytes, overflow_policy);
+    relay.set_coalesce_patterns(coalesce_patterns);
+    std::cout << "Relaying on " << relay.get_num_threads() << " threads, queueing up to " << send_queue_bytes
+        << " bytes per client, then " << SendQueue::PolicyToString(overflow_policy) << std::endl;
+
+    // every shard publishes the events it relays, so the publisher is shared under a lock
+    MulticastPublisher multicast;
+    std::mutex multicast_mutex;
+    if (!multicast_group.empty()) {
+        if (!multicast.Open(multicast_group, multicast_port, multicast_port + 1, multicast_interface)) {
+            return 1;
+        }
+        relay.set_relay_callback([&](const OutboundFramePtr &frame) {
+            std::lock_guard<std::mutex> lock(multicast_mutex);
+            multicast.QueueString(frame->body);
+        });
+    }
+    relay.set_disconnect_callback([&](Connection *client) {
+        std::stringstream msg;
+        msg << "Dropped connection from " << client->get_description();
+        const SendQueue *queue = client->get_send_queue();
+        if ((queue != NULL) && (queue->get_num_dropped() + queue->get_num_coalesced() > 0)) {
+            msg << " (" << queue->get_num_dropped() << " events dropped and " << queue->get_num_coalesced()
+                << " coalesced because it could not keep up)";
+        }
+        // one write, so lines from different shards do not interleave
+        msg << std::endl;
+        std::cout << msg.str() << std::flush;
+    });
+
+    if (listen_addresses.empty()) {
+        listen_addresses.push_back(std::to_string(port));
+    }
+    for (int i=0; i<listen_addresses.size(); i++) {
+        SOCKET listener_fd;
+        if (!MinVR3Net::CreateListener(listen_addresses[i], &listener_fd)) {
+            return 1;
+        }
+        relay.AddListener(new TcpListener(listener_fd));
+    }
+    if (!relay.Start()) {
+        return 1;
+    }
+
+    // wake up at least every 100ms to notice a shutdown, sooner if multicast heartbeats are due
+    int timeout_ms = 100;
+    if (multicast.is_open()) {
+        timeout_ms = std::min(timeout_ms, multicast.get_heartbeat_interval_ms());
+    }
+    while (!relay.is_shutdown_requested()) {
+        if (!relay.RunOnce(timeout_ms)) {
+            break;
+        }
+        if (multicast.is_open()) {
+            std::lock_guard<std::mutex> lock(multicast_mutex);
+            multicast.Flush();
+            multicast.Poll();
+        }
+    }
+    relay.Stop();
+    if (multicast.is_open()) {
+        multicast.Flush();
+    }
+    MinVR3Net::Shutdown();
+    return 0;
+}
+
+
 int main(int argc, char** argv) {
     // default settings
     int port = 9034;
     bool relay_to_source_client = true;
     int read_write_timeout_ms = 500;
-    int sleep_ms = 10;
     
-    // optionally, override defaults with command line options
-    if (argc > 1) {
-        std::string arg = argv[1];
+    std::string io_backend = "auto";
+    std::string overflow = "drop-oldest";
+    int64_t send_queue_bytes = 4194304;
+    std::string multicast_group;
+    int multicast_port = 0;
+    std::string multicast_interface;
+    std::vector<std::string> listen_addresses;
+    std::vector<std::string> link_listen_addresses;
+    std::vector<std::string> coalesce_patterns;
+    std::string handover_address;
+    std::string take_over_address;
+    int num_threads = 1;
+    std::string socket_profile = "default";
+    bool spin_wait = false;
+    std::string uplink_address;
+    std::string relay_id;
+    
+    // optionally, override defaults with command line options; named options start with --, the rest are
+    // positional
+    std::vector<std::string> args;
+    for (int i=1; i<argc; i++) {
+        std::string arg = argv[i];
         if ((arg == "help") || (arg == "-h") || (arg == "-help") || (arg == "--help")) {
-            std::cout << "Usage: minvr3_relay_server [port] [relay-to-source-client: true/false] [read-write-timeout-ms] [sleep-ms] " << std::endl;
+            std::cout << "Usage: minvr3_relay_server [port] [relay-to-source-client: true/false] [read-write-timeout-ms] [options]" << std::endl;
             std::cout << "  * Relays all VREvents received to all connected clients." << std::endl;
             std::cout << "" << std::endl;
             std::cout << "  * port defaults to " << port << std::endl;
             std::cout << "  * relay-to-source-client defaults to " << relay_to_source_client << std::endl;
             std::cout << "  * read-write-timeout-ms defaults to " << read_write_timeout_ms << std::endl;
-            std::cout << "  * sleep-ms defaults to " << sleep_ms << std::endl;
             std::cout << "  * Quits if an event named 'Shutdown' is received, or press Ctrl-C" << std::endl;
+            std::cout << "" << std::endl;
+            std::cout << "Options:" << std::endl;
+            std::cout << "  --overflow block|drop-oldest|disconnect|coalesce" << std::endl;
+            std::cout << "                                       What to do when a client cannot keep up, defaults to " << overflow << std::endl;
+            std::cout << "                                       (block waits up to read-write-timeout-ms for each client in turn)" << std::endl;
+            std::cout << "  --coalesce pattern                   Send clients that are behind only the latest of these events, e.g. \"Tracker/*\", may be repeated" << std::endl;
+            std::cout << "  --send-queue bytes                   Max bytes queued for a client that cannot keep up, defaults to " << send_queue_bytes << std::endl;
+            std::cout << "  --max-frame bytes                    Drop a client that sends a larger event, defaults to " << MinNet::get_max_frame_size() << std::endl;
+            std::cout << "  --io-backend auto|syscall|io_uring   How relayed events are sent with --overflow block, defaults to " << io_backend << std::endl;
+            std::cout << "  --listen port|unix:/path|unix:@name  Listen here instead of on [port], may be repeated" << std::endl;
+            std::cout << "  --handover unix:/path|unix:@name     Hand everything over to a new relay that connects here" << std::endl;
+            std::cout << "  --take-over unix:/path|unix:@name    Take over from the relay started with --handover here" << std::endl;
+            std::cout << "  --threads n                          Split the clients between n threads (0 for one per core), defaults to " << num_threads << std::endl;
+            std::cout << "  --multicast group:port               Also publish relayed events to this multicast group" << std::endl;
+            std::cout << "  --multicast-interface ip             Interface to publish on, e.g. 127.0.0.1, defaults to the OS choice" << std::endl;
+            std::cout << "  --socket-profile default|low-latency|throughput" << std::endl;
+            std::cout << "                                       Socket options for client connections, defaults to " << socket_profile << std::endl;
+            std::cout << "  --spin-wait                          Wait for clients' events on a busy core rather than sleeping" << std::endl;
+            std::cout << "  --link-listen port|unix:/path        Listen here for the relays that link to this one with --uplink, may be repeated" << std::endl;
+            std::cout << "  --uplink host:port|unix:/path        Link to this upstream relay, for a session shared between sites" << std::endl;
+            std::cout << "  --relay-id id                        Name of this relay in the links between relays, defaults to a random one" << std::endl;
             exit(0);
         }
-        port = std::stoi(argv[1]);
+        else if ((arg == "--io-backend") && (i+1 < argc)) {
+            io_backend = argv[++i];
+        }
+        else if ((arg == "--overflow") && (i+1 < argc)) {
+            overflow = argv[++i];
+            SendQueue::OverflowPolicy policy;
+            if ((overflow != "block") && (!SendQueue::StringToPolicy(overflow, &policy))) {
+                std::cerr << "Unknown --overflow policy " << overflow << std::endl;
+                exit(1);
+            }
+        }
+        else if ((arg == "--coalesce") && (i+1 < argc)) {
+            coalesce_patterns.push_back(argv[++i]);
+        }
+        else if ((arg == "--send-queue") && (i+1 < argc)) {
+            send_queue_bytes = std::stoll(argv[++i]);
+        }
+        else if ((arg == "--max-frame") && (i+1 < argc)) {
+            // every connection's decoder picks this up when it is created
+            MinNet::set_max_frame_size((uint32_t)std::stoul(argv[++i]));
+        }
+        else if ((arg == "--multicast") && (i+1 < argc)) {
+            std::string group_and_port = argv[++i];
+            size_t colon = group_and_port.rfind(':');
+            if (colon == std::string::npos) {
+                std::cerr << "Expected --multicast group:port" << std::endl;
+                exit(1);
+            }
+            multicast_group = group_and_port.substr(0, colon);
+            multicast_port = std::stoi(group_and_port.substr(colon + 1));
+        }
+        else if ((arg == "--listen") && (i+1 < argc)) {
+            listen_addresses.push_back(argv[++i]);
+        }
+        else if ((arg == "--link-listen") && (i+1 < argc)) {
+            link_listen_addresses.push_back(argv[++i]);
+        }
+        else if ((arg == "--handover") && (i+1 < argc)) {
+            handover_address = argv[++i];
+        }
+        else if ((arg == "--take-over") && (i+1 < argc)) {
+            take_over_address = argv[++i];
+        }
+        else if ((arg == "--threads") && (i+1 < argc)) {
+            num_threads = std::stoi(argv[++i]);
+        }
+        else if ((arg == "--multicast-interface") && (i+1 < argc)) {
+            multicast_interface = argv[++i];
+        }
+        else if ((arg == "--socket-profile") && (i+1 < argc)) {
+            socket_profile = argv[++i];
+        }
+        else if (arg == "--spin-wait") {
+            spin_wait = true;
+        }
+        else if ((arg == "--uplink") && (i+1 < argc)) {
+            uplink_address = argv[++i];
+            if ((!MinNet::IsUnixAddress(uplink_address)) && (uplink_address.rfind(':') == std::string::npos)) {
+                std::cerr << "Expected --uplink host:port or unix:/path" << std::endl;
+                exit(1);
+            }
+        }
+        else if ((arg == "--relay-id") && (i+1 < argc)) {
+            relay_id = argv[++i];
+            if ((relay_id.empty()) || (relay_id.find(' ') != std::string::npos) || (relay_id.size() > 255)) {
+                std::cerr << "--relay-id must be 1 to 255 characters without spaces" << std::endl;
+                exit(1);
+            }
+        }
+        else {
+            args.push_back(arg);
+        }
     }
-    if (argc > 2) {
-        std::string arg = argv[2];
-        relay_to_source_client = ((arg == "1") || (arg == "true") || (arg == "True") || (arg == "TRUE"));
+    if (args.size() > 0) {
+        port = std::stoi(args[0]);
     }
-    if (argc > 3) {
-        read_write_timeout_ms = std::stoi(argv[3]);
+    if (args.size() > 1) {
+        std::string arg = args[1];
+        relay_to_source_client = ((arg == "1") || (arg == "true") || (arg == "True") || (arg == "TRUE"));
     }
-    if (argc > 4) {
-        sleep_ms = std::stoi(argv[4]);
+    if (args.size() > 2) {
+        read_write_timeout_ms = std::stoi(args[2]);
     }
+    // args[3] used to set an inner-loop sleep-ms; it is still accepted but ignored since the server no longer polls
 
+    // before any client connects, since the options are set as each one is accepted
+    SocketTuning tuning;
+    if (!SocketTuning::FromProfile(socket_profile, &tuning)) {
+        std::cerr << "Unknown --socket-profile " << socket_profile << std::endl;
+        exit(1);
+    }
+    tuning.spin_wait = spin_wait;
+    MinNet::set_socket_tuning(tuning);
 
     std::cout << "MinVR3 Relay Server" << std::endl;
+    std::cout << "Client sockets: " << tuning.ToString() << std::endl;
     MinVR3Net::Init();
+#ifndef WIN32
+    // a client that disconnects while we are sending to it should not kill the server
+    signal(SIGPIPE, SIG_IGN);
+#endif
     
-    SOCKET listener_fd;
-    if (!MinVR3Net::CreateListener(port, &listener_fd)) {
-        exit(1);
+    if ((num_threads != 1) && ((!uplink_address.empty()) || (!link_listen_addresses.empty()))) {
+        std::cerr << "--uplink and --link-listen are not available with --threads" << std::endl;
+        return 1;
     }
-    
-    std::vector<SOCKET> client_fds;
-    std::vector<std::string> client_descs;
+    if ((!uplink_address.empty()) && ((!handover_address.empty()) || (!take_over_address.empty()))) {
+        std::cerr << "--uplink is not available with --handover and --take-over" << std::endl;
+        return 1;
+    }
+    if (num_threads != 1) {
+        return RunSharded(num_threads, relay_to_source_client, overflow, send_queue_bytes, coalesce_patterns, listen_addresses, port,
+                          multicast_group, multicast_port, multicast_interface, handover_address, take_over_address);
+    }
+
+    NetReactor reactor;
+    EventRelay relay(relay_to_source_client);
+    // all events relayed during one pass through the loop are sent together
+    NetBatchIO batch(NetBatchIO::StringToBackend(io_backend));
+    SendQueue::OverflowPolicy overflow_policy;
+    if (SendQueue::StringToPolicy(overflow, &overflow_policy)) {
+        // each client has its own queue, and a slow one is only sent more once its socket is writable
+        relay.set_send_limit(send_queue_bytes, overflow_policy);
+        relay.set_coalesce_patterns(coalesce_patterns);
+        std::cout << "Queueing up to " << send_queue_bytes << " bytes per client, then "
+            << SendQueue::PolicyToString(overflow_policy) << std::endl;
+    }
+    else if (!coalesce_patterns.empty()) {
+        std::cerr << "--coalesce is not available with --overflow block" << std::endl;
+        return 1;
+    }
+    else {
+        relay.set_batch_io(&batch);
+        std::cout << "Sending with the " << NetBatchIO::BackendToString(batch.get_backend()) << " backend" << std::endl;
+    }
+    MulticastPublisher multicast;
+    if (!multicast_group.empty()) {
+        if (!multicast.Open(multicast_group, multicast_port, multicast_port + 1, multicast_interface)) {
+            exit(1);
+        }
+        relay.set_relay_callback([&](const OutboundFramePtr &frame) {
+            multicast.QueueString(frame->body);
+        });
+        // repair requests from subscribers
+        reactor.Add(multicast.get_repair_socket(), NetReactor::READABLE, [&](SOCKET, int) {
+            multicast.Poll();
+        });
+    }
+    SOCKET handover_fd = INVALID_SOCKET;
     bool shutdown = false;
-    while (!shutdown) {
-        std::vector<SOCKET> disconnected_fds;
-        
-        // Accept new connections from any clients trying to connect
-        while (MinVR3Net::IsReadyToRead(&listener_fd)) {
-            SOCKET new_client_fd;
-            if (MinVR3Net::TryAcceptConnection(listener_fd, &new_client_fd)) {
-                client_fds.push_back(new_client_fd);
-                client_descs.push_back(MinVR3Net::GetAddressAndPort(new_client_fd));
-            }
-        }
-        
-        // See if any clients have sent messages
-        if (client_fds.size() > 0) {
-            std::vector<SOCKET> ready_to_read = MinNet::SelectReadyToRead(client_fds);
-            // Read one event from every socket that is ready for a read.
-            for (int i=0; i<ready_to_read.size(); i++) {
-                // Receive the incoming event from the client
-                VREvent* e = MinVR3Net::ReceiveVREvent(&ready_to_read[i], read_write_timeout_ms);
-                if (e == NULL) {
-                    // If there was a problem receiving, then assume this client disconnected
-                    disconnected_fds.push_back(ready_to_read[i]);
-                }
-                else {
-                    // Relay the event out to all clients.
-                    for (int j=0; j<client_fds.size(); j++) {
-                        if ((relay_to_source_client) || (client_fds[j] != ready_to_read[i])) {
-                            bool success = MinVR3Net::SendVREvent(&client_fds[j], *e, read_write_timeout_ms);
-                            
-                            //std::cout << *e << std::endl;
-                            
-                            if (!success) {
-                                // If there was a problem sending, then assume this client disconnected
-                                disconnected_fds.push_back(client_fds[j]);
-                            }
-                        }
-                    }
-
-                    // If the event happened to be named "Shutdown", then we can also shutdown.
-                    shutdown = (e->get_name() == "Shutdown") || (e->get_name() == "SHUTDOWN");
-                    
-                    // Done with the event
-                    delete e;
+
+    // The link to the upstream relay, connected on a thread of its own since a connect to another site can take
+    // a long time to fail, and connected again a second after it is lost.
+    if (!relay_id.empty()) {
+        relay.set_relay_id(relay_id);
+    }
+    Connection *uplink = NULL;
+    std::future<Connection*> uplink_connecting;
+    std::chrono::steady_clock::time_point next_uplink_attempt = std::chrono::steady_clock::now();
+    auto connect_uplink = [&]() {
+        if (uplink_connecting.valid()) {
+            if (uplink_connecting.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return;
+            }
+            uplink = uplink_connecting.get();
+            if (uplink != NULL) {
+                std::cout << "Linked to upstream relay " << uplink_address << " as relay " << relay.get_relay_id() << std::endl;
+                relay.AddLink(uplink);
+            }
+            next_uplink_attempt = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+        }
+        else if ((uplink == NULL) && (std::chrono::steady_clock::now() >= next_uplink_attempt)) {
+            std::string address = uplink_address;
+            int port = 0;
+            if (!MinNet::IsUnixAddress(address)) {
+                size_t colon = uplink_address.rfind(':');
+                address = uplink_address.substr(0, colon);
+                port = std::stoi(uplink_address.substr(colon + 1));
+            }
+            uplink_connecting = std::async(std::launch::async, [address, port]() {
+                return Connection::Connect(address, port);
+            });
+        }
+    };
+
+    // Each client's socket is watched by the reactor.  Since the reactor only reports new data, the relay reads
+    // until the socket has nothing more to give, and relays every event that completes before returning.  The
+    // socket is also watched for space to write while the client has events waiting that it could not take.
+    relay.set_connect_callback([&](Connection *client) {
+        reactor.Add(client->get_socket(), NetReactor::READABLE, [&relay, client](SOCKET, int events) {
+            if (events & NetReactor::WRITABLE) {
+                relay.WriteTo(client);
+            }
+            if (events & (NetReactor::READABLE | NetReactor::CLOSED)) {
+                relay.ReadFrom(client);
+            }
+        });
+    });
+    relay.set_writable_callback([&](Connection *client, bool waiting) {
+        reactor.Modify(client->get_socket(), waiting ? (NetReactor::READABLE | NetReactor::WRITABLE) : NetReactor::READABLE);
+    });
+    relay.set_disconnect_callback([&](Connection *client) {
+        if (client == uplink) {
+            std::cout << "Lost the link to upstream relay " << uplink_address << ", trying again in a second" << std::endl;
+            uplink = NULL;
+        }
+        std::cout << "Dropped connection from " << client->get_description();
+        const SendQueue *queue = client->get_send_queue();
+        if ((queue != NULL) && (queue->get_num_dropped() + queue->get_num_coalesced() > 0)) {
+            std::cout << " (" << queue->get_num_dropped() << " events dropped and " << queue->get_num_coalesced()
+                << " coalesced because it could not keep up)";
+        }
+        std::cout << std::endl;
+        reactor.Remove(client->get_socket());
+    });
+
+    auto add_listener = [&](SOCKET fd, bool links) {
+        // the reactor is edge-triggered, so listeners are drained with non-blocking accepts
+        TcpListener *listener = new TcpListener(fd);
+        if (links) {
+            relay.AddLinkListener(listener);
+        }
+        else {
+            relay.AddListener(listener);
+        }
+        reactor.Add(fd, NetReactor::READABLE, [&relay, listener](SOCKET, int) {
+            relay.AcceptFrom(listener);
+        });
+    };
+
+    // A new relay has connected to take over.  Everything queued so far is sent first, then each listener and
+    // client connection is passed on along with the relay's state for it and any partial event not yet read, and
+    // this relay quits.
+    NetReactor::Callback on_handover_ready = [&](SOCKET fd, int) {
+        SOCKET successor_fd;
+        if ((shutdown) || (!MinVR3Net::TryAcceptConnection(fd, &successor_fd))) {
+            return;
+        }
+        MinNet::SetNonBlocking(successor_fd, false);
+        relay.Flush(read_write_timeout_ms);
+        relay.RemoveDisconnected();
+        multicast.Flush();
+
+        const std::vector<Listener*> &listeners = relay.get_listeners();
+        const std::vector<Connection*> &clients = relay.get_connections();
+        bool ok = true;
+        int num_handed_over = 0;
+        for (int i=0; (ok) && (i<listeners.size()); i++) {
+            ok = MinNet::SendSocket(&successor_fd, listeners[i]->get_socket(),
+                                    relay.is_link_listener(listeners[i]) ? "link-listener" : "listener",
+                                    read_write_timeout_ms);
+        }
+        // with this relay's id, which the relays linked to it know it by
+        ok = ok && MinNet::SendSocket(&successor_fd, handover_fd, "handover\n" + relay.get_relay_id(),
+                                      read_write_timeout_ms);
+        for (int i=0; (ok) && (i<clients.size()); i++) {
+            // the new relay must start with an empty send queue, so wait for this one to go
+            if (!clients[i]->Flush(read_write_timeout_ms)) {
+                // it cannot be handed over, and this relay is about to go, so it is dropped now rather than left
+                // hanging until then
+                std::cerr << "Could not hand over " << clients[i]->get_description()
+                    << ", its events could not be sent, dropping it" << std::endl;
+                clients[i]->Close();
+                continue;
+            }
+            ok = MinNet::SendSocket(&successor_fd, clients[i]->get_socket(), "client-state\n" +
+                                    relay.GetConnectionState(clients[i]) + "\n" + clients[i]->get_buffered_input(),
+                                    read_write_timeout_ms);
+            num_handed_over += ok;
+        }
+        ok = ok && MinNet::SendSocket(&successor_fd, INVALID_SOCKET, "done", read_write_timeout_ms);
+        MinNet::CloseSocket(&successor_fd);
+        if (ok) {
+            std::cout << "Handed over " << listeners.size() << " listeners and " << num_handed_over
+                << " clients to the new relay" << std::endl;
+            shutdown = true;
+        }
+        else {
+            std::cerr << "Handover failed, carrying on" << std::endl;
+        }
+    };
+
+    if (!take_over_address.empty()) {
+        // receive the listeners and clients of the relay being replaced
+        SOCKET predecessor_fd;
+        if (!MinNet::ConnectTo(take_over_address, 0, &predecessor_fd)) {
+            exit(1);
+        }
+        SOCKET fd;
+        std::string info;
+        while (MinNet::ReceiveSocket(&predecessor_fd, &fd, &info, 5000) && (info != "done")) {
+            if (fd == INVALID_SOCKET) {
+                continue;
+            }
+            if ((info == "listener") || (info == "link-listener")) {
+                add_listener(fd, info == "link-listener");
+            }
+            else if (info.compare(0, 8, "handover") == 0) {
+                handover_fd = fd;
+                if ((info.size() > 9) && (relay_id.empty())) {
+                    relay.set_relay_id(info.substr(9));
                 }
             }
-            
-            // Remove any disconnected clients from the list
-            for (int i=0; i<disconnected_fds.size(); i++) {
-                auto it = std::find(client_fds.begin(), client_fds.end(), disconnected_fds[i]);
-                if (it != client_fds.end()) {
-                    int index = it - client_fds.begin();
-                    std::cout << "Dropped connection from " << client_descs[index] << std::endl;
-
-                    // officially close the socket
-                    MinVR3Net::CloseSocket(&disconnected_fds[i]);
-                    // remove the client from both lists
-                    client_fds.erase(client_fds.begin() + index);
-                    client_descs.erase(client_descs.begin() + index);
+            else if (info.compare(0, 13, "client-state\n") == 0) {
+                // the relay's state for the client, on one line, then whatever it had sent that was not read yet
+                size_t end = info.find('\n', 13);
+                if (end == std::string::npos) {
+                    end = info.size();
                 }
+                relay.AddConnection(new TcpConnection(fd, info.substr(std::min(end + 1, info.size()))),
+                                    info.substr(13, end - 13));
+            }
+            else if (info.compare(0, 7, "client\n") == 0) {
+                // from a relay that did not pass on its state
+                relay.AddConnection(new TcpConnection(fd, info.substr(7)));
+            }
+            else {
+                MinNet::CloseSocket(&fd);
             }
         }
-        else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+        MinNet::CloseSocket(&predecessor_fd);
+        if (info != "done") {
+            std::cerr << "Take over from " << take_over_address << " failed" << std::endl;
+            exit(1);
         }
+        std::cout << "Took over " << relay.get_listeners().size() << " listeners and " << relay.get_connections().size()
+            << " clients" << std::endl;
     }
-                
-    
-    MinVR3Net::CloseSocket(&listener_fd);
-    for (int i=0; i<client_fds.size(); i++) {
-        MinVR3Net::CloseSocket(&client_fds[i]);
+    else {
+        if (listen_addresses.empty()) {
+            listen_addresses.push_back(std::to_string(port));
+        }
+        for (int i=0; i<listen_addresses.size(); i++) {
+            SOCKET listener_fd;
+            if (!MinVR3Net::CreateListener(listen_addresses[i], &listener_fd)) {
+                exit(1);
+            }
+            add_listener(listener_fd, false);
+        }
+        for (int i=0; i<link_listen_addresses.size(); i++) {
+            SOCKET listener_fd;
+            if (!MinVR3Net::CreateListener(link_listen_addresses[i], &listener_fd)) {
+                exit(1);
+            }
+            add_listener(listener_fd, true);
+        }
+    }
+
+    if ((handover_fd == INVALID_SOCKET) && (!handover_address.empty())) {
+        if (!MinNet::CreateListener(handover_address, &handover_fd)) {
+            exit(1);
+        }
+    }
+    if (handover_fd != INVALID_SOCKET) {
+        MinNet::SetNonBlocking(handover_fd, true);
+        reactor.Add(handover_fd, NetReactor::READABLE, on_handover_ready);
+    }
+
+    while ((!shutdown) && (!relay.is_shutdown_requested())) {
+        // Sleep until there is work to do, then handle it; with multicast, wake up in time to send heartbeats, and
+        // without its uplink, to connect it
+        int timeout_ms = multicast.is_open() ? multicast.get_heartbeat_interval_ms() : -1;
+        if ((!uplink_address.empty()) && (uplink == NULL)) {
+            timeout_ms = (timeout_ms < 0) ? 100 : std::min(timeout_ms, 100);
+        }
+        if (reactor.RunOnce(timeout_ms) < 0) {
+            break;
+        }
+        if (!uplink_address.empty()) {
+            connect_uplink();
+        }
+        if (multicast.is_open()) {
+            multicast.Flush();
+            multicast.Poll();
+        }
+
+        // Send everything relayed during this pass (or as much as each client can take), then drop the clients
+        // that disconnected
+        relay.Flush(read_write_timeout_ms);
+        relay.RemoveDisconnected();
+    }
+
+    if (handover_fd != INVALID_SOCKET) {
+        MinVR3Net::CloseSocket(&handover_fd);
+    }
+    for (int i=0; i<relay.get_listeners().size(); i++) {
+        relay.get_listeners()[i]->Close();
+    }
+    for (int i=0; i<relay.get_connections().size(); i++) {
+        relay.get_connections()[i]->Close();
     }
     MinVR3Net::Shutdown();
     return 0;
@@ -4,6 +4,77 @@
 
 #include <minvr3.h>
 
+#include "sample_events.h"
+
+
+// Encodes each event with MsgPackCodec and decodes it again, including the edges of each MessagePack encoding (e.g.,
+// ints that just fit a fixint, strings of 32 bytes and more).  Returns the number that did not come back exactly
+// as they were sent.
+static int CheckMsgPack(const std::vector<VREvent*> &samples) {
+    std::vector<VREvent*> events(samples);
+    std::vector<VREvent*> edges;
+    int ints[] = { 0, 127, 128, -1, -32, -33, -128, -129, 255, 32767, -32768, 65536, 2147483647, -2147483647 - 1 };
+    for (int i=0; i<sizeof(ints) / sizeof(ints[0]); i++) {
+        edges.push_back(new VREventInt("Edge", ints[i]));
+    }
+    edges.push_back(new VREventFloat("Edge", 1.0e-30f));
+    edges.push_back(new VREventString("Edge", ""));
+    edges.push_back(new VREventString("Edge", std::string(31, 'a')));
+    edges.push_back(new VREventString("Edge", std::string(32, 'b')));
+    edges.push_back(new VREventString("Edge", std::string(300, 'c')));
+    edges.push_back(new VREventString("Edge", std::string(70000, 'd')));
+    edges.push_back(new VREventString("Edge", "caf\xc3\xa9 \"quoted\"\n"));
+    edges.push_back(new VREventVector3(std::string(40, 'n'), -1.0e10f, 3.0e-7f, 0.1f));
+    events.insert(events.end(), edges.begin(), edges.end());
+
+    int num_failed = 0;
+    for (int i=0; i<events.size(); i++) {
+        std::string frame;
+        VREvent *e = NULL;
+        if (MsgPackCodec::Encode(*events[i], &frame) && MsgPackCodec::IsMsgPack(frame)) {
+            e = MsgPackCodec::Decode(frame);
+        }
+        if ((e == NULL) || (e->ToJson() != events[i]->ToJson())) {
+            std::cout << "MessagePack round trip failed: " << events[i]->ToJson().substr(0, 100) << std::endl;
+            num_failed++;
+        }
+        delete e;
+    }
+    std::cout << "MessagePack: " << events.size() - num_failed << " of " << events.size()
+        << " events came back exactly as they were sent" << std::endl;
+    for (int i=0; i<edges.size(); i++) {
+        delete edges[i];
+    }
+    return num_failed;
+}
+
+
+// Encodes each event with every version of the dictionary protocol, the data as json text (version 1) and in the
+// binary layout (version 2 and later), and decodes it again.  Returns the number that did not come back exactly as
+// they were sent.
+static int CheckDictionary(const std::vector<VREvent*> &samples) {
+    int num_failed = 0;
+    for (int version=1; version<=EventDictionary::PROTOCOL_VERSION; version++) {
+        for (int i=0; i<samples.size(); i++) {
+            EventDictionary sender, receiver;
+            std::string definition, compact;
+            sender.Encode(*samples[i], version, &definition, &compact);
+            delete receiver.ReadVREvent(definition);
+            VREvent *e = receiver.ReadVREvent(compact);
+            if ((e == NULL) || (e->ToJson() != samples[i]->ToJson())) {
+                std::cout << "Dictionary version " << version << " round trip failed: " << samples[i]->ToJson();
+                num_failed++;
+            }
+            delete e;
+        }
+    }
+    std::cout << "Dictionary: " << EventDictionary::PROTOCOL_VERSION * samples.size() - num_failed << " of "
+        << EventDictionary::PROTOCOL_VERSION * samples.size() << " events came back exactly as they were sent"
+        << std::endl;
+    return num_failed;
+}
+
+
 int main(int argc, char* argv[])
 {
     VREventFloat e1("example_float", 5.0f);
@@ -21,6 +92,12 @@ int main(int argc, char* argv[])
     VREvent *e4 = VREvent::CreateFromJson(json2);
     std::cout << "From Json: " << *e4 << std::endl << std::endl;
     delete e4;
+
+    std::vector<VREvent*> samples = MakeSampleEvents();
+    int num_failed = CheckDictionary(samples) + CheckMsgPack(samples);
+    for (int i=0; i<samples.size(); i++) {
+        delete samples[i];
+    }
     
-    return 0;
+    return (num_failed == 0) ? 0 : 1;
 }
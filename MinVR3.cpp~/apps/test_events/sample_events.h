@@ -0,0 +1,27 @@
+/** One event of each built-in type, with typical names and data, for test_events' round-trip checks and for
+ minvr3_bench, which times each type's encodings with them.
+*/
+
+#ifndef MINVR3_SAMPLE_EVENTS_H
+#define MINVR3_SAMPLE_EVENTS_H
+
+#include <vector>
+
+#include <minvr3.h>
+
+
+// The caller deletes the events.
+inline std::vector<VREvent*> MakeSampleEvents() {
+    std::vector<VREvent*> samples;
+    samples.push_back(new VREvent("Wand/Trigger/Down"));
+    samples.push_back(new VREventInt("Wand/Joystick/Clicks", 42));
+    samples.push_back(new VREventFloat("Wand/Trigger/Value", 0.8125f));
+    samples.push_back(new VREventVector2("Wand/Joystick/Position", 0.25f, -0.5f));
+    samples.push_back(new VREventVector3("Tracker/RightHand/Position", 1.25f, 1.5f, -0.75f));
+    samples.push_back(new VREventVector4("Display/Viewport", 0.0f, 0.0f, 1920.0f, 1080.0f));
+    samples.push_back(new VREventQuaternion("Tracker/RightHand/Rotation", 0.0f, 0.7071068f, 0.0f, 0.7071068f));
+    samples.push_back(new VREventString("Speech/Command", "show the menu"));
+    return samples;
+}
+
+#endif
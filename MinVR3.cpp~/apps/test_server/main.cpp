@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <thread>
@@ -0,0 +1,232 @@
+#include "async_client.h"
+
+#include "min_net.h"
+
+#include <deque>
+#include <iostream>
+
+#ifdef WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+
+AsyncClient::AsyncClient(int queue_capacity) :
+    connection_(NULL), wake_read_fd_(INVALID_SOCKET), wake_write_fd_(INVALID_SOCKET),
+    outbound_(queue_capacity), inbound_(queue_capacity), running_(false), connected_(false), io_sleeping_(false),
+    num_sent_(0), num_received_(0), close_timeout_ms_(0)
+{
+}
+
+
+AsyncClient::~AsyncClient() {
+    Close();
+}
+
+
+bool AsyncClient::Connect(const std::string &address, int port) {
+    Connection *connection = Connection::Connect(address, port);
+    if (connection == NULL) {
+        return false;
+    }
+    return Start(connection);
+}
+
+
+bool AsyncClient::Start(Connection *connection) {
+    if (connection_ != NULL) {
+        std::cerr << "AsyncClient::Start() Error: Already connected." << std::endl;
+        delete connection;
+        return false;
+    }
+    if (connection->get_socket() == INVALID_SOCKET) {
+        std::cerr << "AsyncClient::Start() Error: " << connection->get_description() << " has no socket to wait on." << std::endl;
+        delete connection;
+        return false;
+    }
+    if (!MinNet::CreateSocketPair(&wake_read_fd_, &wake_write_fd_)) {
+        delete connection;
+        return false;
+    }
+    connection_ = connection;
+    running_ = true;
+    connected_ = true;
+    thread_ = std::thread(&AsyncClient::Run, this);
+    return true;
+}
+
+
+void AsyncClient::Close(double timeout_ms) {
+    if (connection_ == NULL) {
+        return;
+    }
+    close_timeout_ms_ = timeout_ms;
+    running_ = false;
+    char c = 1;
+    send(wake_write_fd_, &c, 1, 0);
+    thread_.join();
+
+    delete connection_;
+    connection_ = NULL;
+    connected_ = false;
+    VREvent *e;
+    while (inbound_.TryPop(&e)) {
+        delete e;
+    }
+    std::string s;
+    while (outbound_.TryPop(&s)) {
+    }
+    MinNet::CloseSocket(&wake_read_fd_);
+    MinNet::CloseSocket(&wake_write_fd_);
+    wake_read_fd_ = INVALID_SOCKET;
+    wake_write_fd_ = INVALID_SOCKET;
+}
+
+
+bool AsyncClient::SendString(const std::string &s) {
+    if ((!connected_) || (!outbound_.TryPush(s))) {
+        return false;
+    }
+    Wake();
+    return true;
+}
+
+
+bool AsyncClient::SendVREvent(const VREvent &e) {
+    return SendString(e.ToJson());
+}
+
+
+void AsyncClient::Wake() {
+    // pairs with the fence in Run(): either the I/O thread sees the new event before it sleeps, or this sees
+    // that it is asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (io_sleeping_.exchange(false)) {
+        char c = 1;
+        send(wake_write_fd_, &c, 1, 0);
+    }
+}
+
+
+VREvent* AsyncClient::TryReceiveVREvent() {
+    VREvent *e;
+    return inbound_.TryPop(&e) ? e : NULL;
+}
+
+
+bool AsyncClient::ReceiveAvailableVREvents(std::vector<VREvent*> *events) {
+    // read first: once the I/O thread has said it is disconnected, it has nothing more to push
+    bool was_connected = connected_;
+    VREvent *e;
+    while (inbound_.TryPop(&e)) {
+        events->push_back(e);
+    }
+    return was_connected || !inbound_.is_empty();
+}
+
+
+bool AsyncClient::is_connected() const {
+    return connected_;
+}
+
+
+uint64_t AsyncClient::get_num_sent() const {
+    return num_sent_;
+}
+
+
+uint64_t AsyncClient::get_num_received() const {
+    return num_received_;
+}
+
+
+void AsyncClient::Run() {
+    FrameBatch frames;                  // reused, so receiving does not allocate beyond the events themselves
+    std::deque<VREvent*> backlog;       // received, but the inbound queue was full
+    std::string s;
+    bool flush_pending = false;
+    bool closed = false;
+    while (true) {
+        bool stopping = !running_;
+
+        // send everything the program has queued, as far as the socket will take it
+        if (!closed) {
+            int n_queued = 0;
+            while (outbound_.TryPop(&s)) {
+                connection_->QueueString(s);
+                n_queued++;
+            }
+            if ((n_queued > 0) || (flush_pending)) {
+                Connection::FlushResult r = stopping ? (connection_->Flush(close_timeout_ms_) ? Connection::FLUSH_DONE :
+                                                        Connection::FLUSH_ERROR) : connection_->TryFlush();
+                num_sent_ += n_queued;
+                flush_pending = (r == Connection::FLUSH_PENDING);
+                closed = (r == Connection::FLUSH_ERROR);
+            }
+        }
+        if (stopping) {
+            break;
+        }
+
+        // hand over what is received, oldest first; while the program is behind, stop reading and leave the
+        // rest in the socket so the sender is slowed down instead
+        while ((!backlog.empty()) && (inbound_.TryPush(backlog.front()))) {
+            backlog.pop_front();
+            num_received_++;
+        }
+        if ((backlog.empty()) && (!closed)) {
+            frames.Clear();
+            if (!connection_->ReceiveAvailableFrames(&frames)) {
+                closed = true;
+            }
+            for (int i=0; i<frames.get_num_frames(); i++) {
+                VREvent *e = VREvent::CreateFromJson(frames.get_frame(i));
+                if (e == NULL) {
+                    continue;
+                }
+                if ((backlog.empty()) && (inbound_.TryPush(e))) {
+                    num_received_++;
+                }
+                else {
+                    backlog.push_back(e);
+                }
+            }
+        }
+        if ((closed) && (backlog.empty())) {
+            // everything received has been handed over, the program can now find out
+            connected_ = false;
+        }
+
+        // sleep until there is something to do
+        struct pollfd p[2];
+        int n_fds = 1;
+        p[0].fd = wake_read_fd_;
+        p[0].events = POLLIN;
+        p[0].revents = 0;
+        if (!closed) {
+            p[1].fd = connection_->get_socket();
+            p[1].events = (backlog.empty() ? POLLIN : 0) | (flush_pending ? POLLOUT : 0);
+            p[1].revents = 0;
+            n_fds = 2;
+        }
+        io_sleeping_ = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if ((!outbound_.is_empty()) || (!running_)) {
+            io_sleeping_ = false;
+            continue;
+        }
+        // with a backlog, check back often for room in the inbound queue
+        poll(p, n_fds, backlog.empty() ? -1 : 1);
+        io_sleeping_ = false;
+        char buf[64];
+        while (recv(wake_read_fd_, buf, sizeof(buf), 0) > 0) {
+        }
+    }
+
+    for (int i=0; i<backlog.size(); i++) {
+        delete backlog[i];
+    }
+    connected_ = false;
+}
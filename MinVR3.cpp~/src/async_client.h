@@ -0,0 +1,104 @@
+/**
+  Client connection for render and simulation loops that must not wait on the network.  The socket belongs to
+  a background I/O thread, which does all of the sending, receiving, and parsing, and hands events to and from
+  the program through SpscQueues.  Receiving in the frame loop is then just popping already-parsed events off a
+  queue, with no system calls and no locks, so network jitter never lands on frame time.
+
+  Sending pushes the event's json onto the outbound queue.  The I/O thread only needs waking (one small write
+  to a socket pair) when it is asleep with nothing else to do; a stream of sends to a busy thread costs no
+  system calls on the program's side either.
+
+  If the program falls behind, the inbound queue fills up and the I/O thread stops reading, so TCP flow control
+  slows the sender down rather than events being lost.  If the I/O thread falls behind, SendVREvent() returns
+  false once the outbound queue is full.
+
+  Each queue has one producer and one consumer, so one program thread sends and one receives (usually the
+  same one).
+
+  ```
+  AsyncClient client;
+  client.Connect("localhost", 9034);
+  while (running) {
+      std::vector<VREvent*> events;
+      client.ReceiveAvailableVREvents(&events);
+      for (int i=0; i<events.size(); i++) {
+          ...
+          delete events[i];
+      }
+      client.SendVREvent(VREventVector3("Tracker/Head/Position", x, y, z));
+      Render();
+  }
+  ```
+ */
+
+#ifndef MINVR3_ASYNC_CLIENT_H
+#define MINVR3_ASYNC_CLIENT_H
+
+#include "connection.h"
+#include "spsc_queue.h"
+#include "vr_event.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+class AsyncClient {
+public:
+    /// queue_capacity is the number of events each of the inbound and outbound queues can hold.
+    AsyncClient(int queue_capacity=4096);
+
+    /// Closes the connection if it is still open.
+    virtual ~AsyncClient();
+
+    /// Connects to a relay, as Connection::Connect() does (so TCP and unix domain sockets both work), and starts
+    /// the I/O thread.
+    bool Connect(const std::string &address, int port=0);
+
+    /// Takes ownership of a connection that is already open and starts the I/O thread.  The connection must
+    /// have a socket (e.g., a TcpConnection).
+    bool Start(Connection *connection);
+
+    /// Stops the I/O thread, after it has sent what was queued (waiting up to timeout_ms, 0 for no limit), and
+    /// closes the connection.  Events not yet received are deleted.
+    void Close(double timeout_ms=500);
+
+    /// Queue an event or any other string for the I/O thread to send.  Returns false if the outbound queue is
+    /// full or the connection has closed.
+    bool SendString(const std::string &s);
+    bool SendVREvent(const VREvent &e);
+
+    /// Returns the next event received, or NULL if none is waiting.  Never waits.  The caller deletes it.
+    VREvent* TryReceiveVREvent();
+
+    /// Appends every event that is waiting to events, without waiting.  Returns false once the connection has
+    /// closed and every event received before that has been taken.
+    bool ReceiveAvailableVREvents(std::vector<VREvent*> *events);
+
+    /// False once the I/O thread has found the connection closed (or Close() has been called).  Events received
+    /// before then may still be waiting.
+    bool is_connected() const;
+
+    uint64_t get_num_sent() const;
+    uint64_t get_num_received() const;
+
+private:
+    void Run();
+    void Wake();
+
+    Connection *connection_;
+    std::thread thread_;
+    SOCKET wake_read_fd_;
+    SOCKET wake_write_fd_;
+    SpscQueue<std::string> outbound_;
+    SpscQueue<VREvent*> inbound_;
+    std::atomic<bool> running_;
+    std::atomic<bool> connected_;
+    std::atomic<bool> io_sleeping_;     // the I/O thread is (about to be) in poll() and needs a wake-up to send
+    std::atomic<uint64_t> num_sent_;
+    std::atomic<uint64_t> num_received_;
+    double close_timeout_ms_;
+};
+
+#endif
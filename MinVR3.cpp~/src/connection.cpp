@@ -0,0 +1,246 @@
+#include "connection.h"
+
+#include "memory_connection.h"
+#include "tcp_connection.h"
+
+#include <algorithm>
+
+
+static bool IsMemoryAddress(const std::string &address) {
+    return address.compare(0, 4, "mem:") == 0;
+}
+
+
+Connection::Connection() : dictionary_offered_(0), dictionary_version_(0), event_format_(JSON_FORMAT) {
+}
+
+
+Connection* Connection::Connect(const std::string &address, int port) {
+    if (IsMemoryAddress(address)) {
+        return MemoryListener::Connect(address.substr(4));
+    }
+    return TcpConnection::Connect(address, port);
+}
+
+
+Connection::~Connection() {
+}
+
+
+void Connection::QueueFrame(const OutboundFramePtr &frame) {
+    QueueString(frame->body, frame->key);
+}
+
+
+Connection::FlushResult Connection::TryFlush() {
+    return Flush() ? FLUSH_DONE : FLUSH_ERROR;
+}
+
+
+// a transport that never waits has no output buffer to bound
+void Connection::set_send_limit(int64_t, SendQueue::OverflowPolicy) {
+}
+
+
+// nothing waits in a queue behind a large frame if the transport never waits
+void Connection::set_fragment_size(int) {
+}
+
+
+// a transport without a FrameDecoder never sees fragments
+void Connection::set_receive_fragments(bool) {
+}
+
+
+const SendQueue* Connection::get_send_queue() const {
+    return NULL;
+}
+
+
+SOCKET Connection::get_socket() const {
+    return INVALID_SOCKET;
+}
+
+
+std::string Connection::get_buffered_input() const {
+    return "";
+}
+
+
+bool Connection::SendVREvent(const VREvent &e, double timeout_ms) {
+    if ((dictionary_version_ == 0) || (!dictionary_.Encode(e, dictionary_version_, &definition_, &compact_))) {
+        if ((event_format_ == MSGPACK_FORMAT) && (MsgPackCodec::Encode(e, &compact_))) {
+            return SendString(compact_, timeout_ms);
+        }
+        return SendString(e.ToJson(), timeout_ms);
+    }
+    if (!definition_.empty()) {
+        // later events cannot be read without it, so it is never dropped to make room
+        QueueFrame(std::make_shared<const OutboundFrame>(definition_, "", false, "", true));
+    }
+    return SendString(compact_, timeout_ms);
+}
+
+
+void Connection::QueueVREvent(const VREvent &e) {
+    if ((dictionary_version_ == 0) || (!dictionary_.Encode(e, dictionary_version_, &definition_, &compact_))) {
+        if ((event_format_ == MSGPACK_FORMAT) && (MsgPackCodec::Encode(e, &compact_))) {
+            QueueString(compact_, e.get_name());
+            return;
+        }
+        QueueString(e.ToJson(), e.get_name());
+        return;
+    }
+    if (!definition_.empty()) {
+        QueueFrame(std::make_shared<const OutboundFrame>(definition_, "", false, "", true));
+    }
+    QueueString(compact_, e.get_name());
+}
+
+
+void Connection::set_event_format(EventFormat format) {
+    event_format_ = format;
+}
+
+
+Connection::EventFormat Connection::get_event_format() const {
+    return event_format_;
+}
+
+
+bool Connection::RequestEventFormat(EventFormat format, double timeout_ms) {
+    return SendVREvent(VREventString("RelayEventFormat", EventFormatToString(format)), timeout_ms);
+}
+
+
+std::string Connection::EventFormatToString(EventFormat format) {
+    return (format == MSGPACK_FORMAT) ? "msgpack" : "json";
+}
+
+
+bool Connection::EventFormatFromString(const std::string &s, EventFormat *format) {
+    if (s == "json") {
+        *format = JSON_FORMAT;
+    }
+    else if (s == "msgpack") {
+        *format = MSGPACK_FORMAT;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+
+bool Connection::Subscribe(const std::string &pattern, double timeout_ms) {
+    return SendVREvent(VREventString("RelaySubscribe", pattern), timeout_ms);
+}
+
+
+bool Connection::Unsubscribe(const std::string &pattern, double timeout_ms) {
+    return SendVREvent(VREventString("RelayUnsubscribe", pattern), timeout_ms);
+}
+
+
+bool Connection::OfferEventDictionary(double timeout_ms, int max_version) {
+    dictionary_offered_ = max_version;
+    return SendVREvent(VREventInt("EventDictionaryOffer", max_version), timeout_ms);
+}
+
+
+bool Connection::is_event_dictionary_accepted() const {
+    return dictionary_version_ > 0;
+}
+
+
+int Connection::get_protocol_version() const {
+    return dictionary_version_;
+}
+
+
+VREvent* Connection::ReadVREvent(const std::string &frame) {
+    if (EventDictionary::GetFrameType(frame) != EventDictionary::JSON_FRAME) {
+        return dictionary_.ReadVREvent(frame);
+    }
+    VREvent *e = MsgPackCodec::IsMsgPack(frame) ? MsgPackCodec::Decode(frame) : VREvent::CreateFromJson(frame);
+    if ((e != NULL) && (dictionary_offered_ > 0) && (e->get_name() == "EventDictionaryAccept")) {
+        VREventInt *accept = dynamic_cast<VREventInt*>(e);
+        // never more than was offered
+        if ((accept != NULL) && (accept->get_data() > 0)) {
+            dictionary_version_ = std::min(accept->get_data(), dictionary_offered_);
+            if (dictionary_version_ >= EventDictionary::FRAGMENTS_VERSION) {
+                set_fragment_size(SendQueue::DEFAULT_FRAGMENT_SIZE);
+                set_receive_fragments(true);
+            }
+        }
+        delete e;
+        return NULL;
+    }
+    return e;
+}
+
+
+VREvent* Connection::ReceiveVREvent(double timeout_ms) {
+    std::string frame;
+    while (ReceiveString(&frame, timeout_ms)) {
+        VREvent *e = ReadVREvent(frame);
+        if (e != NULL) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+
+bool Connection::ReceiveAvailableFrames(FrameBatch *frames) {
+    std::vector<std::string> strings;
+    bool ok = ReceiveAvailableStrings(&strings);
+    for (int i=0; i<strings.size(); i++) {
+        frames->Append(strings[i].data(), (int)strings[i].size());
+    }
+    return ok;
+}
+
+
+// a transport without a FrameDecoder never reads a length it has to trust
+void Connection::set_max_frame_size(uint32_t) {
+}
+
+
+bool Connection::ReceiveAvailableVREvents(std::vector<VREvent*> *events) {
+    std::vector<std::string> frames;
+    bool ok = ReceiveAvailableStrings(&frames);
+    for (int i=0; i<frames.size(); i++) {
+        VREvent *e = ReadVREvent(frames[i]);
+        if (e != NULL) {
+            events->push_back(e);
+        }
+    }
+    return ok;
+}
+
+
+Listener* Listener::Create(const std::string &address) {
+    if (IsMemoryAddress(address)) {
+        MemoryListener *listener = new MemoryListener();
+        if (!listener->Open(address.substr(4))) {
+            delete listener;
+            return NULL;
+        }
+        return listener;
+    }
+    SOCKET fd;
+    if (!MinNet::CreateListener(address, &fd)) {
+        return NULL;
+    }
+    return new TcpListener(fd);
+}
+
+
+Listener::~Listener() {
+}
+
+
+SOCKET Listener::get_socket() const {
+    return INVALID_SOCKET;
+}
@@ -0,0 +1,224 @@
+/**
+  Transport-independent connections for VREvent streams.  Connection is a framed, bidirectional message stream
+  and Listener accepts new connections; the relay (see EventRelay) and clients program against these
+  interfaces, so a new transport only has to implement them to work with everything else.
+
+  Two transports are included:
+  - TcpConnection/TcpListener wrap MinNet sockets, so they cover TCP and unix domain sockets and speak the same
+    length-prefixed JSON as every other MinVR3 program.
+  - MemoryConnection/MemoryListener pass frames between threads of the same process through in-memory queues,
+    without the kernel.  They are useful for tests, for running a relay inside an application, and for
+    measuring the cost of the relay itself separately from the cost of the sockets.
+
+  The transport is chosen by the address:
+  ```
+  Listener *listener = Listener::Create("9034");             // or "unix:/tmp/relay.sock", or "mem:relay"
+  Connection *c = Connection::Connect("127.0.0.1", 9034);    // or Connect("mem:relay")
+  c->SendVREvent(VREventVector3("Tracker/Head/Position", x, y, z));
+  VREvent *e = c->ReceiveVREvent();
+  delete c;
+  ```
+
+  For steady streams of the same events, e.g., from a tracker, OfferEventDictionary() asks the other end to
+  stop sending each event's name and data type in every frame and, with protocol version 2, to send the data in
+  a fixed binary layout rather than json (see EventDictionary).  Once the other end has accepted, SendVREvent()
+  and QueueVREvent() send the short form, and ReceiveVREvent() and ReceiveAvailableVREvents() read it;
+  ReceiveString() and the other frame-level calls return frames exactly as they arrive, so a program that uses
+  a dictionary should receive events rather than strings.  With protocol version 3, large events are also sent
+  in fragments (see set_fragment_size()), so a program that queues a large event with QueueVREvent() and then
+  keeps calling TryFlush() can send tracker events alongside it; SendVREvent() still waits until the whole
+  event has gone.
+
+  Events can also be sent as MessagePack rather than json, with set_event_format() (see MsgPackCodec), e.g., to
+  save a peer that reads MessagePack natively from parsing json, and RequestEventFormat() asks a relay to send
+  this connection MessagePack too.  Received events are read in either format, whatever the setting.
+
+  As with MinNet, timeout_ms == 0 means wait forever.
+ */
+
+#ifndef MINVR3_CONNECTION_H
+#define MINVR3_CONNECTION_H
+
+#include "event_dictionary.h"
+#include "frame_decoder.h"
+#include "msgpack_codec.h"
+#include "net_headers.h"
+#include "send_queue.h"
+#include "vr_event.h"
+
+#include <string>
+#include <vector>
+
+
+class Connection {
+public:
+    enum FlushResult {
+        FLUSH_DONE,         // everything queued has been sent
+        FLUSH_PENDING,      // the rest can go once get_socket() is writable, call TryFlush() again then
+        FLUSH_ERROR         // the connection is broken, or its send queue overflowed with OVERFLOW_DISCONNECT
+    };
+
+    enum EventFormat {
+        JSON_FORMAT,        // VREvent::ToJson(), what every MinVR3 program reads
+        MSGPACK_FORMAT      // MsgPackCodec
+    };
+
+    Connection();
+
+    /// Connects to address, which is "mem:name" for a MemoryListener in this process, or anything
+    /// MinNet::ConnectTo() accepts (an ip or host name together with port, or a unix: address).  Returns NULL
+    /// on failure.  The caller owns the connection.
+    static Connection* Connect(const std::string &address, int port=0);
+
+    /// Closes the connection if it is still open.
+    virtual ~Connection();
+
+    /// Sends s as a single frame, after anything already queued.
+    virtual bool SendString(const std::string &s, double timeout_ms=0) = 0;
+
+    /// Adds s to the connection's output buffer.  Nothing is sent until Flush() or TryFlush(), so frames queued
+    /// together leave together.  key identifies frames that may replace each other if the output buffer is
+    /// bounded with OVERFLOW_COALESCE, see set_send_limit().
+    virtual void QueueString(const std::string &s, const std::string &key="") = 0;
+
+    /// Same as QueueString(), for a frame that is shared with other connections.  Transports with a SendQueue
+    /// keep a reference rather than a copy; the default implementation copies.
+    virtual void QueueFrame(const OutboundFramePtr &frame);
+
+    /// Sends everything queued, waiting for the receiver if necessary.  After a failure the connection should
+    /// be considered broken.
+    virtual bool Flush(double timeout_ms=0) = 0;
+
+    /// Non-blocking alternative to Flush(): sends as much as can go without waiting and keeps the rest queued.
+    /// The default implementation is for transports that never wait, and just calls Flush().
+    virtual FlushResult TryFlush();
+
+    /// Bounds the output buffer, so a receiver that cannot keep up with TryFlush() costs at most max_bytes (0 for
+    /// no limit), with policy deciding what happens to frames that do not fit (see SendQueue).  Ignored by
+    /// transports that never wait.
+    virtual void set_send_limit(int64_t max_bytes, SendQueue::OverflowPolicy policy);
+
+    /// Frames larger than max_bytes are sent in fragments, and smaller frames go out between them (see SendQueue),
+    /// which the other end has to be able to put back together; this is turned on for it once it has accepted
+    /// protocol version 3 or later (see OfferEventDictionary()).  Ignored by transports that never wait, which
+    /// have no queue for a small frame to get stuck in.
+    virtual void set_fragment_size(int max_bytes);
+
+    /// Frames the other end sent in fragments are put back together (see FrameDecoder).  Off until it has agreed
+    /// to protocol version 3 or later, so nothing else can make the connection hold a frame's worth of fragments.
+    /// Ignored by transports that do not decode a byte stream.
+    virtual void set_receive_fragments(bool receive);
+
+    /// The connection's output buffer, e.g., for its counters, or NULL for transports that do not use one.
+    virtual const SendQueue* get_send_queue() const;
+
+    /// Waits for the next frame.  Returns false on timeout or if the connection was closed.
+    virtual bool ReceiveString(std::string *s, double timeout_ms=0) = 0;
+
+    /// Appends every frame that has arrived to frames, without waiting.  Returns false if the connection was
+    /// closed or broken; frames that arrived before that are still appended.
+    virtual bool ReceiveAvailableStrings(std::vector<std::string> *frames) = 0;
+
+    /// Same, into a batch that the caller keeps from call to call (it is not cleared first), so the frames reuse
+    /// the batch's storage.  TcpConnection makes no heap allocations here once the batch has grown to fit; the
+    /// default implementation goes through ReceiveAvailableStrings().
+    virtual bool ReceiveAvailableFrames(FrameBatch *frames);
+
+    /// Frames longer than max_bytes are refused before anything is allocated for them, and break the connection
+    /// (the default is MinNet::get_max_frame_size()).  Ignored by transports that do not decode a byte stream.
+    virtual void set_max_frame_size(uint32_t max_bytes);
+
+    /// True if a frame (or the news that the connection has closed) is waiting.
+    virtual bool IsReadyToRead() = 0;
+
+    virtual void Close() = 0;
+    virtual bool is_open() const = 0;
+
+    /// The socket behind the connection, e.g., to add to a NetReactor, or INVALID_SOCKET for transports that
+    /// do not have one, which must be polled instead.
+    virtual SOCKET get_socket() const;
+
+    /// Bytes received but not yet returned as part of a frame, e.g., to hand the connection to another process.
+    virtual std::string get_buffered_input() const;
+
+    /// Human-readable description of the other end, for log messages.
+    virtual std::string get_description() const = 0;
+
+    bool SendVREvent(const VREvent &e, double timeout_ms=0);
+    void QueueVREvent(const VREvent &e);
+
+    /// The format SendVREvent() and QueueVREvent() send events in, json by default.  Once an event dictionary
+    /// has been accepted, the dictionary's short form is sent instead.
+    void set_event_format(EventFormat format);
+    EventFormat get_event_format() const;
+
+    /// Asks the relay on the other end to send this connection events in format from now on (see EventRelay).
+    bool RequestEventFormat(EventFormat format, double timeout_ms=0);
+
+    /// "json" or "msgpack", as in the "RelayEventFormat" control event.
+    static std::string EventFormatToString(EventFormat format);
+    static bool EventFormatFromString(const std::string &s, EventFormat *format);
+
+    /// Asks the relay on the other end to send this connection only events whose names match pattern (an exact
+    /// name, or with * and ? wildcards), in addition to any earlier subscriptions.  Until the first subscription,
+    /// the relay sends everything.  See EventRelay.
+    bool Subscribe(const std::string &pattern, double timeout_ms=0);
+    bool Unsubscribe(const std::string &pattern, double timeout_ms=0);
+
+    /// Tells the other end that this connection can read events sent with an EventDictionary, with protocol
+    /// versions up to max_version, and asks it to accept the ones this connection sends.  Best sent right after
+    /// connecting.  The answer is noticed by ReceiveVREvent() and ReceiveAvailableVREvents(), so a client that
+    /// only sends should still receive now and then; until then, and for good if the other end does not know
+    /// about dictionaries, events are sent as json.
+    bool OfferEventDictionary(double timeout_ms=0, int max_version=EventDictionary::PROTOCOL_VERSION);
+
+    /// True once the other end has accepted the offer, and events are sent with the dictionary.
+    bool is_event_dictionary_accepted() const;
+
+    /// The protocol version the other end accepted, or 0 before then (i.e., json).
+    int get_protocol_version() const;
+
+    /// Waits for the next event.  Frames that do not hold a valid event are skipped.  Returns NULL on timeout
+    /// or if the connection was closed.  The caller owns the event.
+    VREvent* ReceiveVREvent(double timeout_ms=0);
+
+    /// Appends every event that has arrived to events, without waiting.  The caller owns the events.  Returns
+    /// false if the connection was closed or broken.
+    bool ReceiveAvailableVREvents(std::vector<VREvent*> *events);
+
+private:
+    /// The event in a frame, or NULL for a frame that is not one, including the dictionary's own.
+    VREvent* ReadVREvent(const std::string &frame);
+
+    EventDictionary dictionary_;
+    int dictionary_offered_;        // the version offered
+    int dictionary_version_;        // and accepted
+    EventFormat event_format_;
+
+    // reused between calls
+    std::string definition_, compact_;
+};
+
+
+class Listener {
+public:
+    /// Starts listening on address, which is "mem:name" for in-process connections, a port number, or a unix:
+    /// address (see MinNet::CreateListener()).  Returns NULL on failure.  The caller owns the listener.
+    static Listener* Create(const std::string &address);
+
+    virtual ~Listener();
+
+    /// Returns the next connection waiting to be accepted, or NULL if there is none.  Never waits.  The caller
+    /// owns the connection.
+    virtual Connection* TryAccept() = 0;
+
+    virtual void Close() = 0;
+    virtual bool is_open() const = 0;
+
+    /// The listening socket, or INVALID_SOCKET for transports that do not have one.
+    virtual SOCKET get_socket() const;
+
+    virtual std::string get_description() const = 0;
+};
+
+#endif
@@ -0,0 +1,380 @@
+#include "coro_connection.h"
+
+#include "min_net.h"
+
+#include <algorithm>
+
+
+struct CoroReactor::Detached {
+    struct promise_type {
+        Detached get_return_object() { return Detached(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+
+CoroReactor::CoroReactor() : num_tasks_(0), stopped_(false) {
+}
+
+
+CoroReactor::~CoroReactor() {
+}
+
+
+CoroReactor::Detached CoroReactor::RunDetached(CoroReactor *reactor, CoroTask<void> task) {
+    co_await task;
+    reactor->num_tasks_--;
+}
+
+
+void CoroReactor::Spawn(CoroTask<void> task) {
+    num_tasks_++;
+    // runs until the task first waits for something
+    RunDetached(this, std::move(task));
+}
+
+
+void CoroReactor::Post(std::coroutine_handle<> h) {
+    posted_.push_back(h);
+}
+
+
+bool CoroReactor::RunOnce(int timeout_ms) {
+    resuming_.swap(posted_);
+    for (int i=0; i<resuming_.size(); i++) {
+        resuming_[i].resume();
+    }
+    resuming_.clear();
+
+    bool ok = true;
+    if ((reactor_.get_num_sockets() > 0) || (!posted_.empty())) {
+        ok = (reactor_.RunOnce(posted_.empty() ? timeout_ms : 0) >= 0);
+    }
+
+    // everything sent during the pass goes out together, one write per connection
+    for (int i=0; i<pending_writes_.size(); i++) {
+        pending_writes_[i]->write_scheduled_ = false;
+        pending_writes_[i]->WriteQueued();
+    }
+    pending_writes_.clear();
+    return ok;
+}
+
+
+void CoroReactor::Run() {
+    stopped_ = false;
+    while ((!stopped_) && (num_tasks_ > 0)) {
+        if (!RunOnce(-1)) {
+            break;
+        }
+    }
+}
+
+
+void CoroReactor::Stop() {
+    stopped_ = true;
+}
+
+
+int CoroReactor::get_num_tasks() const {
+    return num_tasks_;
+}
+
+
+NetReactor* CoroReactor::get_net_reactor() {
+    return &reactor_;
+}
+
+
+
+CoroConnection::CoroConnection(CoroReactor *reactor, SOCKET socket_fd, const std::string &buffered_input) :
+    reactor_(reactor), fd_(socket_fd), send_buffer_limit_(262144), ready_(0), interest_(0),
+    write_scheduled_(false), failed_(false)
+{
+    if (!buffered_input.empty()) {
+        decoder_.Append((const uint8_t*)buffered_input.data(), (int)buffered_input.size());
+    }
+    description_ = MinNet::GetAddressAndPort(fd_);
+    MinNet::SetNonBlocking(fd_, true);
+    // edge-triggered readiness is only reported once, so with epoll the socket is watched for both all along
+    // and the flags remember what was reported; with poll() only what a coroutine is waiting for is watched
+    interest_ = reactor_->reactor_.is_edge_triggered() ? (NetReactor::READABLE | NetReactor::WRITABLE) : 0;
+    reactor_->reactor_.Add(fd_, interest_, [this](SOCKET, int events) {
+        OnReady(events);
+    });
+}
+
+
+CoroConnection::~CoroConnection() {
+    Close();
+    if (write_scheduled_) {
+        std::vector<CoroConnection*> &pending = reactor_->pending_writes_;
+        pending.erase(std::remove(pending.begin(), pending.end(), this), pending.end());
+    }
+}
+
+
+bool CoroConnection::ReadyAwaiter::await_ready() const noexcept {
+    return ((connection->ready_ & event) != 0) || (connection->fd_ == INVALID_SOCKET);
+}
+
+
+void CoroConnection::ReadyAwaiter::await_suspend(std::coroutine_handle<> h) noexcept {
+    if (event == NetReactor::READABLE) {
+        connection->reader_ = h;
+    }
+    else {
+        connection->writer_ = h;
+    }
+    connection->UpdateInterest();
+}
+
+
+void CoroConnection::ReadyAwaiter::await_resume() noexcept {
+    // a flag left over from before the last attempt costs at most one more attempt, which clears it
+    connection->ready_ &= ~event;
+}
+
+
+CoroConnection::ReadyAwaiter CoroConnection::WaitFor(int event) {
+    ReadyAwaiter a;
+    a.connection = this;
+    a.event = event;
+    return a;
+}
+
+
+void CoroConnection::UpdateInterest() {
+    if ((fd_ == INVALID_SOCKET) || (reactor_->reactor_.is_edge_triggered())) {
+        return;
+    }
+    int interest = (reader_ ? NetReactor::READABLE : 0) |
+        (((writer_) || (!send_queue_.is_empty())) ? NetReactor::WRITABLE : 0);
+    if (interest != interest_) {
+        interest_ = interest;
+        reactor_->reactor_.Modify(fd_, interest_);
+    }
+}
+
+
+void CoroConnection::OnReady(int events) {
+    if (events & NetReactor::CLOSED) {
+        // whatever is waiting finds out what happened from its next read or write
+        events |= NetReactor::READABLE | NetReactor::WRITABLE;
+    }
+    ready_ |= events & (NetReactor::READABLE | NetReactor::WRITABLE);
+
+    // nobody is waiting to write, but something queued earlier can go now
+    if ((!writer_) && (ready_ & NetReactor::WRITABLE) && (!send_queue_.is_empty())) {
+        ready_ &= ~NetReactor::WRITABLE;
+        WriteQueued();
+    }
+
+    std::coroutine_handle<> reader, writer;
+    if ((reader_) && (ready_ & NetReactor::READABLE)) {
+        reader = std::exchange(reader_, nullptr);
+    }
+    if ((writer_) && (ready_ & NetReactor::WRITABLE)) {
+        writer = std::exchange(writer_, nullptr);
+    }
+    UpdateInterest();
+    // the reader may finish with, and delete, this connection, so nothing here touches it after this point
+    if (writer) {
+        reactor_->Post(writer);
+    }
+    if (reader) {
+        reader.resume();
+    }
+}
+
+
+void CoroConnection::WriteQueued() {
+    if ((fd_ == INVALID_SOCKET) || (failed_) || (send_queue_.is_empty())) {
+        return;
+    }
+    if (send_queue_.WriteTo(&fd_) == SendQueue::WRITE_ERROR) {
+        failed_ = true;
+    }
+    UpdateInterest();
+}
+
+
+CoroTask<bool> CoroConnection::ReceiveString(std::string *s) {
+    while (!decoder_.NextFrame(s)) {
+        if (fd_ == INVALID_SOCKET) {
+            co_return false;
+        }
+        FrameDecoder::ReadResult r = decoder_.ReadFrom(fd_);
+        if ((r == FrameDecoder::READ_CLOSED) || (r == FrameDecoder::READ_ERROR)) {
+            co_return false;
+        }
+        if (r == FrameDecoder::READ_WOULD_BLOCK) {
+            co_await WaitFor(NetReactor::READABLE);
+        }
+    }
+    co_return true;
+}
+
+
+CoroTask<VREvent*> CoroConnection::ReceiveVREvent() {
+    std::string s;
+    while (co_await ReceiveString(&s)) {
+        VREvent *e = VREvent::CreateFromJson(s);
+        if (e != NULL) {
+            co_return e;
+        }
+    }
+    co_return NULL;
+}
+
+
+CoroTask<bool> CoroConnection::SendString(const std::string &s) {
+    co_return co_await SendFrame(std::make_shared<const OutboundFrame>(s));
+}
+
+
+CoroTask<bool> CoroConnection::SendVREvent(const VREvent &e) {
+    co_return co_await SendFrame(std::make_shared<const OutboundFrame>(e.ToJson(), e.get_name()));
+}
+
+
+CoroTask<bool> CoroConnection::SendFrame(OutboundFramePtr frame) {
+    if ((fd_ == INVALID_SOCKET) || (failed_)) {
+        co_return false;
+    }
+    send_queue_.Push(frame);
+    if (send_queue_.get_num_bytes() > send_buffer_limit_) {
+        co_return co_await WaitUntilQueued(send_buffer_limit_);
+    }
+    if (!write_scheduled_) {
+        write_scheduled_ = true;
+        reactor_->pending_writes_.push_back(this);
+    }
+    co_return true;
+}
+
+
+CoroTask<bool> CoroConnection::Flush() {
+    co_return co_await WaitUntilQueued(0);
+}
+
+
+CoroTask<bool> CoroConnection::WaitUntilQueued(int64_t max_bytes) {
+    while (true) {
+        WriteQueued();
+        if ((fd_ == INVALID_SOCKET) || (failed_)) {
+            co_return false;
+        }
+        if (send_queue_.get_num_bytes() <= max_bytes) {
+            co_return true;
+        }
+        co_await WaitFor(NetReactor::WRITABLE);
+    }
+}
+
+
+void CoroConnection::Close() {
+    if (fd_ == INVALID_SOCKET) {
+        return;
+    }
+    reactor_->reactor_.Remove(fd_);
+    MinNet::CloseSocket(&fd_);
+    fd_ = INVALID_SOCKET;
+    send_queue_.Clear();
+    if (reader_) {
+        reactor_->Post(std::exchange(reader_, nullptr));
+    }
+    if (writer_) {
+        reactor_->Post(std::exchange(writer_, nullptr));
+    }
+}
+
+
+bool CoroConnection::is_open() const {
+    return fd_ != INVALID_SOCKET;
+}
+
+
+void CoroConnection::set_send_buffer_limit(int64_t max_bytes) {
+    send_buffer_limit_ = max_bytes;
+}
+
+
+int64_t CoroConnection::get_send_buffer_limit() const {
+    return send_buffer_limit_;
+}
+
+
+void CoroConnection::set_max_frame_size(uint32_t max_bytes) {
+    decoder_.set_max_frame_size(max_bytes);
+}
+
+
+SOCKET CoroConnection::get_socket() const {
+    return fd_;
+}
+
+
+std::string CoroConnection::get_description() const {
+    return description_;
+}
+
+
+
+struct CoroListener::ReadyAwaiter {
+    CoroListener *listener;
+    bool await_ready() const noexcept { return (listener->ready_) || (listener->fd_ == INVALID_SOCKET); }
+    void await_suspend(std::coroutine_handle<> h) noexcept { listener->acceptor_ = h; }
+    void await_resume() noexcept { listener->ready_ = false; }
+};
+
+
+CoroListener::CoroListener(CoroReactor *reactor, SOCKET listener_fd) :
+    reactor_(reactor), fd_(listener_fd), ready_(false)
+{
+    MinNet::SetNonBlocking(fd_, true);
+    reactor_->get_net_reactor()->Add(fd_, NetReactor::READABLE, [this](SOCKET, int) {
+        ready_ = true;
+        if (acceptor_) {
+            std::exchange(acceptor_, nullptr).resume();
+        }
+    });
+}
+
+
+CoroListener::~CoroListener() {
+    Close();
+}
+
+
+CoroTask<std::shared_ptr<CoroConnection>> CoroListener::Accept() {
+    while (fd_ != INVALID_SOCKET) {
+        SOCKET client_fd;
+        if (MinNet::TryAcceptConnection(fd_, &client_fd)) {
+            co_return std::make_shared<CoroConnection>(reactor_, client_fd);
+        }
+        co_await ReadyAwaiter{this};
+    }
+    co_return nullptr;
+}
+
+
+void CoroListener::Close() {
+    if (fd_ == INVALID_SOCKET) {
+        return;
+    }
+    reactor_->get_net_reactor()->Remove(fd_);
+    MinNet::CloseSocket(&fd_);
+    fd_ = INVALID_SOCKET;
+    if (acceptor_) {
+        reactor_->Post(std::exchange(acceptor_, nullptr));
+    }
+}
+
+
+SOCKET CoroListener::get_socket() const {
+    return fd_;
+}
@@ -0,0 +1,268 @@
+/**
+  C++20 coroutine API for MinVR3 connections, for relay-like services and bridges that juggle many connections
+  on one thread.  Each connection is handled by straight-line code that co_awaits its reads and writes, e.g.,
+  `while (co_await conn->ReceiveString(&s)) { ... }`, and a single-threaded CoroReactor (a NetReactor
+  underneath) resumes whichever coroutines' sockets are ready.  A suspended coroutine costs a few hundred bytes
+  and no thread, so thousands of connections are fine.
+
+  Reads suspend until a whole event has arrived.  Writes are buffered: SendString() queues the event, and
+  everything sent to a connection during one pass of the reactor goes out together at the end of the pass, as
+  with EventRelay.  SendString() only suspends while more than get_send_buffer_limit() bytes are waiting to
+  go, so a coroutine that sends to a slow receiver is slowed down to its pace rather than the buffer growing
+  without limit.  Flush() waits for everything queued to go.
+
+  At most one coroutine may wait to read from a connection, and at most one to write to it, at a time, and a
+  connection must outlive the coroutines waiting on it, which holding it by shared_ptr takes care of.
+
+  This is a library of its own, MinVR3Coro, built only when the compiler supports C++20 coroutines; the rest of
+  MinVR3 stays C++14.
+
+  ```
+  CoroTask<void> Echo(std::shared_ptr<CoroConnection> conn) {
+      std::string s;
+      while (co_await conn->ReceiveString(&s)) {
+          co_await conn->SendString(s);
+      }
+  }
+
+  CoroTask<void> Serve(CoroReactor *reactor, CoroListener *listener) {
+      while (std::shared_ptr<CoroConnection> conn = co_await listener->Accept()) {
+          reactor->Spawn(Echo(conn));
+      }
+  }
+
+  CoroReactor reactor;
+  CoroListener listener(&reactor, listener_fd);
+  reactor.Spawn(Serve(&reactor, &listener));
+  reactor.Run();
+  ```
+ */
+
+#ifndef MINVR3_CORO_CONNECTION_H
+#define MINVR3_CORO_CONNECTION_H
+
+#include "frame_decoder.h"
+#include "net_reactor.h"
+#include "send_queue.h"
+#include "vr_event.h"
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/// A coroutine that produces a T.  It starts when it is first co_awaited (or handed to CoroReactor::Spawn()),
+/// and resumes its awaiter directly when it finishes.
+template <typename T>
+class CoroTask;
+
+namespace coro_detail {
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+
+    struct PromiseBase {
+        std::coroutine_handle<> continuation;
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { std::terminate(); }
+    };
+}
+
+template <typename T>
+class CoroTask {
+public:
+    struct promise_type : coro_detail::PromiseBase {
+        T value;
+        CoroTask get_return_object() { return CoroTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_value(T v) { value = std::move(v); }
+    };
+
+    CoroTask(CoroTask &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    CoroTask(const CoroTask&) = delete;
+    ~CoroTask() { if (handle_) handle_.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    T await_resume() { return std::move(handle_.promise().value); }
+
+private:
+    explicit CoroTask(std::coroutine_handle<promise_type> h) : handle_(h) {}
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <>
+class CoroTask<void> {
+public:
+    struct promise_type : coro_detail::PromiseBase {
+        CoroTask get_return_object() { return CoroTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        void return_void() {}
+    };
+
+    CoroTask(CoroTask &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    CoroTask(const CoroTask&) = delete;
+    ~CoroTask() { if (handle_) handle_.destroy(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    void await_resume() {}
+
+private:
+    explicit CoroTask(std::coroutine_handle<promise_type> h) : handle_(h) {}
+    std::coroutine_handle<promise_type> handle_;
+};
+
+
+class CoroConnection;
+
+/// Runs coroutines on one thread, resuming each one when the socket it waits on is ready.
+class CoroReactor {
+public:
+    CoroReactor();
+    virtual ~CoroReactor();
+
+    /// Starts a coroutine that runs on its own, i.e., one that nothing co_awaits, and counts it until it ends.
+    void Spawn(CoroTask<void> task);
+
+    /// Resumes h on the next pass rather than from inside the caller.
+    void Post(std::coroutine_handle<> h);
+
+    /// One pass: resumes posted coroutines, then waits up to timeout_ms (< 0 for no limit, but never while
+    /// coroutines are posted) for sockets to become ready and resumes the coroutines waiting on them.  Returns
+    /// false on error.
+    bool RunOnce(int timeout_ms=-1);
+
+    /// Calls RunOnce() until every spawned coroutine has ended or Stop() is called.
+    void Run();
+    void Stop();
+
+    int get_num_tasks() const;
+    NetReactor* get_net_reactor();
+
+private:
+    friend class CoroConnection;
+    struct Detached;
+    static Detached RunDetached(CoroReactor *reactor, CoroTask<void> task);
+
+    NetReactor reactor_;
+    std::vector<std::coroutine_handle<>> posted_;
+    std::vector<std::coroutine_handle<>> resuming_;
+    std::vector<CoroConnection*> pending_writes_;     // sent to during this pass, written at the end of it
+    int num_tasks_;
+    bool stopped_;
+};
+
+
+/// A framed connection (TCP or unix domain socket) whose reads and writes are co_awaited.
+class CoroConnection {
+public:
+    /// Takes ownership of a connected socket, which is switched to non-blocking mode.
+    CoroConnection(CoroReactor *reactor, SOCKET socket_fd, const std::string &buffered_input="");
+
+    /// Closes the connection.
+    virtual ~CoroConnection();
+
+    /// Waits for the next frame.  Returns false once the connection is closed.
+    CoroTask<bool> ReceiveString(std::string *s);
+
+    /// Waits for the next event.  Returns NULL once the connection is closed.  The caller deletes the event.
+    CoroTask<VREvent*> ReceiveVREvent();
+
+    /// Queues s to send, and waits only while more than the send buffer limit is waiting to go.  Returns false
+    /// if the connection has failed.
+    CoroTask<bool> SendString(const std::string &s);
+    CoroTask<bool> SendVREvent(const VREvent &e);
+
+    /// Same, for a frame shared with other connections, e.g., when relaying.
+    CoroTask<bool> SendFrame(OutboundFramePtr frame);
+
+    /// Waits until everything queued has been sent.  Returns false if the connection has failed.
+    CoroTask<bool> Flush();
+
+    /// Closes the socket.  A coroutine waiting on the connection is resumed and finds it closed.
+    void Close();
+
+    bool is_open() const;
+
+    /// Bytes that may be waiting to go before SendString() waits, 256 KB by default.
+    void set_send_buffer_limit(int64_t max_bytes);
+    int64_t get_send_buffer_limit() const;
+
+    /// Frames longer than this are refused and break the connection, see FrameDecoder.
+    void set_max_frame_size(uint32_t max_bytes);
+
+    SOCKET get_socket() const;
+    std::string get_description() const;
+
+    /// co_awaited by the operations above to wait for the socket.
+    struct ReadyAwaiter {
+        CoroConnection *connection;
+        int event;
+        bool await_ready() const noexcept;
+        void await_suspend(std::coroutine_handle<> h) noexcept;
+        void await_resume() noexcept;
+    };
+
+private:
+    friend class CoroReactor;
+    ReadyAwaiter WaitFor(int event);
+    CoroTask<bool> WaitUntilQueued(int64_t max_bytes);
+    void WriteQueued();
+    void OnReady(int events);
+    void UpdateInterest();
+
+    CoroReactor *reactor_;
+    SOCKET fd_;
+    std::string description_;
+    FrameDecoder decoder_;
+    SendQueue send_queue_;
+    int64_t send_buffer_limit_;
+    int ready_;                             // NetReactor flags seen since the last wait for them
+    int interest_;
+    bool write_scheduled_;
+    std::coroutine_handle<> reader_;
+    std::coroutine_handle<> writer_;
+    bool failed_;
+};
+
+
+/// Accepts connections with co_await.
+class CoroListener {
+public:
+    /// Takes ownership of a listening socket (see MinNet::CreateListener()), which is switched to non-blocking.
+    CoroListener(CoroReactor *reactor, SOCKET listener_fd);
+    virtual ~CoroListener();
+
+    /// Waits for the next connection.  Returns NULL once the listener is closed.
+    CoroTask<std::shared_ptr<CoroConnection>> Accept();
+
+    /// Closes the listener, and resumes a coroutine waiting in Accept().
+    void Close();
+
+    SOCKET get_socket() const;
+
+private:
+    struct ReadyAwaiter;
+
+    CoroReactor *reactor_;
+    SOCKET fd_;
+    bool ready_;
+    std::coroutine_handle<> acceptor_;
+};
+
+#endif
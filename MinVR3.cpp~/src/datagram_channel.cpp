@@ -0,0 +1,294 @@
+#include "datagram_channel.h"
+
+#include "min_net.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string.h>
+
+
+static const uint8_t DATAGRAM_MAGIC[4] = { 'M', 'V', '3', 'D' };
+static const int DATAGRAM_HEADER_BYTES = 12;
+
+// the largest payload an IPv4 UDP datagram can carry
+static const int MAX_UDP_PAYLOAD = 65507;
+
+
+static void WriteUInt32LE(uint8_t *p, uint32_t i) {
+    p[0] = (uint8_t)(i & 0xff);
+    p[1] = (uint8_t)((i >> 8) & 0xff);
+    p[2] = (uint8_t)((i >> 16) & 0xff);
+    p[3] = (uint8_t)((i >> 24) & 0xff);
+}
+
+
+static uint32_t ReadUInt32LE(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+
+DatagramSender::DatagramSender(int max_datagram_bytes) :
+    socket_fd_(INVALID_SOCKET), max_datagram_bytes_(max_datagram_bytes), num_events_(0), session_id_(0),
+    next_seq_(0), num_sent_(0), num_send_errors_(0)
+{
+    if (max_datagram_bytes_ > MAX_UDP_PAYLOAD) {
+        max_datagram_bytes_ = MAX_UDP_PAYLOAD;
+    }
+    if (max_datagram_bytes_ < DATAGRAM_HEADER_BYTES + 4) {
+        max_datagram_bytes_ = DATAGRAM_HEADER_BYTES + 4;
+    }
+}
+
+
+DatagramSender::~DatagramSender() {
+    Close();
+}
+
+
+bool DatagramSender::Open(const std::string &ip, int port) {
+    Close();
+    if (!MinNet::ConnectDatagramSocket(ip, port, &socket_fd_)) {
+        return false;
+    }
+    // a new session id tells receivers to forget the sequence numbers of any earlier run of this sender
+    std::random_device rd;
+    session_id_ = (uint32_t)rd() ^ (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    next_seq_ = 0;
+    StartDatagram();
+    return true;
+}
+
+
+void DatagramSender::Close() {
+    if (socket_fd_ != INVALID_SOCKET) {
+        MinNet::CloseSocket(&socket_fd_);
+        socket_fd_ = INVALID_SOCKET;
+    }
+    buf_.clear();
+    num_events_ = 0;
+}
+
+
+bool DatagramSender::is_open() const {
+    return (socket_fd_ != INVALID_SOCKET);
+}
+
+
+void DatagramSender::StartDatagram() {
+    buf_.resize(DATAGRAM_HEADER_BYTES);
+    memcpy(&buf_[0], DATAGRAM_MAGIC, 4);
+    WriteUInt32LE(&buf_[4], session_id_);
+    num_events_ = 0;
+}
+
+
+bool DatagramSender::QueueFrame(const std::string &json) {
+    int frame_bytes = 4 + (int)json.size();
+    if (DATAGRAM_HEADER_BYTES + frame_bytes > max_datagram_bytes_) {
+        std::cerr << "DatagramSender Error: Event of " << json.size() << " bytes is too large for a datagram."
+            << std::endl;
+        return false;
+    }
+    bool ok = true;
+    if ((int)buf_.size() + frame_bytes > max_datagram_bytes_) {
+        ok = Flush();
+    }
+    size_t offset = buf_.size();
+    buf_.resize(offset + frame_bytes);
+    WriteUInt32LE(&buf_[offset], (uint32_t)json.size());
+    memcpy(&buf_[offset + 4], json.data(), json.size());
+    num_events_++;
+    return ok;
+}
+
+
+bool DatagramSender::SendVREvent(const VREvent &e) {
+    bool ok = Flush();
+    return QueueFrame(e.ToJson()) && Flush() && ok;
+}
+
+
+bool DatagramSender::QueueVREvent(const VREvent &e) {
+    return QueueFrame(e.ToJson());
+}
+
+
+bool DatagramSender::Flush() {
+    if (num_events_ == 0) {
+        return true;
+    }
+    if (socket_fd_ == INVALID_SOCKET) {
+        StartDatagram();
+        return false;
+    }
+    WriteUInt32LE(&buf_[8], next_seq_);
+    next_seq_++;
+    bool ok = MinNet::SendDatagram(&socket_fd_, buf_.data(), (int)buf_.size());
+    if (ok) {
+        num_sent_++;
+    }
+    else {
+        // the sequence number is used up either way, so the receiver counts the datagram as lost
+        num_send_errors_++;
+    }
+    StartDatagram();
+    return ok;
+}
+
+
+bool DatagramSender::IsSampleEvent(const VREvent &e) {
+    std::string t = e.get_data_type_name();
+    return (t == "Single") || (t == "Vector2") || (t == "Vector3") || (t == "Vector4") || (t == "Quaternion");
+}
+
+
+uint32_t DatagramSender::get_session_id() const {
+    return session_id_;
+}
+
+
+uint32_t DatagramSender::get_next_sequence_number() const {
+    return next_seq_;
+}
+
+
+uint64_t DatagramSender::get_num_datagrams_sent() const {
+    return num_sent_;
+}
+
+
+uint64_t DatagramSender::get_num_send_errors() const {
+    return num_send_errors_;
+}
+
+
+
+DatagramReceiver::DatagramReceiver() : socket_fd_(INVALID_SOCKET), buf_(MAX_UDP_PAYLOAD + 1) {
+    ResetCounters();
+}
+
+
+DatagramReceiver::~DatagramReceiver() {
+    Close();
+}
+
+
+bool DatagramReceiver::Open(int port) {
+    Close();
+    return MinNet::CreateDatagramSocket(port, &socket_fd_);
+}
+
+
+void DatagramReceiver::Close() {
+    if (socket_fd_ != INVALID_SOCKET) {
+        MinNet::CloseSocket(&socket_fd_);
+        socket_fd_ = INVALID_SOCKET;
+    }
+}
+
+
+bool DatagramReceiver::is_open() const {
+    return (socket_fd_ != INVALID_SOCKET);
+}
+
+
+bool DatagramReceiver::AcceptSequence(const std::string &from, uint32_t session_id, uint32_t seq) {
+    std::map<std::string, SenderState>::iterator it = senders_.find(from);
+    if ((it == senders_.end()) || (it->second.session_id != session_id)) {
+        // first datagram from this sender, or the sender was restarted
+        SenderState state;
+        state.session_id = session_id;
+        state.last_seq = seq;
+        senders_[from] = state;
+        return true;
+    }
+    // signed difference, so the comparison still works after the sequence number wraps around
+    int32_t diff = (int32_t)(seq - it->second.last_seq);
+    if (diff <= 0) {
+        num_stale_++;
+        return false;
+    }
+    num_lost_ += (uint64_t)(diff - 1);
+    it->second.last_seq = seq;
+    return true;
+}
+
+
+bool DatagramReceiver::ReceiveVREvents(std::vector<VREvent*> *events) {
+    if (socket_fd_ == INVALID_SOCKET) {
+        return false;
+    }
+    int len;
+    std::string from;
+    while (MinNet::ReceiveDatagram(&socket_fd_, buf_.data(), (int)buf_.size(), &len, &from)) {
+        // buf_ is one byte larger than any valid datagram, so a full buffer means it was truncated
+        if ((len < DATAGRAM_HEADER_BYTES) || (len >= (int)buf_.size()) || (memcmp(buf_.data(), DATAGRAM_MAGIC, 4) != 0)) {
+            num_malformed_++;
+            continue;
+        }
+        if (!AcceptSequence(from, ReadUInt32LE(&buf_[4]), ReadUInt32LE(&buf_[8]))) {
+            continue;
+        }
+        num_received_++;
+
+        int pos = DATAGRAM_HEADER_BYTES;
+        while (pos + 4 <= len) {
+            uint32_t frame_len = ReadUInt32LE(&buf_[pos]);
+            if ((uint64_t)pos + 4 + frame_len > (uint64_t)len) {
+                num_malformed_++;
+                break;
+            }
+            VREvent *e = VREvent::CreateFromJson(std::string((const char*)&buf_[pos + 4], frame_len));
+            if (e != NULL) {
+                events->push_back(e);
+            }
+            pos += 4 + frame_len;
+        }
+    }
+    return true;
+}
+
+
+SOCKET DatagramReceiver::get_socket() const {
+    return socket_fd_;
+}
+
+
+int DatagramReceiver::get_port() const {
+    if (socket_fd_ == INVALID_SOCKET) {
+        return 0;
+    }
+    std::string addr = MinNet::GetAddressAndPort(socket_fd_);
+    return std::stoi(addr.substr(addr.rfind(':') + 1));
+}
+
+
+uint64_t DatagramReceiver::get_num_datagrams_received() const {
+    return num_received_;
+}
+
+
+uint64_t DatagramReceiver::get_num_datagrams_lost() const {
+    return num_lost_;
+}
+
+
+uint64_t DatagramReceiver::get_num_datagrams_stale() const {
+    return num_stale_;
+}
+
+
+uint64_t DatagramReceiver::get_num_datagrams_malformed() const {
+    return num_malformed_;
+}
+
+
+void DatagramReceiver::ResetCounters() {
+    senders_.clear();
+    num_received_ = 0;
+    num_lost_ = 0;
+    num_stale_ = 0;
+    num_malformed_ = 0;
+}
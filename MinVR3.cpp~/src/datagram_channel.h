@@ -0,0 +1,140 @@
+/**
+  Sends VREvents as UDP datagrams, for high-rate samples such as tracker poses where a late sample is worthless.
+  Over TCP, one lost packet holds up every later event until it has been retransmitted.  Over UDP, a lost
+  datagram is simply gone, and the next sample replaces it.
+
+  Each datagram has a 12 byte header followed by one or more events, framed the same way as on a TCP connection
+  (4-byte little endian length, then the event's JSON):
+  ```
+  bytes 0-3   'M' 'V' '3' 'D'
+  bytes 4-7   session id, chosen at random when the sender is opened (little endian)
+  bytes 8-11  sequence number, incremented for each datagram (little endian)
+  ```
+  The receiver tracks the sequence numbers of each sender.  Datagrams that arrive after a later one from the same
+  sender has already been received are stale and are dropped, and gaps in the sequence are counted as lost.
+
+  UDP gives no guarantees at all, so events that must arrive (button presses, commands, strings) should stay on
+  the TCP connection.  IsSampleEvent() is a simple test for which events are safe to send this way.
+
+  Sender:
+  ```
+  DatagramSender sender;
+  sender.Open("127.0.0.1", 9031);
+  sender.QueueVREvent(VREventVector3("Tracker/Head/Position", x, y, z));
+  sender.QueueVREvent(VREventQuaternion("Tracker/Head/Rotation", qx, qy, qz, qw));
+  sender.Flush();   // both events leave in one datagram
+  ```
+
+  Receiver:
+  ```
+  DatagramReceiver receiver;
+  receiver.Open(9031);
+  std::vector<VREvent*> events;
+  receiver.ReceiveVREvents(&events);   // never blocks
+  ```
+ */
+
+#ifndef MINVR3_DATAGRAM_CHANNEL_H
+#define MINVR3_DATAGRAM_CHANNEL_H
+
+#include "net_headers.h"
+#include "vr_event.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+class DatagramSender {
+public:
+    /// max_datagram_bytes limits the size of each datagram.  The default fits in a single ethernet frame, so
+    /// datagrams are never fragmented by IP, where the loss of any one fragment would lose the whole datagram.
+    DatagramSender(int max_datagram_bytes=1400);
+    virtual ~DatagramSender();
+
+    bool Open(const std::string &ip, int port);
+    void Close();
+    bool is_open() const;
+
+    /// Sends e in a datagram of its own right away.  Anything already queued is flushed first, so events
+    /// still leave in order.
+    bool SendVREvent(const VREvent &e);
+
+    /// Adds e to the current datagram.  If e does not fit, the current datagram is sent first and e starts a
+    /// new one.  Call Flush() to send the last one.
+    bool QueueVREvent(const VREvent &e);
+
+    /// Sends the current datagram, if it holds any events.
+    bool Flush();
+
+    /// True for event types that carry a sample of a continuously changing value (floats, vectors and
+    /// quaternions), where a lost sample does not matter because another one will soon follow.
+    static bool IsSampleEvent(const VREvent &e);
+
+    uint32_t get_session_id() const;
+    uint32_t get_next_sequence_number() const;
+    uint64_t get_num_datagrams_sent() const;
+    uint64_t get_num_send_errors() const;
+
+private:
+    bool QueueFrame(const std::string &json);
+    void StartDatagram();
+
+    SOCKET socket_fd_;
+    int max_datagram_bytes_;
+    std::vector<uint8_t> buf_;
+    int num_events_;
+    uint32_t session_id_;
+    uint32_t next_seq_;
+    uint64_t num_sent_;
+    uint64_t num_send_errors_;
+};
+
+
+class DatagramReceiver {
+public:
+    DatagramReceiver();
+    virtual ~DatagramReceiver();
+
+    /// Binds to port on all interfaces.  Use port 0 to have the OS pick a free port, see get_port().
+    bool Open(int port);
+    void Close();
+    bool is_open() const;
+
+    /// Reads every datagram that is currently waiting, without blocking, and appends the events from each one
+    /// that is newer than anything already received from the same sender.  The caller owns the events.
+    /// Returns false only if the receiver is not open.
+    bool ReceiveVREvents(std::vector<VREvent*> *events);
+
+    /// The socket, e.g., to add to a NetReactor so that ReceiveVREvents() is called only when there is data.
+    SOCKET get_socket() const;
+    int get_port() const;
+
+    // counters, summed over all senders
+    uint64_t get_num_datagrams_received() const;    // accepted and delivered
+    uint64_t get_num_datagrams_lost() const;        // gaps in the sequence numbers
+    uint64_t get_num_datagrams_stale() const;       // arrived out of order or duplicated, and dropped
+    uint64_t get_num_datagrams_malformed() const;   // not from a DatagramSender, or truncated
+
+    /// Zeroes the counters and forgets all senders.
+    void ResetCounters();
+
+private:
+    struct SenderState {
+        uint32_t session_id;
+        uint32_t last_seq;
+    };
+
+    bool AcceptSequence(const std::string &from, uint32_t session_id, uint32_t seq);
+
+    SOCKET socket_fd_;
+    std::vector<uint8_t> buf_;
+    std::map<std::string, SenderState> senders_;
+    uint64_t num_received_;
+    uint64_t num_lost_;
+    uint64_t num_stale_;
+    uint64_t num_malformed_;
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "event_dictionary.h"
+
+#include "json/json.h"
+
+#include <iostream>
+
+
+const int EventDictionary::PROTOCOL_VERSION;
+const int EventDictionary::FRAGMENTS_VERSION;
+const int EventDictionary::MAX_ENTRIES;
+
+static void AppendVarint(uint32_t v, std::string *s) {
+    while (v >= 0x80) {
+        s->push_back((char)((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    s->push_back((char)v);
+}
+
+
+// Returns false if the varint is cut off or too long for 32 bits.
+static bool ReadVarint(const std::string &s, size_t *pos, uint32_t *v) {
+    *v = 0;
+    for (int shift = 0; (shift < 32) && (*pos < s.size()); shift += 7) {
+        uint8_t b = (uint8_t)s[(*pos)++];
+        *v |= (uint32_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool ReadString(const std::string &s, size_t *pos, std::string *str) {
+    uint32_t len;
+    if ((!ReadVarint(s, pos, &len)) || (len > s.size() - *pos)) {
+        return false;
+    }
+    str->assign(s, *pos, len);
+    *pos += len;
+    return true;
+}
+
+
+EventDictionary::EventDictionary() : num_defined_(0) {
+}
+
+
+EventDictionary::~EventDictionary() {
+}
+
+
+int EventDictionary::Assign(const std::string &name, const std::string &data_type_name, bool *added) {
+    key_.assign(name);
+    key_.push_back('\0');
+    key_.append(data_type_name);
+    std::unordered_map<std::string, int>::const_iterator it = ids_.find(key_);
+    if (it != ids_.end()) {
+        *added = false;
+        return it->second;
+    }
+    if (ids_.size() >= MAX_ENTRIES) {
+        *added = false;
+        return -1;
+    }
+    int id = (int)ids_.size();
+    ids_[key_] = id;
+    *added = true;
+    return id;
+}
+
+
+bool EventDictionary::Encode(const std::string &json, std::string *definition, std::string *compact) {
+    if (!VREvent::PeekFields(json, &name_, &data_type_name_, &data_)) {
+        return false;
+    }
+    bool added;
+    int id = Assign(name_, data_type_name_, &added);
+    if (id < 0) {
+        return false;
+    }
+    definition->clear();
+    if (added) {
+        *definition = MakeDefinition(id, name_, data_type_name_);
+    }
+    *compact = MakeEvent(id, data_);
+    return true;
+}
+
+
+bool EventDictionary::Encode(const VREvent &e, int version, std::string *definition, std::string *compact) {
+    name_ = e.get_name();
+    data_type_name_ = e.get_data_type_name();
+    bool binary = (version >= 2) && (VREvent::HasBinaryLayout(data_type_name_));
+    if ((!binary) && (!VREvent::PeekFields(e.ToJson(), &name_, &data_type_name_, &data_))) {
+        return false;
+    }
+    bool added;
+    int id = Assign(name_, data_type_name_, &added);
+    if (id < 0) {
+        return false;
+    }
+    definition->clear();
+    if (added) {
+        *definition = MakeDefinition(id, name_, data_type_name_);
+    }
+    *compact = binary ? MakeBinaryEvent(id, e) : MakeEvent(id, data_);
+    return true;
+}
+
+
+std::string EventDictionary::MakeDefinition(int id, const std::string &name, const std::string &data_type_name) {
+    std::string s;
+    s.reserve(12 + name.size() + data_type_name.size());
+    s.push_back((char)0x01);
+    AppendVarint((uint32_t)id, &s);
+    AppendVarint((uint32_t)name.size(), &s);
+    s.append(name);
+    AppendVarint((uint32_t)data_type_name.size(), &s);
+    s.append(data_type_name);
+    return s;
+}
+
+
+std::string EventDictionary::MakeEvent(int id, const std::string &dataJsonStr) {
+    std::string s;
+    s.reserve(4 + dataJsonStr.size());
+    s.push_back((char)0x02);
+    AppendVarint((uint32_t)id, &s);
+    s.append(dataJsonStr);
+    return s;
+}
+
+
+std::string EventDictionary::MakeBinaryEvent(int id, const VREvent &e) {
+    std::string s;
+    s.reserve(24);
+    s.push_back((char)0x03);
+    AppendVarint((uint32_t)id, &s);
+    e.AppendBinaryData(&s);
+    return s;
+}
+
+
+std::string EventDictionary::MakeBinaryEvent(int id, const char *data, size_t size) {
+    std::string s;
+    s.reserve(4 + size);
+    s.push_back((char)0x03);
+    AppendVarint((uint32_t)id, &s);
+    s.append(data, size);
+    return s;
+}
+
+
+EventDictionary::FrameType EventDictionary::GetFrameType(const std::string &frame) {
+    if (frame.empty()) {
+        return JSON_FRAME;
+    }
+    if (frame[0] == 0x01) {
+        return DEFINE_FRAME;
+    }
+    if (frame[0] == 0x02) {
+        return EVENT_FRAME;
+    }
+    return (frame[0] == 0x03) ? BINARY_EVENT_FRAME : JSON_FRAME;
+}
+
+
+const EventDictionary::Entry* EventDictionary::Read(const std::string &frame, std::string *data) {
+    FrameType type = GetFrameType(frame);
+    size_t pos = 1;
+    uint32_t id;
+    if ((type == JSON_FRAME) || (!ReadVarint(frame, &pos, &id)) || (id >= MAX_ENTRIES)) {
+        std::cerr << "EventDictionary Error: malformed frame." << std::endl;
+        return NULL;
+    }
+
+    if (type == DEFINE_FRAME) {
+        if ((!ReadString(frame, &pos, &name_)) || (!ReadString(frame, &pos, &data_type_name_))) {
+            std::cerr << "EventDictionary Error: malformed definition." << std::endl;
+            return NULL;
+        }
+        if (id >= entries_.size()) {
+            entries_.resize(id + 1);
+            defined_.resize(id + 1, false);
+        }
+        Entry &entry = entries_[id];
+        entry.name = name_;
+        entry.data_type_name = data_type_name_;
+        entry.json_suffix = "\"m_DataTypeName\":" + Json::valueToQuotedString(data_type_name_.c_str()) +
+            ",\"m_Name\":" + Json::valueToQuotedString(name_.c_str()) + "}\n";
+        if (!defined_[id]) {
+            defined_[id] = true;
+            num_defined_++;
+        }
+        return NULL;
+    }
+
+    if ((id >= entries_.size()) || (!defined_[id])) {
+        std::cerr << "EventDictionary Error: event with undefined id " << id << "." << std::endl;
+        return NULL;
+    }
+    data->assign(frame, pos, std::string::npos);
+    return &entries_[id];
+}
+
+
+const EventDictionary::Entry* EventDictionary::GetDefinition(int id) const {
+    if ((id < 0) || (id >= entries_.size()) || (!defined_[id])) {
+        return NULL;
+    }
+    return &entries_[id];
+}
+
+
+VREvent* EventDictionary::ReadVREvent(const std::string &frame) {
+    FrameType type = GetFrameType(frame);
+    const Entry *entry = Read(frame, &data_);
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (type == BINARY_EVENT_FRAME) {
+        return VREvent::CreateFromBinaryData(entry->name, entry->data_type_name, data_.data(), data_.size());
+    }
+    return VREvent::CreateFromData(entry->name, entry->data_type_name, data_);
+}
+
+
+void EventDictionary::ToJson(const Entry &entry, const std::string &dataJsonStr, std::string *json) {
+    json->clear();
+    json->reserve(12 + dataJsonStr.size() + entry.json_suffix.size());
+    if (dataJsonStr.empty()) {
+        json->push_back('{');
+    }
+    else {
+        json->append("{\"m_Data\":");
+        json->append(dataJsonStr);
+        json->push_back(',');
+    }
+    json->append(entry.json_suffix);
+}
+
+
+int EventDictionary::get_num_assigned() const {
+    return (int)ids_.size();
+}
+
+
+int EventDictionary::get_num_defined() const {
+    return num_defined_;
+}
@@ -0,0 +1,135 @@
+/**
+  Per-connection dictionary of event names, so that a steady stream of the same events, e.g., tracker poses,
+  does not carry each event's name and data type in every frame.  For a VREventVector3, the name, the data
+  type, and the keys around them are most of the json; with a dictionary, the first frame for each name and
+  type pair defines a small integer id for it, and every later frame only holds the id and the event's data.
+
+  This is MinVR3's wire protocol beyond plain json, in three versions:
+  - version 1: the data is the json text of the event's m_Data;
+  - version 2: the data is in a fixed little-endian binary layout (see VREvent::AppendBinaryData()), e.g., 12
+    bytes for a Vector3, which is also far cheaper to write and read than json.  Events of types without a
+    binary layout (anything but the built-in ones) are still sent as in version 1.
+  - version 3: as version 2, and large frames may be sent in fragments, with smaller frames overtaking them
+    (see SendQueue::set_fragment_size() and FrameDecoder), so a large event does not hold up the tracker
+    events behind it.
+
+  Three kinds of frame body are used in place of the json, and since a json body starts with '{' (or white
+  space), the first byte tells them apart from json, which can still be sent at any time:
+  - DEFINE: 0x01, id, name, data type; it defines id for every later frame on the connection and is not an
+    event itself.
+  - EVENT: 0x02, id, then the json text of the event's m_Data (nothing for an event without data).
+  - BINARY_EVENT (version 2): 0x03, id, then the event's data in the binary layout.
+  Ids and string lengths are unsigned LEB128 varints, and strings are UTF-8 without a terminator.  Ids are
+  assigned by the sender, counting up from 0, and each direction of a connection has its own.
+
+  Both are opt-in, so every existing peer, e.g., Unity's TcpJsonVREventConnection and the Python and JS
+  clients, keeps working with json.  Right after connecting, a client that can read these frames sends a
+  VREventInt named "EventDictionaryOffer" holding the highest version it reads, and a peer that can read them
+  too (EventRelay can) answers with "EventDictionaryAccept" holding the version both will use, the lower of
+  the two; from then on either side may use it.  A peer that does not know about dictionaries never answers,
+  so the client keeps sending json.  See Connection::OfferEventDictionary().
+
+  One EventDictionary holds both directions: Assign() and Encode() number the events sent, and Read() looks up
+  the events received.
+  ```
+  EventDictionary sent, received;
+  std::string definition, compact, data;
+  sent.Encode(VREventVector3("Head/Position", x, y, z), 2, &definition, &compact);
+  // send definition first, if it is not empty, then compact
+  received.Read(definition, &data);                        // NULL, but defines the id
+  const EventDictionary::Entry *entry = received.Read(compact, &data);
+  VREvent *e = VREvent::CreateFromBinaryData(entry->name, entry->data_type_name, data.data(), data.size());
+  ```
+ */
+
+#ifndef MINVR3_EVENT_DICTIONARY_H
+#define MINVR3_EVENT_DICTIONARY_H
+
+#include "vr_event.h"
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+class EventDictionary {
+public:
+    enum FrameType {
+        JSON_FRAME,
+        DEFINE_FRAME,
+        EVENT_FRAME,
+        BINARY_EVENT_FRAME
+    };
+
+    /// The highest protocol version this library reads and writes.
+    static const int PROTOCOL_VERSION = 3;
+
+    /// The first version in which large frames may be sent in fragments.
+    static const int FRAGMENTS_VERSION = 3;
+
+    /// Ids per direction; events with names beyond this many are sent as json, so a peer that makes up endless
+    /// names does not get to grow the dictionary forever.
+    static const int MAX_ENTRIES = 65536;
+
+    struct Entry {
+        std::string name;
+        std::string data_type_name;
+        std::string json_suffix;        // the json after m_Data, for ToJson()
+    };
+
+    EventDictionary();
+    virtual ~EventDictionary();
+
+    /// Returns the id for events with this name and data type, assigning the next one if they are new, in which
+    /// case *added is set and its definition (see MakeDefinition()) must be sent before any event that uses it.
+    /// Returns -1 if the dictionary is full.
+    int Assign(const std::string &name, const std::string &data_type_name, bool *added);
+
+    /// Turns an event's json into an EVENT frame, and into a DEFINE frame for its id if the id is new (otherwise
+    /// definition is cleared).  Returns false if the event is to be sent as json instead, e.g., if the json
+    /// holds anything but the three fields of an event (see VREvent::PeekFields()) or the dictionary is full.
+    bool Encode(const std::string &json, std::string *definition, std::string *compact);
+
+    /// Same, straight from the event, without writing its json first: a BINARY_EVENT frame with version 2 if the
+    /// event's type has a binary layout, else an EVENT frame.
+    bool Encode(const VREvent &e, int version, std::string *definition, std::string *compact);
+
+    static std::string MakeDefinition(int id, const std::string &name, const std::string &data_type_name);
+    static std::string MakeEvent(int id, const std::string &dataJsonStr);
+    static std::string MakeBinaryEvent(int id, const VREvent &e);
+    static std::string MakeBinaryEvent(int id, const char *data, size_t size);
+
+    static FrameType GetFrameType(const std::string &frame);
+
+    /// Reads a frame from the other side.  A DEFINE frame is remembered, and returns NULL.  An EVENT or
+    /// BINARY_EVENT frame returns the entry its id was defined with, and its data (m_Data json, or the binary
+    /// layout) in data.  A malformed frame, or an event whose id was never defined, returns NULL with an error
+    /// message.
+    const Entry* Read(const std::string &frame, std::string *data);
+
+    /// The entry the other side defined id as, or NULL if it has not defined it, e.g., to pass the definitions on to
+    /// another EventDictionary as DEFINE frames (see EventRelay::GetConnectionState()).
+    const Entry* GetDefinition(int id) const;
+
+    /// The event in an EVENT or BINARY_EVENT frame, or NULL for any other frame, as Read().  The caller owns it.
+    VREvent* ReadVREvent(const std::string &frame);
+
+    /// The json of an event read as an entry and its m_Data json, laid out as VREvent::ToJson() lays it out.
+    static void ToJson(const Entry &entry, const std::string &dataJsonStr, std::string *json);
+
+    /// Number of ids assigned to events sent, and defined by the other side.
+    int get_num_assigned() const;
+    int get_num_defined() const;
+
+private:
+    std::unordered_map<std::string, int> ids_;      // name + '\0' + data type -> id, for events sent
+    std::vector<Entry> entries_;                    // by id, for events received
+    std::vector<bool> defined_;
+    int num_defined_;
+
+    // reused between calls
+    std::string key_, name_, data_type_name_, data_;
+};
+
+#endif
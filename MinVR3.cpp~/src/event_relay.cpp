@@ -0,0 +1,992 @@
+#include "event_relay.h"
+
+#include "minvr3_utils.h"
+#include "json/json.h"
+
+#include <algorithm>
+#include <iostream>
+
+
+const int EventRelay::MAX_SUBSCRIPTIONS;
+const int EventRelay::MAX_LINK_SUBSCRIPTIONS;
+
+EventRelay::EventRelay(bool relay_to_source) :
+    relay_to_source_(relay_to_source), batch_(NULL), non_blocking_(false), send_limit_(0),
+    overflow_policy_(SendQueue::OVERFLOW_DROP_OLDEST), shutdown_(false), num_relayed_(0), links_changed_(false),
+    relay_id_(RelayFederation::MakeRelayId()), chain_(relay_id_), num_looped_(0), from_link_(false), link_hops_(0),
+    num_dictionary_peers_(0),
+    compact_id_(-1), compact_made_(false), has_binary_data_(false), msgpack_made_(false), has_msgpack_frame_(false)
+{
+}
+
+
+EventRelay::~EventRelay() {
+    for (int i=0; i<connections_.size(); i++) {
+        delete connections_[i];
+    }
+    for (int i=0; i<listeners_.size(); i++) {
+        delete listeners_[i];
+    }
+}
+
+
+void EventRelay::AddListener(Listener *listener) {
+    listeners_.push_back(listener);
+}
+
+
+void EventRelay::AddLinkListener(Listener *listener) {
+    listeners_.push_back(listener);
+    link_listeners_.insert(listener);
+}
+
+
+bool EventRelay::is_link_listener(Listener *listener) const {
+    return link_listeners_.count(listener) != 0;
+}
+
+
+void EventRelay::AddConnection(Connection *connection) {
+    if (non_blocking_) {
+        connection->set_send_limit(send_limit_, overflow_policy_);
+    }
+    connections_.push_back(connection);
+    // it receives everything until it subscribes
+    links_changed_ = true;
+    if (connect_callback_) {
+        connect_callback_(connection);
+    }
+}
+
+
+bool EventRelay::AddConnection(Connection *connection, const std::string &state) {
+    AddConnection(connection);
+    Json::Value root;
+    Json::Reader reader;
+    if ((!reader.parse(state, root)) || (!root.isObject())) {
+        std::cerr << "EventRelay Error: Could not read the state of " << connection->get_description()
+            << ", relaying to it as a new connection." << std::endl;
+        return false;
+    }
+    Connection::EventFormat format;
+    if ((root["event_format"].isString()) &&
+        (Connection::EventFormatFromString(root["event_format"].asString(), &format))) {
+        connection->set_event_format(format);
+    }
+    const Json::Value &dictionary = root["dictionary"];
+    if ((dictionary.isObject()) && (dictionary["version"].isInt()) && (dictionary["version"].asInt() > 0)) {
+        DictionaryPeer &peer = dictionary_peers_[connection];
+        if (peer.version == 0) {
+            num_dictionary_peers_++;
+        }
+        peer.version = std::min(dictionary["version"].asInt(), EventDictionary::PROTOCOL_VERSION);
+        if (peer.version >= EventDictionary::FRAGMENTS_VERSION) {
+            connection->set_fragment_size(SendQueue::DEFAULT_FRAGMENT_SIZE);
+            connection->set_receive_fragments(true);
+        }
+        // the client will not define its names again, so they are read as the old relay read them
+        const Json::Value &definitions = dictionary["definitions"];
+        for (Json::ArrayIndex i=0; (definitions.isArray()) && (i<definitions.size()); i++) {
+            const Json::Value &d = definitions[i];
+            if ((d.isArray()) && (d.size() == 3) && (d[0].isInt()) && (d[1].isString()) && (d[2].isString())) {
+                peer.received.Read(EventDictionary::MakeDefinition(d[0].asInt(), d[1].asString(), d[2].asString()),
+                                   &data_);
+            }
+        }
+    }
+    // after the dictionary, whose version 3 sets the default
+    if (root["fragment_size"].isInt()) {
+        connection->set_fragment_size(root["fragment_size"].asInt());
+    }
+    // a link, with what this relay is subscribed to on it, so only the changes are sent; the subscriptions below
+    // are the other relay's
+    const Json::Value &link = root["link"];
+    if (link.isObject()) {
+        LinkPeer &peer = links_[connection];
+        peer.id = link["id"].asString();
+        peer.subscribed = link["subscribed"].asBool();
+        const Json::Value &patterns = link["patterns"];
+        for (Json::ArrayIndex i=0; (patterns.isArray()) && (i<patterns.size()); i++) {
+            if (patterns[i].isString()) {
+                peer.patterns.insert(patterns[i].asString());
+            }
+        }
+        links_changed_ = true;
+    }
+    const Json::Value &subscriptions = root["subscriptions"];
+    if (subscriptions.isArray()) {
+        // subscribed, even if to nothing now
+        subscribers_.insert(connection);
+        routes_.clear();
+        for (Json::ArrayIndex i=0; i<subscriptions.size(); i++) {
+            if (subscriptions[i].isString()) {
+                Subscribe(connection, subscriptions[i].asString());
+            }
+        }
+    }
+    return true;
+}
+
+
+std::string EventRelay::GetConnectionState(Connection *connection) const {
+    Json::Value root(Json::objectValue);
+    if (subscribers_.count(connection) != 0) {
+        Json::Value subscriptions(Json::arrayValue);
+        std::unordered_map<Connection*, std::set<std::string>>::const_iterator p = patterns_.find(connection);
+        if (p != patterns_.end()) {
+            for (std::set<std::string>::const_iterator it = p->second.begin(); it != p->second.end(); it++) {
+                subscriptions.append(*it);
+            }
+        }
+        root["subscriptions"] = subscriptions;
+    }
+    std::unordered_map<Connection*, LinkPeer>::const_iterator l = links_.find(connection);
+    if (l != links_.end()) {
+        Json::Value link(Json::objectValue);
+        link["id"] = l->second.id;
+        link["subscribed"] = l->second.subscribed;
+        Json::Value patterns(Json::arrayValue);
+        const std::set<std::string> &subscribed_to = l->second.patterns;
+        for (std::set<std::string>::const_iterator it = subscribed_to.begin(); it != subscribed_to.end(); it++) {
+            patterns.append(*it);
+        }
+        link["patterns"] = patterns;
+        root["link"] = link;
+    }
+    root["event_format"] = Connection::EventFormatToString(connection->get_event_format());
+    if (connection->get_send_queue() != NULL) {
+        root["fragment_size"] = connection->get_send_queue()->get_fragment_size();
+    }
+    std::unordered_map<Connection*, DictionaryPeer>::const_iterator peer = dictionary_peers_.find(connection);
+    if ((peer != dictionary_peers_.end()) && (peer->second.version > 0)) {
+        Json::Value dictionary(Json::objectValue);
+        dictionary["version"] = peer->second.version;
+        Json::Value definitions(Json::arrayValue);
+        const EventDictionary &received = peer->second.received;
+        for (int id=0, n=0; n<received.get_num_defined(); id++) {
+            const EventDictionary::Entry *entry = received.GetDefinition(id);
+            if (entry != NULL) {
+                Json::Value d(Json::arrayValue);
+                d.append(id);
+                d.append(entry->name);
+                d.append(entry->data_type_name);
+                definitions.append(d);
+                n++;
+            }
+        }
+        dictionary["definitions"] = definitions;
+        root["dictionary"] = dictionary;
+    }
+    Json::FastWriter writer;
+    std::string state = writer.write(root);
+    // the writer ends it with a newline
+    if ((!state.empty()) && (state.back() == '\n')) {
+        state.pop_back();
+    }
+    return state;
+}
+
+
+void EventRelay::AddLink(Connection *connection) {
+    AddConnection(connection);
+    links_[connection];
+    connection->QueueVREvent(VREventString("RelayLink", relay_id_));
+}
+
+
+int EventRelay::AcceptFrom(Listener *listener) {
+    int n = 0;
+    bool may_link = (link_listeners_.count(listener) != 0);
+    Connection *c;
+    while ((c = listener->TryAccept()) != NULL) {
+        if (may_link) {
+            may_link_.insert(c);
+        }
+        AddConnection(c);
+        n++;
+    }
+    return n;
+}
+
+
+void EventRelay::ReadFrom(Connection *connection) {
+    if (disconnected_.count(connection) != 0) {
+        return;
+    }
+    frames_.clear();
+    if (!connection->ReceiveAvailableStrings(&frames_)) {
+        // If there was a problem receiving, then assume this client disconnected
+        disconnected_.insert(connection);
+    }
+    std::string name;
+    for (int i=0; i<frames_.size(); i++) {
+        bool routed = false;
+        from_link_ = false;
+        if (!links_.empty()) {
+            std::unordered_map<Connection*, LinkPeer>::const_iterator link = links_.find(connection);
+            if (link != links_.end()) {
+                // as far as this relay can tell, an untagged event from a link (relayed before the other end knew it
+                // was a link) started at the other end
+                from_link_ = true;
+                link_origin_ = link->second.id;
+                link_hops_ = 1;
+                if (RelayFederation::IsRoutedFrame(frames_[i])) {
+                    if (!RelayFederation::ReadRoutedFrame(frames_[i], &link_origin_, &link_hops_, &data_)) {
+                        std::cerr << "EventRelay Error: malformed routed frame from " << connection->get_description()
+                            << "." << std::endl;
+                        continue;
+                    }
+                    if ((link_origin_ == relay_id_) || (link_hops_ >= RelayFederation::MAX_HOPS)) {
+                        num_looped_++;
+                        continue;
+                    }
+                    frames_[i].swap(data_);
+                    routed = true;
+                }
+            }
+        }
+        EventDictionary::FrameType type = EventDictionary::GetFrameType(frames_[i]);
+        has_binary_data_ = false;
+        has_msgpack_frame_ = false;
+        if (MsgPackCodec::IsMsgPack(frames_[i])) {
+            // back to json as well, with the frame kept for the peers that read MessagePack, see PrepareMsgPack()
+            VREvent *e = MsgPackCodec::Decode(frames_[i]);
+            if (e == NULL) {
+                continue;
+            }
+            name = e->get_name();
+            msgpack_frame_.swap(frames_[i]);
+            has_msgpack_frame_ = true;
+            frames_[i] = e->ToJson();
+            delete e;
+        }
+        else if (type != EventDictionary::JSON_FRAME) {
+            // the short form goes back to json, which every receiver can read, but only from a peer that offered it
+            std::unordered_map<Connection*, DictionaryPeer>::iterator peer = dictionary_peers_.find(connection);
+            if ((peer == dictionary_peers_.end()) || (peer->second.version == 0)) {
+                std::cerr << "EventRelay Error: event in the short form from " << connection->get_description()
+                    << ", which has not offered an event dictionary." << std::endl;
+                continue;
+            }
+            const EventDictionary::Entry *entry = peer->second.received.Read(frames_[i], &data_);
+            if (entry == NULL) {
+                // a definition, or a frame that cannot be read
+                continue;
+            }
+            // its data is put into the json as it is, so it must be a json value and nothing more
+            if ((type == EventDictionary::EVENT_FRAME) && (!data_.empty()) && (!VREvent::IsJsonValue(data_))) {
+                std::cerr << "EventRelay Error: " << entry->name << " from " << connection->get_description()
+                    << " does not hold valid json data." << std::endl;
+                continue;
+            }
+            if (type == EventDictionary::BINARY_EVENT_FRAME) {
+                // and the binary data is kept for the peers that read it, see PrepareCompact()
+                binary_data_.swap(data_);
+                has_binary_data_ = true;
+                if (!VREvent::BinaryDataToJson(entry->data_type_name, binary_data_.data(), binary_data_.size(), &data_)) {
+                    std::cerr << "EventRelay Error: " << entry->name << " from " << connection->get_description()
+                        << " does not fit its data type." << std::endl;
+                    continue;
+                }
+            }
+            name = entry->name;
+            EventDictionary::ToJson(*entry, data_, &frames_[i]);
+        }
+        // the event goes out exactly as it came in, only its name is needed here
+        else if (!VREvent::PeekName(frames_[i], &name)) {
+            VREvent* e = VREvent::CreateFromJson(frames_[i]);
+            if (e == NULL) {
+                // a frame that does not hold a valid event is skipped, the next frame is still intact
+                continue;
+            }
+            name = e->get_name();
+            frames_[i] = e->ToJson();
+            delete e;
+        }
+        // events relayed from other relays' clients are never control events for this one
+        if ((!routed) && (HandleControl(connection, name, frames_[i]))) {
+            continue;
+        }
+        Relay(connection, MakeFrame(std::move(frames_[i]), name));
+
+        // If the event happened to be named "Shutdown", then we can also shutdown, but only if one of this
+        // relay's own clients sent it, or a client at any site could stop every relay in the tree.
+        if (((name == "Shutdown") || (name == "SHUTDOWN")) && (!routed) && (!from_link_)) {
+            shutdown_ = true;
+        }
+    }
+    has_binary_data_ = false;
+    has_msgpack_frame_ = false;
+    from_link_ = false;
+}
+
+
+OutboundFramePtr EventRelay::MakeFrame(std::string &&body, const std::string &name) {
+    if (coalesce_patterns_.empty()) {
+        return std::make_shared<const OutboundFrame>(std::move(body), name);
+    }
+    // with patterns, only the events they name are ever coalesced, even by OVERFLOW_COALESCE
+    bool latest = is_latest_value(name);
+    return std::make_shared<const OutboundFrame>(std::move(body), latest ? name : std::string(), latest, name);
+}
+
+
+bool EventRelay::HandleControl(Connection *connection, const std::string &name, const std::string &json) {
+    if (name == "EventDictionaryOffer") {
+        VREvent *e = VREvent::CreateFromJson(json);
+        VREventInt *offer = dynamic_cast<VREventInt*>(e);
+        if ((offer == NULL) || (offer->get_data() < 1)) {
+            std::cerr << "EventRelay Error: " << name << " from " << connection->get_description()
+                << " should be a VREventInt holding a protocol version." << std::endl;
+        }
+        else {
+            DictionaryPeer &peer = dictionary_peers_[connection];
+            if (peer.version == 0) {
+                num_dictionary_peers_++;
+            }
+            peer.version = std::min(offer->get_data(), EventDictionary::PROTOCOL_VERSION);
+            connection->QueueVREvent(VREventInt("EventDictionaryAccept", peer.version));
+            if (peer.version >= EventDictionary::FRAGMENTS_VERSION) {
+                connection->set_fragment_size(SendQueue::DEFAULT_FRAGMENT_SIZE);
+                connection->set_receive_fragments(true);
+            }
+        }
+        delete e;
+        return true;
+    }
+    if (name == "RelayEventFormat") {
+        VREvent *e = VREvent::CreateFromJson(json);
+        VREventString *request = dynamic_cast<VREventString*>(e);
+        Connection::EventFormat format;
+        if ((request == NULL) || (!Connection::EventFormatFromString(request->get_data(), &format))) {
+            std::cerr << "EventRelay Error: " << name << " from " << connection->get_description()
+                << " should be a VREventString holding \"json\" or \"msgpack\"." << std::endl;
+        }
+        else {
+            connection->set_event_format(format);
+        }
+        delete e;
+        return true;
+    }
+    if ((name == "RelayLink") || (name == "RelayLinkAccept")) {
+        return HandleLinkControl(connection, name, json);
+    }
+    bool subscribe = (name == "RelaySubscribe");
+    if ((!subscribe) && (name != "RelayUnsubscribe")) {
+        return false;
+    }
+    VREvent *e = VREvent::CreateFromJson(json);
+    VREventString *s = dynamic_cast<VREventString*>(e);
+    if (s == NULL) {
+        std::cerr << "EventRelay Error: " << name << " from " << connection->get_description()
+            << " should be a VREventString holding the pattern." << std::endl;
+    }
+    else if (subscribe) {
+        int max_patterns = (links_.count(connection) != 0) ? MAX_LINK_SUBSCRIPTIONS : MAX_SUBSCRIPTIONS;
+        std::unordered_map<Connection*, std::set<std::string>>::const_iterator p = patterns_.find(connection);
+        if ((p != patterns_.end()) && ((int)p->second.size() >= max_patterns) &&
+            (p->second.count(s->get_data()) == 0))
+        {
+            if (disconnected_.insert(connection).second) {
+                std::cerr << "EventRelay Error: " << connection->get_description() << " subscribed to more than "
+                    << max_patterns << " patterns, dropping it." << std::endl;
+            }
+        }
+        else {
+            Subscribe(connection, s->get_data());
+        }
+    }
+    else {
+        Unsubscribe(connection, s->get_data());
+    }
+    delete e;
+    return true;
+}
+
+
+bool EventRelay::HandleLinkControl(Connection *connection, const std::string &name, const std::string &json) {
+    VREvent *e = VREvent::CreateFromJson(json);
+    VREventString *s = dynamic_cast<VREventString*>(e);
+    std::vector<std::string> chain;
+    std::string data;
+    if (s != NULL) {
+        data = s->get_data();
+        chain = RelayFederation::SplitChain(data);
+    }
+    delete e;
+    if (chain.empty()) {
+        std::cerr << "EventRelay Error: " << name << " from " << connection->get_description()
+            << " should be a VREventString holding relay ids." << std::endl;
+        return true;
+    }
+
+    if (name == "RelayLink") {
+        // only a connection to a link listener can claim to be a relay, or any client could send ROUTED frames with
+        // made-up origins
+        if ((may_link_.count(connection) == 0) && (links_.count(connection) == 0)) {
+            std::cerr << "EventRelay Error: Refusing the link from relay " << chain[0] << " at "
+                << connection->get_description() << ", it did not connect to a link listener." << std::endl;
+            disconnected_.insert(connection);
+            return true;
+        }
+        // a relay linking to this one from below, unless it is this one or one above it
+        std::vector<std::string> above = RelayFederation::SplitChain(chain_);
+        if (std::find(above.begin(), above.end(), chain[0]) != above.end()) {
+            std::cerr << "EventRelay Error: Refusing the link from relay " << chain[0] << " at "
+                << connection->get_description() << ", it would close a loop." << std::endl;
+            disconnected_.insert(connection);
+            return true;
+        }
+        links_[connection].id = chain[0];
+        links_changed_ = true;
+        connection->QueueVREvent(VREventString("RelayLinkAccept", chain_));
+        return true;
+    }
+
+    std::unordered_map<Connection*, LinkPeer>::iterator link = links_.find(connection);
+    if (link == links_.end()) {
+        std::cerr << "EventRelay Error: " << name << " from " << connection->get_description()
+            << ", which this relay did not link to." << std::endl;
+        return true;
+    }
+    if (std::find(chain.begin(), chain.end(), relay_id_) != chain.end()) {
+        std::cerr << "EventRelay Error: Dropping the link to relay " << chain[0] << " at "
+            << connection->get_description() << ", it would close a loop." << std::endl;
+        disconnected_.insert(connection);
+        return true;
+    }
+    link->second.id = chain[0];
+    chain_ = relay_id_ + " " + data;
+    return true;
+}
+
+
+bool EventRelay::Subscribe(Connection *connection, const std::string &pattern) {
+    if (std::find(connections_.begin(), connections_.end(), connection) == connections_.end()) {
+        return false;
+    }
+    // the first subscription also switches the connection from receiving everything to receiving only what it
+    // subscribes to
+    bool changed = subscriptions_.Add(pattern, connection);
+    changed = subscribers_.insert(connection).second || changed;
+    if (changed) {
+        routes_.clear();
+        patterns_[connection].insert(pattern);
+        links_changed_ = true;
+    }
+    return changed;
+}
+
+
+bool EventRelay::Unsubscribe(Connection *connection, const std::string &pattern) {
+    if (!subscriptions_.Remove(pattern, connection)) {
+        return false;
+    }
+    routes_.clear();
+    patterns_[connection].erase(pattern);
+    links_changed_ = true;
+    return true;
+}
+
+
+int EventRelay::get_num_subscribers() const {
+    return (int)subscribers_.size();
+}
+
+
+void EventRelay::UpdateLinkSubscriptions() {
+    links_changed_ = false;
+    for (std::unordered_map<Connection*, LinkPeer>::iterator l = links_.begin(); l != links_.end(); l++) {
+        Connection *link = l->first;
+        LinkPeer &peer = l->second;
+        if (disconnected_.count(link) != 0) {
+            continue;
+        }
+        // what every other connection wants, including the other links, i.e., the relays beyond them
+        std::set<std::string> wanted;
+        for (int i=0; i<connections_.size(); i++) {
+            Connection *c = connections_[i];
+            if ((c == link) || (disconnected_.count(c) != 0)) {
+                continue;
+            }
+            if (subscribers_.count(c) == 0) {
+                wanted.insert("*");
+                continue;
+            }
+            std::unordered_map<Connection*, std::set<std::string>>::const_iterator p = patterns_.find(c);
+            if (p != patterns_.end()) {
+                wanted.insert(p->second.begin(), p->second.end());
+            }
+        }
+        if (wanted.count("*") != 0) {
+            wanted = std::set<std::string>({"*"});
+        }
+        if (!peer.subscribed) {
+            if (wanted.count("*") != 0) {
+                continue;
+            }
+            // the first subscription switches the link from receiving everything to only what it subscribes to
+            link->QueueVREvent(VREventString("RelaySubscribe", "*"));
+            peer.patterns.insert("*");
+            peer.subscribed = true;
+        }
+        // the new patterns first, so nothing wanted is missed in between
+        for (std::set<std::string>::const_iterator w = wanted.begin(); w != wanted.end(); w++) {
+            if (peer.patterns.insert(*w).second) {
+                link->QueueVREvent(VREventString("RelaySubscribe", *w));
+            }
+        }
+        for (std::set<std::string>::iterator p = peer.patterns.begin(); p != peer.patterns.end(); ) {
+            if (wanted.count(*p) == 0) {
+                link->QueueVREvent(VREventString("RelayUnsubscribe", *p));
+                p = peer.patterns.erase(p);
+            }
+            else {
+                p++;
+            }
+        }
+    }
+}
+
+
+const std::vector<Connection*>& EventRelay::Subscribers(const std::string &name) {
+    std::unordered_map<std::string, std::vector<Connection*>>::const_iterator it = routes_.find(name);
+    if (it != routes_.end()) {
+        return it->second;
+    }
+    // a client that makes up endless names does not get to grow the cache forever
+    if (routes_.size() >= 10000) {
+        routes_.clear();
+    }
+    std::vector<Connection*> &subscribers = routes_[name];
+    subscriptions_.Match(name, &subscribers);
+    return subscribers;
+}
+
+
+void EventRelay::Send(const OutboundFramePtr &frame) {
+    Relay(NULL, frame);
+}
+
+
+void EventRelay::Relay(Connection *source, const OutboundFramePtr &frame) {
+    // This just queues the sends, they happen when the relay is flushed.
+    dest_fds_.clear();
+    routed_.reset();
+    compact_made_ = false;
+    compact_json_.reset();
+    compact_binary_.reset();
+    msgpack_made_ = false;
+    msgpack_.reset();
+    // never back over the link it came from
+    bool skip_source = (!relay_to_source_) || (from_link_);
+    for (int i=0; i<connections_.size(); i++) {
+        Connection *dest = connections_[i];
+        if (((skip_source) && (dest == source)) || (disconnected_.count(dest) != 0)) {
+            continue;
+        }
+        if ((subscribers_.empty()) || (subscribers_.count(dest) == 0)) {
+            QueueTo(dest, frame);
+        }
+    }
+    if (!subscribers_.empty()) {
+        const std::vector<Connection*> &subscribers = Subscribers(frame->name);
+        for (int i=0; i<subscribers.size(); i++) {
+            Connection *dest = subscribers[i];
+            if (((skip_source) && (dest == source)) || (disconnected_.count(dest) != 0)) {
+                continue;
+            }
+            QueueTo(dest, frame);
+        }
+    }
+    if (!dest_fds_.empty()) {
+        batch_->QueueString(dest_fds_, frame->body);
+    }
+    if (source != NULL) {
+        if (relay_callback_) {
+            relay_callback_(frame);
+        }
+        num_relayed_++;
+    }
+}
+
+
+void EventRelay::QueueTo(Connection *dest, const OutboundFramePtr &frame) {
+    if ((!links_.empty()) && (links_.count(dest) != 0)) {
+        QueueFrameTo(dest, PrepareRouted(frame));
+        return;
+    }
+    if (num_dictionary_peers_ > 0) {
+        std::unordered_map<Connection*, DictionaryPeer>::iterator it = dictionary_peers_.find(dest);
+        if ((it != dictionary_peers_.end()) && (it->second.version > 0)) {
+            OutboundFramePtr compact = PrepareCompact(dest, &it->second, frame);
+            if (compact) {
+                // never through the batch, so it stays in order with the definitions and the accept
+                QueueFrameTo(dest, compact);
+                return;
+            }
+        }
+    }
+    if (dest->get_event_format() == Connection::MSGPACK_FORMAT) {
+        OutboundFramePtr packed = PrepareMsgPack(frame);
+        if (packed) {
+            QueueFrameTo(dest, packed);
+            return;
+        }
+    }
+    if ((batch_ != NULL) && (!non_blocking_) && (dest->get_socket() != INVALID_SOCKET)) {
+        dest_fds_.push_back(dest->get_socket());
+        return;
+    }
+    QueueFrameTo(dest, frame);
+}
+
+
+OutboundFramePtr EventRelay::PrepareCompact(Connection *dest, DictionaryPeer *peer, const OutboundFramePtr &frame) {
+    // each form is made once per event, however many peers it goes to
+    if (!compact_made_) {
+        compact_made_ = true;
+        compact_id_ = -1;
+        if (!VREvent::PeekFields(frame->body, &name_, &data_type_name_, &data_)) {
+            return OutboundFramePtr();
+        }
+        bool added;
+        compact_id_ = dictionary_.Assign(name_, data_type_name_, &added);
+        if (compact_id_ < 0) {
+            return OutboundFramePtr();
+        }
+        if (added) {
+            definitions_.push_back(std::make_shared<const OutboundFrame>(
+                EventDictionary::MakeDefinition(compact_id_, name_, data_type_name_), "", false, "", true));
+        }
+    }
+    if (compact_id_ < 0) {
+        return OutboundFramePtr();
+    }
+
+    if ((peer->version >= 2) && (!compact_binary_) && (VREvent::HasBinaryLayout(data_type_name_))) {
+        if (has_binary_data_) {
+            // it arrived that way, see ReadFrom()
+            compact_binary_ = std::make_shared<const OutboundFrame>(EventDictionary::MakeBinaryEvent(compact_id_,
+                binary_data_.data(), binary_data_.size()), frame->key, frame->latest_value, frame->name);
+        }
+        else {
+            VREvent *e = VREvent::CreateFromData(name_, data_type_name_, data_);
+            if (e != NULL) {
+                compact_binary_ = std::make_shared<const OutboundFrame>(EventDictionary::MakeBinaryEvent(compact_id_, *e),
+                                                                        frame->key, frame->latest_value, frame->name);
+                delete e;
+            }
+        }
+    }
+    OutboundFramePtr compact = compact_binary_;
+    if ((peer->version < 2) || (!compact)) {
+        if (!compact_json_) {
+            compact_json_ = std::make_shared<const OutboundFrame>(EventDictionary::MakeEvent(compact_id_, data_),
+                                                                  frame->key, frame->latest_value, frame->name);
+        }
+        compact = compact_json_;
+    }
+
+    if (peer->defined.size() <= compact_id_) {
+        peer->defined.resize(compact_id_ + 1, false);
+    }
+    if (!peer->defined[compact_id_]) {
+        QueueFrameTo(dest, definitions_[compact_id_]);
+        peer->defined[compact_id_] = true;
+    }
+    return compact;
+}
+
+
+OutboundFramePtr EventRelay::PrepareRouted(const OutboundFramePtr &frame) {
+    // made once per event, however many links it goes to
+    if (!routed_) {
+        std::string body = from_link_ ? RelayFederation::MakeRoutedFrame(link_origin_, link_hops_ + 1, frame->body) :
+            RelayFederation::MakeRoutedFrame(relay_id_, 1, frame->body);
+        routed_ = std::make_shared<const OutboundFrame>(std::move(body), frame->key, frame->latest_value, frame->name);
+    }
+    return routed_;
+}
+
+
+OutboundFramePtr EventRelay::PrepareMsgPack(const OutboundFramePtr &frame) {
+    // made once per event, however many peers it goes to
+    if (msgpack_made_) {
+        return msgpack_;
+    }
+    msgpack_made_ = true;
+    if (has_msgpack_frame_) {
+        // it arrived that way, see ReadFrom()
+        msgpack_ = std::make_shared<const OutboundFrame>(msgpack_frame_, frame->key, frame->latest_value,
+                                                         frame->name);
+        return msgpack_;
+    }
+    if (!VREvent::PeekFields(frame->body, &name_, &data_type_name_, &data_)) {
+        return msgpack_;
+    }
+    VREvent *e = VREvent::CreateFromData(name_, data_type_name_, data_);
+    std::string packed;
+    if ((e != NULL) && (MsgPackCodec::Encode(*e, &packed))) {
+        msgpack_ = std::make_shared<const OutboundFrame>(std::move(packed), frame->key, frame->latest_value,
+                                                         frame->name);
+    }
+    delete e;
+    return msgpack_;
+}
+
+
+void EventRelay::QueueFrameTo(Connection *dest, const OutboundFramePtr &frame) {
+    dest->QueueFrame(frame);
+    // a large burst read in one pass could overflow the queue before the flush at the end of the pass,
+    // so a connection that is not known to be full is written to as soon as its queue is half full
+    if ((non_blocking_) && (send_limit_ > 0) && (waiting_.count(dest) == 0) && (dest->get_send_queue() != NULL) &&
+        (dest->get_send_queue()->get_num_bytes() > send_limit_ / 2))
+    {
+        Connection::FlushResult r = dest->TryFlush();
+        if (r == Connection::FLUSH_PENDING) {
+            SetWaiting(dest, true);
+        }
+        else if (r == Connection::FLUSH_ERROR) {
+            disconnected_.insert(dest);
+        }
+    }
+}
+
+
+void EventRelay::Flush(double timeout_ms) {
+    if (links_changed_) {
+        UpdateLinkSubscriptions();
+    }
+    if ((batch_ != NULL) && (batch_->get_num_queued() > 0)) {
+        std::vector<SOCKET> failed_fds;
+        if (!batch_->Submit(timeout_ms, &failed_fds)) {
+            // If there was a problem sending, then assume the client disconnected
+            for (int i=0; i<connections_.size(); i++) {
+                if (std::find(failed_fds.begin(), failed_fds.end(), connections_[i]->get_socket()) != failed_fds.end()) {
+                    disconnected_.insert(connections_[i]);
+                }
+            }
+        }
+    }
+    for (int i=0; i<connections_.size(); i++) {
+        Connection *c = connections_[i];
+        if (disconnected_.count(c) != 0) {
+            continue;
+        }
+        if (!non_blocking_) {
+            if (!c->Flush(timeout_ms)) {
+                disconnected_.insert(c);
+            }
+        }
+        else if (waiting_.count(c) != 0) {
+            // nothing more can go until the socket is writable, but an overflow is noticed straight away
+            if ((c->get_send_queue() != NULL) && (c->get_send_queue()->is_overflowed())) {
+                disconnected_.insert(c);
+            }
+        }
+        else {
+            Connection::FlushResult r = c->TryFlush();
+            if (r == Connection::FLUSH_PENDING) {
+                SetWaiting(c, true);
+            }
+            else if (r == Connection::FLUSH_ERROR) {
+                disconnected_.insert(c);
+            }
+        }
+    }
+}
+
+
+void EventRelay::WriteTo(Connection *connection) {
+    if (disconnected_.count(connection) != 0) {
+        return;
+    }
+    Connection::FlushResult r = connection->TryFlush();
+    if (r == Connection::FLUSH_DONE) {
+        SetWaiting(connection, false);
+    }
+    else if (r == Connection::FLUSH_ERROR) {
+        disconnected_.insert(connection);
+    }
+}
+
+
+void EventRelay::SetWaiting(Connection *connection, bool waiting) {
+    bool was_waiting = (waiting_.count(connection) != 0);
+    if (waiting == was_waiting) {
+        return;
+    }
+    if (waiting) {
+        waiting_.insert(connection);
+    }
+    else {
+        waiting_.erase(connection);
+    }
+    if (writable_callback_) {
+        writable_callback_(connection, waiting);
+    }
+}
+
+
+void EventRelay::RemoveDisconnected() {
+    if (disconnected_.empty()) {
+        return;
+    }
+    for (auto d = disconnected_.begin(); d != disconnected_.end(); d++) {
+        Connection *c = *d;
+        auto it = std::find(connections_.begin(), connections_.end(), c);
+        if (it != connections_.end()) {
+            if (disconnect_callback_) {
+                disconnect_callback_(c);
+            }
+            connections_.erase(it);
+            waiting_.erase(c);
+            if (subscribers_.erase(c) != 0) {
+                subscriptions_.RemoveAll(c);
+                routes_.clear();
+            }
+            patterns_.erase(c);
+            links_.erase(c);
+            may_link_.erase(c);
+            links_changed_ = true;
+            std::unordered_map<Connection*, DictionaryPeer>::iterator peer = dictionary_peers_.find(c);
+            if (peer != dictionary_peers_.end()) {
+                if (peer->second.version > 0) {
+                    num_dictionary_peers_--;
+                }
+                dictionary_peers_.erase(peer);
+            }
+            delete c;
+        }
+    }
+    disconnected_.clear();
+}
+
+
+int EventRelay::Poll(double timeout_ms) {
+    uint64_t num_before = num_relayed_;
+    for (int i=0; i<listeners_.size(); i++) {
+        AcceptFrom(listeners_[i]);
+    }
+    for (int i=0; i<connections_.size(); i++) {
+        ReadFrom(connections_[i]);
+    }
+    // there is no reactor to say when a full connection has room again, so just try
+    std::vector<Connection*> waiting(waiting_.begin(), waiting_.end());
+    for (int i=0; i<waiting.size(); i++) {
+        WriteTo(waiting[i]);
+    }
+    Flush(timeout_ms);
+    RemoveDisconnected();
+    return (int)(num_relayed_ - num_before);
+}
+
+
+void EventRelay::set_batch_io(NetBatchIO *batch) {
+    batch_ = batch;
+}
+
+
+void EventRelay::set_send_limit(int64_t max_bytes, SendQueue::OverflowPolicy policy) {
+    non_blocking_ = true;
+    send_limit_ = max_bytes;
+    overflow_policy_ = policy;
+    for (int i=0; i<connections_.size(); i++) {
+        connections_[i]->set_send_limit(send_limit_, overflow_policy_);
+    }
+}
+
+
+void EventRelay::set_coalesce_patterns(const std::vector<std::string> &patterns) {
+    coalesce_patterns_ = patterns;
+    latest_value_names_.clear();
+}
+
+
+const std::vector<std::string>& EventRelay::get_coalesce_patterns() const {
+    return coalesce_patterns_;
+}
+
+
+bool EventRelay::is_latest_value(const std::string &name) {
+    std::unordered_map<std::string, bool>::const_iterator it = latest_value_names_.find(name);
+    if (it != latest_value_names_.end()) {
+        return it->second;
+    }
+    bool match = false;
+    for (int i=0; (i<coalesce_patterns_.size()) && (!match); i++) {
+        match = MinVRUtils::MatchesWildcard(name, coalesce_patterns_[i]);
+    }
+    // a client that makes up endless names does not get to grow the cache forever
+    if (latest_value_names_.size() < 10000) {
+        latest_value_names_[name] = match;
+    }
+    return match;
+}
+
+
+void EventRelay::set_writable_callback(const WritableCallback &callback) {
+    writable_callback_ = callback;
+}
+
+
+void EventRelay::set_connect_callback(const ConnectionCallback &callback) {
+    connect_callback_ = callback;
+}
+
+
+void EventRelay::set_disconnect_callback(const ConnectionCallback &callback) {
+    disconnect_callback_ = callback;
+}
+
+
+void EventRelay::set_relay_callback(const RelayCallback &callback) {
+    relay_callback_ = callback;
+}
+
+
+bool EventRelay::is_shutdown_requested() const {
+    return shutdown_;
+}
+
+
+const std::vector<Listener*>& EventRelay::get_listeners() const {
+    return listeners_;
+}
+
+
+const std::vector<Connection*>& EventRelay::get_connections() const {
+    return connections_;
+}
+
+
+uint64_t EventRelay::get_num_events_relayed() const {
+    return num_relayed_;
+}
+
+
+bool EventRelay::is_link(Connection *connection) const {
+    return links_.count(connection) != 0;
+}
+
+
+int EventRelay::get_num_links() const {
+    return (int)links_.size();
+}
+
+
+void EventRelay::set_relay_id(const std::string &id) {
+    relay_id_ = id;
+    chain_ = id;
+}
+
+
+const std::string& EventRelay::get_relay_id() const {
+    return relay_id_;
+}
+
+
+uint64_t EventRelay::get_num_looped() const {
+    return num_looped_;
+}
@@ -0,0 +1,311 @@
+/**
+  The core of minvr3_relay_server: every VREvent received on any connection is relayed to all connections,
+  optionally including the one it came from.  EventRelay only uses the Connection and Listener interfaces, so
+  it relays between any mix of transports, and it does no waiting of its own, so it can be driven either by a
+  NetReactor or by calling Poll() in a loop.
+
+  Driven by a NetReactor (as minvr3_relay_server does), the program calls AcceptFrom() when a listener's
+  socket is ready and ReadFrom() when a connection's socket is ready, then Flush() and RemoveDisconnected()
+  once per pass.  The connect and disconnect callbacks are where the program adds sockets to its reactor and
+  removes them again.
+
+  Driven by Poll(), e.g., for memory connections, which have no socket:
+  ```
+  EventRelay relay;
+  relay.AddListener(Listener::Create("mem:relay"));
+  while (!relay.is_shutdown_requested()) {
+      relay.Poll();
+  }
+  ```
+
+  All events received during one pass are sent together when the relay is flushed.  By default, Flush() waits
+  for each connection in turn to take its events, so one slow receiver delays everybody.  After
+  set_send_limit(), Flush() never waits: each connection gets a bounded send queue, whatever a connection
+  cannot take right away stays in its queue, and the writable callback asks the program to call WriteTo() once
+  the connection's socket can take more.  A receiver that keeps falling behind then only costs its own queue
+  space, and the overflow policy decides which of its events are given up, while every other receiver gets
+  its events as soon as they arrive.
+
+  For high-rate streams where only the current value matters, such as tracker poses, set_coalesce_patterns()
+  names the events (by wildcard, e.g., "Tracker/" followed by *) for which a receiver that is behind is only sent
+  the newest value: each such event replaces the one with the same name still waiting in the receiver's queue (see
+  SendQueue).  Every other event, e.g., a button press, is still delivered, and everything arrives in order.
+
+  Clients can also ask for only the events they need, e.g., a projector node that only needs the head pose, by
+  sending the relay a VREventString named "RelaySubscribe" whose data is an event name or pattern ("Head/Position",
+  or "Head/" followed by * for every head event, see SubscriptionTrie), or "RelayUnsubscribe" to take one back (see
+  Connection::Subscribe()).  These control events are not relayed.  A client that has never subscribed receives
+  every event; once it has, it only receives events matching its subscriptions.  A client that asks for more than
+  MAX_SUBSCRIPTIONS patterns at once (MAX_LINK_SUBSCRIPTIONS for a link to another relay) is dropped, so one
+  client cannot grow the trie without limit.  The destinations of each event name are worked out once, from the
+  trie, and kept until the subscriptions change, so the cost of relaying an event grows with the number of
+  clients that want it rather than the number connected.
+
+  Clients that send "EventDictionaryOffer" (see Connection::OfferEventDictionary()) are answered with
+  "EventDictionaryAccept", and from then on are sent events in EventDictionary's short form, without their
+  names, and with protocol version 2 with their data in binary.  The relay numbers the names itself, once for
+  every such client, so each event is still encoded once however many of them it goes to; each client is sent
+  the definition of a name the first time it needs it.  Events that arrive in the short form are turned back
+  into json when they are read, for everybody else.  Clients that accept protocol version 3 are also sent large
+  events in fragments, with smaller events going out between the fragments (see SendQueue::set_fragment_size()),
+  so a client receiving a mesh from one client and tracker events from another gets the tracker events on
+  time; the relay reassembles fragmented events as it reads them.
+
+  In the same way, clients that send a VREventString named "RelayEventFormat" holding "msgpack" (see
+  Connection::RequestEventFormat()) are sent events as MessagePack (see MsgPackCodec), made once per event, and
+  events that arrive as MessagePack are read back into json, and passed on as they came to those clients.
+
+  Events are relayed as the exact bytes that arrived, without being parsed or serialized again; the relay only
+  scans each event for its name (see VREvent::PeekName()), and falls back to parsing it when the scan cannot
+  tell.  The bytes are held in one OutboundFrame that every connection's send queue shares.
+
+  Relays can be linked into a tree with AddLink(), e.g., one per site, so each event crosses the link between
+  two sites once rather than once per client at the far end (see RelayFederation).
+
+  With set_batch_io() (and no send limit), events for connections that have a socket are handed to a
+  NetBatchIO instead, which stores each relayed event once no matter how many connections it goes to and sends
+  to all of them with as few system calls as possible.
+ */
+
+#ifndef MINVR3_EVENT_RELAY_H
+#define MINVR3_EVENT_RELAY_H
+
+#include "connection.h"
+#include "event_dictionary.h"
+#include "msgpack_codec.h"
+#include "net_batch_io.h"
+#include "relay_federation.h"
+#include "subscription_trie.h"
+
+#include <functional>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+class EventRelay {
+public:
+    typedef std::function<void(Connection *connection)> ConnectionCallback;
+    typedef std::function<void(const OutboundFramePtr &frame)> RelayCallback;
+    typedef std::function<void(Connection *connection, bool waiting)> WritableCallback;
+
+    /// Most patterns a client can be subscribed to through "RelaySubscribe".
+    static const int MAX_SUBSCRIPTIONS = 1000;
+
+    /// Same, for a link to another relay, which subscribes for everybody beyond it.
+    static const int MAX_LINK_SUBSCRIPTIONS = 100000;
+
+    EventRelay(bool relay_to_source=true);
+
+    /// Closes and deletes every listener and connection.
+    virtual ~EventRelay();
+
+    /// Takes ownership of the listener.
+    void AddListener(Listener *listener);
+
+    /// Same, for a listener the relays below this one connect to: connections accepted from it may link to this
+    /// relay by sending "RelayLink" (see RelayFederation), and are otherwise clients like any other.  A connection
+    /// from any other listener that sends "RelayLink" is dropped.
+    void AddLinkListener(Listener *listener);
+
+    /// True if the listener was added with AddLinkListener().
+    bool is_link_listener(Listener *listener) const;
+
+    /// Takes ownership of the connection and starts relaying events to and from it.
+    void AddConnection(Connection *connection);
+
+    /// Same, for a connection handed over from another relay process (see minvr3_relay_server --handover), with
+    /// what that relay knew about it from GetConnectionState(), so the client carries on as it was.  Returns false,
+    /// with an error message, if state cannot be read, in which case the connection is treated as new.
+    bool AddConnection(Connection *connection, const std::string &state);
+
+    /// What the relay knows about a connection beyond the connection itself, as one line of json, to hand it over
+    /// to another relay: its subscriptions, the event format it asked for, the size of the fragments large events
+    /// are sent to it in, and the dictionary protocol version it accepted (so it is still sent the short form, and
+    /// binary data from version 2) with the event names it has defined for the events it sends.  The relay taking
+    /// over sends the definitions of its own ids again as they are needed.  For a link to another relay, also the
+    /// other relay's id and what this relay is subscribed to on it, so the link carries on as a link.
+    std::string GetConnectionState(Connection *connection) const;
+
+    /// Accepts every connection waiting on the listener.  Returns the number accepted.
+    int AcceptFrom(Listener *listener);
+
+    /// Reads everything that has arrived on the connection and queues each event it holds for every
+    /// destination.  A connection that turns out to be closed is marked as disconnected.
+    void ReadFrom(Connection *connection);
+
+    /// Queues an event that arrived by some other means (e.g., on another EventRelay) for every connection.
+    void Send(const OutboundFramePtr &frame);
+
+    /// Sends everything queued since the last flush.  Connections that fail are marked as disconnected.
+    /// timeout_ms only applies when there is no send limit.
+    void Flush(double timeout_ms=0);
+
+    /// With a send limit, sends more of what is queued for a connection that was waiting to become writable.
+    void WriteTo(Connection *connection);
+
+    /// Calls the disconnect callback for, closes, and deletes every connection marked as disconnected.
+    void RemoveDisconnected();
+
+    /// One pass over everything, without waiting: accepts from every listener, reads from every connection,
+    /// writes to connections that were waiting to become writable, flushes, and removes disconnected
+    /// connections.  Returns the number of events relayed.
+    int Poll(double timeout_ms=0);
+
+    /// Events for connections that have a socket are queued in batch rather than in the connections, and are
+    /// sent when Flush() submits it.  Not used once there is a send limit.
+    void set_batch_io(NetBatchIO *batch);
+
+    /// Switches to non-blocking sends, with at most max_bytes queued for each connection (0 for no limit) and
+    /// policy deciding what happens to events that do not fit.  Events are coalesced by name, or only those that
+    /// match a coalesce pattern, if there are any.
+    void set_send_limit(int64_t max_bytes, SendQueue::OverflowPolicy policy);
+
+    /// Events whose names match any of these wildcard patterns (see MinVRUtils::MatchesWildcard()) are relayed
+    /// as latest values: a receiver that is behind only gets the newest of each.  Only applies with a send
+    /// limit, since that is when receivers have queues.
+    void set_coalesce_patterns(const std::vector<std::string> &patterns);
+    const std::vector<std::string>& get_coalesce_patterns() const;
+
+    /// True if events named name are relayed as latest values.
+    bool is_latest_value(const std::string &name);
+
+    /// Subscriptions can also be made for a connection directly, as if it had sent "RelaySubscribe", but without
+    /// the MAX_SUBSCRIPTIONS limit.  Returns false if the connection is not in the relay, or the subscription did
+    /// not change anything.
+    bool Subscribe(Connection *connection, const std::string &pattern);
+    bool Unsubscribe(Connection *connection, const std::string &pattern);
+
+    /// Number of connections that have subscribed, and so only receive what they asked for.
+    int get_num_subscribers() const;
+
+    /// Takes ownership of a connection to another relay, e.g., this relay's upstream relay, and links the two
+    /// (see RelayFederation): the link is subscribed to what this relay's other connections want, and events
+    /// cross it tagged with where they started, so they are never relayed back.  The other relay treats the
+    /// connection as a link once it has sent "RelayLink", which it only accepts on a link listener.
+    void AddLink(Connection *connection);
+
+    /// True if the connection is a link to another relay, made by either end.
+    bool is_link(Connection *connection) const;
+    int get_num_links() const;
+
+    /// The id this relay tags the events its clients send with when they cross a link, a random one by default.
+    /// Must not contain spaces.
+    void set_relay_id(const std::string &id);
+    const std::string& get_relay_id() const;
+
+    /// Number of events dropped because they came back over a link to the relay where they started, or had
+    /// crossed RelayFederation::MAX_HOPS links.
+    uint64_t get_num_looped() const;
+
+    /// Called with waiting == true when a connection's socket is full and WriteTo() should be called once it is
+    /// writable, and with waiting == false once everything queued for it has gone.
+    void set_writable_callback(const WritableCallback &callback);
+
+    /// Called for each connection that is added or accepted, e.g., to add its socket to a NetReactor.
+    void set_connect_callback(const ConnectionCallback &callback);
+
+    /// Called for each connection just before it is removed and deleted.
+    void set_disconnect_callback(const ConnectionCallback &callback);
+
+    /// Called with each relayed event, e.g., to publish it by some other means as well.  Events passed to
+    /// Send() are not included.
+    void set_relay_callback(const RelayCallback &callback);
+
+    /// True once an event named "Shutdown" has been relayed from one of this relay's own connections, rather than
+    /// over a link.
+    bool is_shutdown_requested() const;
+
+    const std::vector<Listener*>& get_listeners() const;
+    const std::vector<Connection*>& get_connections() const;
+    uint64_t get_num_events_relayed() const;
+
+private:
+    OutboundFramePtr MakeFrame(std::string &&body, const std::string &name);
+    bool HandleControl(Connection *connection, const std::string &name, const std::string &json);
+    bool HandleLinkControl(Connection *connection, const std::string &name, const std::string &json);
+    void UpdateLinkSubscriptions();
+    OutboundFramePtr PrepareRouted(const OutboundFramePtr &frame);
+    const std::vector<Connection*>& Subscribers(const std::string &name);
+    void Relay(Connection *source, const OutboundFramePtr &frame);
+    void QueueTo(Connection *dest, const OutboundFramePtr &frame);
+    struct DictionaryPeer;
+    OutboundFramePtr PrepareCompact(Connection *dest, DictionaryPeer *peer, const OutboundFramePtr &frame);
+    OutboundFramePtr PrepareMsgPack(const OutboundFramePtr &frame);
+    void QueueFrameTo(Connection *dest, const OutboundFramePtr &frame);
+    void SetWaiting(Connection *connection, bool waiting);
+
+    bool relay_to_source_;
+    std::vector<Listener*> listeners_;
+    std::vector<Connection*> connections_;
+    std::set<Connection*> disconnected_;
+    std::set<Connection*> waiting_;         // for their sockets to become writable
+    NetBatchIO *batch_;
+    bool non_blocking_;
+    int64_t send_limit_;
+    SendQueue::OverflowPolicy overflow_policy_;
+    ConnectionCallback connect_callback_;
+    ConnectionCallback disconnect_callback_;
+    RelayCallback relay_callback_;
+    WritableCallback writable_callback_;
+    bool shutdown_;
+    uint64_t num_relayed_;
+    std::vector<std::string> coalesce_patterns_;
+    std::unordered_map<std::string, bool> latest_value_names_;     // is_latest_value() of each name seen so far
+    SubscriptionTrie subscriptions_;
+    std::set<Connection*> subscribers_;
+    std::unordered_map<std::string, std::vector<Connection*>> routes_;    // subscribers of each name seen so far
+    std::unordered_map<Connection*, std::set<std::string>> patterns_;      // of each subscriber, for the links
+
+    struct LinkPeer {
+        std::string id;                     // of the relay at the other end, once known
+        bool subscribed;                    // it has been sent a subscription, so no longer sends everything
+        std::set<std::string> patterns;     // this relay is subscribed to on it
+        LinkPeer() : subscribed(false) {}
+    };
+    std::unordered_map<Connection*, LinkPeer> links_;
+    std::set<Listener*> link_listeners_;
+    std::set<Connection*> may_link_;    // accepted from a link listener
+    bool links_changed_;                // the links' subscriptions may need updating, see UpdateLinkSubscriptions()
+    std::string relay_id_;
+    std::string chain_;                 // ids from this relay up to the root of its tree
+    uint64_t num_looped_;
+    // where the event being relayed started and how many links it has crossed, if it came over a link, and it
+    // as a ROUTED frame, made for the first link that needs it
+    bool from_link_;
+    std::string link_origin_;
+    int link_hops_;
+    OutboundFramePtr routed_;
+
+    struct DictionaryPeer {
+        EventDictionary received;       // the ids of the events it sends
+        std::vector<bool> defined;      // the relay's ids it has been sent the definition of
+        int version;                    // the protocol version it is sent, 0 until it offers one
+        DictionaryPeer() : version(0) {}
+    };
+    std::unordered_map<Connection*, DictionaryPeer> dictionary_peers_;
+    int num_dictionary_peers_;          // that have offered
+    EventDictionary dictionary_;        // the relay's ids of the events it sends
+    std::vector<OutboundFramePtr> definitions_;     // by id
+    // the event being relayed, in the short form of each version, made for the first peer that needs it
+    OutboundFramePtr compact_json_;
+    OutboundFramePtr compact_binary_;
+    int compact_id_;
+    bool compact_made_;
+    std::string binary_data_;           // of the event being relayed, if it arrived in the binary form
+    bool has_binary_data_;
+    // and as MessagePack, see PrepareMsgPack()
+    OutboundFramePtr msgpack_;
+    bool msgpack_made_;
+    std::string msgpack_frame_;         // the event being relayed, if it arrived as MessagePack
+    bool has_msgpack_frame_;
+
+    // reused between calls
+    std::vector<std::string> frames_;
+    std::vector<SOCKET> dest_fds_;
+    std::string name_, data_type_name_, data_;
+};
+
+#endif
@@ -0,0 +1,360 @@
+
+#include "frame_decoder.h"
+
+#include "min_net.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+
+#ifdef WIN32
+#include <winsock2.h>
+#else
+#include <errno.h>
+#include <sys/socket.h>
+#endif
+
+
+FrameBatch::FrameBatch() : num_frames_(0) {
+}
+
+
+FrameBatch::~FrameBatch() {
+}
+
+
+void FrameBatch::Clear() {
+    num_frames_ = 0;
+}
+
+
+void FrameBatch::Append(const char *data, int len) {
+    if (num_frames_ == frames_.size()) {
+        frames_.push_back(std::string());
+    }
+    frames_[num_frames_].assign(data, len);
+    num_frames_++;
+}
+
+
+int FrameBatch::get_num_frames() const {
+    return num_frames_;
+}
+
+
+const std::string& FrameBatch::get_frame(int i) const {
+    return frames_[i];
+}
+
+
+std::string* FrameBatch::get_frame_ptr(int i) {
+    return &frames_[i];
+}
+
+
+
+const uint8_t FrameDecoder::FRAGMENT_MARKER;
+
+
+FrameDecoder::FrameDecoder(int read_size) :
+    start_(0), end_(0), read_size_(read_size), max_frame_size_(MinNet::get_max_frame_size()), too_large_(false),
+    reassemble_(false), assembling_(false), assembled_total_(0)
+{
+}
+
+
+FrameDecoder::~FrameDecoder() {
+}
+
+
+void FrameDecoder::MakeSpace(int min_free) {
+    if (start_ == end_) {
+        // everything has been consumed, start over at the front
+        start_ = 0;
+        end_ = 0;
+    }
+    if ((int)buf_.size() - end_ >= min_free) {
+        return;
+    }
+    // slide the unconsumed bytes to the front before growing
+    if (start_ > 0) {
+        memmove(buf_.data(), buf_.data() + start_, end_ - start_);
+        end_ -= start_;
+        start_ = 0;
+    }
+    if ((int)buf_.size() - end_ < min_free) {
+        buf_.resize(end_ + min_free);
+    }
+}
+
+
+static uint32_t ReadUInt32LE(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+bool FrameDecoder::CheckFrameSize(uint32_t len) {
+    if ((len > max_frame_size_) && (!too_large_)) {
+        std::cerr << "FrameDecoder Error: Frame of " << len << " bytes is larger than the maximum of "
+            << max_frame_size_ << "." << std::endl;
+        too_large_ = true;
+    }
+    return !too_large_;
+}
+
+
+FrameDecoder::ReadResult FrameDecoder::ReadFrom(SOCKET socket_fd) {
+    int min_free = read_size_;
+    if (end_ - start_ >= 4) {
+        // checked before making any room for it
+        uint32_t len = ReadUInt32LE(&buf_[start_]);
+        if (!CheckFrameSize(len)) {
+            return READ_ERROR;
+        }
+        // if a large frame is partially here, make room for all of it so it can arrive in one read
+        int64_t needed = 4 + (int64_t)len - (end_ - start_);
+        if (needed > min_free) {
+            min_free = (int)needed;
+        }
+    }
+    MakeSpace(min_free);
+    int space = (int)buf_.size() - end_;
+
+#ifdef WIN32
+    // no MSG_DONTWAIT on windows, so check for readability first; a socket that is readable with nothing to
+    // read has been closed by the peer, and the recv() below reports that by returning 0
+    WSAPOLLFD p;
+    p.fd = socket_fd;
+    p.events = POLLRDNORM;
+    p.revents = 0;
+    if (WSAPoll(&p, 1, 0) == SOCKET_ERROR) {
+        return READ_ERROR;
+    }
+    if (p.revents == 0) {
+        return READ_WOULD_BLOCK;
+    }
+    u_long available = 0;
+    if ((ioctlsocket(socket_fd, FIONREAD, &available) == 0) && (available > 0) && ((int)available < space)) {
+        space = (int)available;
+    }
+    int n = recv(socket_fd, (char*)(buf_.data() + end_), space, 0);
+    if (n == SOCKET_ERROR) {
+        return (WSAGetLastError() == WSAEWOULDBLOCK) ? READ_WOULD_BLOCK : READ_ERROR;
+    }
+#else
+    int n = (int)recv(socket_fd, (void*)(buf_.data() + end_), space, MSG_DONTWAIT);
+    if (n == SOCKET_ERROR) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+            return READ_WOULD_BLOCK;
+        }
+        return READ_ERROR;
+    }
+#endif
+    if (n == 0) {
+        return READ_CLOSED;
+    }
+    MinNet::RearmQuickAck(socket_fd);
+    end_ += n;
+    return READ_OK;
+}
+
+
+void FrameDecoder::Append(const uint8_t *data, int len) {
+    MakeSpace(len);
+    memcpy(buf_.data() + end_, data, len);
+    end_ += len;
+}
+
+
+// The length of the whole frame a fragment is part of, and where its share of the frame starts.
+static bool ReadFragmentTotal(const uint8_t *body, uint32_t len, uint32_t *total, uint32_t *pos) {
+    *total = 0;
+    *pos = 1;
+    for (int shift = 0; (shift < 32) && (*pos < len); shift += 7) {
+        uint8_t b = body[(*pos)++];
+        *total |= (uint32_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool IsFragment(const uint8_t *body, uint32_t len) {
+    return (len > 0) && (body[0] == FrameDecoder::FRAGMENT_MARKER);
+}
+
+
+bool FrameDecoder::AddFragment(const uint8_t *body, uint32_t len) {
+    uint32_t total, pos;
+    if (!ReadFragmentTotal(body, len, &total, &pos)) {
+        std::cerr << "FrameDecoder Error: Malformed fragment." << std::endl;
+        assembling_ = false;
+        return false;
+    }
+    if (!CheckFrameSize(total)) {
+        return false;
+    }
+    if ((assembling_) && (total != assembled_total_)) {
+        std::cerr << "FrameDecoder Error: Fragment of a new frame before the last one was complete." << std::endl;
+        assembling_ = false;
+    }
+    if (!assembling_) {
+        assembling_ = true;
+        assembled_total_ = total;
+        // the total is only what the peer claims, so the space is made as the fragments actually arrive
+        assembled_.clear();
+    }
+    if (assembled_.size() + (len - pos) > total) {
+        std::cerr << "FrameDecoder Error: Fragments add up to more than their frame." << std::endl;
+        assembling_ = false;
+        return false;
+    }
+    assembled_.append((const char*)body + pos, len - pos);
+    if (assembled_.size() < total) {
+        return false;
+    }
+    assembling_ = false;
+    return true;
+}
+
+
+bool FrameDecoder::NextFrame(std::string *frame) {
+    while ((end_ - start_ >= 4) && (!too_large_)) {
+        uint32_t len = ReadUInt32LE(&buf_[start_]);
+        if ((!CheckFrameSize(len)) || ((uint64_t)(end_ - start_) < 4 + (uint64_t)len)) {
+            return false;
+        }
+        const uint8_t *body = buf_.data() + start_ + 4;
+        start_ += 4 + len;
+        if ((!reassemble_) || (!IsFragment(body, len))) {
+            frame->assign((const char*)body, len);
+            return true;
+        }
+        if (AddFragment(body, len)) {
+            frame->assign(assembled_);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+int FrameDecoder::NextFrames(FrameBatch *frames) {
+    int n = 0;
+    while ((end_ - start_ >= 4) && (!too_large_)) {
+        uint32_t len = ReadUInt32LE(&buf_[start_]);
+        if ((!CheckFrameSize(len)) || ((uint64_t)(end_ - start_) < 4 + (uint64_t)len)) {
+            break;
+        }
+        const uint8_t *body = buf_.data() + start_ + 4;
+        start_ += 4 + len;
+        if ((!reassemble_) || (!IsFragment(body, len))) {
+            frames->Append((const char*)body, (int)len);
+            n++;
+        }
+        else if (AddFragment(body, len)) {
+            frames->Append(assembled_.data(), (int)assembled_.size());
+            n++;
+        }
+    }
+    return n;
+}
+
+
+bool FrameDecoder::HasFrame() const {
+    // the fragments buffered so far may or may not complete a frame
+    int pos = start_;
+    bool assembling = assembling_;
+    uint64_t assembled = assembled_.size();
+    uint32_t assembled_total = assembled_total_;
+    while ((end_ - pos >= 4) && (!too_large_)) {
+        uint32_t len = ReadUInt32LE(&buf_[pos]);
+        if ((len > max_frame_size_) || ((uint64_t)(end_ - pos) < 4 + (uint64_t)len)) {
+            return false;
+        }
+        const uint8_t *body = buf_.data() + pos + 4;
+        pos += 4 + len;
+        uint32_t total, start;
+        if ((!reassemble_) || (!IsFragment(body, len))) {
+            return true;
+        }
+        if (!ReadFragmentTotal(body, len, &total, &start)) {
+            assembling = false;
+            continue;
+        }
+        if ((!assembling) || (total != assembled_total)) {
+            assembling = true;
+            assembled = 0;
+            assembled_total = total;
+        }
+        assembled += len - start;
+        if (assembled >= total) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+int FrameDecoder::get_num_buffered_bytes() const {
+    return end_ - start_;
+}
+
+
+std::string FrameDecoder::get_buffered_data() const {
+    std::string data;
+    if (assembling_) {
+        // what has been put together so far goes first, as one fragment
+        std::string body(1, (char)FRAGMENT_MARKER);
+        uint32_t total = assembled_total_;
+        while (total >= 0x80) {
+            body.push_back((char)((total & 0x7f) | 0x80));
+            total >>= 7;
+        }
+        body.push_back((char)total);
+        body.append(assembled_);
+        uint32_t len = (uint32_t)body.size();
+        for (int i=0; i<4; i++) {
+            data.push_back((char)((len >> (8 * i)) & 0xff));
+        }
+        data.append(body);
+    }
+    data.append((const char*)buf_.data() + start_, end_ - start_);
+    return data;
+}
+
+
+void FrameDecoder::Clear() {
+    start_ = 0;
+    end_ = 0;
+    too_large_ = false;
+    assembling_ = false;
+    assembled_.clear();
+}
+
+
+void FrameDecoder::set_max_frame_size(uint32_t max_bytes) {
+    max_frame_size_ = std::min(max_bytes, (uint32_t)0x7FFFFFF0);
+}
+
+
+uint32_t FrameDecoder::get_max_frame_size() const {
+    return max_frame_size_;
+}
+
+
+bool FrameDecoder::is_frame_too_large() const {
+    return too_large_;
+}
+
+
+void FrameDecoder::set_reassemble_fragments(bool reassemble) {
+    reassemble_ = reassemble;
+}
+
+
+bool FrameDecoder::get_reassemble_fragments() const {
+    return reassemble_;
+}
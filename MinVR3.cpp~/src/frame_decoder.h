@@ -0,0 +1,153 @@
+/**
+  Per-connection input buffer that splits a MinNet byte stream back into the length-prefixed frames written by
+  MinNet::SendString().  Rather than making two blocking reads per message (one for the length and one for the
+  body), ReadFrom() makes a single non-blocking recv() that takes everything the kernel has buffered for the
+  socket.  NextFrame() then returns each complete frame in turn, and any partial frame at the end stays in the
+  buffer until the rest of it arrives with a later read.
+
+  Typical use with a NetReactor callback:
+  ```
+  FrameDecoder::ReadResult r;
+  while ((r = decoder.ReadFrom(fd)) == FrameDecoder::READ_OK) {
+      std::string frame;
+      while (decoder.NextFrame(&frame)) {
+          VREvent *e = VREvent::CreateFromJson(frame);
+          ...
+      }
+  }
+  if ((r == FrameDecoder::READ_CLOSED) || (r == FrameDecoder::READ_ERROR)) {
+      // drop the connection
+  }
+  ```
+
+  The length of each frame comes from the wire, so it is checked against get_max_frame_size() before any space
+  is made for the frame; a larger one (most likely a corrupt header) puts the decoder in an error state, and
+  ReadFrom() returns READ_ERROR from then on.
+
+  Frames too large to send in one piece without holding up everything behind them are sent in fragments by
+  SendQueue (see SendQueue::set_fragment_size()), each a frame of its own whose body is FRAGMENT_MARKER, the
+  length of the whole frame as an unsigned LEB128 varint, and the next part of the frame.  The fragments of one
+  frame are sent in order, with other whole frames possibly in between, and the next fragmented frame only
+  starts after the last one is complete.  Once set_reassemble_fragments() is on, which it should only be for a
+  peer that has agreed to send fragments, NextFrame() and NextFrames() put them back together and return the
+  frame once it is complete, so fragments are never seen by the decoder's users, and a frame sent in fragments
+  is checked against get_max_frame_size() like any other.  Space for the frame is only made as its fragments
+  arrive, never from the length a fragment claims.  Until then a fragment is returned as a frame like any
+  other, which nothing reads as an event.
+
+  At steady state the decoder does not allocate: its buffer grows to fit the largest frame (or read) seen and
+  is then reused, and NextFrame() copies into the caller's string, reusing its storage.  A FrameBatch does the
+  same for all of the frames returned by one call, e.g., Connection::ReceiveAvailableFrames().
+ */
+
+#ifndef MINVR3_FRAME_DECODER_H
+#define MINVR3_FRAME_DECODER_H
+
+#include "net_headers.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+/// Frames received together.  The strings are kept when the batch is cleared and reused for the next frames,
+/// so once a batch has held as many frames of a given size, receiving into it makes no heap allocations.
+class FrameBatch {
+public:
+    FrameBatch();
+    virtual ~FrameBatch();
+
+    /// Empties the batch, keeping the storage.
+    void Clear();
+
+    /// Adds a copy of data as the last frame.
+    void Append(const char *data, int len);
+
+    int get_num_frames() const;
+    const std::string& get_frame(int i) const;
+
+    /// The frame itself, e.g., to std::move() it somewhere else, at the price of its storage.
+    std::string* get_frame_ptr(int i);
+
+private:
+    std::vector<std::string> frames_;
+    int num_frames_;
+};
+
+
+class FrameDecoder {
+public:
+    /// First byte of a fragment's body, see above.  Neither json nor any of EventDictionary's frames start with it.
+    static const uint8_t FRAGMENT_MARKER = 0x04;
+
+    enum ReadResult {
+        READ_OK,            // some bytes were read, call NextFrame() to get any frames they completed
+        READ_WOULD_BLOCK,   // nothing more to read right now
+        READ_CLOSED,        // the peer closed the connection
+        READ_ERROR          // socket error, or a frame larger than the maximum
+    };
+
+    /// read_size is the minimum free space made available for each read.  The buffer grows beyond this as
+    /// needed to hold large frames, up to the maximum frame size, which starts out as MinNet::get_max_frame_size().
+    FrameDecoder(int read_size=65536);
+    virtual ~FrameDecoder();
+
+    /// Makes one non-blocking recv() into the free space at the end of the buffer.  The socket itself may be
+    /// in blocking or non-blocking mode.
+    ReadResult ReadFrom(SOCKET socket_fd);
+
+    /// Adds bytes that were received by some other means (e.g., NetBatchIO) to the end of the buffer.
+    void Append(const uint8_t *data, int len);
+
+    /// If the buffer holds at least one complete frame, copies the oldest one into frame, removes it from the
+    /// buffer, and returns true.  Otherwise returns false and leaves any partial frame in the buffer.
+    bool NextFrame(std::string *frame);
+
+    /// Moves every complete frame in the buffer to the end of frames.  Returns the number of frames moved.
+    int NextFrames(FrameBatch *frames);
+
+    /// True if the buffer holds at least one complete frame, i.e., NextFrame() would succeed.
+    bool HasFrame() const;
+
+    /// Number of bytes received but not yet returned as part of a frame, not counting fragments already put
+    /// together.
+    int get_num_buffered_bytes() const;
+
+    /// Copy of the bytes received but not yet returned as part of a frame, e.g., to hand a connection and its
+    /// partial frame over to another decoder with Append().  The part of a fragmented frame put together so far
+    /// comes first, as a single fragment.
+    std::string get_buffered_data() const;
+
+    /// Discards everything in the buffer, and the error state.
+    void Clear();
+
+    /// Frames longer than max_bytes are refused (see above).
+    void set_max_frame_size(uint32_t max_bytes);
+    uint32_t get_max_frame_size() const;
+
+    /// True once a frame longer than the maximum has arrived.
+    bool is_frame_too_large() const;
+
+    /// Fragments are put back together (see above), off by default.
+    void set_reassemble_fragments(bool reassemble);
+    bool get_reassemble_fragments() const;
+
+private:
+    void MakeSpace(int min_free);
+    bool CheckFrameSize(uint32_t len);
+    /// Returns true once the fragment completes its frame, which is then in assembled_.
+    bool AddFragment(const uint8_t *body, uint32_t len);
+
+    std::vector<uint8_t> buf_;
+    int start_;     // first byte that has not been returned yet
+    int end_;       // one past the last byte received
+    int read_size_;
+    uint32_t max_frame_size_;
+    bool too_large_;
+    bool reassemble_;
+    std::string assembled_;         // the fragments of a frame received so far
+    bool assembling_;
+    uint32_t assembled_total_;      // the length of that frame
+};
+
+#endif
@@ -0,0 +1,57 @@
+
+#include "frame_encoder.h"
+
+#include "min_net.h"
+
+#include <string.h>
+
+
+FrameEncoder::FrameEncoder() : num_frames_(0) {
+}
+
+
+FrameEncoder::~FrameEncoder() {
+}
+
+
+void FrameEncoder::QueueString(const std::string &s) {
+    size_t offset = buf_.size();
+    uint32_t len = (uint32_t)s.size();
+    buf_.resize(offset + 4 + s.size());
+    // little endian, same as MinNet::SendUInt32()
+    buf_[offset] = (uint8_t)(len & 0xff);
+    buf_[offset + 1] = (uint8_t)((len >> 8) & 0xff);
+    buf_[offset + 2] = (uint8_t)((len >> 16) & 0xff);
+    buf_[offset + 3] = (uint8_t)((len >> 24) & 0xff);
+    memcpy(&buf_[offset + 4], s.data(), s.size());
+    num_frames_++;
+}
+
+
+bool FrameEncoder::Flush(SOCKET* socket_fd, double timeout_ms) {
+    if (buf_.empty()) {
+        return true;
+    }
+    const uint8_t* data = buf_.data();
+    int len = (int)buf_.size();
+    bool ok = MinNet::SendGather(socket_fd, &data, &len, 1, timeout_ms);
+    Clear();
+    return ok;
+}
+
+
+int FrameEncoder::get_num_buffered_bytes() const {
+    return (int)buf_.size();
+}
+
+
+int FrameEncoder::get_num_buffered_frames() const {
+    return num_frames_;
+}
+
+
+void FrameEncoder::Clear() {
+    // keeps the capacity, so steady state queueing does not allocate
+    buf_.clear();
+    num_frames_ = 0;
+}
@@ -0,0 +1,43 @@
+/**
+  Per-connection output buffer for length-prefixed frames, the sending counterpart of FrameDecoder.
+  QueueString() only appends a frame to the buffer, framed exactly as MinNet::SendString() frames it.  Nothing
+  is written to the socket until Flush(), which sends everything queued since the last flush with as few
+  system calls as the socket allows.  So, queue all of the events generated during one frame of the
+  application and then flush once, and they leave in as few TCP packets as possible even though TCP_NODELAY is
+  set on MinNet sockets.
+ */
+
+#ifndef MINVR3_FRAME_ENCODER_H
+#define MINVR3_FRAME_ENCODER_H
+
+#include "net_headers.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+class FrameEncoder {
+public:
+    FrameEncoder();
+    virtual ~FrameEncoder();
+
+    /// Appends s to the buffer as a length-prefixed frame.
+    void QueueString(const std::string &s);
+
+    /// Sends all buffered frames.  The buffer is emptied whether or not this succeeds, since after a failure
+    /// an unknown part of it has already been sent and the connection should be considered broken.
+    bool Flush(SOCKET* socket_fd, double timeout_ms=0);
+
+    int get_num_buffered_bytes() const;
+    int get_num_buffered_frames() const;
+
+    /// Discards everything in the buffer without sending it.
+    void Clear();
+
+private:
+    std::vector<uint8_t> buf_;
+    int num_frames_;
+};
+
+#endif
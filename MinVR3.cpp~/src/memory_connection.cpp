@@ -0,0 +1,270 @@
+#include "memory_connection.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <map>
+#include <mutex>
+
+
+struct MemoryConnection::Queue {
+    Queue() : closed(false) {}
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::string> frames;
+    bool closed;
+};
+
+
+struct MemoryListener::Backlog {
+    std::mutex mutex;
+    std::deque<MemoryConnection*> connections;
+};
+
+
+// listeners by name, shared by every thread in the process
+static std::mutex registry_mutex;
+static std::map<std::string, std::shared_ptr<MemoryListener::Backlog>> registry;
+
+static int next_connection_id = 1;
+
+
+
+void MemoryConnection::CreatePair(MemoryConnection **a, MemoryConnection **b, const std::string &name) {
+    std::shared_ptr<Queue> a_to_b = std::make_shared<Queue>();
+    std::shared_ptr<Queue> b_to_a = std::make_shared<Queue>();
+    int id;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        id = next_connection_id++;
+    }
+    *a = new MemoryConnection(b_to_a, a_to_b, "mem:" + name + "#" + std::to_string(id) + "a");
+    *b = new MemoryConnection(a_to_b, b_to_a, "mem:" + name + "#" + std::to_string(id) + "b");
+}
+
+
+MemoryConnection::MemoryConnection(const std::shared_ptr<Queue> &in, const std::shared_ptr<Queue> &out,
+                                   const std::string &description) :
+    in_(in), out_(out), open_(true), description_(description)
+{
+}
+
+
+MemoryConnection::~MemoryConnection() {
+    Close();
+}
+
+
+bool MemoryConnection::SendString(const std::string &s, double timeout_ms) {
+    QueueString(s);
+    return Flush(timeout_ms);
+}
+
+
+// the queue is never bounded, so frames with the same key never replace each other
+void MemoryConnection::QueueString(const std::string &s, const std::string &) {
+    queued_.push_back(s);
+}
+
+
+// the other end's queue always has room, so this never waits
+bool MemoryConnection::Flush(double) {
+    if (queued_.empty()) {
+        return open_;
+    }
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(out_->mutex);
+        ok = (open_) && (!out_->closed);
+        if (ok) {
+            if (out_->frames.empty()) {
+                out_->frames.swap(queued_);
+            }
+            else {
+                for (int i=0; i<queued_.size(); i++) {
+                    out_->frames.push_back(std::move(queued_[i]));
+                }
+            }
+        }
+    }
+    queued_.clear();
+    if (ok) {
+        out_->cond.notify_one();
+    }
+    return ok;
+}
+
+
+bool MemoryConnection::ReceiveString(std::string *s, double timeout_ms) {
+    if (received_.empty()) {
+        std::vector<std::string> frames;
+        {
+            std::unique_lock<std::mutex> lock(in_->mutex);
+            auto ready = [this]() { return (!in_->frames.empty()) || (in_->closed); };
+            if (timeout_ms > 0) {
+                in_->cond.wait_for(lock, std::chrono::microseconds((int64_t)(timeout_ms * 1000.0)), ready);
+            }
+            else {
+                in_->cond.wait(lock, ready);
+            }
+            frames.swap(in_->frames);
+        }
+        for (int i=0; i<frames.size(); i++) {
+            received_.push_back(std::move(frames[i]));
+        }
+        if (received_.empty()) {
+            return false;
+        }
+    }
+    s->swap(received_.front());
+    received_.pop_front();
+    return true;
+}
+
+
+bool MemoryConnection::ReceiveAvailableStrings(std::vector<std::string> *frames) {
+    while (!received_.empty()) {
+        frames->push_back(std::move(received_.front()));
+        received_.pop_front();
+    }
+    bool closed;
+    {
+        std::lock_guard<std::mutex> lock(in_->mutex);
+        if (frames->empty()) {
+            frames->swap(in_->frames);
+        }
+        else {
+            for (int i=0; i<in_->frames.size(); i++) {
+                frames->push_back(std::move(in_->frames[i]));
+            }
+            in_->frames.clear();
+        }
+        closed = in_->closed;
+    }
+    return (open_) && (!closed);
+}
+
+
+bool MemoryConnection::IsReadyToRead() {
+    if (!received_.empty()) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(in_->mutex);
+    return (!in_->frames.empty()) || (in_->closed);
+}
+
+
+void MemoryConnection::Close() {
+    if (!open_) {
+        return;
+    }
+    open_ = false;
+    queued_.clear();
+    // the peer sees the close on its input once it has read everything sent before it
+    {
+        std::lock_guard<std::mutex> lock(out_->mutex);
+        out_->closed = true;
+    }
+    out_->cond.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(in_->mutex);
+        in_->closed = true;
+        in_->frames.clear();
+    }
+    in_->cond.notify_all();
+}
+
+
+bool MemoryConnection::is_open() const {
+    return open_;
+}
+
+
+std::string MemoryConnection::get_description() const {
+    return description_;
+}
+
+
+
+MemoryListener::MemoryListener() {
+}
+
+
+MemoryListener::~MemoryListener() {
+    Close();
+}
+
+
+bool MemoryListener::Open(const std::string &name) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    if (registry.find(name) != registry.end()) {
+        std::cerr << "MemoryListener::Open() Error: mem:" << name << " is already in use." << std::endl;
+        return false;
+    }
+    backlog_ = std::make_shared<Backlog>();
+    registry[name] = backlog_;
+    name_ = name;
+    return true;
+}
+
+
+MemoryConnection* MemoryListener::Connect(const std::string &name) {
+    std::shared_ptr<Backlog> backlog;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto it = registry.find(name);
+        if (it == registry.end()) {
+            std::cerr << "MemoryListener::Connect() Error: Nothing is listening on mem:" << name << "." << std::endl;
+            return NULL;
+        }
+        backlog = it->second;
+    }
+    MemoryConnection *client, *server;
+    MemoryConnection::CreatePair(&client, &server, name);
+    std::lock_guard<std::mutex> lock(backlog->mutex);
+    backlog->connections.push_back(server);
+    return client;
+}
+
+
+Connection* MemoryListener::TryAccept() {
+    if (!backlog_) {
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lock(backlog_->mutex);
+    if (backlog_->connections.empty()) {
+        return NULL;
+    }
+    MemoryConnection *c = backlog_->connections.front();
+    backlog_->connections.pop_front();
+    return c;
+}
+
+
+void MemoryListener::Close() {
+    if (!backlog_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.erase(name_);
+    }
+    // connections that were never accepted are closed, so their clients find out
+    std::lock_guard<std::mutex> lock(backlog_->mutex);
+    for (int i=0; i<backlog_->connections.size(); i++) {
+        delete backlog_->connections[i];
+    }
+    backlog_->connections.clear();
+    backlog_.reset();
+}
+
+
+bool MemoryListener::is_open() const {
+    return (bool)backlog_;
+}
+
+
+std::string MemoryListener::get_description() const {
+    return "mem:" + name_;
+}
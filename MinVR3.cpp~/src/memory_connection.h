@@ -0,0 +1,85 @@
+/**
+  Connection and Listener that pass frames between threads of one process through a pair of in-memory queues,
+  one for each direction.  Frames are moved, never copied into a byte stream or through the kernel, so a relay
+  driven over memory connections measures only its own cost.  Flush() moves everything queued across with a
+  single lock, and ReceiveAvailableStrings() takes everything that has arrived with a single lock.
+
+  Memory connections have no socket to wait on.  A thread that only has memory connections waits in
+  ReceiveString(), and one that serves them, like EventRelay::Poll(), checks them in turn.
+
+  Listeners are found by name, within the process:
+  ```
+  MemoryListener listener;
+  listener.Open("relay");
+  Connection *client = MemoryListener::Connect("relay");   // or Connection::Connect("mem:relay")
+  Connection *server_side = listener.TryAccept();
+  ```
+ */
+
+#ifndef MINVR3_MEMORY_CONNECTION_H
+#define MINVR3_MEMORY_CONNECTION_H
+
+#include "connection.h"
+
+#include <deque>
+#include <memory>
+
+
+class MemoryConnection : public Connection {
+public:
+    /// Creates two connections joined to each other, e.g., for the two ends of a test.
+    static void CreatePair(MemoryConnection **a, MemoryConnection **b, const std::string &name="pair");
+
+    virtual ~MemoryConnection();
+
+    bool SendString(const std::string &s, double timeout_ms=0);
+    void QueueString(const std::string &s, const std::string &key="");
+    bool Flush(double timeout_ms=0);
+    bool ReceiveString(std::string *s, double timeout_ms=0);
+    bool ReceiveAvailableStrings(std::vector<std::string> *frames);
+    bool IsReadyToRead();
+    void Close();
+    bool is_open() const;
+    std::string get_description() const;
+
+    // one direction of a connection, defined in the .cpp
+    struct Queue;
+
+private:
+    MemoryConnection(const std::shared_ptr<Queue> &in, const std::shared_ptr<Queue> &out,
+                     const std::string &description);
+
+    std::shared_ptr<Queue> in_;
+    std::shared_ptr<Queue> out_;
+    std::vector<std::string> queued_;       // waiting for Flush()
+    std::deque<std::string> received_;      // taken from in_ but not returned yet
+    bool open_;
+    std::string description_;
+};
+
+
+class MemoryListener : public Listener {
+public:
+    MemoryListener();
+    virtual ~MemoryListener();
+
+    /// Registers the listener under name, which must not already be in use in this process.
+    bool Open(const std::string &name);
+
+    /// Connects to the listener registered under name.  Returns NULL if there is none.
+    static MemoryConnection* Connect(const std::string &name);
+
+    Connection* TryAccept();
+    void Close();
+    bool is_open() const;
+    std::string get_description() const;
+
+    // connections waiting to be accepted, defined in the .cpp
+    struct Backlog;
+
+private:
+    std::shared_ptr<Backlog> backlog_;
+    std::string name_;
+};
+
+#endif
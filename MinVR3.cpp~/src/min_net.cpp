@@ -1,8 +1,11 @@
 
 #include "min_net.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <iostream>
+#include <mutex>
 
 #ifdef WIN32
 #include <winsock2.h>
@@ -12,20 +15,46 @@
 #pragma comment (lib, "Ws2_32.lib")
 #pragma comment (lib, "Mswsock.lib")
 #pragma comment (lib, "AdvApi32.lib")
+#define poll WSAPoll
 #else
 #define SOCKET int
 #include "stdint.h"
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <netdb.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
+#include <stddef.h>
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// max number of buffers handed to the OS in a single gathered send
+static const int MAX_GATHER = 64;
+
+const uint32_t MinNet::DEFAULT_MAX_FRAME_SIZE;
+
+// see set_max_frame_size(), read by every thread that receives
+static std::atomic<uint32_t> max_frame_size(MinNet::DEFAULT_MAX_FRAME_SIZE);
+
+// see set_socket_tuning(), with the two options that are checked on every read kept apart, so reading them
+// takes no lock
+static std::mutex socket_tuning_mutex;
+static SocketTuning socket_tuning;
+static std::atomic<bool> quick_ack(false);
+static std::atomic<bool> spin_wait(false);
+
 
 bool MinNet::Init() {
 #ifdef WIN32
@@ -48,10 +77,64 @@ bool MinNet::Shutdown() {
 }
 
 
+bool MinNet::IsUnixAddress(const std::string &address) {
+    return (address.compare(0, 5, "unix:") == 0);
+}
+
+
+#ifndef WIN32
+// converts "unix:/path" or "unix:@abstract-name" to a sockaddr_un
+static bool MakeUnixAddress(const std::string &address, struct sockaddr_un *addr, socklen_t *addr_len) {
+    std::string path = address.substr(5);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if ((path.empty()) || (path.size() >= sizeof(addr->sun_path))) {
+        std::cerr << "MinNet Error: Invalid unix domain socket address " << address << std::endl;
+        return false;
+    }
+    memcpy(addr->sun_path, path.data(), path.size());
+    if (path[0] == '@') {
+        // abstract namespace, the name starts with a 0 byte and is not 0 terminated
+        addr->sun_path[0] = '\0';
+        *addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path.size());
+    }
+    else {
+        *addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + path.size() + 1);
+    }
+    return true;
+}
+#endif
+
+
 bool MinNet::ConnectTo(const std::string &ip, int port, SOCKET *socket_fd) {
     std::string port_str = std::to_string(port);
     *socket_fd = INVALID_SOCKET;
 
+    if (IsUnixAddress(ip)) {
+#ifdef WIN32
+        std::cerr << "MinNet::ConnectTo() Error: unix domain sockets are not supported on windows." << std::endl;
+        return false;
+#else
+        struct sockaddr_un addr;
+        socklen_t addr_len;
+        if (!MakeUnixAddress(ip, &addr, &addr_len)) {
+            return false;
+        }
+        *socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (*socket_fd == INVALID_SOCKET) {
+            std::cerr << "MinNet::ConnectTo() Error: could not create socket." << std::endl;
+            return false;
+        }
+        if (connect(*socket_fd, (struct sockaddr *)&addr, addr_len) != 0) {
+            std::cerr << "MinNet::ConnectTo() Error: Connect to " << ip << " refused, errno = " << errno << std::endl;
+            CloseSocket(socket_fd);
+            return false;
+        }
+        std::cout << "MinNet::OpenSocket() Connected to " << ip << std::endl;
+        return true;
+#endif
+    }
+
     struct addrinfo hints;
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_UNSPEC;
@@ -114,15 +197,42 @@ bool MinNet::ConnectTo(const std::string &ip, int port, SOCKET *socket_fd) {
         return false;
     }
         
-    // Disable Nagle's algorithm
-    char value = 1;
-    setsockopt(*socket_fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+    // Disable Nagle's algorithm, and anything else the process's tuning asks for
+    ApplySocketTuning(*socket_fd, get_socket_tuning());
 
     std::cout << "MinNet::OpenSocket() Connected to " << MinNet::GetAddressAndPort(*socket_fd) << std::endl;
     return true;
 }
 
 
+bool MinNet::CreateSocketPair(SOCKET* fd_a, SOCKET* fd_b) {
+#ifdef WIN32
+    SOCKET listener_fd;
+    if (!CreateListener(0, &listener_fd, 1)) {
+        return false;
+    }
+    std::string addr = GetAddressAndPort(listener_fd);
+    int port = std::stoi(addr.substr(addr.rfind(':') + 1));
+    bool ok = ConnectTo("127.0.0.1", port, fd_a) && TryAcceptConnection(listener_fd, fd_b);
+    CloseSocket(&listener_fd);
+    if (!ok) {
+        return false;
+    }
+#else
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::cerr << "MinNet::CreateSocketPair() Error: socketpair failed, errno = " << errno << std::endl;
+        return false;
+    }
+    *fd_a = fds[0];
+    *fd_b = fds[1];
+#endif
+    SetNonBlocking(*fd_a, true);
+    SetNonBlocking(*fd_b, true);
+    return true;
+}
+
+
 bool MinNet::CreateListener(int port, SOCKET* socket_fd, int backlog)
 {
     std::string port_str = std::to_string(port);
@@ -207,18 +317,66 @@ bool MinNet::CreateListener(int port, SOCKET* socket_fd, int backlog)
 }
 
 
+bool MinNet::CreateListener(const std::string &address, SOCKET* socket_fd, int backlog) {
+    if (!IsUnixAddress(address)) {
+        return CreateListener(std::stoi(address), socket_fd, backlog);
+    }
+#ifdef WIN32
+    std::cerr << "MinNet::CreateListener() Error: unix domain sockets are not supported on windows." << std::endl;
+    return false;
+#else
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    if (!MakeUnixAddress(address, &addr, &addr_len)) {
+        return false;
+    }
+    if (addr.sun_path[0] != '\0') {
+        // a socket file left behind by an earlier run would make bind() fail, but never remove anything else
+        struct stat st;
+        if ((lstat(addr.sun_path, &st) == 0) && (S_ISSOCK(st.st_mode))) {
+            unlink(addr.sun_path);
+        }
+    }
+    *socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (*socket_fd == INVALID_SOCKET) {
+        std::cerr << "MinNet::CreateListener() Error: could not create socket." << std::endl;
+        return false;
+    }
+    if (bind(*socket_fd, (struct sockaddr *)&addr, addr_len) != 0) {
+        std::cerr << "MinNet::CreateListener() Error: Could not bind to " << address << ", errno = " << errno << std::endl;
+        CloseSocket(socket_fd);
+        return false;
+    }
+    if (listen(*socket_fd, backlog) != 0) {
+        std::cerr << "MinNet::CreateListener() Error: Could not listen on socket, errno = " << errno << std::endl;
+        CloseSocket(socket_fd);
+        return false;
+    }
+    std::cout << "MinNet::CreateListener() Listening on " << address << std::endl;
+    return true;
+#endif
+}
+
+
 bool MinNet::TryAcceptConnection(const SOCKET listener_fd, SOCKET* client_fd) {
-    struct sockaddr_in client_addr;
+    struct sockaddr_storage client_addr;
     socklen_t client_len = sizeof(client_addr);
     *client_fd = accept(listener_fd, (struct sockaddr *) &client_addr, &client_len);
     if (*client_fd == INVALID_SOCKET) {
-        std::cerr << "MinNet::TryAcceptConnection() Accept failed." << std::endl;
+        // for a non-blocking listener, no pending connection is not an error
+#ifdef WIN32
+        bool would_block = (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+        bool would_block = ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+#endif
+        if (!would_block) {
+            std::cerr << "MinNet::TryAcceptConnection() Accept failed." << std::endl;
+        }
         return false;
     }
             
-    // Disable Nagle's algorithm on the client's socket
-    char value = 1;
-    setsockopt(*client_fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+    // Disable Nagle's algorithm on the client's socket, and anything else the process's tuning asks for
+    ApplySocketTuning(*client_fd, get_socket_tuning());
 
     std::cout << "MinNet::TryAcceptConnection() Accepted connection from "
         << MinNet::GetAddressAndPort(*client_fd) << std::endl;
@@ -226,73 +384,369 @@ bool MinNet::TryAcceptConnection(const SOCKET listener_fd, SOCKET* client_fd) {
 }
 
 
-bool MinNet::SendBytes(SOCKET* socket_fd, uint8_t* buf, int len, double timeout_ms) {
-    std::chrono::time_point<std::chrono::system_clock> start_time;
-    if (timeout_ms != 0) {
-        start_time = std::chrono::system_clock::now();
+bool MinNet::SetNonBlocking(SOCKET socket_fd, bool non_blocking) {
+#ifdef WIN32
+    u_long mode = non_blocking ? 1 : 0;
+    return (ioctlsocket(socket_fd, FIONBIO, &mode) == 0);
+#else
+    int flags = fcntl(socket_fd, F_GETFL, 0);
+    if (flags < 0) {
+        return false;
     }
-    
-    int total = 0;        // how many bytes we've sent
-    int bytesleft = len;  // how many we have left to send
-    int n = 0;
-    while (total < len) {
+    flags = non_blocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return (fcntl(socket_fd, F_SETFL, flags) == 0);
+#endif
+}
+
+
+bool MinNet::CreateDatagramSocket(int port, SOCKET* socket_fd) {
+    *socket_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (*socket_fd == INVALID_SOCKET) {
+        std::cerr << "MinNet::CreateDatagramSocket() Error: Could not create socket." << std::endl;
+        return false;
+    }
+    const char value = 1;
+    setsockopt(*socket_fd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(*socket_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        std::cerr << "MinNet::CreateDatagramSocket() Error: Could not bind to port " << port << std::endl;
+        CloseSocket(socket_fd);
+        return false;
+    }
+    std::cout << "MinNet::CreateDatagramSocket() Receiving on " << MinNet::GetAddressAndPort(*socket_fd) << std::endl;
+    return true;
+}
+
+
+bool MinNet::ConnectDatagramSocket(const std::string &ip, int port, SOCKET* socket_fd) {
+    std::string port_str = std::to_string(port);
+    *socket_fd = INVALID_SOCKET;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
+    struct addrinfo *dest_addresses;
+    int err = getaddrinfo(ip.c_str(), port_str.c_str(), &hints, &dest_addresses);
+    if (err != 0) {
+        std::cerr << "MinNet::ConnectDatagramSocket() Error: Could not obtain addrinfo, error code: " << err << std::endl;
+        return false;
+    }
+    // a connected datagram socket just remembers the destination, so the first address will do
+    *socket_fd = socket(dest_addresses->ai_family, dest_addresses->ai_socktype, dest_addresses->ai_protocol);
+    if (*socket_fd == INVALID_SOCKET) {
+        std::cerr << "MinNet::ConnectDatagramSocket() Error: Could not create socket." << std::endl;
+        freeaddrinfo(dest_addresses);
+        return false;
+    }
+    err = connect(*socket_fd, dest_addresses->ai_addr, (int)dest_addresses->ai_addrlen);
+    freeaddrinfo(dest_addresses);
+    if (err != 0) {
+        std::cerr << "MinNet::ConnectDatagramSocket() Error: Connect failed with error code: " << err << std::endl;
+        CloseSocket(socket_fd);
+        return false;
+    }
+    std::cout << "MinNet::ConnectDatagramSocket() Sending to " << ip << ":" << port << std::endl;
+    return true;
+}
+
+
+bool MinNet::SendDatagram(SOCKET* socket_fd, const uint8_t* buf, int len) {
 #ifdef WIN32
-        n = send(*socket_fd, (const char*)(buf + total), bytesleft, 0);
+    int n = send(*socket_fd, (const char*)buf, len, 0);
 #else
-        n = send(*socket_fd, (void*)(buf + total), bytesleft, 0);
+    int n = (int)send(*socket_fd, (const void*)buf, len, MSG_NOSIGNAL);
+    if ((n == SOCKET_ERROR) && (errno == ECONNREFUSED)) {
+        // an ICMP port unreachable from an earlier datagram, nobody was listening at the time, but the next
+        // datagram may well be received, so this is not a reason to give up on the socket
+        n = (int)send(*socket_fd, (const void*)buf, len, MSG_NOSIGNAL);
+    }
 #endif
-        if (n == SOCKET_ERROR) {
-            return false;
-        }
-        total += n;
-        bytesleft -= n;
-        
-        if (timeout_ms != 0) {
-            std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-            double elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time).count();
-            if (elapsed_ms > timeout_ms) {
-                return false;
-            }
-        }
+    return (n == len);
+}
+
+
+bool MinNet::ReceiveDatagram(SOCKET* socket_fd, uint8_t* buf, int max_len, int* len, std::string* from) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    socklen_t addr_len = sizeof(addr);
+#ifdef WIN32
+    if (!IsReadyToRead(socket_fd)) {
+        return false;
+    }
+    int n = recvfrom(*socket_fd, (char*)buf, max_len, 0, (struct sockaddr *)&addr, &addr_len);
+#else
+    int n = (int)recvfrom(*socket_fd, (void*)buf, max_len, MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_len);
+#endif
+    if (n == SOCKET_ERROR) {
+        return false;
+    }
+    *len = n;
+    if (from != NULL) {
+        char ip_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip_str, sizeof(ip_str));
+        *from = std::string(ip_str) + ":" + std::to_string(ntohs(addr.sin_port));
     }
     return true;
 }
 
 
-bool MinNet::ReceiveBytes(SOCKET* socket_fd, uint8_t* buf, int len, double timeout_ms) {
-    std::chrono::time_point<std::chrono::system_clock> start_time;
-    if (timeout_ms != 0) {
-        start_time = std::chrono::system_clock::now();
+bool MinNet::SendDatagramTo(SOCKET* socket_fd, const std::string &ip_and_port, const uint8_t* buf, int len) {
+    size_t colon = ip_and_port.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
     }
-    
-    int total = 0;        // how many bytes we've received
-    int bytesleft = len;  // how many we have left to receive
-    int n = 0;
-    while (total < len) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)std::stoi(ip_and_port.substr(colon + 1)));
+    if (inet_pton(AF_INET, ip_and_port.substr(0, colon).c_str(), &addr.sin_addr) != 1) {
+        return false;
+    }
+#ifdef WIN32
+    int n = sendto(*socket_fd, (const char*)buf, len, 0, (struct sockaddr *)&addr, sizeof(addr));
+#else
+    int n = (int)sendto(*socket_fd, (const void*)buf, len, MSG_NOSIGNAL, (struct sockaddr *)&addr, sizeof(addr));
+#endif
+    return (n == len);
+}
+
+
+// fills in an IPv4 address, "" means any
+static bool ParseIPv4(const std::string &ip, struct in_addr *addr) {
+    if (ip.empty()) {
+        addr->s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+    return (inet_pton(AF_INET, ip.c_str(), addr) == 1);
+}
+
+
+bool MinNet::CreateMulticastSender(const std::string &group, int port, SOCKET* socket_fd,
+                                   const std::string &interface_ip, int ttl)
+{
+    struct in_addr iface;
+    if (!ParseIPv4(interface_ip, &iface)) {
+        std::cerr << "MinNet::CreateMulticastSender() Error: Invalid interface address " << interface_ip << std::endl;
+        return false;
+    }
+    if (!ConnectDatagramSocket(group, port, socket_fd)) {
+        return false;
+    }
+    unsigned char ttl_value = (unsigned char)ttl;
+    unsigned char loop_value = 1;   // so that group members on this host receive the datagrams too
+    if ((setsockopt(*socket_fd, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&ttl_value, sizeof(ttl_value)) != 0) ||
+        (setsockopt(*socket_fd, IPPROTO_IP, IP_MULTICAST_LOOP, (const char*)&loop_value, sizeof(loop_value)) != 0) ||
+        ((!interface_ip.empty()) &&
+         (setsockopt(*socket_fd, IPPROTO_IP, IP_MULTICAST_IF, (const char*)&iface, sizeof(iface)) != 0)))
+    {
+        std::cerr << "MinNet::CreateMulticastSender() Error: Could not set multicast options." << std::endl;
+        CloseSocket(socket_fd);
+        return false;
+    }
+    return true;
+}
+
+
+bool MinNet::JoinMulticastGroup(const std::string &group, int port, SOCKET* socket_fd, const std::string &interface_ip) {
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof mreq);
+    if ((inet_pton(AF_INET, group.c_str(), &mreq.imr_multiaddr) != 1) || (!ParseIPv4(interface_ip, &mreq.imr_interface))) {
+        std::cerr << "MinNet::JoinMulticastGroup() Error: Invalid group " << group << " or interface "
+            << interface_ip << std::endl;
+        return false;
+    }
+
+    *socket_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (*socket_fd == INVALID_SOCKET) {
+        std::cerr << "MinNet::JoinMulticastGroup() Error: Could not create socket." << std::endl;
+        return false;
+    }
+    // several receivers on the same host all bind the group's port
+    int value = 1;
+    setsockopt(*socket_fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&value, sizeof(value));
+#ifdef SO_REUSEPORT
+    setsockopt(*socket_fd, SOL_SOCKET, SO_REUSEPORT, (const char*)&value, sizeof(value));
+#endif
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(*socket_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        std::cerr << "MinNet::JoinMulticastGroup() Error: Could not bind to port " << port << std::endl;
+        CloseSocket(socket_fd);
+        return false;
+    }
+    if (setsockopt(*socket_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&mreq, sizeof(mreq)) != 0) {
+        std::cerr << "MinNet::JoinMulticastGroup() Error: Could not join group " << group << std::endl;
+        CloseSocket(socket_fd);
+        return false;
+    }
+    std::cout << "MinNet::JoinMulticastGroup() Joined " << group << ":" << port << std::endl;
+    return true;
+}
+
+
+// The error from the last failed socket call, and what it means.
+static int LastSocketError() {
+#ifdef WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
+
+static bool IsWouldBlock(int err) {
+#ifdef WIN32
+    return (err == WSAEWOULDBLOCK);
+#else
+    return ((err == EAGAIN) || (err == EWOULDBLOCK));
+#endif
+}
+
+static bool IsInterrupted(int err) {
+#ifdef WIN32
+    return (err == WSAEINTR);
+#else
+    return (err == EINTR);
+#endif
+}
+
+static MinNet::IOResult ErrorToResult(int err) {
 #ifdef WIN32
-        n = recv(*socket_fd, (char*)(buf + total), bytesleft, 0);
+    bool closed = ((err == WSAECONNRESET) || (err == WSAECONNABORTED) || (err == WSAESHUTDOWN));
 #else
-        n = recv(*socket_fd, (void*)(buf + total), bytesleft, 0);
+    bool closed = ((err == EPIPE) || (err == ECONNRESET));
 #endif
-        if (n == SOCKET_ERROR) { 
-            return false; 
+    return closed ? MinNet::IO_CLOSED : MinNet::IO_ERROR;
+}
+
+static std::chrono::steady_clock::time_point Deadline(double timeout_ms) {
+    return std::chrono::steady_clock::now() + std::chrono::microseconds((int64_t)(timeout_ms * 1000.0));
+}
+
+// Waits for the socket to be ready for events (POLLIN or POLLOUT) until the deadline, or for as long as it takes
+// if timeout_ms <= 0.  A socket with an error or hang-up counts as ready; the send/recv that follows says which.
+static MinNet::IOResult WaitForSocket(SOCKET fd, short events, double timeout_ms,
+                                      const std::chrono::steady_clock::time_point &deadline)
+{
+    while (true) {
+        int wait_ms = -1;
+        if (timeout_ms > 0) {
+            int64_t left_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (left_us <= 0) {
+                return MinNet::IO_TIMEOUT;
+            }
+            // rounded up, so the last fraction of a millisecond is not spent spinning
+            wait_ms = (int)((left_us + 999) / 1000);
         }
-        total += n;
-        bytesleft -= n;
-        
-        if (timeout_ms != 0) {
-            std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
-            double elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - start_time).count();
-            if (elapsed_ms > timeout_ms) {
-                return false;
+        int n = MinNet::PollSocket(fd, events, wait_ms);
+        if (n > 0) {
+            return MinNet::IO_OK;
+        }
+        if ((n == SOCKET_ERROR) && (!IsInterrupted(LastSocketError()))) {
+            return MinNet::IO_ERROR;
+        }
+        // timed out or interrupted, the deadline check above decides whether to carry on
+    }
+}
+
+// With a timeout, sends and receives must not block, since that would wait past the deadline.  Where there is
+// no per-call flag for that, the socket is polled before every call instead.
+#ifdef MSG_DONTWAIT
+#define DONTWAIT_IF(timeout_ms) (((timeout_ms) > 0) ? MSG_DONTWAIT : 0)
+#define POLL_FIRST(timeout_ms) false
+#else
+#define DONTWAIT_IF(timeout_ms) 0
+#define POLL_FIRST(timeout_ms) (((timeout_ms) > 0) || (spin_wait))
+#endif
+
+
+MinNet::IOResult MinNet::SendBytes(SOCKET* socket_fd, uint8_t* buf, int len, double timeout_ms) {
+    std::chrono::steady_clock::time_point deadline = Deadline(timeout_ms);
+    int total = 0;        // how many bytes we've sent
+    while (total < len) {
+        if (POLL_FIRST(timeout_ms)) {
+            IOResult r = WaitForSocket(*socket_fd, POLLOUT, timeout_ms, deadline);
+            if (r != IO_OK) {
+                return r;
             }
         }
+        int n = (int)send(*socket_fd, (const char*)(buf + total), len - total, MSG_NOSIGNAL | DONTWAIT_IF(timeout_ms));
+        if (n != SOCKET_ERROR) {
+            total += n;
+            continue;
+        }
+        int err = LastSocketError();
+        if (IsInterrupted(err)) {
+            continue;
+        }
+        if (!IsWouldBlock(err)) {
+            return ErrorToResult(err);
+        }
+        IOResult r = WaitForSocket(*socket_fd, POLLOUT, timeout_ms, deadline);
+        if (r != IO_OK) {
+            return r;
+        }
     }
-    return true;
+    return IO_OK;
 }
 
 
-bool MinNet::SendUInt32(SOCKET* socket_fd, uint32_t i, double timeout_ms) {
+MinNet::IOResult MinNet::ReceiveBytes(SOCKET* socket_fd, uint8_t* buf, int len, double timeout_ms) {
+    std::chrono::steady_clock::time_point deadline = Deadline(timeout_ms);
+    int total = 0;        // how many bytes we've received
+    while (total < len) {
+        if (POLL_FIRST(timeout_ms)) {
+            IOResult r = WaitForSocket(*socket_fd, POLLIN, timeout_ms, deadline);
+            if (r != IO_OK) {
+                return r;
+            }
+        }
+        int flags = DONTWAIT_IF(timeout_ms);
+#ifdef MSG_DONTWAIT
+        if (spin_wait) {
+            // a blocking recv() would sleep, so wait in WaitForSocket() instead
+            flags = MSG_DONTWAIT;
+        }
+#endif
+        int n = (int)recv(*socket_fd, (char*)(buf + total), len - total, flags);
+        if (n > 0) {
+            RearmQuickAck(*socket_fd);
+            total += n;
+            continue;
+        }
+        if (n == 0) {
+            // an orderly shutdown by the peer, nothing more will ever arrive
+            return IO_CLOSED;
+        }
+        int err = LastSocketError();
+        if (IsInterrupted(err)) {
+            continue;
+        }
+        if (!IsWouldBlock(err)) {
+            return ErrorToResult(err);
+        }
+        IOResult r = WaitForSocket(*socket_fd, POLLIN, timeout_ms, deadline);
+        if (r != IO_OK) {
+            return r;
+        }
+    }
+    return IO_OK;
+}
+
+
+bool MinNet::SendUInt32(SOCKET* socket_fd, uint32_t i, double timeout_ms, IOResult* result) {
     uint8_t buf[4];
     const uint8_t* p = static_cast<const uint8_t*>(static_cast<const void*>(&i));
     if (!is_little_endian()) {
@@ -306,13 +760,21 @@ bool MinNet::SendUInt32(SOCKET* socket_fd, uint32_t i, double timeout_ms) {
         buf[2] = p[2];
         buf[3] = p[3];
     }
-    return SendBytes(socket_fd, buf, 4, timeout_ms);
+    IOResult r = SendBytes(socket_fd, buf, 4, timeout_ms);
+    if (result != NULL) {
+        *result = r;
+    }
+    return (r == IO_OK);
 }
 
 
-bool MinNet::ReceiveUInt32(SOCKET* socket_fd, uint32_t *i, double timeout_ms) {
+bool MinNet::ReceiveUInt32(SOCKET* socket_fd, uint32_t *i, double timeout_ms, IOResult* result) {
     uint8_t buf[4];
-    bool ok = ReceiveBytes(socket_fd, buf, 4, timeout_ms);
+    IOResult r = ReceiveBytes(socket_fd, buf, 4, timeout_ms);
+    if (result != NULL) {
+        *result = r;
+    }
+    bool ok = (r == IO_OK);
     if (ok) {
         uint8_t* p = static_cast<uint8_t*>(static_cast<void*>(i));
         if (!is_little_endian()) {
@@ -331,38 +793,318 @@ bool MinNet::ReceiveUInt32(SOCKET* socket_fd, uint32_t *i, double timeout_ms) {
 }
 
 
-bool MinNet::SendString(SOCKET* socket_fd, const std::string &s, double timeout_ms) {
-    return SendUInt32(socket_fd, (uint32_t)s.size(), timeout_ms) && SendBytes(socket_fd, (uint8_t*)s.c_str(), (int)s.size(), timeout_ms);
+bool MinNet::SendString(SOCKET* socket_fd, const std::string &s, double timeout_ms, IOResult* result) {
+    // little endian length header, same as SendUInt32()
+    uint32_t len = (uint32_t)s.size();
+    uint8_t header[4];
+    header[0] = (uint8_t)(len & 0xff);
+    header[1] = (uint8_t)((len >> 8) & 0xff);
+    header[2] = (uint8_t)((len >> 16) & 0xff);
+    header[3] = (uint8_t)((len >> 24) & 0xff);
+    const uint8_t* bufs[2] = { header, (const uint8_t*)s.data() };
+    int lens[2] = { 4, (int)s.size() };
+    return SendGather(socket_fd, bufs, lens, 2, timeout_ms, result);
 }
 
 
-bool MinNet::ReceiveString(SOCKET* socket_fd, std::string *s, double timeout_ms) {
+bool MinNet::SendGather(SOCKET* socket_fd, const uint8_t* const* bufs, const int* lens, int count, double timeout_ms,
+                        IOResult* result)
+{
+    std::chrono::steady_clock::time_point deadline = Deadline(timeout_ms);
+    IOResult r = IO_OK;
+    int cur = 0;        // first buffer not completely sent
+    int offset = 0;     // how much of bufs[cur] has been sent
+    while ((cur < count) && (lens[cur] == 0)) {
+        cur++;
+    }
+    while ((cur < count) && (r == IO_OK)) {
+        if (POLL_FIRST(timeout_ms)) {
+            r = WaitForSocket(*socket_fd, POLLOUT, timeout_ms, deadline);
+            if (r != IO_OK) {
+                break;
+            }
+        }
+        int n_bufs = 0;
+#ifdef WIN32
+        WSABUF wsabufs[MAX_GATHER];
+        for (int i=cur; (i<count) && (n_bufs<MAX_GATHER); i++) {
+            int skip = (i == cur) ? offset : 0;
+            wsabufs[n_bufs].buf = (char*)(bufs[i] + skip);
+            wsabufs[n_bufs].len = (ULONG)(lens[i] - skip);
+            n_bufs++;
+        }
+        DWORD sent = 0;
+        int n = SOCKET_ERROR;
+        if (WSASend(*socket_fd, wsabufs, n_bufs, &sent, 0, NULL, NULL) != SOCKET_ERROR) {
+            n = (int)sent;
+        }
+#else
+        struct iovec iov[MAX_GATHER];
+        for (int i=cur; (i<count) && (n_bufs<MAX_GATHER); i++) {
+            int skip = (i == cur) ? offset : 0;
+            iov[n_bufs].iov_base = (void*)(bufs[i] + skip);
+            iov[n_bufs].iov_len = lens[i] - skip;
+            n_bufs++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n_bufs;
+        int n = (int)sendmsg(*socket_fd, &msg, MSG_NOSIGNAL | DONTWAIT_IF(timeout_ms));
+#endif
+        if (n == SOCKET_ERROR) {
+            int err = LastSocketError();
+            if (IsWouldBlock(err)) {
+                r = WaitForSocket(*socket_fd, POLLOUT, timeout_ms, deadline);
+            }
+            else if (!IsInterrupted(err)) {
+                r = ErrorToResult(err);
+            }
+            continue;
+        }
+
+        // advance past everything that was sent, which may end part way through a buffer
+        while ((n > 0) && (cur < count)) {
+            int left = lens[cur] - offset;
+            if (n >= left) {
+                n -= left;
+                cur++;
+                offset = 0;
+            }
+            else {
+                offset += n;
+                n = 0;
+            }
+        }
+        while ((cur < count) && (lens[cur] == 0)) {
+            cur++;
+        }
+    }
+    if (result != NULL) {
+        *result = r;
+    }
+    return (r == IO_OK);
+}
+
+
+int MinNet::TrySendGather(SOCKET* socket_fd, const uint8_t* const* bufs, const int* lens, int count) {
+    int n_bufs = 0;
+#ifdef WIN32
+    WSABUF wsabufs[MAX_GATHER];
+    for (int i=0; (i<count) && (n_bufs<MAX_GATHER); i++) {
+        wsabufs[n_bufs].buf = (char*)bufs[i];
+        wsabufs[n_bufs].len = (ULONG)lens[i];
+        n_bufs++;
+    }
+    DWORD sent = 0;
+    if (WSASend(*socket_fd, wsabufs, n_bufs, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+        return (WSAGetLastError() == WSAEWOULDBLOCK) ? 0 : -1;
+    }
+    return (int)sent;
+#else
+    struct iovec iov[MAX_GATHER];
+    for (int i=0; (i<count) && (n_bufs<MAX_GATHER); i++) {
+        iov[n_bufs].iov_base = (void*)bufs[i];
+        iov[n_bufs].iov_len = lens[i];
+        n_bufs++;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n_bufs;
+    while (true) {
+        int n = (int)sendmsg(*socket_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n != SOCKET_ERROR) {
+            return n;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+    }
+#endif
+}
+
+
+bool MinNet::SetCork(SOCKET socket_fd, bool cork) {
+    int value = cork ? 1 : 0;
+#if defined(TCP_CORK)
+    return (setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0);
+#elif defined(TCP_NOPUSH)
+    if (setsockopt(socket_fd, IPPROTO_TCP, TCP_NOPUSH, &value, sizeof(value)) != 0) {
+        return false;
+    }
+    if (!cork) {
+        // on BSDs, clearing TCP_NOPUSH does not push out what is pending, an empty send does
+        send(socket_fd, "", 0, 0);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+bool MinNet::ReceiveString(SOCKET* socket_fd, std::string *s, double timeout_ms, IOResult* result) {
+    // one deadline covers both the header and the body
+    std::chrono::steady_clock::time_point deadline = Deadline(timeout_ms);
     uint32_t len = 0;
-    bool ok = ReceiveUInt32(socket_fd, &len, timeout_ms);
-    if (ok) {
-        char* buf = new char[len+1];
-        if (ReceiveBytes(socket_fd, (uint8_t*)buf, len, timeout_ms)) {
-            buf[len] = '\0';
-            *s = std::string(buf);
+    if (!ReceiveUInt32(socket_fd, &len, timeout_ms, result)) {
+        s->clear();
+        return false;
+    }
+    if (len > get_max_frame_size()) {
+        std::cerr << "MinNet::ReceiveString() Error: Message of " << len << " bytes is larger than the maximum of "
+            << get_max_frame_size() << "." << std::endl;
+        if (result != NULL) {
+            *result = IO_TOO_LARGE;
+        }
+        s->clear();
+        return false;
+    }
+    double left_ms = 0;
+    if (timeout_ms > 0) {
+        left_ms = std::max(0.001, std::chrono::duration<double, std::milli>(deadline - std::chrono::steady_clock::now()).count());
+    }
+    // reuses s's storage when it is big enough already
+    s->resize(len);
+    IOResult r = (len == 0) ? IO_OK : ReceiveBytes(socket_fd, (uint8_t*)&(*s)[0], (int)len, left_ms);
+    if (result != NULL) {
+        *result = r;
+    }
+    if (r != IO_OK) {
+        s->clear();
+        return false;
+    }
+    return true;
+}
+
+
+void MinNet::set_max_frame_size(uint32_t max_bytes) {
+    // frames are buffered and indexed with ints
+    max_frame_size = std::min(max_bytes, (uint32_t)0x7FFFFFF0);
+}
+
+
+uint32_t MinNet::get_max_frame_size() {
+    return max_frame_size;
+}
+
+
+void MinNet::set_socket_tuning(const SocketTuning &tuning) {
+    std::lock_guard<std::mutex> lock(socket_tuning_mutex);
+    socket_tuning = tuning;
+    quick_ack = tuning.quick_ack;
+    spin_wait = tuning.spin_wait;
+}
+
+
+SocketTuning MinNet::get_socket_tuning() {
+    std::lock_guard<std::mutex> lock(socket_tuning_mutex);
+    return socket_tuning;
+}
+
+
+// Sets an int socket option (a char is too short for linux, which refuses it), with a warning the first time
+// each option fails, rather than once per connection.
+static bool SetIntOption(SOCKET socket_fd, int level, int option, int value, const char *name, int warn_bit) {
+    static std::atomic<int> warned(0);
+    if (setsockopt(socket_fd, level, option, (const char*)&value, sizeof(value)) == 0) {
+        return true;
+    }
+    int err = LastSocketError();
+    if ((warned.fetch_or(warn_bit) & warn_bit) == 0) {
+        std::cerr << "MinNet Warning: Could not set " << name << " to " << value << ", error " << err << "." << std::endl;
+    }
+    return false;
+}
+
+
+bool MinNet::ApplySocketTuning(SOCKET socket_fd, const SocketTuning &tuning) {
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (getsockname(socket_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        return false;
+    }
+    bool ok = true;
+    if (tuning.send_buffer_bytes > 0) {
+        ok &= SetIntOption(socket_fd, SOL_SOCKET, SO_SNDBUF, tuning.send_buffer_bytes, "SO_SNDBUF", 1);
+    }
+    if (tuning.receive_buffer_bytes > 0) {
+        ok &= SetIntOption(socket_fd, SOL_SOCKET, SO_RCVBUF, tuning.receive_buffer_bytes, "SO_RCVBUF", 2);
+    }
+    if (addr.ss_family == AF_UNIX) {
+        // the rest are TCP/IP's
+        return ok;
+    }
+    ok &= SetIntOption(socket_fd, IPPROTO_TCP, TCP_NODELAY, tuning.no_delay ? 1 : 0, "TCP_NODELAY", 4);
+#ifdef TCP_QUICKACK
+    if (tuning.quick_ack) {
+        ok &= SetIntOption(socket_fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK", 8);
+    }
+#endif
+#ifdef SO_BUSY_POLL
+    if (tuning.busy_poll_us > 0) {
+        ok &= SetIntOption(socket_fd, SOL_SOCKET, SO_BUSY_POLL, tuning.busy_poll_us, "SO_BUSY_POLL", 16);
+    }
+#endif
+    if (tuning.dscp > 0) {
+        // the DSCP is the top 6 bits of the traffic class byte
+        int tos = (tuning.dscp & 0x3f) << 2;
+        if (addr.ss_family == AF_INET6) {
+            ok &= SetIntOption(socket_fd, IPPROTO_IPV6, IPV6_TCLASS, tos, "IPV6_TCLASS", 32);
+        }
+        else {
+            ok &= SetIntOption(socket_fd, IPPROTO_IP, IP_TOS, tos, "IP_TOS", 64);
         }
-        delete [] buf;
     }
     return ok;
 }
 
 
+void MinNet::RearmQuickAck(SOCKET socket_fd) {
+#ifdef TCP_QUICKACK
+    if (quick_ack) {
+        int value = 1;
+        setsockopt(socket_fd, IPPROTO_TCP, TCP_QUICKACK, &value, sizeof(value));
+    }
+#endif
+}
+
+
+int MinNet::PollSocket(SOCKET socket_fd, short events, int timeout_ms) {
+    struct pollfd p;
+    p.fd = socket_fd;
+    p.events = events;
+    p.revents = 0;
+    if ((!spin_wait) || ((events & POLLIN) == 0) || (timeout_ms == 0)) {
+        return poll(&p, 1, timeout_ms);
+    }
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(timeout_ms);
+    while (true) {
+        int n = poll(&p, 1, 0);
+        if ((n != 0) || ((timeout_ms > 0) && (std::chrono::steady_clock::now() >= deadline))) {
+            return n;
+        }
+    }
+}
+
+
+bool MinNet::is_spin_wait() {
+    return spin_wait;
+}
+
+
 bool MinNet::IsReadyToRead(SOCKET* socket_fd) {
-    // create a fd set that contains only socket_fd
-    fd_set fds;
-    FD_ZERO(&fds);
-    FD_SET(*socket_fd, &fds);
-    struct timeval  tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 0;
-    SOCKET max_fd = *socket_fd;
-    int err = select((int)max_fd + 1, &fds, NULL, NULL, &tv);
+    // poll() rather than select() so that fds >= FD_SETSIZE work
+    struct pollfd p;
+    p.fd = *socket_fd;
+    p.events = POLLIN;
+    p.revents = 0;
+    int err = poll(&p, 1, 0);
     if (err == SOCKET_ERROR) {
-        std::cerr << "MinNet::IsReadyToRead() Error: Select failed." << std::endl;
+        std::cerr << "MinNet::IsReadyToRead() Error: Poll failed." << std::endl;
 #ifdef WIN32
         std::cerr << "WSAGetLastError() = " << WSAGetLastError() << std::endl;
 #else
@@ -371,8 +1113,8 @@ bool MinNet::IsReadyToRead(SOCKET* socket_fd) {
         return false;
     }
     else {
-        // true if socket_fd is still in the set after calling select
-        return FD_ISSET(*socket_fd, &fds);
+        // a hangup also counts as ready, the next read will report the closed connection
+        return (p.revents & (POLLIN | POLLHUP | POLLERR)) != 0;
     }
 }
 
@@ -380,24 +1122,16 @@ bool MinNet::IsReadyToRead(SOCKET* socket_fd) {
 std::vector<SOCKET> MinNet::SelectReadyToRead(const std::vector<SOCKET> &test_fds) {
     std::vector<SOCKET> ready_fds;
     if (test_fds.size() > 0) {
-        // create a fd set that contains all of the socket fds in fds_to_test,
-        // and keep track of the max fd
-        fd_set fds;
-        FD_ZERO(&fds);
-        SOCKET max_fd = test_fds[0];
+        std::vector<struct pollfd> pfds(test_fds.size());
         for (int i=0; i<test_fds.size(); i++) {
-            FD_SET(test_fds[i], &fds);
-            if (test_fds[i] > max_fd) {
-                max_fd = test_fds[i];
-            }
+            pfds[i].fd = test_fds[i];
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
         }
 
-        struct timeval  tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 0;
-        int err = select((int)max_fd + 1, &fds, NULL, NULL, &tv);
+        int err = poll(pfds.data(), (unsigned long)pfds.size(), 0);
         if (err == SOCKET_ERROR) {
-            std::cerr << "MinNet::SelectReadyToRead() Error: Select failed." << std::endl;
+            std::cerr << "MinNet::SelectReadyToRead() Error: Poll failed." << std::endl;
 #ifdef WIN32
             std::cerr << "WSAGetLastError() = " << WSAGetLastError() << std::endl;
 #else
@@ -406,8 +1140,8 @@ std::vector<SOCKET> MinNet::SelectReadyToRead(const std::vector<SOCKET> &test_fd
             return ready_fds;
         }
         
-        for (int i=0; i<test_fds.size(); i++) {
-            if (FD_ISSET(test_fds[i], &fds)) {
+        for (int i=0; i<pfds.size(); i++) {
+            if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
                 ready_fds.push_back(test_fds[i]);
             }
         }
@@ -416,6 +1150,121 @@ std::vector<SOCKET> MinNet::SelectReadyToRead(const std::vector<SOCKET> &test_fd
 }
 
 
+bool MinNet::SendSocket(SOCKET* channel_fd, SOCKET socket_to_send, const std::string &info, double timeout_ms) {
+#ifdef WIN32
+    std::cerr << "MinNet::SendSocket() Error: Passing sockets is not supported on windows." << std::endl;
+    return false;
+#else
+    // the socket rides along with the first byte of a length-prefixed message, and the rest of the message
+    // follows as ordinary data
+    uint32_t len = (uint32_t)info.size();
+    uint8_t header[4];
+    header[0] = (uint8_t)(len & 0xff);
+    header[1] = (uint8_t)((len >> 8) & 0xff);
+    header[2] = (uint8_t)((len >> 16) & 0xff);
+    header[3] = (uint8_t)((len >> 24) & 0xff);
+
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = 4;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    if (socket_to_send != INVALID_SOCKET) {
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &socket_to_send, sizeof(int));
+    }
+    int n;
+    do {
+        n = (int)sendmsg(*channel_fd, &msg, MSG_NOSIGNAL);
+    } while ((n == SOCKET_ERROR) && (errno == EINTR));
+    if (n <= 0) {
+        std::cerr << "MinNet::SendSocket() Error: sendmsg failed, errno = " << errno << std::endl;
+        return false;
+    }
+    // the socket has gone with the first byte, anything else is sent normally
+    return (SendBytes(channel_fd, header + n, 4 - n, timeout_ms) == IO_OK) &&
+        (SendBytes(channel_fd, (uint8_t*)info.data(), (int)info.size(), timeout_ms) == IO_OK);
+#endif
+}
+
+
+bool MinNet::ReceiveSocket(SOCKET* channel_fd, SOCKET* received_fd, std::string* info, double timeout_ms) {
+    *received_fd = INVALID_SOCKET;
+#ifdef WIN32
+    std::cerr << "MinNet::ReceiveSocket() Error: Passing sockets is not supported on windows." << std::endl;
+    return false;
+#else
+    if (timeout_ms > 0) {
+        struct pollfd p;
+        p.fd = *channel_fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, (int)timeout_ms) <= 0) {
+            return false;
+        }
+    }
+
+    uint8_t header[4];
+    struct iovec iov;
+    iov.iov_base = header;
+    iov.iov_len = 4;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    int n;
+    do {
+#ifdef MSG_CMSG_CLOEXEC
+        n = (int)recvmsg(*channel_fd, &msg, MSG_CMSG_CLOEXEC);
+#else
+        n = (int)recvmsg(*channel_fd, &msg, 0);
+#endif
+    } while ((n == SOCKET_ERROR) && (errno == EINTR));
+    if (n <= 0) {
+        return false;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS) &&
+            (cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))) {
+            memcpy(received_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    bool ok = (ReceiveBytes(channel_fd, header + n, 4 - n, timeout_ms) == IO_OK);
+    if (ok) {
+        uint32_t len = (uint32_t)header[0] | ((uint32_t)header[1] << 8) | ((uint32_t)header[2] << 16) |
+            ((uint32_t)header[3] << 24);
+        info->resize(len);
+        ok = (len == 0) || (ReceiveBytes(channel_fd, (uint8_t*)&(*info)[0], (int)len, timeout_ms) == IO_OK);
+    }
+    if ((!ok) && (*received_fd != INVALID_SOCKET)) {
+        CloseSocket(received_fd);
+        *received_fd = INVALID_SOCKET;
+    }
+    return ok;
+#endif
+}
+
+
 bool MinNet::CloseSocket(SOCKET *socket_fd) {
 #ifdef WIN32
     closesocket(*socket_fd);
@@ -427,12 +1276,38 @@ bool MinNet::CloseSocket(SOCKET *socket_fd) {
 
 
 std::string MinNet::GetAddressAndPort(SOCKET socket_fd) {
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof addr);
-    socklen_t len = sizeof(addr);
-    getsockname(socket_fd, (struct sockaddr *)&addr, &len);
+    struct sockaddr_storage storage;
+    memset(&storage, 0, sizeof storage);
+    socklen_t len = sizeof(storage);
+    getsockname(socket_fd, (struct sockaddr *)&storage, &len);
+#ifndef WIN32
+    if (storage.ss_family == AF_UNIX) {
+        struct sockaddr_un *addr = (struct sockaddr_un *)&storage;
+        size_t path_len = len - offsetof(struct sockaddr_un, sun_path);
+        if ((len <= offsetof(struct sockaddr_un, sun_path)) || (path_len == 0)) {
+            // the client end of a unix domain connection has no name
+            return "unix:";
+        }
+        if (addr->sun_path[0] == '\0') {
+            return "unix:@" + std::string(addr->sun_path + 1, path_len - 1);
+        }
+        return "unix:" + std::string(addr->sun_path, strnlen(addr->sun_path, path_len));
+    }
+#endif
+    struct sockaddr_in *addr = (struct sockaddr_in *)&storage;
     char ip_str[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &addr.sin_addr, ip_str, sizeof(ip_str));
-    unsigned int port = ntohs(addr.sin_port);
+    inet_ntop(AF_INET, &addr->sin_addr, ip_str, sizeof(ip_str));
+    unsigned int port = ntohs(addr->sin_port);
     return std::string(ip_str) + ":" + std::to_string(port);
 }
+
+
+std::string MinNet::IOResultToString(IOResult result) {
+    switch (result) {
+        case IO_OK: return "ok";
+        case IO_TIMEOUT: return "timed out";
+        case IO_CLOSED: return "closed by peer";
+        case IO_TOO_LARGE: return "message too large";
+        default: return "socket error";
+    }
+}
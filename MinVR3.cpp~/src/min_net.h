@@ -6,12 +6,18 @@
   complex data in a serialized form, e.g., vector3, matrix4, custom data structure.  This class just provides
   a wrapper around the low-level socket programming and leaves the details of which messages to send and
   when up to the application programmer.
+
+  Wherever an ip address is accepted, a unix domain socket may be given instead as "unix:/path/to/socket", or as
+  "unix:@name" for a socket in the abstract namespace (linux only), which has no file and disappears with the last
+  socket that uses it.  Unix domain sockets skip the TCP/IP stack, so they are the cheaper choice for clients
+  running on the same machine.  Their port numbers are ignored.
  */
 
 #ifndef MINVR3_MINNET_H
 #define MINVR3_MINNET_H
 
 #include "net_headers.h"
+#include "socket_tuning.h"
 
 #include <stdint.h>
 #include <string>
@@ -20,33 +26,128 @@
 
 class MinNet {
 public:
+    // how a send or receive ended, for callers that need to tell a slow peer from one that has gone away
+    enum IOResult {
+        IO_OK,          // everything was sent/received
+        IO_TIMEOUT,     // the timeout passed first, the socket is still usable but a message may be half sent/received
+        IO_CLOSED,      // the peer closed the connection (or reset it)
+        IO_ERROR,       // any other socket error
+        IO_TOO_LARGE    // the length header asked for more than get_max_frame_size(), nothing was allocated for it
+                        // but the stream can no longer be trusted, so close the socket
+    };
+
+    // default for set_max_frame_size(), far beyond any event but well short of what a corrupt header can ask for
+    static const uint32_t DEFAULT_MAX_FRAME_SIZE = 64 * 1024 * 1024;
+
     // initialize networking -- same for client and server
     static bool Init();
 
     // server management
     static bool CreateListener(int port, SOCKET* socket_fd, int backlog=10);
+    // address is either a port number or a "unix:" address, so one setting can select either kind of listener
+    static bool CreateListener(const std::string &address, SOCKET* socket_fd, int backlog=10);
     static bool TryAcceptConnection(const SOCKET listener_fd, SOCKET* client_fd);
 
+    // in non-blocking mode, accept/send/recv return immediately rather than waiting for the socket to be ready
+    static bool SetNonBlocking(SOCKET socket_fd, bool non_blocking);
+
     // client management
     static bool ConnectTo(const std::string &ip, int port, SOCKET* socket_fd);
 
-    // send messages
-    static bool SendUInt32(SOCKET* socket_fd, uint32_t i, double timeout_ms=0);
-    static bool SendString(SOCKET* socket_fd, const std::string &s, double timeout_ms=0);
+    // a connected pair of non-blocking stream sockets within this process, e.g., so one thread can wake another
+    // that is waiting in poll() by sending it a byte (AF_UNIX socketpair, or a loopback TCP pair on windows)
+    static bool CreateSocketPair(SOCKET* fd_a, SOCKET* fd_b);
+
+    // send messages -- timeout_ms is a deadline for the whole message, measured with a monotonic clock, and
+    // 0 means wait as long as it takes.  result (if not NULL) says why a call returned false.
+    static bool SendUInt32(SOCKET* socket_fd, uint32_t i, double timeout_ms=0, IOResult* result=NULL);
+    static bool SendString(SOCKET* socket_fd, const std::string &s, double timeout_ms=0, IOResult* result=NULL);
+
+    // sends count buffers back to back, gathering them into a single system call (writev-style) whenever the
+    // socket can take them all at once, so a message's header and body leave in the same packet
+    static bool SendGather(SOCKET* socket_fd, const uint8_t* const* bufs, const int* lens, int count, double timeout_ms=0,
+                           IOResult* result=NULL);
+
+    // non-blocking version of SendGather(), makes one gathered write of as much as the socket will take right now.
+    // returns the number of bytes sent, which may end part way through a buffer, 0 if the socket's send buffer is
+    // full, or -1 on error.  on windows the socket must be in non-blocking mode (see SetNonBlocking()).
+    static int TrySendGather(SOCKET* socket_fd, const uint8_t* const* bufs, const int* lens, int count);
+
+    // while corked, the OS holds back partially filled packets so that several small sends leave together,
+    // uncorking sends anything still pending (TCP_CORK on linux, TCP_NOPUSH on osx, no effect on windows)
+    static bool SetCork(SOCKET socket_fd, bool cork);
+
+    // datagram (UDP) sockets -- each send is delivered whole or not at all, with no retransmits and no ordering.
+    // CreateDatagramSocket() binds to port on all interfaces (port 0 picks a free one) for receiving, and
+    // ConnectDatagramSocket() creates a socket that sends to ip:port.  ReceiveDatagram() never blocks, it
+    // returns false if no datagram is waiting or on error.  from (if not NULL) is set to the sender's ip:port.
+    static bool CreateDatagramSocket(int port, SOCKET* socket_fd);
+    static bool ConnectDatagramSocket(const std::string &ip, int port, SOCKET* socket_fd);
+    static bool SendDatagram(SOCKET* socket_fd, const uint8_t* buf, int len);
+    static bool ReceiveDatagram(SOCKET* socket_fd, uint8_t* buf, int max_len, int* len, std::string* from=NULL);
+    // sends to a specific address (as reported by ReceiveDatagram()'s from), e.g., to reply on a bound socket
+    static bool SendDatagramTo(SOCKET* socket_fd, const std::string &ip_and_port, const uint8_t* buf, int len);
+
+    // multicast (UDP) sockets -- CreateMulticastSender() creates a socket whose datagrams go to every member of
+    // the group, and JoinMulticastGroup() creates a socket that receives them.  Several processes on the same
+    // host may join the same group and port.  interface_ip selects the network interface (e.g., "127.0.0.1" to
+    // stay on the loopback interface), the default lets the OS choose.  ttl limits how many routers the
+    // datagrams may cross, 1 keeps them on the local network.
+    static bool CreateMulticastSender(const std::string &group, int port, SOCKET* socket_fd,
+                                      const std::string &interface_ip="", int ttl=1);
+    static bool JoinMulticastGroup(const std::string &group, int port, SOCKET* socket_fd,
+                                   const std::string &interface_ip="");
 
     // receive messages
     static bool IsReadyToRead(SOCKET* socket_fd);
     static std::vector<SOCKET> SelectReadyToRead(const std::vector<SOCKET> &fds_to_test);
     
-    static bool ReceiveUInt32(SOCKET* socket_fd, uint32_t* i, double timeout_ms=0);
-    static bool ReceiveString(SOCKET* socket_fd, std::string* s, double timeout_ms=0);
+    // timeout_ms and result work the same as for sending.  ReceiveString() reads into s's existing storage, so
+    // a caller that keeps receiving into the same string makes no heap allocations once it has grown to the size
+    // of the largest message.  If the call fails, s is left empty.
+    static bool ReceiveUInt32(SOCKET* socket_fd, uint32_t* i, double timeout_ms=0, IOResult* result=NULL);
+    static bool ReceiveString(SOCKET* socket_fd, std::string* s, double timeout_ms=0, IOResult* result=NULL);
+
+    // Largest message ReceiveString() (and any FrameDecoder created afterwards) will accept; the length header
+    // is checked against it before anything is allocated.  Applies to the whole process.
+    static void set_max_frame_size(uint32_t max_bytes);
+    static uint32_t get_max_frame_size();
+
+    // Socket options for every TCP connection made by ConnectTo() or accepted by TryAcceptConnection() from then on,
+    // e.g., a low-latency profile for a tracking path (see SocketTuning).  Applies to the whole process.
+    static void set_socket_tuning(const SocketTuning &tuning);
+    static SocketTuning get_socket_tuning();
+
+    // sets tuning's options on a connected socket, returns false with a warning (once per option) if the OS
+    // refused any of them, e.g., SO_BUSY_POLL without CAP_NET_ADMIN
+    static bool ApplySocketTuning(SOCKET socket_fd, const SocketTuning &tuning);
+
+    // linux turns TCP_QUICKACK off again after a while, so with the process's tuning's quick_ack, everything
+    // that reads from a socket calls this after each read; otherwise it does nothing
+    static void RearmQuickAck(SOCKET socket_fd);
+
+    // poll() on a single socket, except that with the process's tuning's spin_wait, a wait to read (POLLIN) polls
+    // without sleeping until the socket is ready or timeout_ms (-1 for no limit) has passed
+    static int PollSocket(SOCKET socket_fd, short events, int timeout_ms);
+    static bool is_spin_wait();
     
+    // Passing sockets between processes over a unix domain socket connection (not available on windows).  The
+    // receiver gets its own descriptor for the same socket, e.g., so a new relay server can take over the
+    // listener and all of the client connections of the one it replaces without dropping a connection.  A short
+    // message (info) travels with each socket; socket_to_send may be INVALID_SOCKET to send just the message.
+    static bool SendSocket(SOCKET* channel_fd, SOCKET socket_to_send, const std::string &info, double timeout_ms=0);
+    static bool ReceiveSocket(SOCKET* channel_fd, SOCKET* received_fd, std::string* info, double timeout_ms=0);
+
+    static bool IsUnixAddress(const std::string &address);
+
     // cleanup -- same for client and server
     static bool CloseSocket(SOCKET* socket_fd);
     static bool Shutdown();
     
     static std::string GetAddressAndPort(SOCKET socket_fd);
 
+    static std::string IOResultToString(IOResult result);
+
     // return 0 for big endian, 1 for little endian.
     static inline bool is_little_endian() {
         // http://stackoverflow.com/questions/12791864/c-program-to-check-little-vs-big-endian
@@ -56,10 +157,10 @@ public:
     
 protected:
     // if timeout_ms == 0, then these routines block and do not return until len bytes have been sent/received.
-    // if timeout_ms > 0, then the routine returns true if len bytes are successfully sent/received and false
-    // if the operation failed due to either a socket error or taking longer than the timeout.
-    static bool SendBytes(SOCKET* socket_fd, uint8_t* buf, int len, double timeout_ms=0);
-    static bool ReceiveBytes(SOCKET* socket_fd, uint8_t* buf, int len, double timeout_ms=0);
+    // if timeout_ms > 0, then they never wait past the deadline: the socket is only read/written when poll() says
+    // it is ready, and poll() is given whatever is left of the timeout.
+    static IOResult SendBytes(SOCKET* socket_fd, uint8_t* buf, int len, double timeout_ms=0);
+    static IOResult ReceiveBytes(SOCKET* socket_fd, uint8_t* buf, int len, double timeout_ms=0);
 };
 
 #endif
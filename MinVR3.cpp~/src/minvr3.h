@@ -10,10 +10,31 @@
 #include "net_headers.h"
 
 #include "json/json.h"
+#include "async_client.h"
 #include "config_val.h"
+#include "connection.h"
+#include "datagram_channel.h"
+#include "event_dictionary.h"
+#include "event_relay.h"
+#include "frame_decoder.h"
+#include "frame_encoder.h"
+#include "memory_connection.h"
 #include "min_net.h"
 #include "minvr3_net.h"
 #include "minvr3_utils.h"
+#include "msgpack_codec.h"
+#include "multicast_channel.h"
+#include "net_batch_io.h"
+#include "net_reactor.h"
+#include "relay_cluster.h"
+#include "relay_federation.h"
+#include "send_queue.h"
+#include "sharded_event_relay.h"
+#include "shm_ring.h"
+#include "socket_tuning.h"
+#include "spsc_queue.h"
+#include "subscription_trie.h"
+#include "tcp_connection.h"
 #include "vr_event.h"
 
 #endif
@@ -7,6 +7,10 @@ bool MinVR3Net::SendVREvent(SOCKET* socket_fd, const VREvent &e, double timeout_
     return SendString(socket_fd, json, timeout_ms);
 }
 
+void MinVR3Net::QueueVREvent(FrameEncoder* encoder, const VREvent &e) {
+    encoder->QueueString(e.ToJson());
+}
+
 VREvent* MinVR3Net::ReceiveVREvent(SOCKET* socket_fd, double timeout_ms) {
     std::string json;
     if (ReceiveString(socket_fd, &json, timeout_ms)) {
@@ -70,3 +74,17 @@ VREventString* MinVR3Net::ReceiveVREventString(SOCKET* socket_fd, double timeout
     }
     return NULL;
 }
+
+bool MinVR3Net::ReceiveAvailableVREvents(SOCKET* socket_fd, FrameDecoder* decoder, std::vector<VREvent*>* events) {
+    FrameDecoder::ReadResult r;
+    std::string json;
+    while ((r = decoder->ReadFrom(*socket_fd)) == FrameDecoder::READ_OK) {
+        while (decoder->NextFrame(&json)) {
+            VREvent* e = VREvent::CreateFromJson(json);
+            if (e != NULL) {
+                events->push_back(e);
+            }
+        }
+    }
+    return (r == FrameDecoder::READ_WOULD_BLOCK);
+}
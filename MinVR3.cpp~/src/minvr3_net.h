@@ -2,9 +2,13 @@
 #ifndef MINVR3_MINVR3_NET_H
 #define MINVR3_MINVR3_NET_H
 
+#include "frame_decoder.h"
+#include "frame_encoder.h"
 #include "min_net.h"
 #include "vr_event.h"
 
+#include <vector>
+
 
 /** Extends the MinNet class to send/receive VREvent types.
  */
@@ -13,6 +17,10 @@ public:
     /// use this function to send all types of vrevents
     static bool SendVREvent(SOCKET* socket_fd, const VREvent &e, double timeout_ms=0);
 
+    /// buffered alternative to SendVREvent(): adds the event to the connection's encoder, and nothing is sent until
+    /// encoder->Flush() is called, so all events queued in between leave together in as few packets as possible
+    static void QueueVREvent(FrameEncoder* encoder, const VREvent &e);
+
     /// this function can receive any type of vrevent but you will need to cast the event created to the appropriate type if
     /// the event has a data payload and you want to access its data
     static VREvent* ReceiveVREvent(SOCKET* socket_fd, double timeout_ms=0);
@@ -24,6 +32,11 @@ public:
     static VREventVector4* ReceiveVREventVector4(SOCKET* socket_fd, double timeout_ms=0);
     static VREventQuaternion* ReceiveVREventQuaternion(SOCKET* socket_fd, double timeout_ms=0);
     static VREventString* ReceiveVREventString(SOCKET* socket_fd, double timeout_ms=0);
+
+    /// non-blocking alternative to the functions above: reads everything currently available on the socket into
+    /// the connection's decoder and appends every complete event to events, leaving any partial event buffered
+    /// for next time.  returns false if the connection was closed or there was a socket error.
+    static bool ReceiveAvailableVREvents(SOCKET* socket_fd, FrameDecoder* decoder, std::vector<VREvent*>* events);
 };
 
 #endif
@@ -45,6 +45,33 @@ bool MinVRUtils::BeginsWith(const std::string &test, const std::string &pattern)
     }
 }
 
+bool MinVRUtils::MatchesWildcard(const std::string &test, const std::string &pattern) {
+    // greedy, backing up to the last * on a mismatch, so it never takes more than O(test * pattern)
+    size_t t = 0, p = 0;
+    size_t star = std::string::npos, star_t = 0;
+    while (t < test.size()) {
+        if ((p < pattern.size()) && ((pattern[p] == '?') || (pattern[p] == test[t]))) {
+            t++;
+            p++;
+        }
+        else if ((p < pattern.size()) && (pattern[p] == '*')) {
+            star = p++;
+            star_t = t;
+        }
+        else if (star != std::string::npos) {
+            p = star + 1;
+            t = ++star_t;
+        }
+        else {
+            return false;
+        }
+    }
+    while ((p < pattern.size()) && (pattern[p] == '*')) {
+        p++;
+    }
+    return p == pattern.size();
+}
+
 std::string MinVRUtils::TrimWhitespace(const std::string &s) {
     size_t left = 0;
     // Trim from left
@@ -17,6 +17,10 @@ public:
 
     static bool BeginsWith(const std::string &test, const std::string &pattern);
 
+    /// Wildcard match of the whole string: * matches any run of characters (including none, and including /),
+    /// ? matches any one character, e.g., "Tracker/*/Position" or "*Rotation".
+    static bool MatchesWildcard(const std::string &test, const std::string &pattern);
+
     static std::string TrimWhitespace(const std::string &s);
 
     static std::string ReplaceAll(std::string str, const std::string &from, const std::string &to);
@@ -0,0 +1,410 @@
+#include "msgpack_codec.h"
+
+#include <cstring>
+#include <iostream>
+#include <stdint.h>
+
+
+// MessagePack is big-endian, VREvent's binary layout (see VREvent::AppendBinaryData()) little-endian
+static uint32_t ReadLittleEndian32(const char *p) {
+    const uint8_t *b = (const uint8_t*)p;
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+
+static void AppendLittleEndian32(uint32_t v, std::string *s) {
+    s->push_back((char)(v & 0xff));
+    s->push_back((char)((v >> 8) & 0xff));
+    s->push_back((char)((v >> 16) & 0xff));
+    s->push_back((char)((v >> 24) & 0xff));
+}
+
+
+static void AppendBigEndian(uint64_t v, int num_bytes, std::string *s) {
+    for (int i=num_bytes - 1; i>=0; i--) {
+        s->push_back((char)((v >> (8 * i)) & 0xff));
+    }
+}
+
+
+static void AppendString(const char *str, size_t len, std::string *s) {
+    if (len < 32) {
+        s->push_back((char)(0xa0 | len));
+    }
+    else if (len <= 0xff) {
+        s->push_back((char)0xd9);
+        AppendBigEndian(len, 1, s);
+    }
+    else if (len <= 0xffff) {
+        s->push_back((char)0xda);
+        AppendBigEndian(len, 2, s);
+    }
+    else {
+        s->push_back((char)0xdb);
+        AppendBigEndian(len, 4, s);
+    }
+    s->append(str, len);
+}
+
+
+static void AppendString(const std::string &str, std::string *s) {
+    AppendString(str.data(), str.size(), s);
+}
+
+
+static void AppendInt(int32_t v, std::string *s) {
+    if ((v >= -32) && (v <= 127)) {
+        // positive and negative fixint
+        s->push_back((char)(int8_t)v);
+    }
+    else if ((v >= -128) && (v <= 127)) {
+        s->push_back((char)0xd0);
+        AppendBigEndian((uint8_t)(int8_t)v, 1, s);
+    }
+    else if ((v >= -32768) && (v <= 32767)) {
+        s->push_back((char)0xd1);
+        AppendBigEndian((uint16_t)(int16_t)v, 2, s);
+    }
+    else {
+        s->push_back((char)0xd2);
+        AppendBigEndian((uint32_t)v, 4, s);
+    }
+}
+
+
+// the float's bits, as they are in the binary layout
+static void AppendFloat(uint32_t bits, std::string *s) {
+    s->push_back((char)0xca);
+    AppendBigEndian(bits, 4, s);
+}
+
+
+bool MsgPackCodec::IsMsgPack(const std::string &frame) {
+    if (frame.empty()) {
+        return false;
+    }
+    uint8_t b = (uint8_t)frame[0];
+    return ((b & 0xf0) == 0x80) || (b == 0xde) || (b == 0xdf);
+}
+
+
+bool MsgPackCodec::Encode(const VREvent &e, std::string *frame) {
+    frame->clear();
+    const std::string &type = e.get_data_type_name();
+    if (!VREvent::HasBinaryLayout(type)) {
+        return false;
+    }
+    std::string data;
+    e.AppendBinaryData(&data);
+
+    frame->reserve(32 + e.get_name().size() + 2 * data.size());
+    frame->push_back((char)(type.empty() ? 0x82 : 0x83));
+    AppendString("m_Name", 6, frame);
+    AppendString(e.get_name(), frame);
+    AppendString("m_DataTypeName", 14, frame);
+    AppendString(type, frame);
+    if (type.empty()) {
+        return true;
+    }
+    AppendString("m_Data", 6, frame);
+    if (type == "String") {
+        AppendString(data, frame);
+    }
+    else if (type == "Int32") {
+        AppendInt((int32_t)ReadLittleEndian32(data.data()), frame);
+    }
+    else if (type == "Single") {
+        AppendFloat(ReadLittleEndian32(data.data()), frame);
+    }
+    else {
+        static const char *keys[4] = { "x", "y", "z", "w" };
+        int num_floats = (int)data.size() / 4;
+        frame->push_back((char)(0x80 | num_floats));
+        for (int i=0; i<num_floats; i++) {
+            AppendString(keys[i], 1, frame);
+            AppendFloat(ReadLittleEndian32(data.data() + 4 * i), frame);
+        }
+    }
+    return true;
+}
+
+
+// Reads the few kinds of value an event is made of, each call returns false if the next value is not of that
+// kind or is cut off.
+class MsgPackReader {
+public:
+    MsgPackReader(const char *data, size_t size) : data_((const uint8_t*)data), size_(size), pos_(0) {}
+
+    bool ReadMapSize(uint32_t *n) {
+        if (pos_ >= size_) {
+            return false;
+        }
+        uint8_t b = data_[pos_];
+        if ((b & 0xf0) == 0x80) {
+            pos_++;
+            *n = b & 0x0f;
+            return true;
+        }
+        uint64_t v;
+        if ((b == 0xde) || (b == 0xdf)) {
+            pos_++;
+            if (!ReadBigEndian((b == 0xde) ? 2 : 4, &v)) {
+                return false;
+            }
+            *n = (uint32_t)v;
+            return true;
+        }
+        return false;
+    }
+
+    bool ReadString(std::string *s) {
+        if (pos_ >= size_) {
+            return false;
+        }
+        uint8_t b = data_[pos_++];
+        uint64_t len;
+        if ((b & 0xe0) == 0xa0) {
+            len = b & 0x1f;
+        }
+        else if ((b < 0xd9) || (b > 0xdb) || (!ReadBigEndian(1 << (b - 0xd9), &len))) {
+            return false;
+        }
+        if (len > size_ - pos_) {
+            return false;
+        }
+        s->assign((const char*)data_ + pos_, (size_t)len);
+        pos_ += (size_t)len;
+        return true;
+    }
+
+    /// Any integer or float.  is_integer is set for integers, and for floats with a whole value.
+    bool ReadNumber(double *v, bool *is_integer) {
+        if (pos_ >= size_) {
+            return false;
+        }
+        uint8_t b = data_[pos_++];
+        uint64_t bits;
+        *is_integer = true;
+        if (b <= 0x7f) {
+            *v = b;
+        }
+        else if (b >= 0xe0) {
+            *v = (int8_t)b;
+        }
+        else if ((b >= 0xcc) && (b <= 0xcf)) {
+            if (!ReadBigEndian(1 << (b - 0xcc), &bits)) {
+                return false;
+            }
+            *v = (double)bits;
+        }
+        else if ((b >= 0xd0) && (b <= 0xd3)) {
+            int num_bytes = 1 << (b - 0xd0);
+            if (!ReadBigEndian(num_bytes, &bits)) {
+                return false;
+            }
+            // sign extend
+            if ((num_bytes < 8) && (bits & ((uint64_t)1 << (8 * num_bytes - 1)))) {
+                bits |= ~(uint64_t)0 << (8 * num_bytes);
+            }
+            *v = (double)(int64_t)bits;
+        }
+        else if (b == 0xca) {
+            if (!ReadBigEndian(4, &bits)) {
+                return false;
+            }
+            uint32_t f_bits = (uint32_t)bits;
+            float f;
+            memcpy(&f, &f_bits, 4);
+            *v = f;
+            *is_integer = IsWhole(*v);
+        }
+        else if (b == 0xcb) {
+            if (!ReadBigEndian(8, &bits)) {
+                return false;
+            }
+            memcpy(v, &bits, 8);
+            *is_integer = IsWhole(*v);
+        }
+        else {
+            pos_--;
+            return false;
+        }
+        return true;
+    }
+
+    bool ReadNil() {
+        if ((pos_ < size_) && (data_[pos_] == 0xc0)) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool is_at_end() const {
+        return pos_ == size_;
+    }
+
+private:
+    static bool IsWhole(double v) {
+        return (v > -9.0e18) && (v < 9.0e18) && (v == (double)(int64_t)v);
+    }
+
+    bool ReadBigEndian(int num_bytes, uint64_t *v) {
+        if (num_bytes > size_ - pos_) {
+            return false;
+        }
+        *v = 0;
+        for (int i=0; i<num_bytes; i++) {
+            *v = (*v << 8) | data_[pos_++];
+        }
+        return true;
+    }
+
+    const uint8_t *data_;
+    size_t size_;
+    size_t pos_;
+};
+
+
+// m_Data, as read before m_DataTypeName says what it should be, since the keys can come in any order
+struct MsgPackData {
+    enum Kind { NONE, NUMBER, STRING, FLOATS };
+    Kind kind;
+    double number;
+    bool is_integer;
+    std::string str;
+    float floats[4];
+    int keys_found;     // bit 0 for x, 1 for y, ...
+
+    MsgPackData() : kind(NONE), number(0), is_integer(false), keys_found(0) {}
+};
+
+
+static bool ReadData(MsgPackReader *reader, MsgPackData *data) {
+    if (reader->ReadNil()) {
+        data->kind = MsgPackData::NONE;
+        return true;
+    }
+    if (reader->ReadNumber(&data->number, &data->is_integer)) {
+        data->kind = MsgPackData::NUMBER;
+        return true;
+    }
+    uint32_t n;
+    if (reader->ReadMapSize(&n)) {
+        data->kind = MsgPackData::FLOATS;
+        data->keys_found = 0;
+        std::string key;
+        for (uint32_t i=0; i<n; i++) {
+            double v;
+            bool is_integer;
+            if ((!reader->ReadString(&key)) || (key.size() != 1) || (key.find_first_not_of("xyzw") != std::string::npos) ||
+                (!reader->ReadNumber(&v, &is_integer)))
+            {
+                return false;
+            }
+            int k = (key[0] == 'w') ? 3 : key[0] - 'x';
+            if (data->keys_found & (1 << k)) {
+                return false;
+            }
+            data->keys_found |= 1 << k;
+            data->floats[k] = (float)v;
+        }
+        return true;
+    }
+    data->kind = MsgPackData::STRING;
+    return reader->ReadString(&data->str);
+}
+
+
+// turns m_Data into VREvent's binary layout for data_type_name, which VREvent then checks the size of
+static bool DataToBinary(const std::string &data_type_name, const MsgPackData &data, std::string *binary) {
+    binary->clear();
+    switch (data.kind) {
+    case MsgPackData::NONE:
+        return data_type_name.empty();
+    case MsgPackData::NUMBER:
+        if (data_type_name == "Int32") {
+            if ((!data.is_integer) || (data.number < -2147483648.0) || (data.number > 2147483647.0)) {
+                return false;
+            }
+            AppendLittleEndian32((uint32_t)(int32_t)data.number, binary);
+            return true;
+        }
+        if (data_type_name == "Single") {
+            float f = (float)data.number;
+            uint32_t bits;
+            memcpy(&bits, &f, 4);
+            AppendLittleEndian32(bits, binary);
+            return true;
+        }
+        return false;
+    case MsgPackData::STRING:
+        *binary = data.str;
+        return data_type_name == "String";
+    case MsgPackData::FLOATS:
+        // x, y, ... with none missing
+        for (int i=0; i<4; i++) {
+            if ((data.keys_found & (1 << i)) == 0) {
+                return (data.keys_found >> i) == 0;
+            }
+            uint32_t bits;
+            memcpy(&bits, &data.floats[i], 4);
+            AppendLittleEndian32(bits, binary);
+        }
+        return true;
+    }
+    return false;
+}
+
+
+VREvent* MsgPackCodec::Decode(const std::string &frame) {
+    return Decode(frame.data(), frame.size());
+}
+
+
+VREvent* MsgPackCodec::Decode(const char *data, size_t size) {
+    MsgPackReader reader(data, size);
+    uint32_t n;
+    if (!reader.ReadMapSize(&n)) {
+        std::cerr << "MsgPackCodec Error: frame is not a map." << std::endl;
+        return NULL;
+    }
+    std::string key, name, data_type_name;
+    bool has_name = false, has_type = false;
+    MsgPackData event_data;
+    for (uint32_t i=0; i<n; i++) {
+        bool ok = reader.ReadString(&key);
+        if ((ok) && (key == "m_Name")) {
+            ok = reader.ReadString(&name);
+            has_name = true;
+        }
+        else if ((ok) && (key == "m_DataTypeName")) {
+            ok = reader.ReadString(&data_type_name);
+            has_type = true;
+        }
+        else if ((ok) && (key == "m_Data")) {
+            ok = ReadData(&reader, &event_data);
+        }
+        else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "MsgPackCodec Error: malformed event." << std::endl;
+            return NULL;
+        }
+    }
+    if ((!has_name) || (!has_type) || (!reader.is_at_end())) {
+        std::cerr << "MsgPackCodec Error: malformed event." << std::endl;
+        return NULL;
+    }
+
+    std::string binary;
+    VREvent *e = NULL;
+    if (DataToBinary(data_type_name, event_data, &binary)) {
+        e = VREvent::CreateFromBinaryData(name, data_type_name, binary.data(), binary.size());
+    }
+    if (e == NULL) {
+        std::cerr << "MsgPackCodec Error: " << name << " does not hold a " << data_type_name << "." << std::endl;
+    }
+    return e;
+}
@@ -0,0 +1,48 @@
+/**
+  MessagePack (https://msgpack.org) encoding of VREvents, for peers that would rather not write and parse json,
+  e.g., the Python and JS clients, whose msgpack packages decode it natively into the same objects they get
+  from json.  The frame body is a map with the same structure as the json: "m_Name" and "m_DataTypeName" as
+  strings, and "m_Data" (left out for an event without data) as
+  - an integer for Int32,
+  - a float 32 for Single,
+  - a string for String,
+  - a map of float 32s keyed "x", "y", "z", "w" for Vector2, Vector3, Vector4 and Quaternion.
+  Decode() is more forgiving, as a peer in another language may not pick the same types: the keys may come in
+  any order, m_Data may be nil for an event without data, and every number may be any MessagePack integer or
+  float, as long as it fits the event's type.
+
+  A MessagePack frame starts with a map's type byte (0x80 to 0x8f, 0xde or 0xdf), so it is told apart from json
+  (see IsMsgPack()) and from EventDictionary's frames, and a program can read all three from the same
+  connection.  Which one a Connection sends is chosen per connection, see Connection::set_event_format().
+
+  ```
+  std::string frame;
+  MsgPackCodec::Encode(VREventVector3("Head/Position", x, y, z), &frame);     // 74 bytes, 89 as json
+  VREvent *e = MsgPackCodec::Decode(frame);
+  ```
+ */
+
+#ifndef MINVR3_MSGPACK_CODEC_H
+#define MINVR3_MSGPACK_CODEC_H
+
+#include "vr_event.h"
+
+#include <string>
+
+
+class MsgPackCodec {
+public:
+    /// True if frame holds a MessagePack map, rather than json or an EventDictionary frame.
+    static bool IsMsgPack(const std::string &frame);
+
+    /// Writes the event to frame, replacing its contents.  Returns false, leaving frame empty, for an event type
+    /// with no MessagePack layout (i.e., anything but the built-in ones).
+    static bool Encode(const VREvent &e, std::string *frame);
+
+    /// The event in a frame written by Encode(), or by any MessagePack library from a map of the same structure,
+    /// or NULL with an error message if the frame does not hold one.  The caller owns the event.
+    static VREvent* Decode(const std::string &frame);
+    static VREvent* Decode(const char *data, size_t size);
+};
+
+#endif
@@ -0,0 +1,586 @@
+#include "multicast_channel.h"
+
+#include "min_net.h"
+
+#include <iostream>
+#include <string.h>
+
+
+static const uint8_t MULTICAST_MAGIC[4] = { 'M', 'V', '3', 'M' };
+static const int MULTICAST_HEADER_BYTES = 16;
+
+enum MulticastDatagramType {
+    TYPE_DATA = 1,
+    TYPE_HEARTBEAT = 2,
+    TYPE_NACK = 3,
+    TYPE_GONE = 4
+};
+
+// the largest payload an IPv4 UDP datagram can carry
+static const int MAX_UDP_PAYLOAD = 65507;
+
+// limits the work done for a single repair request
+static const uint32_t MAX_NACK_RANGE = 1024;
+static const int MAX_NACKS_PER_ROUND = 64;
+
+
+static void WriteUInt32LE(uint8_t *p, uint32_t i) {
+    p[0] = (uint8_t)(i & 0xff);
+    p[1] = (uint8_t)((i >> 8) & 0xff);
+    p[2] = (uint8_t)((i >> 16) & 0xff);
+    p[3] = (uint8_t)((i >> 24) & 0xff);
+}
+
+
+static uint32_t ReadUInt32LE(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static void WriteHeader(uint8_t *p, int type, uint32_t session_id, uint32_t seq) {
+    memcpy(p, MULTICAST_MAGIC, 4);
+    p[4] = (uint8_t)type;
+    p[5] = 0;
+    p[6] = 0;
+    p[7] = 0;
+    WriteUInt32LE(p + 8, session_id);
+    WriteUInt32LE(p + 12, seq);
+}
+
+
+// a repair request or cannot-repair reply for the count datagrams starting at first
+static void WriteRange(uint8_t *p, int type, uint32_t session_id, uint32_t first, uint32_t count) {
+    WriteHeader(p, type, session_id, first);
+    WriteUInt32LE(p + MULTICAST_HEADER_BYTES, count);
+}
+
+
+
+MulticastPublisher::MulticastPublisher(int history_size, int max_datagram_bytes) :
+    data_fd_(INVALID_SOCKET), repair_fd_(INVALID_SOCKET), max_datagram_bytes_(max_datagram_bytes),
+    num_events_(0), recv_buf_(MAX_UDP_PAYLOAD + 1), history_(history_size > 0 ? history_size : 1),
+    history_seqs_(history_.size(), 0), session_id_(0), next_seq_(0), heartbeat_interval_ms_(100),
+    num_sent_(0), num_repair_requests_(0), num_repairs_sent_(0), num_unrepairable_(0)
+{
+    if (max_datagram_bytes_ > MAX_UDP_PAYLOAD) {
+        max_datagram_bytes_ = MAX_UDP_PAYLOAD;
+    }
+    if (max_datagram_bytes_ < MULTICAST_HEADER_BYTES + 4) {
+        max_datagram_bytes_ = MULTICAST_HEADER_BYTES + 4;
+    }
+}
+
+
+MulticastPublisher::~MulticastPublisher() {
+    Close();
+}
+
+
+bool MulticastPublisher::Open(const std::string &group, int port, int repair_port, const std::string &interface_ip, int ttl) {
+    Close();
+    if (!MinNet::CreateMulticastSender(group, port, &data_fd_, interface_ip, ttl)) {
+        return false;
+    }
+    if (!MinNet::CreateDatagramSocket(repair_port, &repair_fd_)) {
+        Close();
+        return false;
+    }
+    // a new session id tells subscribers to forget the sequence numbers of any earlier run of the publisher
+    std::random_device rd;
+    session_id_ = (uint32_t)rd() ^ (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    next_seq_ = 0;
+    for (int i=0; i<history_.size(); i++) {
+        history_[i].clear();
+    }
+    last_send_time_ = std::chrono::steady_clock::now();
+    StartDatagram();
+    return true;
+}
+
+
+void MulticastPublisher::Close() {
+    if (data_fd_ != INVALID_SOCKET) {
+        MinNet::CloseSocket(&data_fd_);
+        data_fd_ = INVALID_SOCKET;
+    }
+    if (repair_fd_ != INVALID_SOCKET) {
+        MinNet::CloseSocket(&repair_fd_);
+        repair_fd_ = INVALID_SOCKET;
+    }
+    buf_.clear();
+    num_events_ = 0;
+}
+
+
+bool MulticastPublisher::is_open() const {
+    return (data_fd_ != INVALID_SOCKET);
+}
+
+
+void MulticastPublisher::StartDatagram() {
+    buf_.resize(MULTICAST_HEADER_BYTES);
+    num_events_ = 0;
+}
+
+
+bool MulticastPublisher::QueueVREvent(const VREvent &e) {
+    return QueueString(e.ToJson());
+}
+
+
+bool MulticastPublisher::QueueString(const std::string &json) {
+    int frame_bytes = 4 + (int)json.size();
+    if (MULTICAST_HEADER_BYTES + frame_bytes > max_datagram_bytes_) {
+        std::cerr << "MulticastPublisher Error: Event of " << json.size() << " bytes is too large for a datagram."
+            << std::endl;
+        return false;
+    }
+    bool ok = true;
+    if ((int)buf_.size() + frame_bytes > max_datagram_bytes_) {
+        ok = Flush();
+    }
+    size_t offset = buf_.size();
+    buf_.resize(offset + frame_bytes);
+    WriteUInt32LE(&buf_[offset], (uint32_t)json.size());
+    memcpy(&buf_[offset + 4], json.data(), json.size());
+    num_events_++;
+    return ok;
+}
+
+
+bool MulticastPublisher::Flush() {
+    if (num_events_ == 0) {
+        return true;
+    }
+    if (data_fd_ == INVALID_SOCKET) {
+        StartDatagram();
+        return false;
+    }
+    uint32_t seq = next_seq_++;
+    WriteHeader(buf_.data(), TYPE_DATA, session_id_, seq);
+    // kept even if the send fails, then subscribers repair it like any other lost datagram
+    size_t index = seq % history_.size();
+    history_[index].assign((const char*)buf_.data(), buf_.size());
+    history_seqs_[index] = seq;
+    bool ok = MinNet::SendDatagram(&data_fd_, buf_.data(), (int)buf_.size());
+    num_sent_++;
+    last_send_time_ = std::chrono::steady_clock::now();
+    StartDatagram();
+    return ok;
+}
+
+
+void MulticastPublisher::SendHeartbeat() {
+    uint8_t hb[MULTICAST_HEADER_BYTES];
+    WriteHeader(hb, TYPE_HEARTBEAT, session_id_, next_seq_);
+    MinNet::SendDatagram(&data_fd_, hb, MULTICAST_HEADER_BYTES);
+    last_send_time_ = std::chrono::steady_clock::now();
+}
+
+
+void MulticastPublisher::Poll() {
+    if (repair_fd_ == INVALID_SOCKET) {
+        return;
+    }
+    int len;
+    std::string from;
+    while (MinNet::ReceiveDatagram(&repair_fd_, recv_buf_.data(), (int)recv_buf_.size(), &len, &from)) {
+        const uint8_t *p = recv_buf_.data();
+        if ((len < MULTICAST_HEADER_BYTES + 4) || (memcmp(p, MULTICAST_MAGIC, 4) != 0) || (p[4] != TYPE_NACK)) {
+            continue;
+        }
+        num_repair_requests_++;
+        if (ReadUInt32LE(p + 8) != session_id_) {
+            // the subscriber is following an earlier run, a heartbeat tells it where this one is
+            uint8_t hb[MULTICAST_HEADER_BYTES];
+            WriteHeader(hb, TYPE_HEARTBEAT, session_id_, next_seq_);
+            MinNet::SendDatagramTo(&repair_fd_, from, hb, MULTICAST_HEADER_BYTES);
+            continue;
+        }
+        uint32_t first = ReadUInt32LE(p + 12);
+        uint32_t count = ReadUInt32LE(p + MULTICAST_HEADER_BYTES);
+        if (count > MAX_NACK_RANGE) {
+            count = MAX_NACK_RANGE;
+        }
+
+        // resend what is still in the history, and report runs of what is not
+        uint32_t gone_first = 0;
+        uint32_t gone_count = 0;
+        for (uint32_t i=0; i<=count; i++) {
+            uint32_t seq = first + i;
+            bool available = false;
+            if (i < count) {
+                size_t index = seq % history_.size();
+                available = ((int32_t)(next_seq_ - seq) > 0) && (history_seqs_[index] == seq) &&
+                    (!history_[index].empty());
+                if (available) {
+                    MinNet::SendDatagramTo(&repair_fd_, from, (const uint8_t*)history_[index].data(),
+                                           (int)history_[index].size());
+                    num_repairs_sent_++;
+                }
+                else if ((int32_t)(next_seq_ - seq) > 0) {
+                    if (gone_count == 0) {
+                        gone_first = seq;
+                    }
+                    gone_count++;
+                    num_unrepairable_++;
+                    continue;
+                }
+            }
+            if (gone_count > 0) {
+                uint8_t gone[MULTICAST_HEADER_BYTES + 4];
+                WriteRange(gone, TYPE_GONE, session_id_, gone_first, gone_count);
+                MinNet::SendDatagramTo(&repair_fd_, from, gone, sizeof(gone));
+                gone_count = 0;
+            }
+        }
+    }
+
+    if (std::chrono::steady_clock::now() - last_send_time_ >= std::chrono::milliseconds(heartbeat_interval_ms_)) {
+        SendHeartbeat();
+    }
+}
+
+
+SOCKET MulticastPublisher::get_repair_socket() const {
+    return repair_fd_;
+}
+
+
+int MulticastPublisher::get_heartbeat_interval_ms() const {
+    return heartbeat_interval_ms_;
+}
+
+
+void MulticastPublisher::set_heartbeat_interval_ms(int ms) {
+    heartbeat_interval_ms_ = ms;
+}
+
+
+uint32_t MulticastPublisher::get_session_id() const {
+    return session_id_;
+}
+
+
+uint64_t MulticastPublisher::get_num_datagrams_sent() const {
+    return num_sent_;
+}
+
+
+uint64_t MulticastPublisher::get_num_repair_requests() const {
+    return num_repair_requests_;
+}
+
+
+uint64_t MulticastPublisher::get_num_repairs_sent() const {
+    return num_repairs_sent_;
+}
+
+
+uint64_t MulticastPublisher::get_num_unrepairable() const {
+    return num_unrepairable_;
+}
+
+
+
+MulticastSubscriber::MulticastSubscriber(int nack_retry_ms, int max_nack_attempts, int max_pending) :
+    data_fd_(INVALID_SOCKET), repair_fd_(INVALID_SOCKET), recv_buf_(MAX_UDP_PAYLOAD + 1),
+    nack_retry_ms_(nack_retry_ms), max_nack_attempts_(max_nack_attempts), max_pending_(max_pending),
+    have_session_(false), session_id_(0), next_expected_(0), known_end_(0), nacked_end_(0), nack_attempts_(0),
+    simulated_loss_(0.0), rng_((unsigned int)std::chrono::steady_clock::now().time_since_epoch().count()),
+    num_received_(0), num_repaired_(0), num_lost_(0), num_duplicates_(0), num_nacks_sent_(0), num_malformed_(0)
+{
+}
+
+
+MulticastSubscriber::~MulticastSubscriber() {
+    Close();
+}
+
+
+bool MulticastSubscriber::Open(const std::string &group, int port, const std::string &publisher_ip, int repair_port,
+                               const std::string &interface_ip)
+{
+    Close();
+    if (!MinNet::JoinMulticastGroup(group, port, &data_fd_, interface_ip)) {
+        return false;
+    }
+    // connected to the publisher's repair port, so repairs are the only thing this socket receives
+    if (!MinNet::ConnectDatagramSocket(publisher_ip, repair_port, &repair_fd_)) {
+        Close();
+        return false;
+    }
+    have_session_ = false;
+    pending_.clear();
+    return true;
+}
+
+
+void MulticastSubscriber::Close() {
+    if (data_fd_ != INVALID_SOCKET) {
+        MinNet::CloseSocket(&data_fd_);
+        data_fd_ = INVALID_SOCKET;
+    }
+    if (repair_fd_ != INVALID_SOCKET) {
+        MinNet::CloseSocket(&repair_fd_);
+        repair_fd_ = INVALID_SOCKET;
+    }
+}
+
+
+bool MulticastSubscriber::is_open() const {
+    return (data_fd_ != INVALID_SOCKET);
+}
+
+
+void MulticastSubscriber::ResetSession(uint32_t session_id, uint32_t next_seq) {
+    have_session_ = true;
+    session_id_ = session_id;
+    next_expected_ = next_seq;
+    known_end_ = next_seq;
+    nacked_end_ = next_seq;
+    pending_.clear();
+    nack_attempts_ = 0;
+}
+
+
+void MulticastSubscriber::HandleDatagram(const uint8_t *buf, int len, bool is_repair) {
+    if ((len < MULTICAST_HEADER_BYTES) || (len >= (int)recv_buf_.size()) || (memcmp(buf, MULTICAST_MAGIC, 4) != 0)) {
+        num_malformed_++;
+        return;
+    }
+    int type = buf[4];
+    uint32_t session_id = ReadUInt32LE(buf + 8);
+    uint32_t seq = ReadUInt32LE(buf + 12);
+
+    if (type == TYPE_DATA) {
+        if ((!is_repair) && (simulated_loss_ > 0.0) &&
+            (std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < simulated_loss_)) {
+            return;
+        }
+        if ((!have_session_) || (session_id != session_id_)) {
+            if (is_repair) {
+                // a late reply to a request made during an earlier session
+                return;
+            }
+            // joining mid-stream, or the publisher restarted: start with this datagram
+            ResetSession(session_id, seq);
+        }
+        if ((int32_t)(seq - next_expected_) < 0) {
+            num_duplicates_++;
+            return;
+        }
+        std::map<uint32_t, Pending>::iterator it = pending_.find(seq);
+        if ((it != pending_.end()) && (!it->second.gone)) {
+            num_duplicates_++;
+            return;
+        }
+        Pending &p = pending_[seq];
+        p.gone = false;
+        p.data.assign((const char*)buf + MULTICAST_HEADER_BYTES, len - MULTICAST_HEADER_BYTES);
+        if (is_repair) {
+            num_repaired_++;
+        }
+        if ((int32_t)(seq + 1 - known_end_) > 0) {
+            known_end_ = seq + 1;
+        }
+    }
+    else if (type == TYPE_HEARTBEAT) {
+        if ((!have_session_) || (session_id != session_id_)) {
+            // nothing has been missed yet, start with the next datagram published
+            ResetSession(session_id, seq);
+        }
+        else if ((int32_t)(seq - known_end_) > 0) {
+            known_end_ = seq;
+        }
+    }
+    else if ((type == TYPE_GONE) && (len >= MULTICAST_HEADER_BYTES + 4) && (have_session_) && (session_id == session_id_)) {
+        uint32_t count = ReadUInt32LE(buf + MULTICAST_HEADER_BYTES);
+        for (uint32_t i=0; (i<count) && (i<MAX_NACK_RANGE); i++) {
+            uint32_t s = seq + i;
+            if (((int32_t)(s - next_expected_) >= 0) && ((int32_t)(s - known_end_) < 0) && (pending_.count(s) == 0)) {
+                pending_[s].gone = true;
+            }
+        }
+    }
+    else {
+        num_malformed_++;
+    }
+}
+
+
+void MulticastSubscriber::UnpackEvents(const std::string &data, std::vector<VREvent*> *events) {
+    const uint8_t *p = (const uint8_t*)data.data();
+    int len = (int)data.size();
+    int pos = 0;
+    while (pos + 4 <= len) {
+        uint32_t frame_len = ReadUInt32LE(p + pos);
+        if ((uint64_t)pos + 4 + frame_len > (uint64_t)len) {
+            num_malformed_++;
+            break;
+        }
+        VREvent *e = VREvent::CreateFromJson(std::string((const char*)p + pos + 4, frame_len));
+        if (e != NULL) {
+            events->push_back(e);
+        }
+        pos += 4 + frame_len;
+    }
+}
+
+
+void MulticastSubscriber::Deliver(std::vector<VREvent*> *events) {
+    std::map<uint32_t, Pending>::iterator it;
+    while ((it = pending_.find(next_expected_)) != pending_.end()) {
+        if (it->second.gone) {
+            num_lost_++;
+        }
+        else {
+            UnpackEvents(it->second.data, events);
+            num_received_++;
+        }
+        pending_.erase(it);
+        next_expected_++;
+        nack_attempts_ = 0;
+    }
+}
+
+
+void MulticastSubscriber::SkipHeadGap() {
+    // give up on everything missing before the next datagram that did arrive
+    uint32_t gap = known_end_ - next_expected_;
+    for (std::map<uint32_t, Pending>::iterator it = pending_.begin(); it != pending_.end(); it++) {
+        uint32_t d = it->first - next_expected_;
+        if (d < gap) {
+            gap = d;
+        }
+    }
+    num_lost_ += gap;
+    next_expected_ += gap;
+    nack_attempts_ = 0;
+}
+
+
+void MulticastSubscriber::SendNacks() {
+    if ((!have_session_) || (next_expected_ == known_end_)) {
+        return;
+    }
+    // Gaps that opened since the last round are requested right away.  Everything still missing is requested
+    // again once the retry time has passed since the last full round.
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    bool retry_due = (now - last_nack_time_ >= std::chrono::milliseconds(nack_retry_ms_));
+    uint32_t first = next_expected_;
+    if ((!retry_due) && ((int32_t)(nacked_end_ - next_expected_) > 0)) {
+        first = nacked_end_;
+    }
+    uint32_t span = known_end_ - first;
+    if ((int32_t)span <= 0) {
+        return;
+    }
+    if (span > (uint32_t)max_pending_) {
+        span = (uint32_t)max_pending_;
+    }
+
+    // one request per run of missing datagrams
+    int n_nacks = 0;
+    uint32_t run_first = 0;
+    uint32_t run_count = 0;
+    for (uint32_t i=0; (i<=span) && (n_nacks<MAX_NACKS_PER_ROUND); i++) {
+        uint32_t s = first + i;
+        bool missing = (i < span) && (pending_.count(s) == 0);
+        if ((missing) && (run_count < MAX_NACK_RANGE)) {
+            if (run_count == 0) {
+                run_first = s;
+            }
+            run_count++;
+        }
+        else if (run_count > 0) {
+            uint8_t nack[MULTICAST_HEADER_BYTES + 4];
+            WriteRange(nack, TYPE_NACK, session_id_, run_first, run_count);
+            MinNet::SendDatagram(&repair_fd_, nack, sizeof(nack));
+            num_nacks_sent_++;
+            n_nacks++;
+            run_count = 0;
+            if (missing) {
+                // the run was cut at MAX_NACK_RANGE, s starts the next one
+                run_first = s;
+                run_count = 1;
+            }
+        }
+    }
+    nacked_end_ = first + span;
+    if ((retry_due) && (n_nacks > 0)) {
+        nack_attempts_++;
+        last_nack_time_ = now;
+    }
+}
+
+
+bool MulticastSubscriber::ReceiveVREvents(std::vector<VREvent*> *events) {
+    if (data_fd_ == INVALID_SOCKET) {
+        return false;
+    }
+    int len;
+    while (MinNet::ReceiveDatagram(&data_fd_, recv_buf_.data(), (int)recv_buf_.size(), &len)) {
+        HandleDatagram(recv_buf_.data(), len, false);
+    }
+    while (MinNet::ReceiveDatagram(&repair_fd_, recv_buf_.data(), (int)recv_buf_.size(), &len)) {
+        HandleDatagram(recv_buf_.data(), len, true);
+    }
+    Deliver(events);
+
+    // gaps that are taking too long to fill, or that are holding back too much, are skipped
+    bool out_of_attempts = (nack_attempts_ >= max_nack_attempts_) &&
+        (std::chrono::steady_clock::now() - last_nack_time_ >= std::chrono::milliseconds(nack_retry_ms_));
+    while ((next_expected_ != known_end_) && ((out_of_attempts) || ((int)pending_.size() > max_pending_))) {
+        out_of_attempts = false;
+        SkipHeadGap();
+        Deliver(events);
+    }
+    SendNacks();
+    return true;
+}
+
+
+SOCKET MulticastSubscriber::get_socket() const {
+    return data_fd_;
+}
+
+
+SOCKET MulticastSubscriber::get_repair_socket() const {
+    return repair_fd_;
+}
+
+
+void MulticastSubscriber::set_simulated_loss(double fraction) {
+    simulated_loss_ = fraction;
+}
+
+
+uint64_t MulticastSubscriber::get_num_datagrams_received() const {
+    return num_received_;
+}
+
+
+uint64_t MulticastSubscriber::get_num_datagrams_repaired() const {
+    return num_repaired_;
+}
+
+
+uint64_t MulticastSubscriber::get_num_datagrams_lost() const {
+    return num_lost_;
+}
+
+
+uint64_t MulticastSubscriber::get_num_duplicates() const {
+    return num_duplicates_;
+}
+
+
+uint64_t MulticastSubscriber::get_num_nacks_sent() const {
+    return num_nacks_sent_;
+}
+
+
+uint64_t MulticastSubscriber::get_num_malformed() const {
+    return num_malformed_;
+}
@@ -0,0 +1,196 @@
+/**
+  Reliable multicast delivery of VREvents, for clusters (e.g., a CAVE) where every render node needs the same
+  event stream.  The publisher sends each datagram once to a multicast group, no matter how many nodes are
+  listening, rather than once per node over TCP.
+
+  Multicast datagrams can be lost, so each one carries a sequence number, and the publisher keeps the most
+  recent ones in a history buffer.  A subscriber that notices a gap sends a repair request (NACK) to the
+  publisher's repair port, a unicast UDP side channel, and the publisher resends the missing datagrams to that
+  subscriber alone.  The subscriber holds back later events until the gap is filled, so every node sees the
+  same events in the same order.  When the publisher is idle it sends a heartbeat with its latest sequence
+  number, so a loss at the end of a burst is noticed too.  A gap that can no longer be repaired (it has left the
+  publisher's history, or the publisher does not answer) is skipped and counted as lost.
+
+  Every datagram starts with a 16 byte header:
+  ```
+  bytes 0-3    'M' 'V' '3' 'M'
+  byte  4      type: 1 = data, 2 = heartbeat, 3 = repair request, 4 = cannot repair
+  bytes 5-7    zero
+  bytes 8-11   session id, chosen at random when the publisher is opened (little endian)
+  bytes 12-15  sequence number (data), next sequence number (heartbeat), or first sequence number of the
+               range (repair request, cannot repair) (little endian)
+  ```
+  Data datagrams then hold one or more events framed as on a TCP connection (4-byte little endian length, then
+  JSON), and the range types hold the number of datagrams in the range (4 bytes, little endian).
+
+  Both classes are non-blocking and must be called regularly, e.g., from a NetReactor callback on their sockets
+  plus once per pass of the program's main loop, since repair requests and heartbeats are also timer driven.
+
+  Publisher:
+  ```
+  MulticastPublisher pub;
+  pub.Open("239.255.77.34", 9035, 9036);
+  pub.QueueVREvent(e);
+  pub.Flush();
+  pub.Poll();      // answers repair requests and sends heartbeats
+  ```
+
+  Subscriber:
+  ```
+  MulticastSubscriber sub;
+  sub.Open("239.255.77.34", 9035, "192.168.1.10", 9036);
+  std::vector<VREvent*> events;
+  sub.ReceiveVREvents(&events);
+  ```
+ */
+
+#ifndef MINVR3_MULTICAST_CHANNEL_H
+#define MINVR3_MULTICAST_CHANNEL_H
+
+#include "net_headers.h"
+#include "vr_event.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+class MulticastPublisher {
+public:
+    /// history_size is the number of recent datagrams kept for repairs.  max_datagram_bytes limits the size of
+    /// each datagram, the default fits in a single ethernet frame.
+    MulticastPublisher(int history_size=4096, int max_datagram_bytes=1400);
+    virtual ~MulticastPublisher();
+
+    /// Publishes to group:port, and listens for repair requests on repair_port.
+    bool Open(const std::string &group, int port, int repair_port, const std::string &interface_ip="", int ttl=1);
+    void Close();
+    bool is_open() const;
+
+    /// Adds an event (or its JSON) to the current datagram.  If it does not fit, the current datagram is
+    /// published first.  Call Flush() to publish the last one.
+    bool QueueVREvent(const VREvent &e);
+    bool QueueString(const std::string &json);
+
+    /// Publishes the current datagram, if it holds any events.
+    bool Flush();
+
+    /// Answers every waiting repair request, and sends a heartbeat if nothing has been published for
+    /// heartbeat_interval_ms.
+    void Poll();
+
+    SOCKET get_repair_socket() const;
+    int get_heartbeat_interval_ms() const;
+    void set_heartbeat_interval_ms(int ms);
+
+    uint32_t get_session_id() const;
+    uint64_t get_num_datagrams_sent() const;
+    uint64_t get_num_repair_requests() const;
+    uint64_t get_num_repairs_sent() const;
+    uint64_t get_num_unrepairable() const;     // requested datagrams that had already left the history
+
+private:
+    void StartDatagram();
+    void SendHeartbeat();
+
+    SOCKET data_fd_;
+    SOCKET repair_fd_;
+    int max_datagram_bytes_;
+    std::vector<uint8_t> buf_;
+    int num_events_;
+    std::vector<uint8_t> recv_buf_;
+
+    // datagram seq is kept in history_[seq % history_.size()]
+    std::vector<std::string> history_;
+    std::vector<uint32_t> history_seqs_;
+
+    uint32_t session_id_;
+    uint32_t next_seq_;
+    int heartbeat_interval_ms_;
+    std::chrono::steady_clock::time_point last_send_time_;
+
+    uint64_t num_sent_;
+    uint64_t num_repair_requests_;
+    uint64_t num_repairs_sent_;
+    uint64_t num_unrepairable_;
+};
+
+
+class MulticastSubscriber {
+public:
+    /// A repair request that is not answered within nack_retry_ms is sent again, up to max_nack_attempts
+    /// times, after which the gap is skipped.  At most max_pending datagrams are held back waiting for a gap
+    /// to be filled; if more arrive, the gap is skipped.
+    MulticastSubscriber(int nack_retry_ms=20, int max_nack_attempts=10, int max_pending=4096);
+    virtual ~MulticastSubscriber();
+
+    /// Joins group:port, and sends repair requests to publisher_ip:repair_port.
+    bool Open(const std::string &group, int port, const std::string &publisher_ip, int repair_port,
+              const std::string &interface_ip="");
+    void Close();
+    bool is_open() const;
+
+    /// Reads every datagram currently waiting on both sockets, without blocking, and appends the events that
+    /// are now in order to events.  Also sends any repair requests that are due.  The caller owns the events.
+    /// Returns false only if the subscriber is not open.
+    bool ReceiveVREvents(std::vector<VREvent*> *events);
+
+    /// The multicast socket and the socket that repairs arrive on, e.g., to add to a NetReactor.
+    SOCKET get_socket() const;
+    SOCKET get_repair_socket() const;
+
+    /// For testing repairs: drops this fraction (0..1) of the multicast data datagrams as they arrive.
+    void set_simulated_loss(double fraction);
+
+    uint64_t get_num_datagrams_received() const;    // delivered, including repaired ones
+    uint64_t get_num_datagrams_repaired() const;    // delivered after arriving as a repair
+    uint64_t get_num_datagrams_lost() const;        // skipped because they could not be repaired
+    uint64_t get_num_duplicates() const;
+    uint64_t get_num_nacks_sent() const;
+    uint64_t get_num_malformed() const;
+
+private:
+    struct Pending {
+        bool gone;          // placeholder for a datagram that will never arrive
+        std::string data;
+    };
+
+    void HandleDatagram(const uint8_t *buf, int len, bool is_repair);
+    void ResetSession(uint32_t session_id, uint32_t next_seq);
+    void Deliver(std::vector<VREvent*> *events);
+    void SendNacks();
+    void SkipHeadGap();
+    void UnpackEvents(const std::string &data, std::vector<VREvent*> *events);
+
+    SOCKET data_fd_;
+    SOCKET repair_fd_;
+    std::vector<uint8_t> recv_buf_;
+
+    int nack_retry_ms_;
+    int max_nack_attempts_;
+    int max_pending_;
+
+    bool have_session_;
+    uint32_t session_id_;
+    uint32_t next_expected_;    // next sequence number to deliver
+    uint32_t known_end_;        // one past the highest sequence number the publisher is known to have sent
+    uint32_t nacked_end_;       // one past the highest sequence number covered by the last repair requests
+    std::map<uint32_t, Pending> pending_;
+    int nack_attempts_;
+    std::chrono::steady_clock::time_point last_nack_time_;
+
+    double simulated_loss_;
+    std::minstd_rand rng_;
+
+    uint64_t num_received_;
+    uint64_t num_repaired_;
+    uint64_t num_lost_;
+    uint64_t num_duplicates_;
+    uint64_t num_nacks_sent_;
+    uint64_t num_malformed_;
+};
+
+#endif
@@ -0,0 +1,655 @@
+
+#include "net_batch_io.h"
+
+#include "min_net.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <string.h>
+
+#ifdef WIN32
+#include <winsock2.h>
+#else
+#include <errno.h>
+#include <sys/socket.h>
+#endif
+
+#ifdef MINVR3_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+
+#ifdef MINVR3_HAVE_IO_URING
+
+// user_data for cancel requests, never a valid index into ops_
+static const uint64_t CANCEL_USER_DATA = ~(uint64_t)0;
+
+struct NetBatchIO::Ring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    bool buffers_registered;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void CloseRing(NetBatchIO::Ring *r);
+
+static bool OpenRing(unsigned entries, NetBatchIO::Ring *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = sys_io_uring_setup(entries, &p);
+    if (r->fd < 0) {
+        return false;
+    }
+    // EXT_ARG is needed to wait with a timeout; SINGLE_MMAP and NODROP are just assumed by the code below
+    const unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((p.features & required) != required) {
+        close(r->fd);
+        r->fd = -1;
+        return false;
+    }
+
+    r->sq_entries = p.sq_entries;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_size > r->sq_size) {
+        r->sq_size = r->cq_size;
+    }
+    r->cq_size = r->sq_size;
+    r->sq_ptr = mmap(0, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = NULL;
+        CloseRing(r);
+        return false;
+    }
+    r->cq_ptr = r->sq_ptr;   // single mmap covers both rings
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe*)mmap(0, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                         r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        CloseRing(r);
+        return false;
+    }
+
+    char *sq = (char*)r->sq_ptr;
+    r->sq_head = (unsigned*)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*)(sq + p.sq_off.array);
+    char *cq = (char*)r->cq_ptr;
+    r->cq_head = (unsigned*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+static void CloseRing(NetBatchIO::Ring *r) {
+    if (r->sqes != NULL) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->sq_ptr != NULL) {
+        munmap(r->sq_ptr, r->sq_size);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+}
+
+#endif
+
+
+NetBatchIO::NetBatchIO(Backend backend, int queue_depth, int registered_buffer_bytes) :
+    backend_(BACKEND_SYSCALL), arena_used_(0), num_syscalls_(0), ring_(NULL)
+{
+#ifdef MINVR3_HAVE_IO_URING
+    if ((backend == BACKEND_AUTO) || (backend == BACKEND_IO_URING)) {
+        Ring *r = new Ring();
+        if (OpenRing(queue_depth, r)) {
+            ring_ = r;
+            backend_ = BACKEND_IO_URING;
+            // the arena must never be reallocated once it is registered with the kernel
+            arena_.resize(registered_buffer_bytes);
+            struct iovec iov;
+            iov.iov_base = arena_.data();
+            iov.iov_len = arena_.size();
+            ring_->buffers_registered = (sys_io_uring_register(ring_->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0);
+            if (!ring_->buffers_registered) {
+                std::cerr << "NetBatchIO Warning: Could not register buffers with io_uring (errno = " << errno
+                    << "), frames will be sent from unregistered memory." << std::endl;
+            }
+        }
+        else {
+            delete r;
+        }
+    }
+#else
+    // only io_uring has a queue and registered buffers to size
+    (void)queue_depth;
+    (void)registered_buffer_bytes;
+#endif
+    if ((backend == BACKEND_IO_URING) && (backend_ != BACKEND_IO_URING)) {
+        std::cerr << "NetBatchIO Warning: io_uring is not supported on this system, using the syscall backend." << std::endl;
+    }
+}
+
+
+NetBatchIO::~NetBatchIO() {
+#ifdef MINVR3_HAVE_IO_URING
+    if (ring_ != NULL) {
+        CloseRing(ring_);
+        delete ring_;
+    }
+#endif
+}
+
+
+bool NetBatchIO::IsIoUringSupported() {
+#ifdef MINVR3_HAVE_IO_URING
+    Ring r;
+    if (OpenRing(4, &r)) {
+        CloseRing(&r);
+        return true;
+    }
+#endif
+    return false;
+}
+
+
+std::string NetBatchIO::BackendToString(Backend backend) {
+    if (backend == BACKEND_SYSCALL) {
+        return "syscall";
+    }
+    else if (backend == BACKEND_IO_URING) {
+        return "io_uring";
+    }
+    return "auto";
+}
+
+
+NetBatchIO::Backend NetBatchIO::StringToBackend(const std::string &name) {
+    if (name == "syscall") {
+        return BACKEND_SYSCALL;
+    }
+    else if ((name == "io_uring") || (name == "uring")) {
+        return BACKEND_IO_URING;
+    }
+    return BACKEND_AUTO;
+}
+
+
+NetBatchIO::Backend NetBatchIO::get_backend() const {
+    return backend_;
+}
+
+
+uint64_t NetBatchIO::get_num_syscalls() const {
+    return num_syscalls_;
+}
+
+
+int NetBatchIO::get_num_queued() const {
+    return (int)ops_.size();
+}
+
+
+int NetBatchIO::StoreFrame(const std::string &s, int *overflow_index) {
+    int frame_len = 4 + (int)s.size();
+    uint8_t header[4];
+    uint32_t len = (uint32_t)s.size();
+    // little endian, same as MinNet::SendUInt32()
+    header[0] = (uint8_t)(len & 0xff);
+    header[1] = (uint8_t)((len >> 8) & 0xff);
+    header[2] = (uint8_t)((len >> 16) & 0xff);
+    header[3] = (uint8_t)((len >> 24) & 0xff);
+
+    if (backend_ == BACKEND_IO_URING) {
+        if (arena_used_ + frame_len > (int)arena_.size()) {
+            // does not fit in the registered buffer
+            *overflow_index = (int)overflow_.size();
+            overflow_.push_back(std::string((const char*)header, 4) + s);
+            return -1;
+        }
+    }
+    else if (arena_used_ + frame_len > (int)arena_.size()) {
+        arena_.resize(arena_used_ + frame_len);
+    }
+    int offset = arena_used_;
+    memcpy(&arena_[offset], header, 4);
+    memcpy(&arena_[offset + 4], s.data(), s.size());
+    arena_used_ += frame_len;
+    *overflow_index = -1;
+    return offset;
+}
+
+
+const uint8_t* NetBatchIO::OpData(const Op &op) const {
+    if (!op.is_send) {
+        return op.recv_buf;
+    }
+    if (op.frame_offset >= 0) {
+        return &arena_[op.frame_offset];
+    }
+    return (const uint8_t*)overflow_[op.overflow_index].data();
+}
+
+
+void NetBatchIO::QueueString(SOCKET socket_fd, const std::string &s) {
+    QueueString(std::vector<SOCKET>(1, socket_fd), s);
+}
+
+
+void NetBatchIO::QueueString(const std::vector<SOCKET> &socket_fds, const std::string &s) {
+    if (socket_fds.empty()) {
+        return;
+    }
+    int overflow_index;
+    int offset = StoreFrame(s, &overflow_index);
+    for (int i=0; i<socket_fds.size(); i++) {
+        Op op;
+        op.fd = socket_fds[i];
+        op.is_send = true;
+        op.frame_offset = offset;
+        op.overflow_index = overflow_index;
+        op.recv_buf = NULL;
+        op.n_received = NULL;
+        op.len = 4 + (int)s.size();
+        ops_.push_back(op);
+    }
+}
+
+
+void NetBatchIO::QueueReceive(SOCKET socket_fd, uint8_t *buf, int len, int *n_received) {
+    Op op;
+    op.fd = socket_fd;
+    op.is_send = false;
+    op.frame_offset = -1;
+    op.overflow_index = -1;
+    op.recv_buf = buf;
+    op.n_received = n_received;
+    op.len = len;
+    *n_received = -1;
+    ops_.push_back(op);
+}
+
+
+void NetBatchIO::BuildGathers() {
+    // group the sends for each socket, keeping the order in which sockets first appear and the order of the
+    // frames within each socket; receives each get their own entry
+    gathers_.clear();
+    gather_ops_.clear();
+    std::vector<std::vector<int>> sends_for_fd;
+    std::map<SOCKET, int> index_for_fd;
+    std::vector<int> order;    // >= 0: index into sends_for_fd, < 0: -(receive op index) - 1
+    for (int i=0; i<ops_.size(); i++) {
+        if (ops_[i].is_send) {
+            auto it = index_for_fd.find(ops_[i].fd);
+            if (it == index_for_fd.end()) {
+                index_for_fd[ops_[i].fd] = (int)sends_for_fd.size();
+                order.push_back((int)sends_for_fd.size());
+                sends_for_fd.push_back(std::vector<int>(1, i));
+            }
+            else {
+                sends_for_fd[it->second].push_back(i);
+            }
+        }
+        else {
+            order.push_back(-i - 1);
+        }
+    }
+
+    for (int k=0; k<order.size(); k++) {
+        std::vector<int> op_indices;
+        if (order[k] >= 0) {
+            op_indices = sends_for_fd[order[k]];
+        }
+        else {
+            op_indices.push_back(-order[k] - 1);
+        }
+        // very long runs are split so each gathered write stays within the OS limit on buffers per call
+        const int max_per_gather = 64;
+        for (int start=0; start<op_indices.size(); start+=max_per_gather) {
+            Gather g;
+            g.fd = ops_[op_indices[start]].fd;
+            g.is_send = ops_[op_indices[start]].is_send;
+            g.first = (int)gather_ops_.size();
+            g.count = 0;
+            g.len = 0;
+            g.done = 0;
+            g.failed = false;
+            for (int j=start; (j<op_indices.size()) && (j<start+max_per_gather); j++) {
+                gather_ops_.push_back(op_indices[j]);
+                g.count++;
+                g.len += ops_[op_indices[j]].len;
+            }
+            gathers_.push_back(g);
+        }
+    }
+}
+
+
+bool NetBatchIO::Submit(double timeout_ms, std::vector<SOCKET> *failed_fds) {
+    if (ops_.empty()) {
+        return true;
+    }
+
+    BuildGathers();
+    bool ok;
+    if (backend_ == BACKEND_IO_URING) {
+        ok = SubmitIoUring(timeout_ms);
+    }
+    else {
+        ok = SubmitSyscall(timeout_ms);
+    }
+
+    if ((!ok) && (failed_fds != NULL)) {
+        for (int i=0; i<gathers_.size(); i++) {
+            if ((gathers_[i].failed) &&
+                (std::find(failed_fds->begin(), failed_fds->end(), gathers_[i].fd) == failed_fds->end())) {
+                failed_fds->push_back(gathers_[i].fd);
+            }
+        }
+    }
+
+    ops_.clear();
+    overflow_.clear();
+    arena_used_ = 0;
+    return ok;
+}
+
+
+bool NetBatchIO::SubmitSyscall(double timeout_ms) {
+    bool ok = true;
+    std::vector<const uint8_t*> bufs;
+    std::vector<int> lens;
+    for (int i=0; i<gathers_.size(); i++) {
+        Gather &g = gathers_[i];
+        if (g.is_send) {
+            bufs.clear();
+            lens.clear();
+            for (int j=g.first; j<g.first+g.count; j++) {
+                bufs.push_back(OpData(ops_[gather_ops_[j]]));
+                lens.push_back(ops_[gather_ops_[j]].len);
+            }
+            g.failed = !MinNet::SendGather(&g.fd, bufs.data(), lens.data(), g.count, timeout_ms);
+            num_syscalls_++;
+        }
+        else {
+            Op &op = ops_[gather_ops_[g.first]];
+#ifdef WIN32
+            int n = recv(op.fd, (char*)op.recv_buf, op.len, 0);
+#else
+            int n = (int)recv(op.fd, (void*)op.recv_buf, op.len, 0);
+#endif
+            num_syscalls_++;
+            *op.n_received = (n == SOCKET_ERROR) ? -1 : n;
+            g.failed = (n == SOCKET_ERROR);
+        }
+        if (g.failed) {
+            ok = false;
+            // never write a later part of a stream after an earlier part was lost
+            for (int j=i+1; j<gathers_.size(); j++) {
+                if ((gathers_[j].fd == g.fd) && (gathers_[j].is_send)) {
+                    gathers_[j].failed = true;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+
+bool NetBatchIO::SubmitIoUring(double timeout_ms) {
+#ifndef MINVR3_HAVE_IO_URING
+    return SubmitSyscall(timeout_ms);
+#else
+    // Each socket's sends form a chain.  Normally a chain is a single gathered write, but very long ones are
+    // submitted as a sequence of linked requests, so the kernel starts one only after the previous one has
+    // been completely written.  A short write breaks the link; the rest of the chain is then cancelled by the
+    // kernel and resubmitted on the next round.  Each receive is a chain of its own.
+    std::vector<std::vector<int>> chains;
+    std::map<SOCKET, int> chain_for_fd;
+    for (int i=0; i<gathers_.size(); i++) {
+        if (!gathers_[i].is_send) {
+            chains.push_back(std::vector<int>(1, i));
+            continue;
+        }
+        auto it = chain_for_fd.find(gathers_[i].fd);
+        if (it == chain_for_fd.end()) {
+            chain_for_fd[gathers_[i].fd] = (int)chains.size();
+            chains.push_back(std::vector<int>(1, i));
+        }
+        else {
+            chains[it->second].push_back(i);
+        }
+    }
+    std::vector<int> chain_next(chains.size(), 0);
+    std::vector<bool> chain_failed(chains.size(), false);
+
+    // sendmsg requests point at these, so they must stay put until the requests complete
+    std::vector<struct iovec> iovs(gather_ops_.size());
+    std::vector<struct msghdr> msgs(gathers_.size());
+
+    std::chrono::time_point<std::chrono::steady_clock> deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds((int64_t)(timeout_ms * 1000.0));
+    bool timed_out = false;
+
+    while (!timed_out) {
+        // fill the submission queue with whatever remains of each chain
+        unsigned tail = *ring_->sq_tail;
+        unsigned space = ring_->sq_entries - (tail - __atomic_load_n(ring_->sq_head, __ATOMIC_ACQUIRE));
+        unsigned n_inflight = 0;
+        for (int c=0; (c<chains.size()) && (space > 0); c++) {
+            if (chain_failed[c]) {
+                continue;
+            }
+            int first = chain_next[c];
+            int n = (int)chains[c].size() - first;
+            if (n > (int)space) {
+                n = (int)space;
+            }
+            for (int k=0; k<n; k++) {
+                int gather_index = chains[c][first + k];
+                Gather &g = gathers_[gather_index];
+                struct io_uring_sqe *sqe = &ring_->sqes[tail & *ring_->sq_mask];
+                memset(sqe, 0, sizeof(*sqe));
+                sqe->fd = g.fd;
+                sqe->user_data = (uint64_t)gather_index;
+                Op &first_op = ops_[gather_ops_[g.first]];
+                if (!g.is_send) {
+                    sqe->opcode = IORING_OP_RECV;
+                    sqe->addr = (uint64_t)(uintptr_t)first_op.recv_buf;
+                    sqe->len = first_op.len;
+                }
+                else if ((g.count == 1) && (first_op.frame_offset >= 0) && (ring_->buffers_registered)) {
+                    sqe->opcode = IORING_OP_WRITE_FIXED;
+                    sqe->addr = (uint64_t)(uintptr_t)(OpData(first_op) + g.done);
+                    sqe->len = g.len - g.done;
+                    sqe->buf_index = 0;
+                    sqe->off = (uint64_t)-1;
+                }
+                else {
+                    // gather every frame not yet completely sent
+                    int skip = g.done;
+                    int n_iov = 0;
+                    for (int j=g.first; j<g.first+g.count; j++) {
+                        const Op &op = ops_[gather_ops_[j]];
+                        if (skip >= op.len) {
+                            skip -= op.len;
+                            continue;
+                        }
+                        iovs[g.first + n_iov].iov_base = (void*)(OpData(op) + skip);
+                        iovs[g.first + n_iov].iov_len = op.len - skip;
+                        skip = 0;
+                        n_iov++;
+                    }
+                    struct msghdr &msg = msgs[gather_index];
+                    memset(&msg, 0, sizeof(msg));
+                    msg.msg_iov = &iovs[g.first];
+                    msg.msg_iovlen = n_iov;
+                    sqe->opcode = IORING_OP_SENDMSG;
+                    sqe->addr = (uint64_t)(uintptr_t)&msg;
+                    sqe->len = 1;
+                    sqe->msg_flags = MSG_NOSIGNAL;
+                }
+                if (k < n - 1) {
+                    sqe->flags = IOSQE_IO_LINK;
+                }
+                ring_->sq_array[tail & *ring_->sq_mask] = tail & *ring_->sq_mask;
+                tail++;
+            }
+            space -= n;
+            n_inflight += n;
+        }
+        if (n_inflight == 0) {
+            break;
+        }
+        __atomic_store_n(ring_->sq_tail, tail, __ATOMIC_RELEASE);
+
+        // one system call submits the whole round, then wait for all of it to complete
+        unsigned to_submit = n_inflight;
+        bool cancelling = false;
+        while (n_inflight > 0) {
+            struct __kernel_timespec ts;
+            struct io_uring_getevents_arg arg;
+            memset(&arg, 0, sizeof(arg));
+            unsigned flags = IORING_ENTER_GETEVENTS;
+            if ((timeout_ms > 0) && (!cancelling)) {
+                int64_t remaining_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+                if (remaining_us < 0) {
+                    remaining_us = 0;
+                }
+                ts.tv_sec = remaining_us / 1000000;
+                ts.tv_nsec = (remaining_us % 1000000) * 1000;
+                arg.ts = (uint64_t)(uintptr_t)&ts;
+                flags |= IORING_ENTER_EXT_ARG;
+            }
+            int ret = sys_io_uring_enter(ring_->fd, to_submit, 1, flags,
+                (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL, (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+            num_syscalls_++;
+            if (ret >= 0) {
+                to_submit -= (ret < (int)to_submit) ? ret : to_submit;
+            }
+            else if ((errno == ETIME) && (!cancelling)) {
+                // cancel everything still running; cancelled requests complete with -ECANCELED or -EINTR
+                timed_out = true;
+                cancelling = true;
+                unsigned ctail = *ring_->sq_tail;
+                for (int i=0; i<gathers_.size(); i++) {
+                    if ((gathers_[i].done < gathers_[i].len) && (!gathers_[i].failed) &&
+                        (ctail - __atomic_load_n(ring_->sq_head, __ATOMIC_ACQUIRE) < ring_->sq_entries)) {
+                        struct io_uring_sqe *sqe = &ring_->sqes[ctail & *ring_->sq_mask];
+                        memset(sqe, 0, sizeof(*sqe));
+                        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                        sqe->fd = -1;
+                        sqe->addr = (uint64_t)i;
+                        sqe->user_data = CANCEL_USER_DATA;
+                        ring_->sq_array[ctail & *ring_->sq_mask] = ctail & *ring_->sq_mask;
+                        ctail++;
+                        to_submit++;
+                    }
+                }
+                __atomic_store_n(ring_->sq_tail, ctail, __ATOMIC_RELEASE);
+            }
+            else if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY) && (errno != ETIME)) {
+                std::cerr << "NetBatchIO::Submit() Error: io_uring_enter failed, errno = " << errno << std::endl;
+                for (int i=0; i<gathers_.size(); i++) {
+                    if (gathers_[i].done < gathers_[i].len) {
+                        gathers_[i].failed = true;
+                    }
+                }
+                return false;
+            }
+
+            // reap completions
+            unsigned head = *ring_->cq_head;
+            unsigned cq_tail = __atomic_load_n(ring_->cq_tail, __ATOMIC_ACQUIRE);
+            while (head != cq_tail) {
+                struct io_uring_cqe *cqe = &ring_->cqes[head & *ring_->cq_mask];
+                if (cqe->user_data != CANCEL_USER_DATA) {
+                    Gather &g = gathers_[(size_t)cqe->user_data];
+                    n_inflight--;
+                    if (!g.is_send) {
+                        *ops_[gather_ops_[g.first]].n_received = (cqe->res >= 0) ? cqe->res : -1;
+                        g.done = g.len;
+                        g.failed = (cqe->res < 0);
+                    }
+                    else if (cqe->res > 0) {
+                        g.done += cqe->res;
+                    }
+                    else if ((cqe->res != -ECANCELED) || (timed_out)) {
+                        // a real error, a zero-length write, or cancelled because of the timeout; an
+                        // -ECANCELED without a timeout just means an earlier link was short
+                        g.failed = true;
+                    }
+                }
+                head++;
+            }
+            __atomic_store_n(ring_->cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        // advance each chain past its completed requests
+        for (int c=0; c<chains.size(); c++) {
+            while ((chain_next[c] < (int)chains[c].size()) && (!chain_failed[c])) {
+                Gather &g = gathers_[chains[c][chain_next[c]]];
+                if (g.failed) {
+                    chain_failed[c] = true;
+                }
+                else if (g.done >= g.len) {
+                    chain_next[c]++;
+                }
+                else {
+                    break;
+                }
+            }
+        }
+    }
+
+    // anything left in a failed or timed out chain counts as failed
+    bool ok = true;
+    for (int c=0; c<chains.size(); c++) {
+        for (int k=chain_next[c]; k<chains[c].size(); k++) {
+            gathers_[chains[c][k]].failed = true;
+            ok = false;
+        }
+    }
+    return ok;
+#endif
+}
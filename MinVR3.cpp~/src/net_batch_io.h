@@ -0,0 +1,109 @@
+/**
+  Batches socket sends and receives so that the work for many sockets can be handed to the kernel at once.
+  Operations are queued with QueueString() and QueueReceive() and then all of them are carried out by a single
+  call to Submit().
+
+  Two backends are available, and the choice is made at runtime:
+  - BACKEND_IO_URING (Linux only) copies queued frames into a buffer that is registered with the kernel
+    and starts everything queued with one system call, no matter how many sockets are involved.
+  - BACKEND_SYSCALL makes one system call per socket.
+  With either backend, all of the frames queued for the same socket are gathered into a single write (a
+  sendmsg(), or a WRITE_FIXED straight from the registered buffer when there is just one frame), so they leave
+  in as few TCP packets as possible, and always in the order they were queued.
+  BACKEND_AUTO picks io_uring when the running kernel supports it and falls back to syscalls otherwise.
+ */
+
+#ifndef MINVR3_NET_BATCH_IO_H
+#define MINVR3_NET_BATCH_IO_H
+
+#include "net_headers.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+class NetBatchIO {
+public:
+    enum Backend {
+        BACKEND_AUTO,
+        BACKEND_SYSCALL,
+        BACKEND_IO_URING
+    };
+
+    /// queue_depth is the max number of operations handed to the kernel at once (io_uring only), and
+    /// registered_buffer_bytes is the size of the frame buffer registered with the kernel (io_uring only).
+    /// Frames that do not fit in the registered buffer are still sent, just without the registered buffer.
+    NetBatchIO(Backend backend=BACKEND_AUTO, int queue_depth=256, int registered_buffer_bytes=1048576);
+    virtual ~NetBatchIO();
+
+    /// Queues s to be sent to socket_fd, framed exactly as MinNet::SendString() frames it.
+    void QueueString(SOCKET socket_fd, const std::string &s);
+
+    /// Queues s to be sent to every socket in socket_fds.  The frame is stored just once and shared by all.
+    void QueueString(const std::vector<SOCKET> &socket_fds, const std::string &s);
+
+    /// Queues a single receive of up to len bytes into buf.  After Submit(), *n_received holds the number of
+    /// bytes received, 0 if the peer closed the connection, or -1 on error.  Only queue receives for sockets
+    /// that are known to be ready to read, otherwise Submit() waits until data arrives.
+    void QueueReceive(SOCKET socket_fd, uint8_t *buf, int len, int *n_received);
+
+    /// Carries out all queued operations and waits for them to finish.  If timeout_ms > 0, operations still
+    /// running after timeout_ms are cancelled.  Each socket with a failed or cancelled operation is appended
+    /// to failed_fds (if not NULL) once.  Returns true if every operation succeeded.
+    bool Submit(double timeout_ms=0, std::vector<SOCKET> *failed_fds=NULL);
+
+    int get_num_queued() const;
+    Backend get_backend() const;
+
+    /// Total number of system calls made to send/receive data since this object was created.
+    uint64_t get_num_syscalls() const;
+
+    static bool IsIoUringSupported();
+    static std::string BackendToString(Backend backend);
+    static Backend StringToBackend(const std::string &name);
+
+    // io_uring state, opaque here so that the header does not depend on linux headers
+    struct Ring;
+
+private:
+    // one queued frame or receive
+    struct Op {
+        SOCKET fd;
+        bool is_send;
+        int frame_offset;   // sends: location of the frame in arena_ (or -1 for overflow_)
+        int overflow_index;
+        uint8_t *recv_buf;  // receives: caller's buffer
+        int *n_received;
+        int len;
+    };
+
+    // consecutive frames for the same socket, sent with one gathered write
+    struct Gather {
+        SOCKET fd;
+        bool is_send;
+        int first;          // index into gather_ops_
+        int count;
+        int len;
+        int done;
+        bool failed;
+    };
+
+    int StoreFrame(const std::string &s, int *overflow_index);
+    const uint8_t* OpData(const Op &op) const;
+    void BuildGathers();
+    bool SubmitSyscall(double timeout_ms);
+    bool SubmitIoUring(double timeout_ms);
+
+    Backend backend_;
+    std::vector<Op> ops_;
+    std::vector<Gather> gathers_;
+    std::vector<int> gather_ops_;
+    std::vector<uint8_t> arena_;
+    int arena_used_;
+    std::vector<std::string> overflow_;
+    uint64_t num_syscalls_;
+    Ring *ring_;
+};
+
+#endif
@@ -0,0 +1,251 @@
+
+#include "net_reactor.h"
+
+#include "min_net.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#ifdef WIN32
+#include <winsock2.h>
+#define poll WSAPoll
+#else
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+
+// max number of ready sockets reported by a single wait; more are picked up on the next RunOnce()
+static const int MAX_EVENTS_PER_WAIT = 256;
+
+
+NetReactor::NetReactor() : stopped_(false) {
+#ifdef __linux__
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        std::cerr << "NetReactor::NetReactor() Error: epoll_create1 failed, errno = " << errno << std::endl;
+    }
+#endif
+}
+
+
+NetReactor::~NetReactor() {
+#ifdef __linux__
+    if (epoll_fd_ >= 0) {
+        close(epoll_fd_);
+    }
+#endif
+}
+
+
+#ifdef __linux__
+static uint32_t ToEpollEvents(int events) {
+    uint32_t ep = EPOLLET | EPOLLRDHUP;
+    if (events & NetReactor::READABLE) {
+        ep |= EPOLLIN;
+    }
+    if (events & NetReactor::WRITABLE) {
+        ep |= EPOLLOUT;
+    }
+    return ep;
+}
+#endif
+
+
+bool NetReactor::Add(SOCKET socket_fd, int events, const Callback &callback) {
+    if (Contains(socket_fd)) {
+        std::cerr << "NetReactor::Add() Error: socket " << socket_fd << " is already registered." << std::endl;
+        return false;
+    }
+#ifdef __linux__
+    struct epoll_event ev;
+    ev.events = ToEpollEvents(events);
+    ev.data.fd = socket_fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, socket_fd, &ev) != 0) {
+        std::cerr << "NetReactor::Add() Error: epoll_ctl failed, errno = " << errno << std::endl;
+        return false;
+    }
+#endif
+    std::shared_ptr<Handler> h(new Handler());
+    h->events = events;
+    h->callback = callback;
+    handlers_[socket_fd] = h;
+    return true;
+}
+
+
+bool NetReactor::Modify(SOCKET socket_fd, int events) {
+    auto it = handlers_.find(socket_fd);
+    if (it == handlers_.end()) {
+        std::cerr << "NetReactor::Modify() Error: socket " << socket_fd << " is not registered." << std::endl;
+        return false;
+    }
+#ifdef __linux__
+    struct epoll_event ev;
+    ev.events = ToEpollEvents(events);
+    ev.data.fd = socket_fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, socket_fd, &ev) != 0) {
+        std::cerr << "NetReactor::Modify() Error: epoll_ctl failed, errno = " << errno << std::endl;
+        return false;
+    }
+#endif
+    it->second->events = events;
+    return true;
+}
+
+
+bool NetReactor::Remove(SOCKET socket_fd) {
+    auto it = handlers_.find(socket_fd);
+    if (it == handlers_.end()) {
+        return false;
+    }
+#ifdef __linux__
+    // the event arg is ignored for EPOLL_CTL_DEL, but must be non-null on older kernels
+    struct epoll_event ev;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, socket_fd, &ev);
+#endif
+    handlers_.erase(it);
+    return true;
+}
+
+
+bool NetReactor::Contains(SOCKET socket_fd) const {
+    return handlers_.find(socket_fd) != handlers_.end();
+}
+
+
+int NetReactor::RunOnce(int timeout_ms) {
+    // Collect (fd, events) pairs first, then dispatch.  Callbacks may add or remove sockets, so the handler
+    // is looked up again right before each call and skipped if it has been removed in the meantime.
+    std::vector<std::pair<SOCKET, int>> ready;
+    // with the process's spin_wait (see SocketTuning), the wait polls without sleeping
+    bool spin = (timeout_ms != 0) && (MinNet::is_spin_wait());
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(std::max(timeout_ms, 0));
+
+#ifdef __linux__
+    struct epoll_event events[MAX_EVENTS_PER_WAIT];
+    int n;
+    do {
+        n = epoll_wait(epoll_fd_, events, MAX_EVENTS_PER_WAIT, spin ? 0 : timeout_ms);
+    } while ((spin) && (n == 0) && ((timeout_ms < 0) || (std::chrono::steady_clock::now() < deadline)));
+    if (n < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        std::cerr << "NetReactor::RunOnce() Error: epoll_wait failed, errno = " << errno << std::endl;
+        return -1;
+    }
+    ready.reserve(n);
+    for (int i=0; i<n; i++) {
+        int flags = 0;
+        if (events[i].events & EPOLLIN) {
+            flags |= READABLE;
+        }
+        if (events[i].events & EPOLLOUT) {
+            flags |= WRITABLE;
+        }
+        if (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+            // also flag as readable so that handlers that only listen for READABLE notice the close
+            flags |= CLOSED | READABLE;
+        }
+        ready.push_back(std::make_pair((SOCKET)events[i].data.fd, flags));
+    }
+#else
+    std::vector<struct pollfd> pfds;
+    pfds.reserve(handlers_.size());
+    for (auto it = handlers_.begin(); it != handlers_.end(); it++) {
+        struct pollfd p;
+        p.fd = it->first;
+        p.events = 0;
+        p.revents = 0;
+        if (it->second->events & READABLE) {
+            p.events |= POLLIN;
+        }
+        if (it->second->events & WRITABLE) {
+            p.events |= POLLOUT;
+        }
+        pfds.push_back(p);
+    }
+    if (pfds.empty()) {
+        // nothing to wait on; poll() with no fds would just sleep for the timeout
+        return 0;
+    }
+    int n;
+    do {
+        n = poll(pfds.data(), (unsigned long)pfds.size(), spin ? 0 : timeout_ms);
+    } while ((spin) && (n == 0) && ((timeout_ms < 0) || (std::chrono::steady_clock::now() < deadline)));
+    if (n == SOCKET_ERROR) {
+#ifndef WIN32
+        if (errno == EINTR) {
+            return 0;
+        }
+#endif
+        std::cerr << "NetReactor::RunOnce() Error: poll failed." << std::endl;
+        return -1;
+    }
+    for (int i=0; i<pfds.size(); i++) {
+        if (pfds[i].revents != 0) {
+            int flags = 0;
+            if (pfds[i].revents & POLLIN) {
+                flags |= READABLE;
+            }
+            if (pfds[i].revents & POLLOUT) {
+                flags |= WRITABLE;
+            }
+            if (pfds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                flags |= CLOSED | READABLE;
+            }
+            ready.push_back(std::make_pair((SOCKET)pfds[i].fd, flags));
+        }
+    }
+#endif
+
+    int n_dispatched = 0;
+    for (int i=0; i<ready.size(); i++) {
+        auto it = handlers_.find(ready[i].first);
+        if (it != handlers_.end()) {
+            // hold a reference so the handler survives if the callback removes its own socket
+            std::shared_ptr<Handler> h = it->second;
+            h->callback(ready[i].first, ready[i].second);
+            n_dispatched++;
+        }
+    }
+    return n_dispatched;
+}
+
+
+void NetReactor::Run() {
+    stopped_ = false;
+    while (!stopped_) {
+        if (RunOnce(-1) < 0) {
+            break;
+        }
+    }
+}
+
+
+void NetReactor::Stop() {
+    stopped_ = true;
+}
+
+
+int NetReactor::get_num_sockets() const {
+    return (int)handlers_.size();
+}
+
+
+bool NetReactor::is_edge_triggered() const {
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
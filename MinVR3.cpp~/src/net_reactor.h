@@ -0,0 +1,81 @@
+/**
+  Readiness-based event loop for MinNet sockets.  Each socket is registered together with a callback, and
+  RunOnce() blocks inside the kernel until at least one registered socket is ready, then invokes the
+  callbacks for the sockets that are ready.  There is no polling and no per-iteration cost proportional to
+  the number of registered sockets.
+
+  On Linux, the reactor is implemented with edge-triggered epoll, so a callback is only invoked when new
+  data arrives (or new buffer space becomes available), not every time the loop runs.  Callbacks must
+  therefore drain their socket, i.e., keep reading (or accepting) until there is nothing left, before
+  returning.  On other platforms the reactor falls back to level-triggered poll()/WSAPoll(); callbacks
+  written for the edge-triggered case work unchanged there.
+ */
+
+#ifndef MINVR3_NET_REACTOR_H
+#define MINVR3_NET_REACTOR_H
+
+#include "net_headers.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+
+
+class NetReactor {
+public:
+    /// Bit flags used both to describe the events of interest when registering a socket and to report
+    /// which events occurred when a callback is invoked.
+    enum EventFlags {
+        READABLE = 1,
+        WRITABLE = 2,
+        CLOSED = 4      // reported only, set when the peer hung up or the socket is in an error state
+    };
+
+    typedef std::function<void(SOCKET fd, int events)> Callback;
+
+    NetReactor();
+    virtual ~NetReactor();
+
+    /// Starts monitoring socket_fd for the events listed in the events bit mask.  The callback is invoked
+    /// from within RunOnce() whenever the socket becomes ready.
+    bool Add(SOCKET socket_fd, int events, const Callback &callback);
+
+    /// Changes the events of interest for a socket that was previously added.
+    bool Modify(SOCKET socket_fd, int events);
+
+    /// Stops monitoring the socket.  It is safe to call this from within a callback, including for a socket
+    /// other than the one that triggered the callback.  The socket is not closed.
+    bool Remove(SOCKET socket_fd);
+
+    bool Contains(SOCKET socket_fd) const;
+
+    /// Waits for at least one socket to become ready and dispatches callbacks for all ready sockets.  If
+    /// timeout_ms < 0, blocks until something happens; if timeout_ms == 0, returns immediately.  Returns the
+    /// number of callbacks invoked or -1 on error.  With the process's SocketTuning::spin_wait, it polls in a loop
+    /// rather than blocking, which keeps a core busy but wakes up sooner.
+    int RunOnce(int timeout_ms=-1);
+
+    /// Calls RunOnce() repeatedly until Stop() is called from within a callback.
+    void Run();
+    void Stop();
+
+    int get_num_sockets() const;
+
+    /// True when the underlying implementation is edge-triggered (epoll) rather than level-triggered.
+    bool is_edge_triggered() const;
+
+private:
+    struct Handler {
+        int events;
+        Callback callback;
+    };
+
+    std::map<SOCKET, std::shared_ptr<Handler>> handlers_;
+    bool stopped_;
+
+#ifdef __linux__
+    int epoll_fd_;
+#endif
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include "relay_cluster.h"
+
+#include "min_net.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#ifdef WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+
+RelayCluster::RelayCluster() {
+}
+
+
+// Splits "host:port", or "[address]:port" for an IPv6 address, whose colons would be taken for the port's.
+// Returns false if there is no port, or it is not a number from 1 to 65535.
+static bool SplitHostAndPort(const std::string &address, std::string *host, int *port) {
+    size_t colon = address.rfind(':');
+    if ((colon == std::string::npos) || (colon == 0)) {
+        return false;
+    }
+    if (address[0] == '[') {
+        if (address[colon - 1] != ']') {
+            return false;
+        }
+        *host = address.substr(1, colon - 2);
+    }
+    else if (address.find(':') != colon) {
+        // an IPv6 address without brackets, which cannot be told apart from its port
+        return false;
+    }
+    else {
+        *host = address.substr(0, colon);
+    }
+    std::string digits = address.substr(colon + 1);
+    if ((host->empty()) || (digits.empty()) || (digits.size() > 5) ||
+        (digits.find_first_not_of("0123456789") != std::string::npos))
+    {
+        return false;
+    }
+    *port = std::stoi(digits);
+    return (*port >= 1) && (*port <= 65535);
+}
+
+
+RelayCluster::~RelayCluster() {
+    for (int i=0; i<pending_.size(); i++) {
+        delete pending_[i];
+    }
+    for (int i=0; i<connections_.size(); i++) {
+        delete connections_[i];
+    }
+}
+
+
+bool RelayCluster::Connect(const std::vector<std::string> &addresses) {
+    int num_connected = 0;
+    for (int i=0; i<addresses.size(); i++) {
+        const std::string &address = addresses[i];
+        Connection *connection = NULL;
+        std::string host;
+        int port;
+        if ((address.compare(0, 4, "mem:") == 0) || (MinNet::IsUnixAddress(address))) {
+            connection = Connection::Connect(address);
+        }
+        else if (SplitHostAndPort(address, &host, &port)) {
+            connection = Connection::Connect(host, port);
+        }
+        else {
+            std::cerr << "RelayCluster Error: Expected host:port, [ipv6 address]:port, a unix: address or mem:name "
+                << "for relay " << i << ", not " << address << ", its events go to the next relay." << std::endl;
+            AddConnection(NULL);
+            continue;
+        }
+        if (connection == NULL) {
+            std::cerr << "RelayCluster Error: Could not connect to relay " << i << " at " << address
+                << ", its events go to the next relay." << std::endl;
+        }
+        else {
+            num_connected++;
+        }
+        AddConnection(connection);
+    }
+    return num_connected > 0;
+}
+
+
+void RelayCluster::AddConnection(Connection *connection) {
+    connections_.push_back(connection);
+}
+
+
+uint32_t RelayCluster::HashName(const std::string &name) {
+    uint32_t h = 2166136261u;
+    for (int i=0; i<name.size(); i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+int RelayCluster::GetPartition(const std::string &name) const {
+    if (connections_.empty()) {
+        return -1;
+    }
+    return (int)(HashName(name) % (uint32_t)connections_.size());
+}
+
+
+int RelayCluster::GetRoute(const std::string &name) const {
+    int partition = GetPartition(name);
+    for (int i=0; i<connections_.size(); i++) {
+        int p = (partition + i) % (int)connections_.size();
+        if (IsUp(p)) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+
+bool RelayCluster::SendVREvent(const VREvent &e, double timeout_ms) {
+    int p;
+    while ((p = GetRoute(e.get_name())) >= 0) {
+        if (connections_[p]->SendVREvent(e, timeout_ms)) {
+            return true;
+        }
+        CloseRelay(p);
+    }
+    return false;
+}
+
+
+void RelayCluster::QueueVREvent(const VREvent &e) {
+    int p = GetRoute(e.get_name());
+    if (p >= 0) {
+        connections_[p]->QueueVREvent(e);
+    }
+}
+
+
+bool RelayCluster::Flush(double timeout_ms) {
+    bool ok = true;
+    for (int i=0; i<connections_.size(); i++) {
+        if ((IsUp(i)) && (!connections_[i]->Flush(timeout_ms))) {
+            CloseRelay(i);
+            ok = false;
+        }
+    }
+    return ok && (get_num_open() > 0);
+}
+
+
+Connection::FlushResult RelayCluster::TryFlush() {
+    Connection::FlushResult result = Connection::FLUSH_DONE;
+    for (int i=0; i<connections_.size(); i++) {
+        if (!IsUp(i)) {
+            continue;
+        }
+        Connection::FlushResult r = connections_[i]->TryFlush();
+        if (r == Connection::FLUSH_ERROR) {
+            CloseRelay(i);
+            result = Connection::FLUSH_ERROR;
+        }
+        else if ((r == Connection::FLUSH_PENDING) && (result == Connection::FLUSH_DONE)) {
+            result = Connection::FLUSH_PENDING;
+        }
+    }
+    return (get_num_open() > 0) ? result : Connection::FLUSH_ERROR;
+}
+
+
+VREvent* RelayCluster::ReceiveVREvent(double timeout_ms) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds((int64_t)(timeout_ms * 1000.0));
+    std::vector<VREvent*> events;
+    while (pending_.empty()) {
+        events.clear();
+        bool open = ReceiveAvailableVREvents(&events);
+        pending_.insert(pending_.end(), events.begin(), events.end());
+        if ((!pending_.empty()) || (!open)) {
+            break;
+        }
+        int wait_ms = -1;
+        if (timeout_ms > 0) {
+            wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (wait_ms < 0) {
+                return NULL;
+            }
+        }
+        // wait for any of the relays, or look again every millisecond if some of them have no socket to wait on
+        std::vector<struct pollfd> pfds;
+        for (int i=0; i<connections_.size(); i++) {
+            if (!IsUp(i)) {
+                continue;
+            }
+            SOCKET fd = connections_[i]->get_socket();
+            if (fd == INVALID_SOCKET) {
+                wait_ms = (wait_ms < 0) ? 1 : std::min(wait_ms, 1);
+                continue;
+            }
+            struct pollfd p;
+            p.fd = fd;
+            p.events = POLLIN;
+            p.revents = 0;
+            pfds.push_back(p);
+        }
+        if (pfds.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        else {
+            poll(pfds.data(), (unsigned long)pfds.size(), wait_ms);
+        }
+    }
+    if (pending_.empty()) {
+        return NULL;
+    }
+    VREvent *e = pending_.front();
+    pending_.pop_front();
+    return e;
+}
+
+
+bool RelayCluster::ReceiveAvailableVREvents(std::vector<VREvent*> *events) {
+    while (!pending_.empty()) {
+        events->push_back(pending_.front());
+        pending_.pop_front();
+    }
+    bool any_open = false;
+    for (int i=0; i<connections_.size(); i++) {
+        if (!IsUp(i)) {
+            continue;
+        }
+        if (connections_[i]->ReceiveAvailableVREvents(events)) {
+            any_open = true;
+        }
+        else {
+            CloseRelay(i);
+        }
+    }
+    return any_open;
+}
+
+
+bool RelayCluster::Subscribe(const std::string &pattern, double timeout_ms) {
+    bool ok = (get_num_open() > 0);
+    for (int i=0; i<connections_.size(); i++) {
+        if ((IsUp(i)) && (!connections_[i]->Subscribe(pattern, timeout_ms))) {
+            CloseRelay(i);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+bool RelayCluster::Unsubscribe(const std::string &pattern, double timeout_ms) {
+    bool ok = (get_num_open() > 0);
+    for (int i=0; i<connections_.size(); i++) {
+        if ((IsUp(i)) && (!connections_[i]->Unsubscribe(pattern, timeout_ms))) {
+            CloseRelay(i);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+bool RelayCluster::OfferEventDictionary(double timeout_ms, int max_version) {
+    bool ok = (get_num_open() > 0);
+    for (int i=0; i<connections_.size(); i++) {
+        if ((IsUp(i)) && (!connections_[i]->OfferEventDictionary(timeout_ms, max_version))) {
+            CloseRelay(i);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+int RelayCluster::get_num_partitions() const {
+    return (int)connections_.size();
+}
+
+
+int RelayCluster::get_num_open() const {
+    int n = 0;
+    for (int i=0; i<connections_.size(); i++) {
+        if (IsUp(i)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+
+Connection* RelayCluster::get_connection(int partition) const {
+    return connections_[partition];
+}
+
+
+bool RelayCluster::IsUp(int partition) const {
+    return (connections_[partition] != NULL) && (connections_[partition]->is_open());
+}
+
+
+void RelayCluster::CloseRelay(int partition) {
+    std::cerr << "RelayCluster Error: Lost relay " << partition << " (" << connections_[partition]->get_description()
+        << "), its events go to the next relay." << std::endl;
+    connections_[partition]->Close();
+}
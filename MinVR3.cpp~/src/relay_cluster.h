@@ -0,0 +1,105 @@
+/**
+  Client side of a cluster of relays that share the event namespace, so an installation is not limited to what one
+  relay process can carry, and losing one relay does not lose every event.  The relays are ordinary relays
+  (EventRelay, minvr3_relay_server) that know nothing of each other.  Each one owns a partition of the event
+  names, by a hash of the name, and every client connects to all of them: an event is sent only to the relay
+  that owns its name, which relays it to every client, so each relay carries 1/n of the events and the total
+  grows with the number of relays, e.g., one per core or per host.
+
+  The partition of a name is HashName(name) % n, with HashName() the 32-bit FNV-1a hash of the name's bytes, so
+  a client in another language can route the same way, and the relays are numbered in the order they are given,
+  which must be the same for every client.  If the relay that owns a name is down, its events go to the next
+  relay that is up, so they still reach every client.
+
+  Events with the same name all go through the same relay, so they stay in order, but events with different
+  names may arrive in a different order than they were sent.  Subscriptions and the event dictionary offer go to
+  every relay.
+
+  ```
+  RelayCluster cluster;
+  cluster.Connect({"10.0.0.1:9034", "10.0.0.2:9034", "10.0.0.3:9034"});
+  cluster.SendVREvent(VREventVector3("Tracker/Head/Position", x, y, z));     // to one of the three
+  VREvent *e = cluster.ReceiveVREvent();                                       // from any of them
+  ```
+ */
+
+#ifndef MINVR3_RELAY_CLUSTER_H
+#define MINVR3_RELAY_CLUSTER_H
+
+#include "connection.h"
+
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+class RelayCluster {
+public:
+    RelayCluster();
+
+    /// Closes and deletes every connection.
+    virtual ~RelayCluster();
+
+    /// Connects to each relay, given as "host:port" ("[address]:port" for an IPv6 address), a unix: address, or
+    /// "mem:name", and adds it as the next partition.  A relay that cannot be reached, or whose address cannot be
+    /// read, still takes its place in the order, with an error message, and its events go to the next relay that
+    /// is up.  Returns false if none of them can be reached.
+    bool Connect(const std::vector<std::string> &addresses);
+
+    /// Adds a connection to a relay as the next partition, and takes ownership of it.  NULL holds the place of a
+    /// relay that is down.
+    void AddConnection(Connection *connection);
+
+    /// The 32-bit FNV-1a hash of the name's bytes.
+    static uint32_t HashName(const std::string &name);
+
+    /// The partition that owns events with this name.
+    int GetPartition(const std::string &name) const;
+
+    /// The partition events with this name are sent to: the owner if it is up, else the next one that is, or -1 if
+    /// every relay is down.
+    int GetRoute(const std::string &name) const;
+
+    /// Sends the event to the relay that its name is routed to.  A relay that fails is closed, and the event is
+    /// sent to the next one that is up instead.  Returns false if no relay could take it.
+    bool SendVREvent(const VREvent &e, double timeout_ms=0);
+
+    /// Same, through the connection's output buffer, sent by Flush() or TryFlush().
+    void QueueVREvent(const VREvent &e);
+    bool Flush(double timeout_ms=0);
+    Connection::FlushResult TryFlush();
+
+    /// Waits for the next event from any relay, and returns NULL on timeout or once every relay has gone.  The
+    /// caller owns the event.
+    VREvent* ReceiveVREvent(double timeout_ms=0);
+
+    /// Appends every event that has arrived from any relay to events, without waiting.  The caller owns the events.
+    /// A relay whose connection is broken is closed.  Returns false once every relay has gone.
+    bool ReceiveAvailableVREvents(std::vector<VREvent*> *events);
+
+    /// Subscribes to (or unsubscribes from) events matching pattern on every relay, see Connection::Subscribe().
+    bool Subscribe(const std::string &pattern, double timeout_ms=0);
+    bool Unsubscribe(const std::string &pattern, double timeout_ms=0);
+
+    /// Offers an event dictionary to every relay, see Connection::OfferEventDictionary().
+    bool OfferEventDictionary(double timeout_ms=0, int max_version=EventDictionary::PROTOCOL_VERSION);
+
+    int get_num_partitions() const;
+
+    /// Number of relays that are up.
+    int get_num_open() const;
+
+    /// The connection to the relay for a partition, or NULL if it could not be reached.
+    Connection* get_connection(int partition) const;
+
+private:
+    bool IsUp(int partition) const;
+    void CloseRelay(int partition);
+
+    std::vector<Connection*> connections_;
+    // events received by ReceiveVREvent() but not returned yet
+    std::deque<VREvent*> pending_;
+};
+
+#endif
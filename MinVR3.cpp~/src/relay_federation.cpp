@@ -0,0 +1,66 @@
+#include "relay_federation.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <stdint.h>
+
+
+const int RelayFederation::MAX_HOPS;
+
+std::string RelayFederation::MakeRelayId() {
+    std::random_device rd;
+    uint64_t r = ((uint64_t)rd() << 32) ^ (uint64_t)rd() ^
+        (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    static const char *hex = "0123456789abcdef";
+    std::string id(16, '0');
+    for (int i=0; i<16; i++) {
+        id[15 - i] = hex[(r >> (4 * i)) & 0xf];
+    }
+    return id;
+}
+
+
+bool RelayFederation::IsRoutedFrame(const std::string &frame) {
+    return (!frame.empty()) && (frame[0] == 0x05);
+}
+
+
+std::string RelayFederation::MakeRoutedFrame(const std::string &origin, int hops, const std::string &event) {
+    size_t origin_size = std::min(origin.size(), (size_t)255);
+    std::string s;
+    s.reserve(3 + origin_size + event.size());
+    s.push_back((char)0x05);
+    s.push_back((char)std::min(hops, 255));
+    s.push_back((char)origin_size);
+    s.append(origin, 0, origin_size);
+    s.append(event);
+    return s;
+}
+
+
+bool RelayFederation::ReadRoutedFrame(const std::string &frame, std::string *origin, int *hops, std::string *event) {
+    if ((!IsRoutedFrame(frame)) || (frame.size() < 3)) {
+        return false;
+    }
+    size_t origin_size = (uint8_t)frame[2];
+    if (frame.size() < 3 + origin_size) {
+        return false;
+    }
+    *hops = (uint8_t)frame[1];
+    origin->assign(frame, 3, origin_size);
+    event->assign(frame, 3 + origin_size, std::string::npos);
+    return true;
+}
+
+
+std::vector<std::string> RelayFederation::SplitChain(const std::string &chain) {
+    std::vector<std::string> ids;
+    std::istringstream s(chain);
+    std::string id;
+    while (s >> id) {
+        ids.push_back(id);
+    }
+    return ids;
+}
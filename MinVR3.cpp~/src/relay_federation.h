@@ -0,0 +1,70 @@
+/**
+  Relays linked into a tree, e.g., one relay per site of a multi-site session, so each event crosses the link
+  between two sites once, however many clients there are at the far end, rather than once per remote client.
+
+  A downstream relay links to its upstream relay with EventRelay::AddLink() (minvr3_relay_server --uplink),
+  connecting to one of the upstream relay's link listeners (EventRelay::AddLinkListener(), minvr3_relay_server
+  --link-listen), so a client that only has the relay's ordinary address cannot pass itself off as a relay.  From
+  then on the two relay every event to each other like any other connection, with these differences:
+  - The link is subscribed, on the relay at the other end, to whatever this relay's own clients and other links
+    want (everything if any of them has not subscribed, nothing if it has none), and the subscription follows
+    them as they change, so an event only crosses a link if somebody beyond it wants it.
+  - An event is never relayed back over the link it arrived on, whatever relay_to_source says, so in a tree
+    each event reaches every relay exactly once.
+  - Events cross a link tagged with the id of the relay where they started and the number of links crossed so
+    far, in a ROUTED frame, which is never sent to anything but another relay:
+    ```
+    0x05  hops (1 byte)  origin length (1 byte)  origin  json event
+    ```
+    An event that comes back to the relay where it started, or has crossed MAX_HOPS links, is dropped, so a
+    loop that was not caught when its last link was made cannot relay an event forever.
+
+  The link starts with the downstream relay sending a VREventString named "RelayLink" holding its id, and the
+  upstream relay answering with "RelayLinkAccept", holding the ids of every relay from itself up to the root of
+  the tree, separated by spaces.  A link that would close a loop (the upstream relay is the downstream relay, or
+  lies below it) is refused by whichever end notices, and closed, as is a "RelayLink" from a connection that was
+  not accepted by a link listener.
+
+  ```
+  // at the hub
+  EventRelay relay;
+  relay.AddListener(Listener::Create("9034"));
+  relay.AddLinkListener(Listener::Create("9044"));
+
+  // at each remote site
+  EventRelay relay;
+  relay.AddListener(Listener::Create("9034"));
+  relay.AddLink(Connection::Connect("hub.example.org", 9044));
+  ```
+ */
+
+#ifndef MINVR3_RELAY_FEDERATION_H
+#define MINVR3_RELAY_FEDERATION_H
+
+#include <string>
+#include <vector>
+
+
+class RelayFederation {
+public:
+    /// Events that have crossed this many links are dropped.
+    static const int MAX_HOPS = 16;
+
+    /// A new relay id: 16 random hex digits.
+    static std::string MakeRelayId();
+
+    /// True if the frame is a ROUTED frame.
+    static bool IsRoutedFrame(const std::string &frame);
+
+    /// The event (json), tagged with the id of the relay where it started (at most 255 bytes) and the number of
+    /// links it has crossed, counting the one it is about to cross.
+    static std::string MakeRoutedFrame(const std::string &origin, int hops, const std::string &event);
+
+    /// Reads a frame made by MakeRoutedFrame().  Returns false if it is not a ROUTED frame or is cut off.
+    static bool ReadRoutedFrame(const std::string &frame, std::string *origin, int *hops, std::string *event);
+
+    /// The ids in a "RelayLinkAccept" event, from the relay that sent it up to the root.
+    static std::vector<std::string> SplitChain(const std::string &chain);
+};
+
+#endif
@@ -0,0 +1,447 @@
+#include "send_queue.h"
+
+#include "frame_decoder.h"
+#include "min_net.h"
+
+#include <algorithm>
+#include <set>
+
+
+// frames handed to the OS per write, two buffers (header and body) each
+static const int MAX_FRAMES_PER_WRITE = 32;
+
+const int SendQueue::DEFAULT_FRAGMENT_SIZE;
+
+
+SendQueue::SendQueue(int64_t max_bytes, OverflowPolicy policy) :
+    next_seq_(0), num_replaced_(0), behind_(false), num_bytes_(0), sent_offset_(0), max_bytes_(max_bytes), policy_(policy),
+    overflowed_(false), num_dropped_(0), num_coalesced_(0), fragment_size_(0), bulk_offset_(0), fragment_header_len_(0),
+    fragment_len_(0), fragment_sent_(0)
+{
+}
+
+
+SendQueue::~SendQueue() {
+}
+
+
+void SendQueue::set_limit(int64_t max_bytes, OverflowPolicy policy) {
+    max_bytes_ = max_bytes;
+    policy_ = policy;
+}
+
+
+void SendQueue::set_fragment_size(int max_bytes) {
+    // large frames already queued still go out in fragments
+    fragment_size_ = std::max(max_bytes, 0);
+}
+
+
+int SendQueue::get_fragment_size() const {
+    return fragment_size_;
+}
+
+
+bool SendQueue::Push(const std::string &s, const std::string &key) {
+    if (overflowed_) {
+        return false;
+    }
+    return Push(std::make_shared<const OutboundFrame>(s, key));
+}
+
+
+bool SendQueue::Push(const OutboundFramePtr &frame) {
+    if (overflowed_) {
+        return false;
+    }
+    const std::string &key = frame->key;
+    bool bulk = (fragment_size_ > 0) && (frame->body.size() > fragment_size_);
+    if ((!bulk) && (behind_) && (frame->latest_value) && (!key.empty())) {
+        // before the limit is checked, since this may make room
+        ReplaceLatest(key);
+    }
+    int64_t frame_bytes = 4 + (int64_t)frame->body.size();
+    if ((max_bytes_ > 0) && (num_bytes_ + frame_bytes > max_bytes_)) {
+        if (policy_ == OVERFLOW_DISCONNECT) {
+            overflowed_ = true;
+            return false;
+        }
+        if (policy_ == OVERFLOW_COALESCE) {
+            Coalesce(key);
+        }
+        DropOldest(num_bytes_ + frame_bytes - max_bytes_);
+    }
+
+    if (bulk) {
+        bulk_.push_back(frame);
+        num_bytes_ += frame_bytes;
+        return true;
+    }
+    frames_.push_back(Frame());
+    Frame &f = frames_.back();
+    uint32_t len = (uint32_t)frame->body.size();
+    f.header[0] = (uint8_t)(len & 0xff);
+    f.header[1] = (uint8_t)((len >> 8) & 0xff);
+    f.header[2] = (uint8_t)((len >> 16) & 0xff);
+    f.header[3] = (uint8_t)((len >> 24) & 0xff);
+    f.data = frame;
+    f.seq = next_seq_++;
+    f.replaced = false;
+    num_bytes_ += frame_bytes;
+    if ((frame->latest_value) && (!key.empty())) {
+        latest_[key] = f.seq;
+    }
+    return true;
+}
+
+
+int64_t SendQueue::FrameBytes(const Frame &f) {
+    return f.replaced ? 0 : 4 + (int64_t)f.data->body.size();
+}
+
+
+void SendQueue::ReplaceLatest(const std::string &key) {
+    std::unordered_map<std::string, uint64_t>::iterator it = latest_.find(key);
+    if (it == latest_.end()) {
+        return;
+    }
+    // frames stay in seq order, even when some in the middle have been dropped or coalesced
+    uint64_t seq = it->second;
+    std::deque<Frame>::iterator f = std::lower_bound(frames_.begin(), frames_.end(), seq,
+        [](const Frame &a, uint64_t b) { return a.seq < b; });
+    if ((f == frames_.end()) || (f->seq != seq) || (f->replaced) || ((f == frames_.begin()) && (sent_offset_ > 0))) {
+        // already gone, or already on its way
+        return;
+    }
+    num_bytes_ -= FrameBytes(*f);
+    f->replaced = true;
+    f->data.reset();
+    num_replaced_++;
+    num_coalesced_++;
+}
+
+
+void SendQueue::CompactLatest() {
+    // latest_ holds the newest frame for each key, so any other frame with a key in it is stale
+    int first_removable = (sent_offset_ > 0) ? 1 : 0;
+    for (int i=first_removable; i<frames_.size(); i++) {
+        Frame &f = frames_[i];
+        if ((f.replaced) || (!f.data->latest_value) || (f.data->key.empty())) {
+            continue;
+        }
+        std::unordered_map<std::string, uint64_t>::const_iterator it = latest_.find(f.data->key);
+        if ((it != latest_.end()) && (it->second != f.seq)) {
+            num_bytes_ -= FrameBytes(f);
+            f.replaced = true;
+            f.data.reset();
+            num_replaced_++;
+            num_coalesced_++;
+        }
+    }
+}
+
+
+void SendQueue::PopFront() {
+    Frame &f = frames_.front();
+    if (f.replaced) {
+        num_replaced_--;
+    }
+    else if (f.data->latest_value) {
+        std::unordered_map<std::string, uint64_t>::iterator it = latest_.find(f.data->key);
+        if ((it != latest_.end()) && (it->second == f.seq)) {
+            latest_.erase(it);
+        }
+    }
+    frames_.pop_front();
+}
+
+
+void SendQueue::Coalesce(const std::string &new_key) {
+    // keep the newest frame for each key, working back from the end, where the frame about to be added is the
+    // newest of all; a partly sent first frame must stay
+    std::set<std::string> seen;
+    if (!new_key.empty()) {
+        seen.insert(new_key);
+    }
+    std::deque<Frame> kept;
+    int first_removable = (sent_offset_ > 0) ? 1 : 0;
+    for (int i=(int)frames_.size() - 1; i>=0; i--) {
+        Frame &f = frames_[i];
+        if (f.replaced) {
+            num_replaced_--;
+        }
+        else if ((i >= first_removable) && (!f.data->key.empty()) && (!seen.insert(f.data->key).second)) {
+            num_bytes_ -= 4 + (int64_t)f.data->body.size();
+            num_coalesced_++;
+        }
+        else {
+            kept.push_front(std::move(f));
+        }
+    }
+    frames_.swap(kept);
+}
+
+
+void SendQueue::DropOldest(int64_t needed) {
+    // whole frames only, and never one that has started to go out, or the receiver would lose its place
+    size_t first_removable = (sent_offset_ > 0) ? 1 : 0;
+    while ((needed > 0) && (frames_.size() > first_removable)) {
+        Frame &f = frames_[first_removable];
+        if ((!f.replaced) && (f.data->pinned)) {
+            first_removable++;
+            continue;
+        }
+        int64_t frame_bytes = FrameBytes(f);
+        if (f.replaced) {
+            num_replaced_--;
+        }
+        else {
+            num_dropped_++;
+        }
+        frames_.erase(frames_.begin() + first_removable);
+        num_bytes_ -= frame_bytes;
+        needed -= frame_bytes;
+    }
+    // then large frames, which go to the back of the line anyway
+    size_t first_bulk = ((bulk_offset_ > 0) || (fragment_len_ > 0)) ? 1 : 0;
+    while ((needed > 0) && (bulk_.size() > first_bulk)) {
+        if (bulk_[first_bulk]->pinned) {
+            first_bulk++;
+            continue;
+        }
+        int64_t frame_bytes = 4 + (int64_t)bulk_[first_bulk]->body.size();
+        bulk_.erase(bulk_.begin() + first_bulk);
+        num_dropped_++;
+        num_bytes_ -= frame_bytes;
+        needed -= frame_bytes;
+    }
+}
+
+
+void SendQueue::NextFragment() {
+    const std::string &body = bulk_.front()->body;
+    int size = (fragment_size_ > 0) ? fragment_size_ : DEFAULT_FRAGMENT_SIZE;
+    fragment_len_ = (int)std::min((int64_t)size, (int64_t)body.size() - bulk_offset_);
+    fragment_sent_ = 0;
+    // the fragment frame's body starts with the marker and the length of the whole frame, see FrameDecoder
+    uint8_t *prefix = fragment_header_ + 4;
+    int prefix_len = 0;
+    prefix[prefix_len++] = FrameDecoder::FRAGMENT_MARKER;
+    uint32_t total = (uint32_t)body.size();
+    while (total >= 0x80) {
+        prefix[prefix_len++] = (uint8_t)((total & 0x7f) | 0x80);
+        total >>= 7;
+    }
+    prefix[prefix_len++] = (uint8_t)total;
+    uint32_t len = (uint32_t)(prefix_len + fragment_len_);
+    fragment_header_[0] = (uint8_t)(len & 0xff);
+    fragment_header_[1] = (uint8_t)((len >> 8) & 0xff);
+    fragment_header_[2] = (uint8_t)((len >> 16) & 0xff);
+    fragment_header_[3] = (uint8_t)((len >> 24) & 0xff);
+    fragment_header_len_ = 4 + prefix_len;
+}
+
+
+void SendQueue::AddFragment(const uint8_t **bufs, int *lens, int *count) {
+    int skip = fragment_sent_;
+    if (skip < fragment_header_len_) {
+        bufs[*count] = fragment_header_ + skip;
+        lens[*count] = fragment_header_len_ - skip;
+        (*count)++;
+        skip = 0;
+    }
+    else {
+        skip -= fragment_header_len_;
+    }
+    bufs[*count] = (const uint8_t*)bulk_.front()->body.data() + bulk_offset_ + skip;
+    lens[*count] = fragment_len_ - skip;
+    (*count)++;
+}
+
+
+int64_t SendQueue::ConsumeFragment(int64_t n) {
+    int64_t left = fragment_header_len_ + fragment_len_ - fragment_sent_;
+    if (n < left) {
+        fragment_sent_ += (int)n;
+        return 0;
+    }
+    num_bytes_ -= fragment_len_;
+    bulk_offset_ += fragment_len_;
+    fragment_len_ = 0;
+    fragment_sent_ = 0;
+    if (bulk_offset_ == (int64_t)bulk_.front()->body.size()) {
+        num_bytes_ -= 4;
+        bulk_.pop_front();
+        bulk_offset_ = 0;
+    }
+    return n - left;
+}
+
+
+SendQueue::WriteResult SendQueue::WriteTo(SOCKET* socket_fd) {
+    if (overflowed_) {
+        return WRITE_ERROR;
+    }
+    // room for a fragment, header and body, as well
+    const uint8_t* bufs[2 * MAX_FRAMES_PER_WRITE + 2];
+    int lens[2 * MAX_FRAMES_PER_WRITE + 2];
+    // pops any replaced frames off the front
+    Consume(0);
+    while ((!frames_.empty()) || (!bulk_.empty())) {
+        int count = 0;
+        int64_t total = 0;
+        // a fragment that has started to go out has to be finished first, otherwise every frame waiting goes
+        // ahead of the next one
+        bool fragment_first = (fragment_len_ > 0) && (fragment_sent_ > 0);
+        if (fragment_first) {
+            AddFragment(bufs, lens, &count);
+        }
+        int i = 0;
+        for (; (i<frames_.size()) && (count + 2 <= 2 * MAX_FRAMES_PER_WRITE); i++) {
+            int skip = (i == 0) ? sent_offset_ : 0;
+            const Frame &f = frames_[i];
+            if (f.replaced) {
+                continue;
+            }
+            if (skip < 4) {
+                bufs[count] = f.header + skip;
+                lens[count] = 4 - skip;
+                count++;
+                skip = 0;
+            }
+            else {
+                skip -= 4;
+            }
+            const std::string &body = f.data->body;
+            if ((int)body.size() > skip) {
+                bufs[count] = (const uint8_t*)body.data() + skip;
+                lens[count] = (int)body.size() - skip;
+                count++;
+            }
+        }
+        bool fragment_last = (!fragment_first) && (i == frames_.size()) && (!bulk_.empty());
+        if (fragment_last) {
+            if (fragment_len_ == 0) {
+                NextFragment();
+            }
+            AddFragment(bufs, lens, &count);
+        }
+        for (int b=0; b<count; b++) {
+            total += lens[b];
+        }
+        int n = MinNet::TrySendGather(socket_fd, bufs, lens, count);
+        if (n < 0) {
+            return WRITE_ERROR;
+        }
+        int64_t left = n;
+        if (fragment_first) {
+            left = ConsumeFragment(left);
+        }
+        left = Consume(left);
+        if (fragment_last) {
+            ConsumeFragment(left);
+        }
+        if (n < total) {
+            if (!behind_) {
+                behind_ = true;
+                CompactLatest();
+            }
+            return WRITE_PENDING;
+        }
+    }
+    behind_ = false;
+    return WRITE_DONE;
+}
+
+
+int64_t SendQueue::Consume(int64_t n) {
+    while ((!frames_.empty()) && ((n > 0) || (frames_.front().replaced))) {
+        int64_t left = FrameBytes(frames_.front()) - sent_offset_;
+        if (n >= left) {
+            n -= left;
+            num_bytes_ -= left;
+            PopFront();
+            sent_offset_ = 0;
+        }
+        else {
+            sent_offset_ += (int)n;
+            num_bytes_ -= n;
+            n = 0;
+        }
+    }
+    return n;
+}
+
+
+bool SendQueue::is_empty() const {
+    // every frame that is not replaced has at least its header left to send
+    return num_bytes_ == 0;
+}
+
+
+bool SendQueue::is_overflowed() const {
+    return overflowed_;
+}
+
+
+int64_t SendQueue::get_num_bytes() const {
+    return num_bytes_;
+}
+
+
+int SendQueue::get_num_frames() const {
+    return (int)frames_.size() - num_replaced_ + (int)bulk_.size();
+}
+
+
+uint64_t SendQueue::get_num_dropped() const {
+    return num_dropped_;
+}
+
+
+uint64_t SendQueue::get_num_coalesced() const {
+    return num_coalesced_;
+}
+
+
+void SendQueue::Clear() {
+    frames_.clear();
+    latest_.clear();
+    num_replaced_ = 0;
+    behind_ = false;
+    num_bytes_ = 0;
+    sent_offset_ = 0;
+    overflowed_ = false;
+    bulk_.clear();
+    bulk_offset_ = 0;
+    fragment_len_ = 0;
+    fragment_sent_ = 0;
+}
+
+
+std::string SendQueue::PolicyToString(OverflowPolicy policy) {
+    if (policy == OVERFLOW_DISCONNECT) {
+        return "disconnect";
+    }
+    else if (policy == OVERFLOW_COALESCE) {
+        return "coalesce";
+    }
+    return "drop-oldest";
+}
+
+
+bool SendQueue::StringToPolicy(const std::string &s, OverflowPolicy *policy) {
+    if (s == "drop-oldest") {
+        *policy = OVERFLOW_DROP_OLDEST;
+    }
+    else if (s == "disconnect") {
+        *policy = OVERFLOW_DISCONNECT;
+    }
+    else if (s == "coalesce") {
+        *policy = OVERFLOW_COALESCE;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,168 @@
+/**
+  Bounded, non-blocking output queue for one connection.  Frames are queued with Push() and written with
+  WriteTo(), which sends as much as the socket will take without waiting and keeps the rest, including a frame
+  that was only partly sent, for the next call.  So a sender that serves many connections, like the relay,
+  never waits for a slow receiver; it calls WriteTo() again when the receiver's socket becomes writable.
+
+  A receiver that keeps falling behind would make the queue grow without limit, so the queue is bounded by
+  max_bytes and the overflow policy decides what happens when a new frame does not fit:
+  - OVERFLOW_DROP_OLDEST drops the oldest whole frames that have not started to go out (other than pinned
+    frames, which later frames depend on).
+  - OVERFLOW_DISCONNECT refuses the frame and marks the queue as overflowed, the connection should be closed.
+  - OVERFLOW_COALESCE keeps only the newest frame for each key (e.g., the event name), so a receiver that is
+    behind skips straight to the latest value of each tracker; if that is not enough, the oldest are dropped.
+
+  Independently of the limit, frames marked latest_value are kept to one per key while the receiver is behind,
+  i.e., from the moment WriteTo() finds the socket full until the queue has drained: the queue is compacted to
+  the newest frame for each key then, and from then on each new frame replaces the queued one with the same key
+  (unless it has started to go out).  So a receiver that is behind has at most one pending sample of each
+  tracker, and catches up to the present as soon as it can take more, instead of first working through a
+  backlog of stale poses.  The replaced frame's place is given up and the new one goes at the end, so what
+  arrives is always in the order it was sent, and frames that are not marked (e.g., button presses) are all
+  delivered, in order, exactly as before.  A receiver that keeps up gets every frame.
+
+  A large frame, e.g., a serialized mesh in a VREventString, would hold up everything queued behind it until the
+  last of it had gone out, which for tracker events is the worst kind of delay.  With set_fragment_size(), frames
+  larger than the fragment size go to a separate bulk lane and are sent as a series of fragments of at most that
+  size (see FrameDecoder, which puts them back together), and all the smaller frames waiting are sent between
+  one fragment and the next.  So a small frame waits for at most one fragment, wherever it is in the queue, and
+  large frames still go out in order among themselves, at whatever bandwidth the small ones leave.  Small frames
+  can overtake large ones this way, so fragmenting is only for receivers that expect that, and that can
+  reassemble the fragments, which MinVR3 peers advertise with protocol version 3 (see EventDictionary).
+
+  Frames are held as OutboundFramePtrs, so a frame that goes to many connections, possibly from several
+  threads, is created once and every queue just holds a reference to it.
+ */
+
+#ifndef MINVR3_SEND_QUEUE_H
+#define MINVR3_SEND_QUEUE_H
+
+#include "net_headers.h"
+
+#include <deque>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+
+/// A frame ready to be sent to any number of connections.  It is never changed once created, so it can be shared
+/// by the send queues of many connections, and between threads, without copying or locking.
+struct OutboundFrame {
+    /// name defaults to the key.
+    OutboundFrame(const std::string &body, const std::string &key="", bool latest_value=false,
+                  const std::string &name="", bool pinned=false) :
+        body(body), key(key), latest_value(latest_value), name(name.empty() ? key : name), pinned(pinned) {}
+    OutboundFrame(std::string &&body, const std::string &key="", bool latest_value=false, const std::string &name="",
+                  bool pinned=false) :
+        body(std::move(body)), key(key), latest_value(latest_value), name(name.empty() ? key : name), pinned(pinned) {}
+
+    const std::string body;     // sent with a length prefix, as MinNet::SendString() does
+    const std::string key;      // frames with the same non-empty key may replace each other, see OVERFLOW_COALESCE
+    const bool latest_value;    // replaces a queued frame with the same key while the receiver is behind, see above
+    const std::string name;     // the event's name, e.g., for the relay to route it by subscription
+    const bool pinned;          // never dropped to make room, e.g., an EventDictionary definition later frames need
+};
+
+typedef std::shared_ptr<const OutboundFrame> OutboundFramePtr;
+
+
+class SendQueue {
+public:
+    enum OverflowPolicy {
+        OVERFLOW_DROP_OLDEST,
+        OVERFLOW_DISCONNECT,
+        OVERFLOW_COALESCE
+    };
+
+    enum WriteResult {
+        WRITE_DONE,         // everything queued has been sent
+        WRITE_PENDING,      // the socket is full, call again once it is writable
+        WRITE_ERROR         // socket error, or the queue overflowed with OVERFLOW_DISCONNECT
+    };
+
+    /// max_bytes == 0 means unbounded.
+    SendQueue(int64_t max_bytes=0, OverflowPolicy policy=OVERFLOW_DROP_OLDEST);
+    virtual ~SendQueue();
+
+    void set_limit(int64_t max_bytes, OverflowPolicy policy);
+
+    /// Frames with bodies larger than max_bytes are sent in fragments, behind every smaller frame (see above).  0,
+    /// the default, sends every frame whole and in order.
+    void set_fragment_size(int max_bytes);
+    int get_fragment_size() const;
+
+    /// Small enough that a tracker event waits a fraction of a millisecond behind a fragment on a fast network,
+    /// large enough that the fragments' own framing is lost in the noise.
+    static const int DEFAULT_FRAGMENT_SIZE = 16384;
+
+    /// Adds s as a length-prefixed frame, framed exactly as MinNet::SendString() frames it.  key identifies
+    /// frames that replace each other with OVERFLOW_COALESCE; frames with an empty key are never coalesced.
+    /// Returns false if the frame was refused because the queue overflowed with OVERFLOW_DISCONNECT.
+    bool Push(const std::string &s, const std::string &key="");
+
+    /// Same, for a frame that may be shared with other queues.
+    bool Push(const OutboundFramePtr &frame);
+
+    /// Sends as much as the socket will take right now, with one gathered write per call to the OS.
+    WriteResult WriteTo(SOCKET* socket_fd);
+
+    bool is_empty() const;
+    bool is_overflowed() const;
+    int64_t get_num_bytes() const;
+    int get_num_frames() const;
+
+    uint64_t get_num_dropped() const;       // frames dropped by OVERFLOW_DROP_OLDEST (or COALESCE as a last resort)
+    uint64_t get_num_coalesced() const;     // frames replaced by a newer one with the same key, either way
+
+    /// Discards everything queued, including a partly sent frame, and clears the overflowed flag.
+    void Clear();
+
+    static std::string PolicyToString(OverflowPolicy policy);
+    /// Accepts "drop-oldest", "disconnect", and "coalesce".  Returns false for anything else.
+    static bool StringToPolicy(const std::string &s, OverflowPolicy *policy);
+
+private:
+    struct Frame {
+        uint8_t header[4];
+        OutboundFramePtr data;
+        uint64_t seq;           // increases from frame to frame
+        bool replaced;          // by a newer latest_value frame, skipped and popped once it reaches the front
+    };
+
+    static int64_t FrameBytes(const Frame &f);
+    void ReplaceLatest(const std::string &key);
+    void CompactLatest();
+    void PopFront();
+    void Coalesce(const std::string &new_key);
+    void DropOldest(int64_t needed);
+    /// Each takes n bytes that were sent off what it has to send, and returns what was left over.
+    int64_t Consume(int64_t n);
+    int64_t ConsumeFragment(int64_t n);
+    void NextFragment();
+    void AddFragment(const uint8_t **bufs, int *lens, int *count);
+
+    std::deque<Frame> frames_;
+    std::unordered_map<std::string, uint64_t> latest_;      // key -> seq of its newest latest_value frame
+    uint64_t next_seq_;
+    int num_replaced_;
+    bool behind_;               // WriteTo() found the socket full, and the queue has not drained since
+    int64_t num_bytes_;         // not sent yet
+    int sent_offset_;           // bytes of the first frame already sent
+    int64_t max_bytes_;
+    OverflowPolicy policy_;
+    bool overflowed_;
+    uint64_t num_dropped_;
+    uint64_t num_coalesced_;
+
+    // the bulk lane, see set_fragment_size()
+    int fragment_size_;
+    std::deque<OutboundFramePtr> bulk_;
+    int64_t bulk_offset_;               // bytes of the first frame's body sent in earlier fragments
+    uint8_t fragment_header_[16];       // length prefix, marker, and total length of the fragment being sent
+    int fragment_header_len_;
+    int fragment_len_;                  // bytes of the body in it, 0 until the next fragment is made
+    int fragment_sent_;                 // of its header and body
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "sharded_event_relay.h"
+
+#include "min_net.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#endif
+
+
+struct ShardedEventRelay::Shard {
+    Shard(bool relay_to_source) : relay(relay_to_source), wake_read_fd(INVALID_SOCKET), wake_write_fd(INVALID_SOCKET),
+        wake_pending(false), num_connections(0), num_relayed(0) {}
+
+    EventRelay relay;
+    NetReactor reactor;
+    std::thread thread;
+    SOCKET wake_read_fd;
+    SOCKET wake_write_fd;
+
+    // events relayed by this shard during the current pass, handed to the other shards at the end of it
+    std::vector<OutboundFramePtr> outbox;
+
+    // handed over by other threads, protected by mutex
+    std::mutex mutex;
+    std::vector<OutboundFramePtr> inbox;
+    std::vector<Connection*> new_connections;
+    bool wake_pending;
+
+    std::atomic<int> num_connections;
+    std::atomic<uint64_t> num_relayed;
+};
+
+
+ShardedEventRelay::ShardedEventRelay(int num_threads, bool relay_to_source) :
+    relay_to_source_(relay_to_source), send_limit_(4194304), overflow_policy_(SendQueue::OVERFLOW_DROP_OLDEST),
+    running_(false), shutdown_(false)
+{
+    if (num_threads <= 0) {
+        num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    for (int i=0; i<num_threads; i++) {
+        shards_.push_back(new Shard(relay_to_source));
+    }
+}
+
+
+ShardedEventRelay::~ShardedEventRelay() {
+    Stop();
+    for (int i=0; i<shards_.size(); i++) {
+        Shard *shard = shards_[i];
+        for (int c=0; c<shard->new_connections.size(); c++) {
+            delete shard->new_connections[c];
+        }
+        if (shard->wake_read_fd != INVALID_SOCKET) {
+            MinNet::CloseSocket(&shard->wake_read_fd);
+            MinNet::CloseSocket(&shard->wake_write_fd);
+        }
+        delete shard;
+    }
+    for (int i=0; i<listeners_.size(); i++) {
+        delete listeners_[i];
+    }
+}
+
+
+void ShardedEventRelay::AddListener(Listener *listener) {
+    listeners_.push_back(listener);
+    if (listener->get_socket() != INVALID_SOCKET) {
+        accept_reactor_.Add(listener->get_socket(), NetReactor::READABLE, [](SOCKET, int) {});
+    }
+}
+
+
+void ShardedEventRelay::AddConnection(Connection *connection) {
+    if (connection->get_socket() == INVALID_SOCKET) {
+        std::cerr << "ShardedEventRelay Error: " << connection->get_description() << " has no socket to wait on." << std::endl;
+        delete connection;
+        return;
+    }
+    Shard *shard = shards_[0];
+    for (int i=1; i<shards_.size(); i++) {
+        if (shards_[i]->num_connections < shard->num_connections) {
+            shard = shards_[i];
+        }
+    }
+    shard->num_connections++;
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->new_connections.push_back(connection);
+    }
+    Wake(shard);
+}
+
+
+void ShardedEventRelay::set_send_limit(int64_t max_bytes, SendQueue::OverflowPolicy policy) {
+    send_limit_ = max_bytes;
+    overflow_policy_ = policy;
+}
+
+
+void ShardedEventRelay::set_coalesce_patterns(const std::vector<std::string> &patterns) {
+    coalesce_patterns_ = patterns;
+}
+
+
+void ShardedEventRelay::set_relay_callback(const EventRelay::RelayCallback &callback) {
+    relay_callback_ = callback;
+}
+
+
+void ShardedEventRelay::set_disconnect_callback(const EventRelay::ConnectionCallback &callback) {
+    disconnect_callback_ = callback;
+}
+
+
+bool ShardedEventRelay::Start() {
+    if (running_) {
+        return true;
+    }
+    for (int i=0; i<shards_.size(); i++) {
+        Shard *shard = shards_[i];
+        if ((shard->wake_read_fd == INVALID_SOCKET) && (!MinNet::CreateSocketPair(&shard->wake_read_fd, &shard->wake_write_fd))) {
+            return false;
+        }
+        shard->reactor.Add(shard->wake_read_fd, NetReactor::READABLE, [shard](SOCKET fd, int) {
+            char buf[64];
+            while (recv(fd, buf, sizeof(buf), 0) > 0) {
+            }
+        });
+
+        EventRelay &relay = shard->relay;
+        relay.set_send_limit(send_limit_, overflow_policy_);
+        relay.set_coalesce_patterns(coalesce_patterns_);
+        relay.set_connect_callback([shard](Connection *c) {
+            shard->reactor.Add(c->get_socket(), NetReactor::READABLE, [shard, c](SOCKET, int events) {
+                if (events & NetReactor::WRITABLE) {
+                    shard->relay.WriteTo(c);
+                }
+                if (events & (NetReactor::READABLE | NetReactor::CLOSED)) {
+                    shard->relay.ReadFrom(c);
+                }
+            });
+        });
+        relay.set_writable_callback([shard](Connection *c, bool waiting) {
+            shard->reactor.Modify(c->get_socket(), waiting ? (NetReactor::READABLE | NetReactor::WRITABLE) : NetReactor::READABLE);
+        });
+        relay.set_disconnect_callback([this, shard](Connection *c) {
+            if (disconnect_callback_) {
+                disconnect_callback_(c);
+            }
+            shard->reactor.Remove(c->get_socket());
+            shard->num_connections--;
+        });
+        relay.set_relay_callback([this, shard](const OutboundFramePtr &frame) {
+            if (shards_.size() > 1) {
+                shard->outbox.push_back(frame);
+            }
+            if (relay_callback_) {
+                relay_callback_(frame);
+            }
+        });
+    }
+    running_ = true;
+    for (int i=0; i<shards_.size(); i++) {
+        shards_[i]->thread = std::thread(&ShardedEventRelay::RunShard, this, shards_[i]);
+    }
+    return true;
+}
+
+
+void ShardedEventRelay::Wake(Shard *shard) {
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        if (shard->wake_pending) {
+            return;
+        }
+        shard->wake_pending = true;
+    }
+    if (shard->wake_write_fd != INVALID_SOCKET) {
+        char c = 1;
+        send(shard->wake_write_fd, &c, 1, 0);
+    }
+}
+
+
+void ShardedEventRelay::RunShard(Shard *shard) {
+    std::vector<OutboundFramePtr> inbox;
+    std::vector<Connection*> new_connections;
+    while (running_) {
+        if (shard->reactor.RunOnce(-1) < 0) {
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            inbox.swap(shard->inbox);
+            new_connections.swap(shard->new_connections);
+            shard->wake_pending = false;
+        }
+        for (int i=0; i<new_connections.size(); i++) {
+            shard->relay.AddConnection(new_connections[i]);
+        }
+        new_connections.clear();
+        for (int i=0; i<inbox.size(); i++) {
+            shard->relay.Send(inbox[i]);
+        }
+        inbox.clear();
+
+        // hand what this shard received to all of the others, with one lock and at most one wake-up each
+        if (!shard->outbox.empty()) {
+            for (int i=0; i<shards_.size(); i++) {
+                Shard *other = shards_[i];
+                if (other == shard) {
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(other->mutex);
+                    other->inbox.insert(other->inbox.end(), shard->outbox.begin(), shard->outbox.end());
+                }
+                Wake(other);
+            }
+            shard->outbox.clear();
+        }
+
+        shard->relay.Flush();
+        shard->relay.RemoveDisconnected();
+        shard->num_relayed = shard->relay.get_num_events_relayed();
+        if (shard->relay.is_shutdown_requested()) {
+            shutdown_ = true;
+        }
+    }
+}
+
+
+bool ShardedEventRelay::RunOnce(int timeout_ms) {
+    if (accept_reactor_.RunOnce(timeout_ms) < 0) {
+        return false;
+    }
+    for (int i=0; i<listeners_.size(); i++) {
+        Connection *c;
+        while ((c = listeners_[i]->TryAccept()) != NULL) {
+            AddConnection(c);
+        }
+    }
+    return true;
+}
+
+
+void ShardedEventRelay::Stop() {
+    if (!running_) {
+        return;
+    }
+    running_ = false;
+    for (int i=0; i<shards_.size(); i++) {
+        {
+            // a wake-up may already be pending from before, make sure this one goes through
+            std::lock_guard<std::mutex> lock(shards_[i]->mutex);
+            shards_[i]->wake_pending = false;
+        }
+        Wake(shards_[i]);
+    }
+    for (int i=0; i<shards_.size(); i++) {
+        if (shards_[i]->thread.joinable()) {
+            shards_[i]->thread.join();
+        }
+    }
+    // events handed over during the last pass (e.g., the Shutdown event itself) still go out
+    for (int i=0; i<shards_.size(); i++) {
+        Shard *shard = shards_[i];
+        for (int f=0; f<shard->inbox.size(); f++) {
+            shard->relay.Send(shard->inbox[f]);
+        }
+        shard->inbox.clear();
+        shard->relay.Flush();
+    }
+}
+
+
+bool ShardedEventRelay::is_shutdown_requested() const {
+    return shutdown_;
+}
+
+
+int ShardedEventRelay::get_num_threads() const {
+    return (int)shards_.size();
+}
+
+
+int ShardedEventRelay::get_num_connections() const {
+    int n = 0;
+    for (int i=0; i<shards_.size(); i++) {
+        n += shards_[i]->num_connections;
+    }
+    return n;
+}
+
+
+uint64_t ShardedEventRelay::get_num_events_relayed() const {
+    uint64_t n = 0;
+    for (int i=0; i<shards_.size(); i++) {
+        n += shards_[i]->num_relayed;
+    }
+    return n;
+}
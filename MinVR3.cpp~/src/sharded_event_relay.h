@@ -0,0 +1,102 @@
+/**
+  Multi-threaded version of EventRelay, for relays with hundreds of clients.  The clients are split into
+  shards, and each shard is an EventRelay of its own with its own thread and NetReactor, so receiving, parsing,
+  and sending for different clients happens on different cores.
+
+  The thread that calls RunOnce() accepts new connections and hands each one to the shard with the fewest
+  connections.  When a shard receives an event, it relays it to its own clients and, once per pass, hands all
+  of the events it received during the pass to every other shard in one go.  An event is serialized once, into
+  an immutable, reference-counted OutboundFrame, and every client on every shard queues a reference to that
+  same frame, so the cost of relaying an event to one more client does not include copying it.
+
+  Sends never wait for a slow client; each connection has a bounded send queue as with
+  EventRelay::set_send_limit(), which is always on here.  Each shard waits on its own NetReactor, so only
+  connections that have a socket (e.g., TcpConnection, not MemoryConnection) can be relayed.
+
+  ```
+  ShardedEventRelay relay(4);
+  relay.AddListener(Listener::Create("9034"));
+  relay.Start();
+  while (!relay.is_shutdown_requested()) {
+      relay.RunOnce(100);
+  }
+  relay.Stop();
+  ```
+ */
+
+#ifndef MINVR3_SHARDED_EVENT_RELAY_H
+#define MINVR3_SHARDED_EVENT_RELAY_H
+
+#include "event_relay.h"
+#include "net_reactor.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+
+class ShardedEventRelay {
+public:
+    /// num_threads == 0 uses one shard per core.
+    ShardedEventRelay(int num_threads=0, bool relay_to_source=true);
+
+    /// Stops the shards, then closes and deletes every listener and connection.
+    virtual ~ShardedEventRelay();
+
+    /// Takes ownership of the listener.  Connections are accepted by RunOnce().
+    void AddListener(Listener *listener);
+
+    /// Hands the connection to the shard with the fewest connections, which takes ownership.  Safe to call
+    /// while the shards are running.
+    void AddConnection(Connection *connection);
+
+    /// Max bytes queued for each connection and what happens to events that do not fit, see SendQueue.  Call
+    /// before Start().
+    void set_send_limit(int64_t max_bytes, SendQueue::OverflowPolicy policy);
+
+    /// Events relayed as latest values, see EventRelay::set_coalesce_patterns().  Call before Start().
+    void set_coalesce_patterns(const std::vector<std::string> &patterns);
+
+    /// Called, from the shard threads and possibly from several of them at once, with each relayed event.
+    void set_relay_callback(const EventRelay::RelayCallback &callback);
+
+    /// Called, from the shard threads, for each connection just before it is removed and deleted.
+    void set_disconnect_callback(const EventRelay::ConnectionCallback &callback);
+
+    /// Starts the shard threads.
+    bool Start();
+
+    /// Waits up to timeout_ms (< 0 for no limit) for new connections on the listeners and hands them to the
+    /// shards.  Returns false on error.
+    bool RunOnce(int timeout_ms);
+
+    /// Stops and joins the shard threads, then sends whatever the connections can take without waiting.
+    /// Connections stay open until the relay is deleted.
+    void Stop();
+
+    /// True once an event named "Shutdown" has been relayed by any shard.
+    bool is_shutdown_requested() const;
+
+    int get_num_threads() const;
+    int get_num_connections() const;
+    uint64_t get_num_events_relayed() const;
+
+private:
+    struct Shard;
+    void RunShard(Shard *shard);
+    void Wake(Shard *shard);
+
+    bool relay_to_source_;
+    std::vector<Shard*> shards_;
+    std::vector<Listener*> listeners_;
+    NetReactor accept_reactor_;
+    int64_t send_limit_;
+    SendQueue::OverflowPolicy overflow_policy_;
+    std::vector<std::string> coalesce_patterns_;
+    EventRelay::RelayCallback relay_callback_;
+    EventRelay::ConnectionCallback disconnect_callback_;
+    std::atomic<bool> running_;
+    std::atomic<bool> shutdown_;
+};
+
+#endif
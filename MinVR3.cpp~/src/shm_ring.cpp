@@ -0,0 +1,440 @@
+#include "shm_ring.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <string.h>
+#include <thread>
+
+#ifndef WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+
+
+static const uint32_t SHM_RING_MAGIC = 0x5333564d;  // "MV3S"
+static const uint32_t SHM_RING_VERSION = 1;
+static const uint32_t WRAP_MARKER = 0xffffffff;
+
+// the header gets a page of its own so the data region is page aligned
+static const size_t HEADER_BYTES = 4096;
+
+// a reader that finds the ring empty keeps checking for this long before going to sleep
+static const int SPIN_MICROSECONDS = 50;
+
+
+// Lives at the start of the shared memory.  Each position is a count of bytes written since the ring was created,
+// so it only ever grows, and the byte at position p is stored at data[p & (capacity - 1)].  The writer advances
+// reserve_pos before overwriting anything and write_pos after it has finished, so a reader that sees write_pos
+// knows the bytes before it are complete, and a reader that sees reserve_pos less than a whole ring ahead of
+// where it is reading knows that nothing it just read was being overwritten.
+struct ShmRingWriter::Header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    std::atomic<uint32_t> closed;
+    alignas(64) std::atomic<uint64_t> reserve_pos;
+    alignas(64) std::atomic<uint64_t> write_pos;
+    // incremented on every send; readers sleep on it with a futex
+    alignas(64) std::atomic<uint32_t> wake_seq;
+    std::atomic<uint32_t> num_waiters;
+};
+
+
+static std::string ShmName(const std::string &name) {
+    return "/minvr3_" + name;
+}
+
+
+// each record is a 4 byte length, 4 bytes of padding, and the data, padded to a multiple of 8 bytes
+static uint64_t RecordBytes(uint64_t len) {
+    return (8 + len + 7) & ~(uint64_t)7;
+}
+
+
+#ifdef __linux__
+static void FutexWait(std::atomic<uint32_t> *word, uint32_t expected, double timeout_ms) {
+    struct timespec ts;
+    struct timespec *tsp = NULL;
+    if (timeout_ms > 0) {
+        int64_t ns = (int64_t)(timeout_ms * 1000000.0);
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        tsp = &ts;
+    }
+    // not FUTEX_PRIVATE_FLAG, the word is shared between processes
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAIT, expected, tsp, NULL, 0);
+}
+
+static void FutexWakeAll(std::atomic<uint32_t> *word) {
+    syscall(SYS_futex, (uint32_t*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
+
+
+ShmRingWriter::ShmRingWriter() : header_(NULL), data_(NULL), map_bytes_(0), num_sent_(0) {
+}
+
+
+ShmRingWriter::~ShmRingWriter() {
+    Close();
+}
+
+
+bool ShmRingWriter::Create(const std::string &name, int capacity_bytes) {
+    Close();
+#ifdef WIN32
+    std::cerr << "ShmRingWriter::Create() Error: Shared-memory rings are not supported on Windows." << std::endl;
+    return false;
+#else
+    uint64_t capacity = 4096;
+    while (capacity < (uint64_t)capacity_bytes) {
+        capacity *= 2;
+    }
+
+    // start from scratch, readers still attached to an earlier ring keep their own mapping of it
+    std::string shm_name = ShmName(name);
+    shm_unlink(shm_name.c_str());
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd < 0) {
+        std::cerr << "ShmRingWriter::Create() Error: Could not create shared memory " << shm_name << ", errno = "
+            << errno << std::endl;
+        return false;
+    }
+    size_t map_bytes = HEADER_BYTES + (size_t)capacity;
+    if (ftruncate(fd, (off_t)map_bytes) != 0) {
+        std::cerr << "ShmRingWriter::Create() Error: Could not size shared memory " << shm_name << std::endl;
+        close(fd);
+        shm_unlink(shm_name.c_str());
+        return false;
+    }
+    void *mem = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        std::cerr << "ShmRingWriter::Create() Error: Could not map shared memory " << shm_name << std::endl;
+        shm_unlink(shm_name.c_str());
+        return false;
+    }
+
+    header_ = new (mem) Header;
+    header_->version = SHM_RING_VERSION;
+    header_->capacity = capacity;
+    header_->closed.store(0);
+    header_->reserve_pos.store(0);
+    header_->write_pos.store(0);
+    header_->wake_seq.store(0);
+    header_->num_waiters.store(0);
+    // written last, readers refuse to attach until the magic number is there
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = SHM_RING_MAGIC;
+
+    data_ = (uint8_t*)mem + HEADER_BYTES;
+    map_bytes_ = map_bytes;
+    name_ = name;
+    num_sent_ = 0;
+    return true;
+#endif
+}
+
+
+void ShmRingWriter::Close() {
+#ifndef WIN32
+    if (header_ != NULL) {
+        header_->closed.store(1);
+        header_->wake_seq.fetch_add(1);
+#ifdef __linux__
+        FutexWakeAll(&header_->wake_seq);
+#endif
+        munmap((void*)header_, map_bytes_);
+        shm_unlink(ShmName(name_).c_str());
+    }
+#endif
+    header_ = NULL;
+    data_ = NULL;
+    map_bytes_ = 0;
+}
+
+
+bool ShmRingWriter::is_open() const {
+    return (header_ != NULL);
+}
+
+
+bool ShmRingWriter::SendString(const std::string &s) {
+    if (header_ == NULL) {
+        return false;
+    }
+    uint64_t capacity = header_->capacity;
+    uint64_t record_bytes = RecordBytes(s.size());
+    if (record_bytes > capacity / 2) {
+        std::cerr << "ShmRingWriter::SendString() Error: Message of " << s.size() << " bytes is too large for the ring."
+            << std::endl;
+        return false;
+    }
+
+    // records never wrap around the end of the ring; if this one does not fit, a marker sends readers back to
+    // the start
+    uint64_t pos = header_->write_pos.load(std::memory_order_relaxed);
+    uint64_t offset = pos & (capacity - 1);
+    uint64_t skip = (offset + record_bytes > capacity) ? (capacity - offset) : 0;
+    uint64_t new_pos = pos + skip + record_bytes;
+
+    header_->reserve_pos.store(new_pos, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (skip > 0) {
+        memcpy(data_ + offset, &WRAP_MARKER, 4);
+        offset = 0;
+    }
+    uint32_t len = (uint32_t)s.size();
+    memcpy(data_ + offset, &len, 4);
+    memcpy(data_ + offset + 8, s.data(), s.size());
+    header_->write_pos.store(new_pos, std::memory_order_seq_cst);
+
+    // a system call only if some reader is asleep
+    header_->wake_seq.fetch_add(1, std::memory_order_seq_cst);
+    if (header_->num_waiters.load(std::memory_order_seq_cst) > 0) {
+#ifdef __linux__
+        FutexWakeAll(&header_->wake_seq);
+#endif
+    }
+    num_sent_++;
+    return true;
+}
+
+
+bool ShmRingWriter::SendVREvent(const VREvent &e) {
+    return SendString(e.ToJson());
+}
+
+
+uint64_t ShmRingWriter::get_num_sent() const {
+    return num_sent_;
+}
+
+
+
+ShmRingReader::ShmRingReader() : header_(NULL), data_(NULL), map_bytes_(0), read_pos_(0), num_received_(0),
+    num_overruns_(0)
+{
+}
+
+
+ShmRingReader::~ShmRingReader() {
+    Close();
+}
+
+
+bool ShmRingReader::Open(const std::string &name) {
+    Close();
+#ifdef WIN32
+    std::cerr << "ShmRingReader::Open() Error: Shared-memory rings are not supported on Windows." << std::endl;
+    return false;
+#else
+    std::string shm_name = ShmName(name);
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        std::cerr << "ShmRingReader::Open() Error: Could not open shared memory " << shm_name << ", errno = "
+            << errno << std::endl;
+        return false;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size <= HEADER_BYTES)) {
+        std::cerr << "ShmRingReader::Open() Error: " << shm_name << " is not a MinVR3 ring." << std::endl;
+        close(fd);
+        return false;
+    }
+    size_t map_bytes = (size_t)st.st_size;
+    // writable because waiting readers register themselves in the header
+    void *mem = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        std::cerr << "ShmRingReader::Open() Error: Could not map shared memory " << shm_name << std::endl;
+        return false;
+    }
+    ShmRingWriter::Header *header = (ShmRingWriter::Header*)mem;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((header->magic != SHM_RING_MAGIC) || (header->version != SHM_RING_VERSION) ||
+        (HEADER_BYTES + header->capacity != map_bytes))
+    {
+        std::cerr << "ShmRingReader::Open() Error: " << shm_name << " is not a MinVR3 ring." << std::endl;
+        munmap(mem, map_bytes);
+        return false;
+    }
+    header_ = header;
+    data_ = (const uint8_t*)mem + HEADER_BYTES;
+    map_bytes_ = map_bytes;
+    read_pos_ = header_->write_pos.load(std::memory_order_acquire);
+    num_received_ = 0;
+    num_overruns_ = 0;
+    return true;
+#endif
+}
+
+
+void ShmRingReader::Close() {
+#ifndef WIN32
+    if (header_ != NULL) {
+        munmap((void*)header_, map_bytes_);
+    }
+#endif
+    header_ = NULL;
+    data_ = NULL;
+    map_bytes_ = 0;
+}
+
+
+bool ShmRingReader::is_open() const {
+    return (header_ != NULL);
+}
+
+
+ShmRingReader::TryResult ShmRingReader::TryReceive(std::string *s) {
+    if (header_ == NULL) {
+        return TRY_CLOSED;
+    }
+    uint64_t capacity = header_->capacity;
+    while (true) {
+        uint64_t write_pos = header_->write_pos.load(std::memory_order_acquire);
+        if (read_pos_ == write_pos) {
+            return header_->closed.load() ? TRY_CLOSED : TRY_EMPTY;
+        }
+        if (write_pos - read_pos_ > capacity) {
+            // lapped by the writer, everything still in the ring is newer than what was missed
+            read_pos_ = write_pos;
+            num_overruns_++;
+            return TRY_EMPTY;
+        }
+
+        uint64_t offset = read_pos_ & (capacity - 1);
+        uint32_t len;
+        memcpy(&len, data_ + offset, 4);
+        bool wrap = (len == WRAP_MARKER);
+        bool valid = wrap || (offset + RecordBytes(len) <= capacity);
+        if ((valid) && (!wrap)) {
+            s->assign((const char*)data_ + offset + 8, len);
+        }
+
+        // if the writer has started on the part of the ring just read, what was read cannot be trusted
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t reserve_pos = header_->reserve_pos.load(std::memory_order_relaxed);
+        if ((reserve_pos - read_pos_ > capacity) || (!valid)) {
+            read_pos_ = header_->write_pos.load(std::memory_order_acquire);
+            num_overruns_++;
+            return TRY_EMPTY;
+        }
+
+        if (wrap) {
+            read_pos_ += capacity - offset;
+            continue;
+        }
+        read_pos_ += RecordBytes(len);
+        num_received_++;
+        return TRY_OK;
+    }
+}
+
+
+void ShmRingReader::Wait(double timeout_ms) {
+    // A short spin catches events that are about to arrive without the cost of sleeping and waking up.  With
+    // a single core the writer cannot make progress while this spins, so then just give it the core.
+    static const bool multi_core = (std::thread::hardware_concurrency() > 1);
+    std::chrono::steady_clock::time_point spin_end = std::chrono::steady_clock::now() +
+        std::chrono::microseconds(SPIN_MICROSECONDS);
+    do {
+        for (int i=0; i<64; i++) {
+            if (header_->write_pos.load(std::memory_order_acquire) != read_pos_) {
+                return;
+            }
+        }
+        if (!multi_core) {
+            std::this_thread::yield();
+        }
+    } while (std::chrono::steady_clock::now() < spin_end);
+#ifdef __linux__
+    header_->num_waiters.fetch_add(1, std::memory_order_seq_cst);
+    uint32_t seq = header_->wake_seq.load(std::memory_order_seq_cst);
+    if ((header_->write_pos.load(std::memory_order_seq_cst) == read_pos_) && (!header_->closed.load())) {
+        FutexWait(&header_->wake_seq, seq, timeout_ms);
+    }
+    header_->num_waiters.fetch_sub(1, std::memory_order_seq_cst);
+#else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+}
+
+
+bool ShmRingReader::IsReadyToRead() {
+    return (header_ != NULL) && (header_->write_pos.load(std::memory_order_acquire) != read_pos_);
+}
+
+
+bool ShmRingReader::ReceiveString(std::string *s, double timeout_ms) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds((int64_t)(timeout_ms * 1000.0));
+    while (true) {
+        TryResult r = TryReceive(s);
+        if (r == TRY_OK) {
+            return true;
+        }
+        if (r == TRY_CLOSED) {
+            return false;
+        }
+        double remaining_ms = 0;
+        if (timeout_ms > 0) {
+            remaining_ms = std::chrono::duration<double, std::milli>(deadline - std::chrono::steady_clock::now()).count();
+            if (remaining_ms <= 0) {
+                return false;
+            }
+        }
+        Wait(remaining_ms);
+    }
+}
+
+
+VREvent* ShmRingReader::ReceiveVREvent(double timeout_ms) {
+    std::string json;
+    if (ReceiveString(&json, timeout_ms)) {
+        return VREvent::CreateFromJson(json);
+    }
+    return NULL;
+}
+
+
+bool ShmRingReader::ReceiveAvailableVREvents(std::vector<VREvent*> *events) {
+    std::string json;
+    TryResult r;
+    while ((r = TryReceive(&json)) == TRY_OK) {
+        VREvent *e = VREvent::CreateFromJson(json);
+        if (e != NULL) {
+            events->push_back(e);
+        }
+    }
+    return (r != TRY_CLOSED);
+}
+
+
+bool ShmRingReader::is_writer_closed() const {
+    return (header_ != NULL) && (header_->closed.load() != 0);
+}
+
+
+uint64_t ShmRingReader::get_num_received() const {
+    return num_received_;
+}
+
+
+uint64_t ShmRingReader::get_num_overruns() const {
+    return num_overruns_;
+}
@@ -0,0 +1,83 @@
+#include "socket_tuning.h"
+
+#include "config_val.h"
+
+#include <iostream>
+#include <sstream>
+
+
+SocketTuning::SocketTuning() :
+    no_delay(true), send_buffer_bytes(0), receive_buffer_bytes(0), quick_ack(false), busy_poll_us(0), dscp(0),
+    spin_wait(false)
+{
+}
+
+
+SocketTuning::~SocketTuning() {
+}
+
+
+bool SocketTuning::FromProfile(const std::string &profile, SocketTuning *tuning) {
+    SocketTuning t;
+    if (profile == "low-latency") {
+        t.quick_ack = true;
+        t.busy_poll_us = 50;
+        t.dscp = 46;
+    }
+    else if (profile == "throughput") {
+        t.send_buffer_bytes = 4 * 1024 * 1024;
+        t.receive_buffer_bytes = 4 * 1024 * 1024;
+    }
+    else if (profile != "default") {
+        return false;
+    }
+    // spin_wait is never part of a profile, it stays as it was
+    t.spin_wait = tuning->spin_wait;
+    *tuning = t;
+    return true;
+}
+
+
+bool SocketTuning::FromConfigVals(SocketTuning *tuning) {
+    if (ConfigVal::Contains("MINNET_SOCKET_PROFILE")) {
+        std::string profile = ConfigVal::Get("MINNET_SOCKET_PROFILE", std::string());
+        if (!FromProfile(profile, tuning)) {
+            std::cerr << "SocketTuning Error: Unknown MINNET_SOCKET_PROFILE " << profile
+                << ", expected default, low-latency or throughput." << std::endl;
+            return false;
+        }
+    }
+    tuning->no_delay = ConfigVal::Get("MINNET_NO_DELAY", tuning->no_delay, false);
+    tuning->send_buffer_bytes = ConfigVal::Get("MINNET_SEND_BUFFER_BYTES", tuning->send_buffer_bytes, false);
+    tuning->receive_buffer_bytes = ConfigVal::Get("MINNET_RECEIVE_BUFFER_BYTES", tuning->receive_buffer_bytes, false);
+    tuning->quick_ack = ConfigVal::Get("MINNET_QUICK_ACK", tuning->quick_ack, false);
+    tuning->busy_poll_us = ConfigVal::Get("MINNET_BUSY_POLL_US", tuning->busy_poll_us, false);
+    tuning->dscp = ConfigVal::Get("MINNET_DSCP", tuning->dscp, false);
+    tuning->spin_wait = ConfigVal::Get("MINNET_SPIN_WAIT", tuning->spin_wait, false);
+    return true;
+}
+
+
+std::string SocketTuning::ToString() const {
+    std::ostringstream s;
+    s << (no_delay ? "no-delay" : "nagle");
+    if (send_buffer_bytes > 0) {
+        s << " send-buffer=" << send_buffer_bytes;
+    }
+    if (receive_buffer_bytes > 0) {
+        s << " receive-buffer=" << receive_buffer_bytes;
+    }
+    if (quick_ack) {
+        s << " quick-ack";
+    }
+    if (busy_poll_us > 0) {
+        s << " busy-poll=" << busy_poll_us << "us";
+    }
+    if (dscp > 0) {
+        s << " dscp=" << dscp;
+    }
+    if (spin_wait) {
+        s << " spin-wait";
+    }
+    return s.str();
+}
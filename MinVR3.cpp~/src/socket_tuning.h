@@ -0,0 +1,67 @@
+/**
+  Socket options for MinNet's TCP connections, chosen as a whole by profile and then adjusted one by one, e.g., for
+  a latency-critical head tracking path:
+  - "default": TCP_NODELAY only, as MinNet has always done;
+  - "low-latency": also TCP_QUICKACK, so the receiver never holds back an ACK that the sender is waiting on,
+    SO_BUSY_POLL of 50 us, so a read polls the network device rather than waiting for its interrupt, and DSCP
+    46 (Expedited Forwarding), so switches that honor it send tracker packets first;
+  - "throughput": TCP_NODELAY with 4 MB send and receive buffers, e.g., for a relay streaming meshes.
+  Options the OS does not have (TCP_QUICKACK and SO_BUSY_POLL are linux only) are skipped, and unix domain
+  sockets only take the buffer sizes.  SO_BUSY_POLL above the system's net.core.busy_read needs CAP_NET_ADMIN;
+  without it, MinNet prints a warning and carries on.
+
+  spin_wait is not part of any profile: with it, every wait for incoming data (MinNet::ReceiveString(),
+  TcpConnection::ReceiveString(), NetReactor::RunOnce()) polls in a loop rather than sleeping in the kernel, which
+  saves the wake-up, tens of microseconds, at the cost of keeping a core busy for as long as the thread waits.
+  It is meant for a process that has a core to spare for its receiving thread.
+
+  The tuning applies to the whole process, to every connection made or accepted after MinNet::set_socket_tuning().
+  ```
+  SocketTuning tuning;
+  SocketTuning::FromProfile("low-latency", &tuning);
+  tuning.spin_wait = true;
+  MinNet::set_socket_tuning(tuning);
+  ```
+  or, from a config file (see ConfigVal), with the same settings:
+  ```
+  MINNET_SOCKET_PROFILE = low-latency
+  MINNET_SPIN_WAIT = true
+  ```
+  and SocketTuning::FromConfigVals(&tuning) before MinNet::set_socket_tuning(tuning).
+ */
+
+#ifndef MINVR3_SOCKET_TUNING_H
+#define MINVR3_SOCKET_TUNING_H
+
+#include <string>
+
+
+class SocketTuning {
+public:
+    /// The "default" profile.
+    SocketTuning();
+    virtual ~SocketTuning();
+
+    /// Sets every option from the named profile: "default", "low-latency" or "throughput".  Returns false, leaving
+    /// tuning alone, for any other name.
+    static bool FromProfile(const std::string &profile, SocketTuning *tuning);
+
+    /// Starts from the profile named by the MINNET_SOCKET_PROFILE ConfigVal, or from tuning as it is if there is
+    /// none, then overrides each option that has its own ConfigVal: MINNET_NO_DELAY, MINNET_SEND_BUFFER_BYTES,
+    /// MINNET_RECEIVE_BUFFER_BYTES, MINNET_QUICK_ACK, MINNET_BUSY_POLL_US, MINNET_DSCP and MINNET_SPIN_WAIT.
+    /// Returns false with an error message if the profile is unknown.
+    static bool FromConfigVals(SocketTuning *tuning);
+
+    /// All of the options, for a log message, e.g., "no-delay quick-ack busy-poll=50us dscp=46".
+    std::string ToString() const;
+
+    bool no_delay;              // TCP_NODELAY, small frames go out straight away rather than waiting for an ACK
+    int send_buffer_bytes;      // SO_SNDBUF, 0 leaves the OS default
+    int receive_buffer_bytes;   // SO_RCVBUF, 0 leaves the OS default
+    bool quick_ack;             // TCP_QUICKACK, re-armed after every read since linux turns it off again
+    int busy_poll_us;           // SO_BUSY_POLL, 0 for none
+    int dscp;                   // differentiated services code point (0 to 63) in IP_TOS / IPV6_TCLASS, 0 for none
+    bool spin_wait;             // waits for incoming data spin rather than sleep
+};
+
+#endif
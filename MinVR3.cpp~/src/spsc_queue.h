@@ -0,0 +1,103 @@
+/**
+  Bounded, wait-free queue between exactly one producer thread and exactly one consumer thread.  Pushing and
+  popping are a few loads and stores on two atomic counters, with no locks and no system calls, so a render
+  loop can drain a queue filled by an I/O thread without ever waiting on it.
+
+  Each side keeps a cached copy of the other side's counter and only reads the shared one (and so only touches
+  the other side's cache line) when the cached copy says the queue is full or empty.
+
+  ```
+  SpscQueue<VREvent*> queue(1024);
+  // producer thread
+  if (!queue.TryPush(e)) { ... full ... }
+  // consumer thread
+  VREvent *e;
+  while (queue.TryPop(&e)) { ... }
+  ```
+ */
+
+#ifndef MINVR3_SPSC_QUEUE_H
+#define MINVR3_SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+
+template <typename T>
+class SpscQueue {
+public:
+    /// capacity is rounded up to a power of two.
+    explicit SpscQueue(size_t capacity) : head_(0), tail_cache_(0), tail_(0), head_cache_(0) {
+        size_t n = 1;
+        while (n < capacity) {
+            n *= 2;
+        }
+        slots_.resize(n);
+        mask_ = n - 1;
+    }
+
+    /// Producer only.  Returns false, leaving item alone, if the queue is full.
+    bool TryPush(T &&item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == slots_.size()) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == slots_.size()) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPush(const T &item) {
+        T copy(item);
+        return TryPush(std::move(copy));
+    }
+
+    /// Consumer only.  Returns false if the queue is empty.
+    bool TryPop(T *item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        *item = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Exact when called by either side for its own purposes (the consumer seeing something to pop, the
+    /// producer seeing room), otherwise a snapshot.
+    bool is_empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    size_t get_size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    size_t get_capacity() const {
+        return slots_.size();
+    }
+
+private:
+    std::vector<T> slots_;
+    size_t mask_;
+
+    // the consumer's counter and its copy of the producer's, then the same for the producer, kept on separate
+    // cache lines so the two threads do not keep taking the line from each other
+    char pad0_[64];
+    std::atomic<size_t> head_;
+    size_t tail_cache_;
+    char pad1_[64];
+    std::atomic<size_t> tail_;
+    size_t head_cache_;
+    char pad2_[64];
+};
+
+#endif
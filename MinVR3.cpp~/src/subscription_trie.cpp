@@ -0,0 +1,171 @@
+#include "subscription_trie.h"
+
+#include "minvr3_utils.h"
+
+#include <algorithm>
+
+
+// exact or prefix patterns go in the trie, path is the part before any trailing *
+static bool IsTriePattern(const std::string &pattern, std::string *path, bool *prefix) {
+    size_t wildcard = pattern.find_first_of("*?");
+    if (wildcard == std::string::npos) {
+        *path = pattern;
+        *prefix = false;
+        return true;
+    }
+    if ((wildcard == pattern.size() - 1) && (pattern[wildcard] == '*')) {
+        *path = pattern.substr(0, wildcard);
+        *prefix = true;
+        return true;
+    }
+    return false;
+}
+
+
+static bool AddTo(std::vector<Connection*> *list, Connection *subscriber) {
+    if (std::find(list->begin(), list->end(), subscriber) != list->end()) {
+        return false;
+    }
+    list->push_back(subscriber);
+    return true;
+}
+
+
+static bool RemoveFrom(std::vector<Connection*> *list, Connection *subscriber) {
+    std::vector<Connection*>::iterator it = std::find(list->begin(), list->end(), subscriber);
+    if (it == list->end()) {
+        return false;
+    }
+    list->erase(it);
+    return true;
+}
+
+
+SubscriptionTrie::SubscriptionTrie() : num_subscriptions_(0) {
+}
+
+
+SubscriptionTrie::~SubscriptionTrie() {
+}
+
+
+SubscriptionTrie::Node* SubscriptionTrie::Find(const std::string &path, bool create) {
+    Node *node = &root_;
+    for (int i=0; i<path.size(); i++) {
+        char c = path[i];
+        std::vector<std::pair<char, std::unique_ptr<Node>>>::iterator it = std::lower_bound(
+            node->children.begin(), node->children.end(), c,
+            [](const std::pair<char, std::unique_ptr<Node>> &child, char ch) { return child.first < ch; });
+        if ((it == node->children.end()) || (it->first != c)) {
+            if (!create) {
+                return NULL;
+            }
+            it = node->children.insert(it, std::make_pair(c, std::unique_ptr<Node>(new Node())));
+        }
+        node = it->second.get();
+    }
+    return node;
+}
+
+
+bool SubscriptionTrie::Add(const std::string &pattern, Connection *subscriber) {
+    std::string path;
+    bool prefix;
+    bool added;
+    if (IsTriePattern(pattern, &path, &prefix)) {
+        Node *node = Find(path, true);
+        added = AddTo(prefix ? &node->prefix : &node->exact, subscriber);
+    }
+    else {
+        std::pair<std::string, Connection*> w(pattern, subscriber);
+        added = (std::find(wildcards_.begin(), wildcards_.end(), w) == wildcards_.end());
+        if (added) {
+            wildcards_.push_back(w);
+        }
+    }
+    if (added) {
+        num_subscriptions_++;
+    }
+    return added;
+}
+
+
+bool SubscriptionTrie::Remove(const std::string &pattern, Connection *subscriber) {
+    std::string path;
+    bool prefix;
+    bool removed = false;
+    if (IsTriePattern(pattern, &path, &prefix)) {
+        // emptied nodes are kept, the same patterns tend to come back with the next client
+        Node *node = Find(path, false);
+        removed = (node != NULL) && (RemoveFrom(prefix ? &node->prefix : &node->exact, subscriber));
+    }
+    else {
+        std::vector<std::pair<std::string, Connection*>>::iterator it = std::find(wildcards_.begin(), wildcards_.end(),
+            std::make_pair(pattern, subscriber));
+        if (it != wildcards_.end()) {
+            wildcards_.erase(it);
+            removed = true;
+        }
+    }
+    if (removed) {
+        num_subscriptions_--;
+    }
+    return removed;
+}
+
+
+void SubscriptionTrie::RemoveAllFrom(Node *node, Connection *subscriber, int *num_removed) {
+    if (RemoveFrom(&node->exact, subscriber)) {
+        (*num_removed)++;
+    }
+    if (RemoveFrom(&node->prefix, subscriber)) {
+        (*num_removed)++;
+    }
+    for (int i=0; i<node->children.size(); i++) {
+        RemoveAllFrom(node->children[i].second.get(), subscriber, num_removed);
+    }
+}
+
+
+void SubscriptionTrie::RemoveAll(Connection *subscriber) {
+    int num_removed = 0;
+    RemoveAllFrom(&root_, subscriber, &num_removed);
+    for (int i=(int)wildcards_.size() - 1; i>=0; i--) {
+        if (wildcards_[i].second == subscriber) {
+            wildcards_.erase(wildcards_.begin() + i);
+            num_removed++;
+        }
+    }
+    num_subscriptions_ -= num_removed;
+}
+
+
+void SubscriptionTrie::Match(const std::string &name, std::vector<Connection*> *subscribers) const {
+    size_t first = subscribers->size();
+    const Node *node = &root_;
+    for (int i=0; (node != NULL); i++) {
+        subscribers->insert(subscribers->end(), node->prefix.begin(), node->prefix.end());
+        if (i == name.size()) {
+            subscribers->insert(subscribers->end(), node->exact.begin(), node->exact.end());
+            break;
+        }
+        char c = name[i];
+        std::vector<std::pair<char, std::unique_ptr<Node>>>::const_iterator it = std::lower_bound(
+            node->children.begin(), node->children.end(), c,
+            [](const std::pair<char, std::unique_ptr<Node>> &child, char ch) { return child.first < ch; });
+        node = ((it != node->children.end()) && (it->first == c)) ? it->second.get() : NULL;
+    }
+    for (int i=0; i<wildcards_.size(); i++) {
+        if (MinVRUtils::MatchesWildcard(name, wildcards_[i].first)) {
+            subscribers->push_back(wildcards_[i].second);
+        }
+    }
+    // a subscriber with several matching patterns is only listed once
+    std::sort(subscribers->begin() + first, subscribers->end());
+    subscribers->erase(std::unique(subscribers->begin() + first, subscribers->end()), subscribers->end());
+}
+
+
+int SubscriptionTrie::get_num_subscriptions() const {
+    return num_subscriptions_;
+}
@@ -0,0 +1,70 @@
+/**
+  Event-name subscriptions, for a relay that only sends each client the events it asked for.  Each subscriber
+  registers any number of patterns, and Match() finds every subscriber with a pattern that matches an event name.
+
+  Patterns come in three kinds, each matched the cheapest way it can be:
+  - exact names, e.g., "Head/Position";
+  - prefixes, i.e., a single * at the end, e.g., "Head/" followed by *, or "*" for everything;
+  - anything else with * or ? in it is a general wildcard (see MinVRUtils::MatchesWildcard()), e.g.,
+    "Wand?/Button".
+  Exact names and prefixes are stored in a trie over the characters of the pattern, so matching a name walks the
+  trie once along the name, collecting prefix subscribers on the way down and exact subscribers at the end, and
+  costs the same however many patterns there are.  General wildcards are checked one by one, so they are best
+  kept few.
+
+  ```
+  SubscriptionTrie trie;
+  trie.Add("Head*", projector);
+  trie.Add("Wand/Button", menu);
+  std::vector<Connection*> subscribers;
+  trie.Match("Head/Position", &subscribers);      // projector
+  ```
+ */
+
+#ifndef MINVR3_SUBSCRIPTION_TRIE_H
+#define MINVR3_SUBSCRIPTION_TRIE_H
+
+#include "connection.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+class SubscriptionTrie {
+public:
+    SubscriptionTrie();
+    virtual ~SubscriptionTrie();
+
+    /// Subscribes subscriber to pattern.  Returns false if it was already subscribed to it.
+    bool Add(const std::string &pattern, Connection *subscriber);
+
+    /// Returns false if subscriber was not subscribed to pattern.
+    bool Remove(const std::string &pattern, Connection *subscriber);
+
+    /// Removes every pattern subscriber is subscribed to, e.g., when it disconnects.
+    void RemoveAll(Connection *subscriber);
+
+    /// Appends every subscriber with at least one pattern matching name to subscribers, each once.
+    void Match(const std::string &name, std::vector<Connection*> *subscribers) const;
+
+    /// Number of (pattern, subscriber) pairs.
+    int get_num_subscriptions() const;
+
+private:
+    struct Node {
+        std::vector<std::pair<char, std::unique_ptr<Node>>> children;     // sorted by char
+        std::vector<Connection*> exact;
+        std::vector<Connection*> prefix;
+    };
+
+    Node* Find(const std::string &path, bool create);
+    static void RemoveAllFrom(Node *node, Connection *subscriber, int *num_removed);
+
+    Node root_;
+    std::vector<std::pair<std::string, Connection*>> wildcards_;
+    int num_subscriptions_;
+};
+
+#endif
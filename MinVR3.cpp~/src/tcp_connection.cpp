@@ -0,0 +1,253 @@
+#include "tcp_connection.h"
+
+#include <chrono>
+
+#ifdef WIN32
+#define poll WSAPoll
+#else
+#include <poll.h>
+#endif
+
+
+TcpConnection* TcpConnection::Connect(const std::string &address, int port) {
+    SOCKET fd;
+    if (!MinNet::ConnectTo(address, port, &fd)) {
+        return NULL;
+    }
+    return new TcpConnection(fd);
+}
+
+
+TcpConnection::TcpConnection(SOCKET socket_fd, const std::string &buffered_input) : fd_(socket_fd) {
+    if (!buffered_input.empty()) {
+        decoder_.Append((const uint8_t*)buffered_input.data(), (int)buffered_input.size());
+    }
+    description_ = MinNet::GetAddressAndPort(fd_);
+}
+
+
+TcpConnection::~TcpConnection() {
+    Close();
+}
+
+
+bool TcpConnection::SendString(const std::string &s, double timeout_ms) {
+    QueueString(s);
+    return Flush(timeout_ms);
+}
+
+
+void TcpConnection::QueueString(const std::string &s, const std::string &key) {
+    send_queue_.Push(s, key);
+}
+
+
+void TcpConnection::QueueFrame(const OutboundFramePtr &frame) {
+    send_queue_.Push(frame);
+}
+
+
+bool TcpConnection::Flush(double timeout_ms) {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds((int64_t)(timeout_ms * 1000.0));
+    FlushResult r;
+    while ((r = TryFlush()) == FLUSH_PENDING) {
+        int wait_ms = -1;
+        if (timeout_ms > 0) {
+            wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (wait_ms < 0) {
+                return false;
+            }
+        }
+        struct pollfd p;
+        p.fd = fd_;
+        p.events = POLLOUT;
+        p.revents = 0;
+        if (poll(&p, 1, wait_ms) < 0) {
+            return false;
+        }
+    }
+    return (r == FLUSH_DONE);
+}
+
+
+Connection::FlushResult TcpConnection::TryFlush() {
+    if (send_queue_.is_empty() && !send_queue_.is_overflowed()) {
+        return FLUSH_DONE;
+    }
+    if (fd_ == INVALID_SOCKET) {
+        return FLUSH_ERROR;
+    }
+    SendQueue::WriteResult r = send_queue_.WriteTo(&fd_);
+    if (r == SendQueue::WRITE_DONE) {
+        return FLUSH_DONE;
+    }
+    return (r == SendQueue::WRITE_PENDING) ? FLUSH_PENDING : FLUSH_ERROR;
+}
+
+
+void TcpConnection::set_send_limit(int64_t max_bytes, SendQueue::OverflowPolicy policy) {
+    send_queue_.set_limit(max_bytes, policy);
+}
+
+
+void TcpConnection::set_fragment_size(int max_bytes) {
+    send_queue_.set_fragment_size(max_bytes);
+}
+
+
+void TcpConnection::set_receive_fragments(bool receive) {
+    decoder_.set_reassemble_fragments(receive);
+}
+
+
+const SendQueue* TcpConnection::get_send_queue() const {
+    return &send_queue_;
+}
+
+
+bool TcpConnection::ReceiveString(std::string *s, double timeout_ms) {
+    if (fd_ == INVALID_SOCKET) {
+        return false;
+    }
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds((int64_t)(timeout_ms * 1000.0));
+    while (!decoder_.NextFrame(s)) {
+        if (decoder_.is_frame_too_large()) {
+            return false;
+        }
+        int wait_ms = -1;
+        if (timeout_ms > 0) {
+            wait_ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            if (wait_ms < 0) {
+                return false;
+            }
+        }
+        if (MinNet::PollSocket(fd_, POLLIN, wait_ms) < 0) {
+            return false;
+        }
+        FrameDecoder::ReadResult r = decoder_.ReadFrom(fd_);
+        if ((r == FrameDecoder::READ_CLOSED) || (r == FrameDecoder::READ_ERROR)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool TcpConnection::ReceiveAvailableStrings(std::vector<std::string> *frames) {
+    if (fd_ == INVALID_SOCKET) {
+        return false;
+    }
+    // drain the socket, so this also works from an edge-triggered NetReactor callback
+    FrameDecoder::ReadResult r = FrameDecoder::READ_WOULD_BLOCK;
+    do {
+        // decoded straight into the vector's new element, rather than copied in
+        frames->emplace_back();
+        while (decoder_.NextFrame(&frames->back())) {
+            frames->emplace_back();
+        }
+        frames->pop_back();
+    } while ((r = decoder_.ReadFrom(fd_)) == FrameDecoder::READ_OK);
+    return (r == FrameDecoder::READ_WOULD_BLOCK);
+}
+
+
+bool TcpConnection::ReceiveAvailableFrames(FrameBatch *frames) {
+    if (fd_ == INVALID_SOCKET) {
+        return false;
+    }
+    FrameDecoder::ReadResult r = FrameDecoder::READ_WOULD_BLOCK;
+    do {
+        decoder_.NextFrames(frames);
+    } while ((r = decoder_.ReadFrom(fd_)) == FrameDecoder::READ_OK);
+    return (r == FrameDecoder::READ_WOULD_BLOCK);
+}
+
+
+void TcpConnection::set_max_frame_size(uint32_t max_bytes) {
+    decoder_.set_max_frame_size(max_bytes);
+}
+
+
+bool TcpConnection::IsReadyToRead() {
+    return (decoder_.HasFrame()) || ((fd_ != INVALID_SOCKET) && (MinNet::IsReadyToRead(&fd_)));
+}
+
+
+void TcpConnection::Close() {
+    if (fd_ != INVALID_SOCKET) {
+        MinNet::CloseSocket(&fd_);
+        fd_ = INVALID_SOCKET;
+    }
+    send_queue_.Clear();
+}
+
+
+bool TcpConnection::is_open() const {
+    return fd_ != INVALID_SOCKET;
+}
+
+
+SOCKET TcpConnection::get_socket() const {
+    return fd_;
+}
+
+
+std::string TcpConnection::get_buffered_input() const {
+    return decoder_.get_buffered_data();
+}
+
+
+std::string TcpConnection::get_description() const {
+    return description_;
+}
+
+
+
+TcpListener::TcpListener(SOCKET listener_fd) : fd_(listener_fd) {
+    MinNet::SetNonBlocking(fd_, true);
+    description_ = MinNet::GetAddressAndPort(fd_);
+}
+
+
+TcpListener::~TcpListener() {
+    Close();
+}
+
+
+Connection* TcpListener::TryAccept() {
+    SOCKET client_fd;
+    if ((fd_ == INVALID_SOCKET) || (!MinNet::TryAcceptConnection(fd_, &client_fd))) {
+        return NULL;
+    }
+    // non-blocking, whether or not the platform passes the listener's flag on, since a relay's sends must never
+    // wait for a slow client (see MinNet::TrySendGather()); the blocking calls wait for the socket themselves
+    MinNet::SetNonBlocking(client_fd, true);
+    return new TcpConnection(client_fd);
+}
+
+
+void TcpListener::Close() {
+    if (fd_ != INVALID_SOCKET) {
+        MinNet::CloseSocket(&fd_);
+        fd_ = INVALID_SOCKET;
+    }
+}
+
+
+bool TcpListener::is_open() const {
+    return fd_ != INVALID_SOCKET;
+}
+
+
+SOCKET TcpListener::get_socket() const {
+    return fd_;
+}
+
+
+std::string TcpListener::get_description() const {
+    return description_;
+}
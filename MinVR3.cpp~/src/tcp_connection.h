@@ -0,0 +1,71 @@
+/**
+  Connection and Listener for MinNet sockets, i.e., TCP and unix domain sockets.  Input goes through a
+  FrameDecoder, so each read takes everything the kernel has buffered, and output goes through a SendQueue, so
+  queued frames leave with a single gathered write when the connection is flushed, and TryFlush() never waits
+  for a slow receiver.
+ */
+
+#ifndef MINVR3_TCP_CONNECTION_H
+#define MINVR3_TCP_CONNECTION_H
+
+#include "connection.h"
+#include "frame_decoder.h"
+#include "min_net.h"
+
+
+class TcpConnection : public Connection {
+public:
+    /// Connects with MinNet::ConnectTo().  Returns NULL on failure.
+    static TcpConnection* Connect(const std::string &address, int port=0);
+
+    /// Takes ownership of a connected socket.  buffered_input holds bytes that were already read from it, e.g.,
+    /// the get_buffered_input() of the connection it was handed over from.
+    TcpConnection(SOCKET socket_fd, const std::string &buffered_input="");
+    virtual ~TcpConnection();
+
+    bool SendString(const std::string &s, double timeout_ms=0);
+    void QueueString(const std::string &s, const std::string &key="");
+    void QueueFrame(const OutboundFramePtr &frame);
+    bool Flush(double timeout_ms=0);
+    FlushResult TryFlush();
+    void set_send_limit(int64_t max_bytes, SendQueue::OverflowPolicy policy);
+    void set_fragment_size(int max_bytes);
+    void set_receive_fragments(bool receive);
+    const SendQueue* get_send_queue() const;
+    bool ReceiveString(std::string *s, double timeout_ms=0);
+    bool ReceiveAvailableStrings(std::vector<std::string> *frames);
+    bool ReceiveAvailableFrames(FrameBatch *frames);
+    void set_max_frame_size(uint32_t max_bytes);
+    bool IsReadyToRead();
+    void Close();
+    bool is_open() const;
+    SOCKET get_socket() const;
+    std::string get_buffered_input() const;
+    std::string get_description() const;
+
+private:
+    SOCKET fd_;
+    FrameDecoder decoder_;
+    SendQueue send_queue_;
+    std::string description_;
+};
+
+
+class TcpListener : public Listener {
+public:
+    /// Takes ownership of a listening socket, which is switched to non-blocking mode so TryAccept() never waits.
+    TcpListener(SOCKET listener_fd);
+    virtual ~TcpListener();
+
+    Connection* TryAccept();
+    void Close();
+    bool is_open() const;
+    SOCKET get_socket() const;
+    std::string get_description() const;
+
+private:
+    SOCKET fd_;
+    std::string description_;
+};
+
+#endif
@@ -1,11 +1,52 @@
 
 #include "vr_event.h"
 
+#include <cstdlib>
 #include <string>
 #include <iostream>
 
 #include "json/json.h"
 
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+
+// Little-endian helpers for the binary layout, which is the same whatever the byte order of the machine.
+static void AppendUint32(uint32_t v, std::string *out) {
+	char b[4] = { (char)(v & 0xff), (char)((v >> 8) & 0xff), (char)((v >> 16) & 0xff), (char)((v >> 24) & 0xff) };
+	out->append(b, 4);
+}
+
+static void AppendFloat(float f, std::string *out) {
+	uint32_t v;
+	memcpy(&v, &f, 4);
+	AppendUint32(v, out);
+}
+
+static uint32_t ReadUint32(const char *p) {
+	const uint8_t *b = (const uint8_t*)p;
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static float ReadFloat(const char *p) {
+	uint32_t v = ReadUint32(p);
+	float f;
+	memcpy(&f, &v, 4);
+	return f;
+}
+
+// Floats in the binary layout of each vector type, or -1 for the other types.
+static int NumFloats(const std::string &data_type_name) {
+	if (data_type_name == "Vector3") {
+		return 3;
+	}
+	if ((data_type_name == "Quaternion") || (data_type_name == "Vector4")) {
+		return 4;
+	}
+	return (data_type_name == "Vector2") ? 2 : -1;
+}
+
 
 VREvent::VREvent(const std::string& event_name) {
 	name_ = event_name;
@@ -43,6 +84,272 @@ void VREvent::SetFromJson(const std::string &eventJsonStr) {
     data_type_name_ = eventJson["m_DataTypeName"].asString();
 }
 
+// Helpers for PeekName(), each returns the position just past what it skipped or read, or npos.
+static size_t SkipSpace(const std::string &json, size_t pos) {
+	while ((pos < json.size()) && ((json[pos] == ' ') || (json[pos] == '\t') || (json[pos] == '\n') || (json[pos] == '\r'))) {
+		pos++;
+	}
+	return pos;
+}
+
+static size_t ReadJsonString(const std::string &json, size_t pos, std::string *s) {
+	if ((pos >= json.size()) || (json[pos] != '"')) {
+		return std::string::npos;
+	}
+	pos++;
+	s->clear();
+	while (pos < json.size()) {
+		char c = json[pos++];
+		if (c == '"') {
+			return pos;
+		}
+		if (c != '\\') {
+			s->push_back(c);
+			continue;
+		}
+		if (pos >= json.size()) {
+			break;
+		}
+		c = json[pos++];
+		switch (c) {
+			case 'b': s->push_back('\b'); break;
+			case 'f': s->push_back('\f'); break;
+			case 'n': s->push_back('\n'); break;
+			case 'r': s->push_back('\r'); break;
+			case 't': s->push_back('\t'); break;
+			case '"': case '\\': case '/': s->push_back(c); break;
+			default: return std::string::npos;   // \u, left to the full parser
+		}
+	}
+	return std::string::npos;
+}
+
+static size_t SkipJsonValue(const std::string &json, size_t pos) {
+	int depth = 0;
+	bool in_string = false;
+	for (; pos < json.size(); pos++) {
+		char c = json[pos];
+		if (in_string) {
+			// brackets and commas inside strings do not count
+			if (c == '\\') {
+				pos++;
+			}
+			else if (c == '"') {
+				in_string = false;
+			}
+		}
+		else if (c == '"') {
+			in_string = true;
+		}
+		else if ((c == '{') || (c == '[')) {
+			depth++;
+		}
+		else if ((c == '}') || (c == ']')) {
+			if (depth == 0) {
+				return pos;
+			}
+			depth--;
+		}
+		else if ((c == ',') && (depth == 0)) {
+			return pos;
+		}
+	}
+	return std::string::npos;
+}
+
+bool VREvent::PeekName(const std::string &eventJsonStr, std::string *name) {
+	const std::string &json = eventJsonStr;
+	size_t pos = SkipSpace(json, 0);
+	if ((pos >= json.size()) || (json[pos] != '{')) {
+		return false;
+	}
+	pos++;
+	std::string key;
+	while (true) {
+		pos = SkipSpace(json, pos);
+		pos = ReadJsonString(json, pos, &key);
+		if (pos == std::string::npos) {
+			return false;
+		}
+		pos = SkipSpace(json, pos);
+		if ((pos >= json.size()) || (json[pos] != ':')) {
+			return false;
+		}
+		pos = SkipSpace(json, pos + 1);
+		if (key == "m_Name") {
+			return ReadJsonString(json, pos, name) != std::string::npos;
+		}
+		pos = SkipJsonValue(json, pos);
+		if ((pos == std::string::npos) || (json[pos] != ',')) {
+			return false;
+		}
+		pos++;
+	}
+}
+
+bool VREvent::PeekFields(const std::string &eventJsonStr, std::string *name, std::string *data_type_name,
+                         std::string *dataJsonStr)
+{
+	const std::string &json = eventJsonStr;
+	size_t pos = SkipSpace(json, 0);
+	if ((pos >= json.size()) || (json[pos] != '{')) {
+		return false;
+	}
+	pos++;
+	bool has_name = false, has_type = false;
+	dataJsonStr->clear();
+	std::string key;
+	while (true) {
+		pos = SkipSpace(json, pos);
+		pos = ReadJsonString(json, pos, &key);
+		if (pos == std::string::npos) {
+			return false;
+		}
+		pos = SkipSpace(json, pos);
+		if ((pos >= json.size()) || (json[pos] != ':')) {
+			return false;
+		}
+		pos = SkipSpace(json, pos + 1);
+		if (key == "m_Name") {
+			pos = ReadJsonString(json, pos, name);
+			has_name = true;
+		}
+		else if (key == "m_DataTypeName") {
+			pos = ReadJsonString(json, pos, data_type_name);
+			has_type = true;
+		}
+		else if (key == "m_Data") {
+			size_t start = pos;
+			pos = SkipJsonValue(json, pos);
+			if (pos != std::string::npos) {
+				size_t end = pos;
+				while ((end > start) && ((json[end - 1] == ' ') || (json[end - 1] == '\t') || (json[end - 1] == '\n') || (json[end - 1] == '\r'))) {
+					end--;
+				}
+				dataJsonStr->assign(json, start, end - start);
+			}
+		}
+		else {
+			// anything else would be lost
+			return false;
+		}
+		pos = SkipSpace(json, pos);
+		if (pos >= json.size()) {
+			return false;
+		}
+		if (json[pos] == '}') {
+			return (has_name) && (has_type) && (SkipSpace(json, pos + 1) == json.size());
+		}
+		if (json[pos] != ',') {
+			return false;
+		}
+		pos++;
+	}
+}
+
+// Unlike SkipJsonValue(), checks what it skips: returns the position just past one complete json value, or npos
+// if there is not one there.
+static size_t ScanJsonValue(const std::string &json, size_t pos, int depth) {
+	if ((pos >= json.size()) || (depth > 1000)) {
+		return std::string::npos;
+	}
+	char c = json[pos];
+	if (c == '"') {
+		for (pos++; pos < json.size(); pos++) {
+			c = json[pos];
+			if (c == '"') {
+				return pos + 1;
+			}
+			if ((unsigned char)c < 0x20) {
+				return std::string::npos;
+			}
+			if (c == '\\') {
+				pos++;
+				if ((pos >= json.size()) || (json[pos] == '\0') || (std::strchr("\"\\/bfnrtu", json[pos]) == NULL)) {
+					return std::string::npos;
+				}
+				if ((json[pos] == 'u') && ((pos + 4 >= json.size()) ||
+					(std::strspn(json.c_str() + pos + 1, "0123456789abcdefABCDEF") < 4)))
+				{
+					return std::string::npos;
+				}
+			}
+		}
+		return std::string::npos;
+	}
+	if ((c == '{') || (c == '[')) {
+		char close = (c == '{') ? '}' : ']';
+		pos = SkipSpace(json, pos + 1);
+		if ((pos < json.size()) && (json[pos] == close)) {
+			return pos + 1;
+		}
+		while (true) {
+			if (close == '}') {
+				if ((pos >= json.size()) || (json[pos] != '"')) {
+					return std::string::npos;
+				}
+				pos = SkipSpace(json, ScanJsonValue(json, pos, depth + 1));
+				if ((pos >= json.size()) || (json[pos] != ':')) {
+					return std::string::npos;
+				}
+				pos = SkipSpace(json, pos + 1);
+			}
+			pos = ScanJsonValue(json, pos, depth + 1);
+			if (pos == std::string::npos) {
+				return pos;
+			}
+			pos = SkipSpace(json, pos);
+			if ((pos < json.size()) && (json[pos] == close)) {
+				return pos + 1;
+			}
+			if ((pos >= json.size()) || (json[pos] != ',')) {
+				return std::string::npos;
+			}
+			pos = SkipSpace(json, pos + 1);
+		}
+	}
+	const char *literals[] = { "true", "false", "null" };
+	for (int i=0; i<3; i++) {
+		if (json.compare(pos, std::strlen(literals[i]), literals[i]) == 0) {
+			return pos + std::strlen(literals[i]);
+		}
+	}
+	// a number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+	size_t start = pos;
+	if (json[pos] == '-') {
+		pos++;
+	}
+	size_t digits = std::strspn(json.c_str() + pos, "0123456789");
+	if ((digits == 0) || ((digits > 1) && (json[pos] == '0'))) {
+		return std::string::npos;
+	}
+	pos += digits;
+	if ((pos < json.size()) && (json[pos] == '.')) {
+		digits = std::strspn(json.c_str() + pos + 1, "0123456789");
+		if (digits == 0) {
+			return std::string::npos;
+		}
+		pos += 1 + digits;
+	}
+	if ((pos < json.size()) && ((json[pos] == 'e') || (json[pos] == 'E'))) {
+		pos++;
+		if ((pos < json.size()) && ((json[pos] == '+') || (json[pos] == '-'))) {
+			pos++;
+		}
+		digits = std::strspn(json.c_str() + pos, "0123456789");
+		if (digits == 0) {
+			return std::string::npos;
+		}
+		pos += digits;
+	}
+	return (pos > start) ? pos : std::string::npos;
+}
+
+bool VREvent::IsJsonValue(const std::string &json) {
+	size_t pos = ScanJsonValue(json, SkipSpace(json, 0), 0);
+	return (pos != std::string::npos) && (SkipSpace(json, pos) == json.size());
+}
+
 std::string VREvent::ToJson() const {
 	Json::Value eventJson;
 	eventJson["m_Name"] = name_;
@@ -52,24 +359,18 @@ std::string VREvent::ToJson() const {
 	return eventJsonStr;
 }
 
-VREvent* VREvent::CreateFromJson(const std::string& eventJsonStr) {
-	Json::Reader reader;
-	Json::Value eventJson;
-	if (!reader.parse(eventJsonStr, eventJson)) {
-		std::cerr << reader.getFormattedErrorMessages() << std::endl;
-		return NULL;
-	}
-
-	std::string name = eventJson["m_Name"].asString();
-	std::string data_type_name = eventJson["m_DataTypeName"].asString();
+// an event without data has nothing to append
+void VREvent::AppendBinaryData(std::string *) const {
+}
 
+// Shared by CreateFromJson() and CreateFromData().
+static VREvent* CreateFromValues(const std::string &name, const std::string &data_type_name, const Json::Value &data) {
 	// empty string means no data payload with the event
 	if (data_type_name == "") {
 		return new VREvent(name);
 	}
 
 	// else, different cases based on the data type:
-	Json::Value data = eventJson["m_Data"];
 	if (data_type_name == "Vector2") {
 		return new VREventVector2(name, data["x"].asFloat(), data["y"].asFloat());
 	}
@@ -96,6 +397,160 @@ VREvent* VREvent::CreateFromJson(const std::string& eventJsonStr) {
 	return NULL;
 }
 
+VREvent* VREvent::CreateFromJson(const std::string& eventJsonStr) {
+	Json::Reader reader;
+	Json::Value eventJson;
+	if (!reader.parse(eventJsonStr, eventJson)) {
+		std::cerr << reader.getFormattedErrorMessages() << std::endl;
+		return NULL;
+	}
+	return CreateFromValues(eventJson["m_Name"].asString(), eventJson["m_DataTypeName"].asString(), eventJson["m_Data"]);
+}
+
+// Reads {"x":1,"y":2,...} with single letter keys from "xyzw", in any order, into xyzw[] without going through
+// jsoncpp.  Returns the number of values read, or -1 if the json is laid out any other way.
+static int ScanFloats(const std::string &json, float xyzw[4]) {
+	size_t pos = SkipSpace(json, 0);
+	if ((pos >= json.size()) || (json[pos] != '{')) {
+		return -1;
+	}
+	int n = 0, seen = 0;
+	std::string key;
+	pos = SkipSpace(json, pos + 1);
+	while ((pos < json.size()) && (json[pos] != '}')) {
+		pos = ReadJsonString(json, pos, &key);
+		if ((pos == std::string::npos) || (key.size() != 1) || (key.find_first_not_of("xyzw") != std::string::npos)) {
+			return -1;
+		}
+		pos = SkipSpace(json, pos);
+		if ((pos >= json.size()) || (json[pos] != ':')) {
+			return -1;
+		}
+		const char *start = json.c_str() + pos + 1;
+		char *end;
+		float v = std::strtof(start, &end);
+		if (end == start) {
+			return -1;
+		}
+		int i = (key[0] == 'w') ? 3 : key[0] - 'x';
+		if (seen & (1 << i)) {
+			return -1;
+		}
+		seen |= 1 << i;
+		xyzw[i] = v;
+		n++;
+		pos = SkipSpace(json, pos + 1 + (end - start));
+		if ((pos < json.size()) && (json[pos] == ',')) {
+			pos = SkipSpace(json, pos + 1);
+		}
+	}
+	return ((pos < json.size()) && (SkipSpace(json, pos + 1) == json.size())) ? n : -1;
+}
+
+VREvent* VREvent::CreateFromData(const std::string &name, const std::string &data_type_name, const std::string &dataJsonStr) {
+	// the common tracker types are read directly, which is several times faster than jsoncpp
+	float xyzw[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+	if ((data_type_name == "Vector3") && (ScanFloats(dataJsonStr, xyzw) == 3)) {
+		return new VREventVector3(name, xyzw[0], xyzw[1], xyzw[2]);
+	}
+	else if ((data_type_name == "Quaternion") && (ScanFloats(dataJsonStr, xyzw) == 4)) {
+		return new VREventQuaternion(name, xyzw[0], xyzw[1], xyzw[2], xyzw[3]);
+	}
+	else if ((data_type_name == "Vector4") && (ScanFloats(dataJsonStr, xyzw) == 4)) {
+		return new VREventVector4(name, xyzw[0], xyzw[1], xyzw[2], xyzw[3]);
+	}
+	else if ((data_type_name == "Vector2") && (ScanFloats(dataJsonStr, xyzw) == 2)) {
+		return new VREventVector2(name, xyzw[0], xyzw[1]);
+	}
+
+	Json::Value data;
+	if (!dataJsonStr.empty()) {
+		Json::Reader reader;
+		if (!reader.parse(dataJsonStr, data)) {
+			std::cerr << reader.getFormattedErrorMessages() << std::endl;
+			return NULL;
+		}
+	}
+	return CreateFromValues(name, data_type_name, data);
+}
+
+bool VREvent::HasBinaryLayout(const std::string &data_type_name) {
+	return (data_type_name == "") || (NumFloats(data_type_name) > 0) || (data_type_name == "Int32") ||
+		(data_type_name == "Single") || (data_type_name == "String");
+}
+
+VREvent* VREvent::CreateFromBinaryData(const std::string &name, const std::string &data_type_name, const char *data,
+                                       size_t size) {
+	int num_floats = NumFloats(data_type_name);
+	if (num_floats > 0) {
+		if (size != 4 * num_floats) {
+			return NULL;
+		}
+		if (data_type_name == "Vector3") {
+			return new VREventVector3(name, ReadFloat(data), ReadFloat(data + 4), ReadFloat(data + 8));
+		}
+		if (data_type_name == "Quaternion") {
+			return new VREventQuaternion(name, ReadFloat(data), ReadFloat(data + 4), ReadFloat(data + 8), ReadFloat(data + 12));
+		}
+		if (data_type_name == "Vector4") {
+			return new VREventVector4(name, ReadFloat(data), ReadFloat(data + 4), ReadFloat(data + 8), ReadFloat(data + 12));
+		}
+		return new VREventVector2(name, ReadFloat(data), ReadFloat(data + 4));
+	}
+	if (data_type_name == "String") {
+		return new VREventString(name, std::string(data, size));
+	}
+	if ((data_type_name == "Int32") && (size == 4)) {
+		return new VREventInt(name, (int32_t)ReadUint32(data));
+	}
+	if ((data_type_name == "Single") && (size == 4)) {
+		return new VREventFloat(name, ReadFloat(data));
+	}
+	if ((data_type_name == "") && (size == 0)) {
+		return new VREvent(name);
+	}
+	return NULL;
+}
+
+bool VREvent::BinaryDataToJson(const std::string &data_type_name, const char *data, size_t size,
+                               std::string *dataJsonStr) {
+	// written directly rather than through jsoncpp, with enough digits for every float to read back exactly
+	char buf[128];
+	int num_floats = NumFloats(data_type_name);
+	if (num_floats > 0) {
+		if (size != 4 * num_floats) {
+			return false;
+		}
+		static const char *keys[4] = { "x", "y", "z", "w" };
+		dataJsonStr->assign("{");
+		for (int i=0; i<num_floats; i++) {
+			snprintf(buf, sizeof(buf), "%s\"%s\":%.9g", (i > 0) ? "," : "", keys[i], ReadFloat(data + 4 * i));
+			dataJsonStr->append(buf);
+		}
+		dataJsonStr->push_back('}');
+		return true;
+	}
+	if (data_type_name == "String") {
+		*dataJsonStr = Json::valueToQuotedString(std::string(data, size).c_str());
+		return true;
+	}
+	if ((data_type_name == "Int32") && (size == 4)) {
+		snprintf(buf, sizeof(buf), "%d", (int)(int32_t)ReadUint32(data));
+		dataJsonStr->assign(buf);
+		return true;
+	}
+	if ((data_type_name == "Single") && (size == 4)) {
+		snprintf(buf, sizeof(buf), "%.9g", ReadFloat(data));
+		dataJsonStr->assign(buf);
+		return true;
+	}
+	if ((data_type_name == "") && (size == 0)) {
+		dataJsonStr->clear();
+		return true;
+	}
+	return false;
+}
+
 
 VREventInt::VREventInt(const std::string& eventName, int data) : VREvent(eventName, "Int32") {
     data_ = data;
@@ -131,6 +586,10 @@ std::string VREventInt::ToJson() const {
     return eventJsonStr;
 }
 
+void VREventInt::AppendBinaryData(std::string *out) const {
+    AppendUint32((uint32_t)data_, out);
+}
+
 
 VREventFloat::VREventFloat(const std::string& eventName, float data) : VREvent(eventName, "Single") {
     data_ = data;
@@ -166,6 +625,10 @@ std::string VREventFloat::ToJson() const {
     return eventJsonStr;
 }
 
+void VREventFloat::AppendBinaryData(std::string *out) const {
+    AppendFloat(data_, out);
+}
+
 
 VREventVector2::VREventVector2(const std::string& eventName, float x, float y) : VREvent(eventName, "Vector2") {
 	x_ = x;
@@ -212,6 +675,11 @@ std::string VREventVector2::ToJson() const {
 	return eventJsonStr;
 }
 
+void VREventVector2::AppendBinaryData(std::string *out) const {
+	AppendFloat(x_, out);
+	AppendFloat(y_, out);
+}
+
 
 VREventVector3::VREventVector3(const std::string& eventName, float x, float y, float z) : VREvent(eventName, "Vector3") {
 	x_ = x;
@@ -263,6 +731,12 @@ std::string VREventVector3::ToJson() const {
 	return eventJsonStr;
 }
 
+void VREventVector3::AppendBinaryData(std::string *out) const {
+	AppendFloat(x_, out);
+	AppendFloat(y_, out);
+	AppendFloat(z_, out);
+}
+
 
 VREventVector4::VREventVector4(const std::string& eventName, float x, float y, float z, float w) : VREvent(eventName, "Vector4") {
 	x_ = x;
@@ -319,6 +793,13 @@ std::string VREventVector4::ToJson() const {
 	return eventJsonStr;
 }
 
+void VREventVector4::AppendBinaryData(std::string *out) const {
+	AppendFloat(x_, out);
+	AppendFloat(y_, out);
+	AppendFloat(z_, out);
+	AppendFloat(w_, out);
+}
+
 
 VREventQuaternion::VREventQuaternion(const std::string& eventName, float x, float y, float z, float w) : VREvent(eventName, "Quaternion") {
 	x_ = x;
@@ -375,6 +856,13 @@ std::string VREventQuaternion::ToJson() const {
 	return eventJsonStr;
 }
 
+void VREventQuaternion::AppendBinaryData(std::string *out) const {
+	AppendFloat(x_, out);
+	AppendFloat(y_, out);
+	AppendFloat(z_, out);
+	AppendFloat(w_, out);
+}
+
 
 VREventString::VREventString(const std::string& eventName, const std::string& data) : VREvent(eventName, "String") {
 	str_ = data;
@@ -410,6 +898,10 @@ std::string VREventString::ToJson() const {
 	return eventJsonStr;
 }
 
+void VREventString::AppendBinaryData(std::string *out) const {
+	out->append(str_);
+}
+
 
 void VREvent::Print(std::ostream& os) const {
     os << get_name() << " [" << get_data_type_name() << "]";
@@ -25,6 +25,44 @@ public:
     static VREvent* CreateFromJson(const std::string &eventJsonStr);
     virtual void Print(std::ostream& os) const;
 
+    /// Finds the event's name in its json without parsing the rest of it, for code that only routes events, like
+    /// the relay.  Returns false if the name cannot be found this way (e.g., it holds a \u escape or the json is
+    /// not an object); CreateFromJson() is then the way to find out whether the event is valid at all.
+    static bool PeekName(const std::string &eventJsonStr, std::string *name);
+
+    /// Same, for all three fields, with the m_Data value returned as its json text (empty if there is none), e.g.,
+    /// to send it without the rest (see EventDictionary).  Returns false if the json holds anything else, or
+    /// cannot be scanned this way.
+    static bool PeekFields(const std::string &eventJsonStr, std::string *name, std::string *data_type_name,
+                           std::string *dataJsonStr);
+
+    /// True if json holds exactly one json value, with nothing but whitespace around it, e.g., to check an m_Data
+    /// value that arrived on its own before it is put into an event's json (see EventDictionary::ToJson()).
+    static bool IsJsonValue(const std::string &json);
+
+    /// Creates an event from its name, data type, and the json text of its m_Data value (empty for no data),
+    /// i.e., what PeekFields() returns.  Returns NULL if the data cannot be parsed or the type is unknown.
+    static VREvent* CreateFromData(const std::string &name, const std::string &data_type_name,
+                                   const std::string &dataJsonStr);
+
+    /// Appends m_Data in the fixed little-endian layout of wire protocol version 2 (see EventDictionary): nothing
+    /// for an event without data, an int32 for Int32, a float32 for Single, the x, y, z, w float32s (as many as
+    /// the type has) for Vector2/3/4 and Quaternion, and the UTF-8 bytes for String.
+    virtual void AppendBinaryData(std::string *out) const;
+
+    /// True for the data types that have a binary layout, i.e., every built-in one.
+    static bool HasBinaryLayout(const std::string &data_type_name);
+
+    /// Creates an event from its name, data type, and data in the binary layout.  Returns NULL if the data does
+    /// not fit the type.
+    static VREvent* CreateFromBinaryData(const std::string &name, const std::string &data_type_name,
+                                         const char *data, size_t size);
+
+    /// Writes data in the binary layout as the json text of an m_Data value (empty for no data), e.g., for a relay
+    /// to pass an event on to peers that only read json.  Returns false if the data does not fit the type.
+    static bool BinaryDataToJson(const std::string &data_type_name, const char *data, size_t size,
+                                 std::string *dataJsonStr);
+
 protected:
     std::string name_;
     std::string data_type_name_;
@@ -41,6 +79,7 @@ public:
 
     virtual void SetFromJson(const std::string &eventJsonStr);
     virtual std::string ToJson() const;
+    virtual void AppendBinaryData(std::string *out) const;
     virtual void Print(std::ostream& os) const;
 
 protected:
@@ -58,6 +97,7 @@ public:
 
     virtual void SetFromJson(const std::string &eventJsonStr);
     virtual std::string ToJson() const;
+    virtual void AppendBinaryData(std::string *out) const;
     virtual void Print(std::ostream& os) const;
 
 protected:
@@ -77,6 +117,7 @@ public:
 
     virtual void SetFromJson(const std::string &eventJsonStr);
     virtual std::string ToJson() const;
+    virtual void AppendBinaryData(std::string *out) const;
     virtual void Print(std::ostream& os) const;
 
 protected:
@@ -98,6 +139,7 @@ public:
 
     virtual void SetFromJson(const std::string &eventJsonStr);
     virtual std::string ToJson() const;
+    virtual void AppendBinaryData(std::string *out) const;
     virtual void Print(std::ostream& os) const;
 
 protected:
@@ -121,6 +163,7 @@ public:
 
     virtual void SetFromJson(const std::string &eventJsonStr);
     virtual std::string ToJson() const;
+    virtual void AppendBinaryData(std::string *out) const;
     virtual void Print(std::ostream& os) const;
 
 protected:
@@ -145,6 +188,7 @@ public:
 
     virtual void SetFromJson(const std::string &eventJsonStr);
     virtual std::string ToJson() const;
+    virtual void AppendBinaryData(std::string *out) const;
     virtual void Print(std::ostream& os) const;
 
 protected:
@@ -165,6 +209,7 @@ public:
 
     virtual void SetFromJson(const std::string &eventJsonStr);
     virtual std::string ToJson() const;
+    virtual void AppendBinaryData(std::string *out) const;
     virtual void Print(std::ostream& os) const;
 
 protected: